@@ -0,0 +1,750 @@
+/** @file bench.c
+ *
+ * @brief Load generator for the postfix server. Opens a number of framed
+ *        connections, drives them with one equation for a fixed duration and
+ *        reports throughput and a latency distribution.
+ *        -i [IPv4 address]
+ *        -p [PORT]
+ *        -u [PATH] (instead of -i and -p) Connect to the server's unix domain
+ *           socket, over shared memory if the server offers it.
+ *        -c [CONNECTIONS] (optional, default 1)
+ *        -d [SECONDS] (optional, default 10)
+ *        -w [WINDOW] (optional, default 1) Requests kept in flight on each
+ *           connection in closed loop mode.
+ *        -r [RATE] (optional) Total requests per second. Switches to open
+ *           loop mode: requests are sent on a fixed schedule whether or not
+ *           earlier responses have arrived, and latency is measured from
+ *           when each request was scheduled rather than when it was sent,
+ *           so a stalled server is not hidden by the sender stalling with it.
+ *        -e ["INFIX notation string"] (optional)
+ *        -b (optional) Send the equation as pre-compiled bytecode.
+ *        -V ["VALUES"] (optional) Treat the -e equation as a formula naming
+ *           variables: prepare it once on each connection, then execute it
+ *           with these comma separated values bound to its variables, in
+ *           order of first appearance. Not with -a.
+ *        -R [ROWS] (optional, with -V) Execute the formula over ROWS rows
+ *           of the values per request, sent as columns, and report rows
+ *           per second as well.
+ *        -a [THREADS] (optional) Drive a cli_pool_t of the -c connections
+ *           from THREADS application threads, each evaluating one equation
+ *           at a time, instead of one thread per connection. -w is ignored.
+ *        -s [SERVERS] (optional, needs -a, instead of -i, -p and -u) A comma
+ *           separated list of IPV4:PORT and unix socket paths. The threads
+ *           share a cli_cluster_t with -c connections to each server.
+ * @par
+ * COPYRIGHT NOTICE: (c) 2018 Barr Group. All rights reserved.
+ */
+
+#define _XOPEN_SOURCE 700 // pthread_barrier_t, clock_nanosleep
+#include <arpa/inet.h> // inet_pton
+#include <errno.h> // errno
+#include <getopt.h> // getopt
+#include <netinet/in.h> // sockaddr_in
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h> // uint64_t
+#include <stdio.h> // stderr
+#include <stdlib.h> // EXIT_FAILURE, malloc, free, strtod
+#include <string.h> // strerror
+#include <sys/socket.h> // socket, connect
+#include <time.h> // clock_gettime, clock_nanosleep
+#include <unistd.h> // close
+
+#include "cli_cluster.h"
+#include "cli_lib.h"
+#include "cli_pool.h"
+#include "histogram.h"
+
+#define USAGE_STRING "Usage: %s -i [SERV IP(v4)] -p [PORT] -u [PATH](Unix socket)" \
+                     " -c [1+](Connections)"                                  \
+                     " -d [1+](Seconds) -w [1+](Closed loop window)"          \
+                     " -r [RATE](Open loop requests per second)"              \
+                     " -e [INFIX STRING] [-b]"                                \
+                     " -V [VALUES](Bind -e variables, comma separated)"       \
+                     " -R [1+](Rows per request, with -V)"                    \
+                     " -a [1+](Application threads sharing a pool)"           \
+                     " -s [SERVERS](IPV4:PORT or PATH list, with -a)\n"
+#define DEFAULT_EQUATION "(1 + 2) * 3"
+#define DEFAULT_DURATION_SECONDS 10
+#define MAX_BENCH_CONNECTIONS 1024
+#define MAX_BENCH_THREADS 1024
+#define NS_PER_SECOND 1000000000ull
+#define NS_PER_US 1000.0
+
+typedef struct bench_config_t {
+    struct sockaddr_in addr;
+    const char*        p_unix_path;
+    const char*        p_servers;
+    int                connections;
+    int                threads;
+    int                workers;
+    int                window;
+    double             rate;
+    uint64_t           duration_ns;
+    bool               b_bytecode;
+    bool               b_prepared;
+    int                value_count;
+    int                column_rows;
+    double             values[PROTO_MAX_VARIABLES];
+    const double*      columns[PROTO_MAX_VARIABLES];
+    char               postfix[MAX_POSTFIX_SIZE];
+} bench_config_t;
+
+typedef struct bench_worker_t {
+    pthread_t   thread_id;
+    uint32_t    handle;
+    uint64_t    completed;
+    uint64_t    errors;
+    bool        b_failed;
+    histogram_t histogram;
+} bench_worker_t;
+
+static bench_config_t    g_config = { 0 };
+static pthread_barrier_t g_start_barrier;
+static cli_pool_t        g_pool;
+static cli_cluster_t     g_cluster;
+static double            g_column_values[PROTO_MAX_VARIABLES]
+                                        [PROTO_MAX_COLUMN_ROWS];
+
+/**
+ * @brief Reads the monotonic clock.
+ * @return The current monotonic time in nanoseconds.
+ */
+static uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * NS_PER_SECOND) + (uint64_t)now.tv_nsec;
+} /* monotonic_ns */
+
+/**
+ * @brief Sleeps until the monotonic clock reaches the given time.
+ */
+static void sleep_until(uint64_t deadline_ns)
+{
+    struct timespec deadline;
+    deadline.tv_sec  = deadline_ns / NS_PER_SECOND;
+    deadline.tv_nsec = deadline_ns % NS_PER_SECOND;
+    while (EINTR == clock_nanosleep(CLOCK_MONOTONIC,
+                                    TIMER_ABSTIME,
+                                    &deadline,
+                                    NULL))
+    {
+        /* continue */
+    }
+} /* sleep_until */
+
+/**
+ * @brief Parses comma separated values to bind to the formula's variables.
+ * @return true if every value parsed
+ *         false if the list is malformed or too long.
+ */
+static bool parse_values(const char* p_list)
+{
+    const char* p_cursor = p_list;
+    g_config.value_count = 0;
+    while (true)
+    {
+        char* p_end = NULL;
+        if (PROTO_MAX_VARIABLES == g_config.value_count)
+        {
+            return false;
+        }
+        g_config.values[g_config.value_count] = strtod(p_cursor, &p_end);
+        if (p_end == p_cursor)
+        {
+            return false;
+        }
+        g_config.value_count++;
+        if ('\0' == *p_end)
+        {
+            return true;
+        }
+        if (',' != *p_end)
+        {
+            return false;
+        }
+        p_cursor = p_end + 1;
+    }
+} /* parse_values */
+
+/**
+ * @brief Prepares the formula on a new connection.
+ * @param[in] p_conn A pointer to a connection using the framed protocol.
+ * @param[out] p_handle A pointer to store the formula's handle in.
+ * @return true if the formula was prepared
+ *         false if the connection failed or the server refused it.
+ */
+static bool prepare_formula(cli_conn_t* p_conn, uint32_t* p_handle)
+{
+    cli_response_t response;
+    if (false == cli_prepare(p_conn, 0, g_config.postfix) ||
+        false == cli_receive(p_conn, &response))
+    {
+        return false;
+    }
+    if (MSG_PREPARED != response.type || PROTO_STATUS_OK != response.status)
+    {
+        fprintf(stderr, "Unable to prepare formula. [%s]\n", response.text);
+        return false;
+    }
+    if (response.variable_count != g_config.value_count)
+    {
+        fprintf(stderr,
+                "Formula has [%d] variables but [%d] values were given.\n",
+                response.variable_count,
+                g_config.value_count);
+        return false;
+    }
+    *p_handle = response.handle;
+    return true;
+} /* prepare_formula */
+
+/**
+ * @brief Connects to the server and selects the framed protocol.
+ * @param[out] p_conn A pointer to the connection to set up.
+ * @param[out] p_handle A pointer to store the handle of the prepared
+ *                      formula in, if -V was given.
+ * @return true if the connection is ready for framed requests
+ *         false if connecting failed or the server only speaks text.
+ */
+static bool open_connection(cli_conn_t* p_conn, uint32_t* p_handle)
+{
+    int fd = (NULL != g_config.p_unix_path) ?
+             cli_connect_unix(g_config.p_unix_path) :
+             cli_connect((struct sockaddr*)&(g_config.addr),
+                         sizeof(g_config.addr));
+    if (0 > fd)
+    {
+        return false;
+    }
+    if (false == cli_handshake(p_conn, fd, true))
+    {
+        close(fd);
+        return false;
+    }
+    if (CLI_PROTO_FRAMED != p_conn->proto)
+    {
+        fprintf(stderr, "Server does not support framed requests.\n");
+        cli_close(p_conn);
+        return false;
+    }
+    p_conn->b_bytecode = g_config.b_bytecode;
+    if (g_config.b_prepared && false == prepare_formula(p_conn, p_handle))
+    {
+        cli_close(p_conn);
+        return false;
+    }
+    return true;
+} /* open_connection */
+
+/**
+ * @brief Queues the next request: the equation, or an execution of the
+ *        prepared formula with -V, over columns with -R.
+ */
+static bool submit_request(bench_worker_t* p_worker,
+                           cli_conn_t*     p_conn,
+                           uint32_t        id)
+{
+    if (0 < g_config.column_rows)
+    {
+        return cli_execute_columns(p_conn,
+                                   id,
+                                   p_worker->handle,
+                                   g_config.columns,
+                                   g_config.value_count,
+                                   g_config.column_rows);
+    }
+    if (g_config.b_prepared)
+    {
+        return cli_execute(p_conn,
+                           id,
+                           p_worker->handle,
+                           g_config.values,
+                           g_config.value_count);
+    }
+    return cli_submit(p_conn, id, g_config.postfix);
+} /* submit_request */
+
+/**
+ * @brief Counts one response.
+ */
+static void record_response(bench_worker_t*       p_worker,
+                            const cli_response_t* p_response,
+                            uint64_t              latency_ns)
+{
+    histogram_record(&(p_worker->histogram), latency_ns);
+    p_worker->completed++;
+    if (PROTO_STATUS_OK != p_response->status)
+    {
+        p_worker->errors++;
+    }
+} /* record_response */
+
+/**
+ * @brief Keeps a window of requests in flight, sending the next request as
+ *        soon as a response arrives.
+ * @return true if the run completed
+ *         false if the connection failed.
+ */
+static bool run_closed_loop(bench_worker_t* p_worker,
+                            cli_conn_t*     p_conn,
+                            uint64_t        end_ns)
+{
+    uint64_t       sent_ns[g_config.window];
+    uint32_t       next_id     = 0;
+    int            outstanding = 0;
+    cli_response_t response;
+
+    for (; outstanding < g_config.window; outstanding++, next_id++)
+    {
+        sent_ns[next_id % g_config.window] = monotonic_ns();
+        if (false == submit_request(p_worker, p_conn, next_id))
+        {
+            return false;
+        }
+    }
+
+    while (0 < outstanding)
+    {
+        if (false == cli_receive(p_conn, &response))
+        {
+            return false;
+        }
+        uint64_t now = monotonic_ns();
+        record_response(p_worker,
+                        &response,
+                        now - sent_ns[response.id % g_config.window]);
+        outstanding--;
+
+        if (now < end_ns)
+        {
+            sent_ns[next_id % g_config.window] = now;
+            if (false == submit_request(p_worker, p_conn, next_id))
+            {
+                return false;
+            }
+            next_id++;
+            outstanding++;
+        }
+    }
+    return true;
+} /* run_closed_loop */
+
+/**
+ * @brief Sends requests on a fixed schedule. A late response delays the
+ *        next send, but every request's latency is measured from when it was
+ *        scheduled, so the delay is charged to the server rather than
+ *        silently dropped from the results.
+ * @return true if the run completed
+ *         false if the connection failed.
+ */
+static bool run_open_loop(bench_worker_t* p_worker,
+                          cli_conn_t*     p_conn,
+                          uint64_t        start_ns,
+                          uint64_t        end_ns)
+{
+    double         interval_ns = ((double)g_config.workers /
+                                  g_config.rate) * NS_PER_SECOND;
+    cli_response_t response;
+
+    for (uint32_t id = 0; true; id++)
+    {
+        uint64_t scheduled_ns = start_ns + (uint64_t)(id * interval_ns);
+        if (scheduled_ns >= end_ns)
+        {
+            break;
+        }
+        if (monotonic_ns() < scheduled_ns)
+        {
+            sleep_until(scheduled_ns);
+        }
+        if (false == submit_request(p_worker, p_conn, id) ||
+            false == cli_receive(p_conn, &response))
+        {
+            return false;
+        }
+        record_response(p_worker, &response, monotonic_ns() - scheduled_ns);
+    }
+    return true;
+} /* run_open_loop */
+
+/**
+ * @brief Evaluates the equation through the shared pool one request at a
+ *        time, as an application thread would. With a rate the requests
+ *        follow a fixed schedule as in run_open_loop.
+ * @return true if the run completed
+ *         false if a request failed after the pool gave up reconnecting.
+ */
+static bool run_pool_loop(bench_worker_t* p_worker,
+                          uint64_t        start_ns,
+                          uint64_t        end_ns)
+{
+    double         interval_ns = (0.0 < g_config.rate) ?
+                                 ((double)g_config.workers / g_config.rate) *
+                                 NS_PER_SECOND : 0.0;
+    cli_response_t response;
+
+    for (uint32_t id = 0; true; id++)
+    {
+        uint64_t scheduled_ns = start_ns + (uint64_t)(id * interval_ns);
+        if (0.0 < interval_ns)
+        {
+            if (scheduled_ns >= end_ns)
+            {
+                break;
+            }
+            if (monotonic_ns() < scheduled_ns)
+            {
+                sleep_until(scheduled_ns);
+            }
+        }
+        else
+        {
+            scheduled_ns = monotonic_ns();
+            if (scheduled_ns >= end_ns)
+            {
+                break;
+            }
+        }
+        int status = (NULL != g_config.p_servers) ?
+            cli_cluster_evaluate(&g_cluster, g_config.postfix, &response) :
+            cli_pool_evaluate(&g_pool, g_config.postfix, &response);
+        if (CLI_POOL_OK != status)
+        {
+            return false;
+        }
+        record_response(p_worker, &response, monotonic_ns() - scheduled_ns);
+    }
+    return true;
+} /* run_pool_loop */
+
+/**
+ * @brief Worker thread body. Connects, waits for every other worker and then
+ *        drives its connection until the run ends.
+ * @param[in] args A pointer to the worker's bench_worker_t.
+ * @return NULL on thread exit
+ */
+static void* bench_worker_handler(void* args)
+{
+    bench_worker_t* p_worker = (bench_worker_t*)args;
+    if (0 < g_config.threads)
+    {
+        pthread_barrier_wait(&g_start_barrier);
+        uint64_t start_ns = monotonic_ns();
+        p_worker->b_failed = !run_pool_loop(p_worker,
+                                            start_ns,
+                                            start_ns + g_config.duration_ns);
+        return NULL;
+    }
+
+    cli_conn_t* p_conn = malloc(sizeof(cli_conn_t));
+    if (NULL == p_conn)
+    {
+        fprintf(stderr,
+                "Error allocating connection state. [%s]\n",
+                strerror(errno));
+    }
+    p_worker->b_failed = (NULL == p_conn) ||
+                         !open_connection(p_conn, &(p_worker->handle));
+
+    // Every worker reaches the barrier, even one that failed to connect, so
+    // the rest are never left waiting.
+    //
+    pthread_barrier_wait(&g_start_barrier);
+    if (false == p_worker->b_failed)
+    {
+        uint64_t start_ns = monotonic_ns();
+        uint64_t end_ns   = start_ns + g_config.duration_ns;
+        p_worker->b_failed = (0.0 < g_config.rate) ?
+            !run_open_loop(p_worker, p_conn, start_ns, end_ns) :
+            !run_closed_loop(p_worker, p_conn, end_ns);
+        cli_close(p_conn);
+    }
+    free(p_conn);
+    return NULL;
+} /* bench_worker_handler */
+
+/**
+ * @brief Prints the combined results of every worker.
+ * @return true if every connection ran to completion
+ *         false if any connection failed.
+ */
+static bool print_report(bench_worker_t* p_workers, uint64_t elapsed_ns)
+{
+    static histogram_t histogram;
+    uint64_t           completed = 0;
+    uint64_t           errors    = 0;
+    int                failed    = 0;
+
+    histogram_init(&histogram);
+    for (int i = 0; i < g_config.workers; i++)
+    {
+        histogram_merge(&histogram, &(p_workers[i].histogram));
+        completed += p_workers[i].completed;
+        errors    += p_workers[i].errors;
+        failed    += p_workers[i].b_failed ? 1 : 0;
+    }
+
+    double seconds = (double)elapsed_ns / NS_PER_SECOND;
+    if (0.0 < g_config.rate)
+    {
+        printf("Mode: open loop at [%.0f] requests/s\n", g_config.rate);
+    }
+    else
+    {
+        printf("Mode: closed loop with window [%d]\n", g_config.window);
+    }
+    if (0 < g_config.threads)
+    {
+        printf("Pool: [%d] connections%s shared by [%d] threads"
+               " (%d failed)\n",
+               g_config.connections,
+               (NULL != g_config.p_servers) ? " per server" : "",
+               g_config.threads,
+               failed);
+    }
+    else
+    {
+        printf("Connections: [%d] (%d failed)\n",
+               g_config.connections,
+               failed);
+    }
+    printf("Duration: [%.3f] s\n", seconds);
+    printf("Requests: [%lu] (%lu errors)\n",
+           (unsigned long)completed,
+           (unsigned long)errors);
+    printf("Throughput: [%.1f] requests/s\n", completed / seconds);
+    if (0 < g_config.column_rows)
+    {
+        printf("Rows: [%.1f] rows/s in requests of [%d]\n",
+               (double)completed * g_config.column_rows / seconds,
+               g_config.column_rows);
+    }
+    if (0 == histogram.count)
+    {
+        return (0 == failed);
+    }
+    printf("Latency (us): min [%.1f] p50 [%.1f] p99 [%.1f] p99.9 [%.1f]"
+           " max [%.1f]\n",
+           histogram.min / NS_PER_US,
+           histogram_percentile(&histogram, 50.0) / NS_PER_US,
+           histogram_percentile(&histogram, 99.0) / NS_PER_US,
+           histogram_percentile(&histogram, 99.9) / NS_PER_US,
+           histogram.max / NS_PER_US);
+    return (0 == failed);
+} /* print_report */
+
+int main(int argc, char** argv)
+{
+    setbuf(stdout, NULL);
+    extern char* optarg;
+
+    char* p_serv_ip      = NULL;
+    char* p_serv_port    = NULL;
+    char* p_infix_string = DEFAULT_EQUATION;
+    char* p_values       = NULL;
+    int   duration       = DEFAULT_DURATION_SECONDS;
+    int   opt;
+
+    g_config.connections = 1;
+    g_config.window      = 1;
+    do
+    {
+        opt = getopt(argc, argv, "i:p:u:c:d:w:r:e:bV:R:a:s:");
+        switch (opt)
+        {
+            case 'i':
+                p_serv_ip = optarg;
+            break;
+            case 'p':
+                p_serv_port = optarg;
+            break;
+            case 'u':
+                g_config.p_unix_path = optarg;
+            break;
+            case 'c':
+                g_config.connections = atoi(optarg);
+            break;
+            case 'd':
+                duration = atoi(optarg);
+            break;
+            case 'w':
+                g_config.window = atoi(optarg);
+            break;
+            case 'r':
+                g_config.rate = atof(optarg);
+            break;
+            case 'e':
+                p_infix_string = optarg;
+            break;
+            case 'b':
+                g_config.b_bytecode = true;
+            break;
+            case 'V':
+                p_values = optarg;
+            break;
+            case 'R':
+                g_config.column_rows = atoi(optarg);
+            break;
+            case 'a':
+                g_config.threads = atoi(optarg);
+            break;
+            case 's':
+                g_config.p_servers = optarg;
+            break;
+            default:
+            break;
+        }
+    } while (-1 != opt);
+
+    bool b_unix      = (NULL != g_config.p_unix_path);
+    bool b_cluster   = (NULL != g_config.p_servers);
+    int  port_number = (b_unix || b_cluster) ?
+                       0 : convert_port_number(p_serv_port);
+    if ((false == b_unix && false == b_cluster &&
+         (NULL == p_serv_ip || 0 > port_number)) ||
+        (b_cluster && 0 == g_config.threads) ||
+        (NULL != p_values && 0 < g_config.threads) ||
+        (0 != g_config.column_rows && NULL == p_values) ||
+        0 > g_config.column_rows ||
+        1 > g_config.connections ||
+        MAX_BENCH_CONNECTIONS < g_config.connections ||
+        1 > duration || 1 > g_config.window || 0.0 > g_config.rate ||
+        0 > g_config.threads || MAX_BENCH_THREADS < g_config.threads ||
+        (0 < g_config.threads &&
+         CLI_POOL_MAX_CONNECTIONS < g_config.connections))
+    {
+        fprintf(stderr, USAGE_STRING, argv[0]);
+        return EXIT_FAILURE;
+    }
+    g_config.duration_ns = (uint64_t)duration * NS_PER_SECOND;
+
+    g_config.addr.sin_family = AF_INET;
+    g_config.addr.sin_port   = htons(port_number);
+    if (false == b_unix && false == b_cluster &&
+        1 > inet_pton(AF_INET, p_serv_ip, &(g_config.addr.sin_addr)))
+    {
+        fprintf(stderr, "A valid IPv4 address is needed.\n");
+        return EXIT_FAILURE;
+    }
+
+    g_config.b_prepared = (NULL != p_values);
+    if (g_config.b_prepared && false == parse_values(p_values))
+    {
+        fprintf(stderr, "Values must be a comma separated list of numbers.\n");
+        return EXIT_FAILURE;
+    }
+    if (cli_column_rows(g_config.value_count) < g_config.column_rows)
+    {
+        fprintf(stderr,
+                "At most [%d] rows of [%d] values fit in one request.\n",
+                cli_column_rows(g_config.value_count),
+                g_config.value_count);
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < g_config.value_count; i++)
+    {
+        for (int row = 0; row < g_config.column_rows; row++)
+        {
+            g_column_values[i][row] = g_config.values[i];
+        }
+        g_config.columns[i] = g_column_values[i];
+    }
+
+    int err = g_config.b_prepared ?
+        formula_to_postfix(p_infix_string, g_config.postfix, MAX_POSTFIX_SIZE) :
+        infix_to_postfix(p_infix_string, g_config.postfix, MAX_POSTFIX_SIZE);
+    if (CONVERT_SUCCESS != err)
+    {
+        fprintf(stderr,
+                "Error converting provided string. [%s]\n",
+                convert_strerror(err));
+        return EXIT_FAILURE;
+    }
+
+    if (b_cluster)
+    {
+        err = cli_cluster_init(&g_cluster,
+                               g_config.p_servers,
+                               g_config.connections,
+                               g_config.b_bytecode);
+        if (CLI_CLUSTER_INIT_SUCCESS != err)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+    else if (0 < g_config.threads)
+    {
+        struct sockaddr_un unix_addr;
+        if (b_unix && false == cli_unix_address(g_config.p_unix_path,
+                                                &unix_addr))
+        {
+            return EXIT_FAILURE;
+        }
+        err = b_unix ?
+            cli_pool_init(&g_pool,
+                          (struct sockaddr*)&unix_addr,
+                          sizeof(unix_addr),
+                          g_config.connections,
+                          g_config.b_bytecode) :
+            cli_pool_init(&g_pool,
+                          (struct sockaddr*)&(g_config.addr),
+                          sizeof(g_config.addr),
+                          g_config.connections,
+                          g_config.b_bytecode);
+        if (CLI_POOL_INIT_SUCCESS != err)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    g_config.workers = (0 < g_config.threads) ? g_config.threads :
+                                                g_config.connections;
+    bench_worker_t* p_workers = calloc(g_config.workers,
+                                       sizeof(bench_worker_t));
+    if (NULL == p_workers)
+    {
+        fprintf(stderr, "Unable to allocate workers. [%s]\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    pthread_barrier_init(&g_start_barrier, NULL, g_config.workers + 1);
+
+    int started = 0;
+    for (; started < g_config.workers; started++)
+    {
+        histogram_init(&(p_workers[started].histogram));
+        err = pthread_create(&(p_workers[started].thread_id),
+                             NULL,
+                             &bench_worker_handler,
+                             &(p_workers[started]));
+        if (0 != err)
+        {
+            fprintf(stderr,
+                    "Thread unable to be created. [%s]\n",
+                    strerror(err));
+            return EXIT_FAILURE;
+        }
+    }
+
+    pthread_barrier_wait(&g_start_barrier);
+    uint64_t start_ns = monotonic_ns();
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(p_workers[i].thread_id, NULL);
+    }
+    uint64_t elapsed_ns = monotonic_ns() - start_ns;
+    if (b_cluster)
+    {
+        cli_cluster_destroy(&g_cluster);
+    }
+    else if (0 < g_config.threads)
+    {
+        cli_pool_destroy(&g_pool);
+    }
+
+    bool success = print_report(p_workers, elapsed_ns);
+    pthread_barrier_destroy(&g_start_barrier);
+    free(p_workers);
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+} /* main */
@@ -0,0 +1,57 @@
+#!/bin/sh
+#
+# @file check_cluster.sh
+#
+# @brief Checks that a client spreading requests over a cluster evicts a
+#        server that turns its connections away at the connection limit,
+#        and is still answered by the rest of the cluster. Run from the
+#        directory holding postfix_server and postfix_client.
+#        The first argument, if given, is the first of two free ports to use.
+#
+# COPYRIGHT NOTICE: (c) 2018 Barr Group. All rights reserved.
+
+HEALTHY_PORT=${1:-47310}
+LIMITED_PORT=$((HEALTHY_PORT + 1))
+OUTPUT=$(mktemp)
+
+# The limited server takes a single client and turns the rest away at once,
+# so the second connection of the client's pool is rejected.
+#
+./postfix_server -p "$HEALTHY_PORT" -m epoll -l off > /dev/null 2>&1 &
+HEALTHY_PID=$!
+./postfix_server -p "$LIMITED_PORT" -m epoll -c 1 -o 0 -l off > /dev/null 2>&1 &
+LIMITED_PID=$!
+sleep 1
+
+timeout 20 ./postfix_client -s "127.0.0.1:$HEALTHY_PORT,127.0.0.1:$LIMITED_PORT" \
+    -e "6 * 7" > "$OUTPUT" 2>&1
+STATUS=$?
+
+kill -INT "$HEALTHY_PID" "$LIMITED_PID"
+wait "$HEALTHY_PID" "$LIMITED_PID"
+
+FAILED=0
+if [ 0 -ne "$STATUS" ]
+then
+    echo "Cluster client failed with status [$STATUS]."
+    FAILED=1
+fi
+if ! grep -q "Server \[127.0.0.1:$LIMITED_PORT\] is at its connection limit, evicted" "$OUTPUT"
+then
+    echo "Server at its connection limit was not evicted."
+    FAILED=1
+fi
+if ! grep -q "The answer to the given equation is \[42\]" "$OUTPUT"
+then
+    echo "Cluster did not answer the equation."
+    FAILED=1
+fi
+
+if [ 0 -ne "$FAILED" ]
+then
+    cat "$OUTPUT"
+    rm -f "$OUTPUT"
+    exit 1
+fi
+rm -f "$OUTPUT"
+echo "All cluster checks passed."
@@ -0,0 +1,470 @@
+/** @file check_queues.c
+ *
+ * @brief Checks of the server's queues that need no socket: the MPMC fd ring
+ *        must hand every fd to exactly one consumer however producers and
+ *        consumers interleave, the admission queue must shed and recover on
+ *        CoDel's schedule, and the timing wheel must expire every entry on
+ *        its own tick across cascades, and never a cancelled one. Time is
+ *        passed in, so only the fd ring depends on scheduling.
+ *        Prints each failure and exits with EXIT_FAILURE if there was one.
+ * @par
+ * COPYRIGHT NOTICE: (c) 2018 Barr Group. All rights reserved.
+ */
+
+#define _XOPEN_SOURCE 700
+#include <math.h> // sqrt
+#include <pthread.h>
+#include <sched.h> // sched_yield
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h> // uint64_t
+#include <stdio.h> // fprintf
+#include <stdlib.h> // EXIT_FAILURE
+
+#include "serv_admit.h"
+#include "serv_queue.h"
+#include "serv_timer.h"
+
+#define CHECK_RING_DEPTH 64
+#define CHECK_RING_PRODUCERS 4
+#define CHECK_RING_PER_PRODUCER 50000
+#define CHECK_RING_FDS (CHECK_RING_PRODUCERS * CHECK_RING_PER_PRODUCER)
+#define CHECK_RING_WAITERS 2
+#define CHECK_RING_BATCHERS 2
+#define CHECK_RING_BATCH 8
+
+#define CHECK_ADMIT_DEPTH 16
+#define CHECK_ADMIT_TARGET_NS 1000ull
+#define CHECK_ADMIT_INTERVAL_NS (CHECK_ADMIT_TARGET_NS * ADMIT_INTERVAL_FACTOR)
+
+#define CHECK_TIMER_SPAN (1ull << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS))
+#define CHECK_TIMER_COUNT 24
+#define CHECK_TIMER_CANCELLED 3
+
+static int g_failures = 0;
+
+static fd_queue_t g_ring;
+static atomic_int g_ring_seen[CHECK_RING_FDS];
+static atomic_int g_ring_consumed;
+
+/**
+ * @brief A timer entry that knows which tick it should expire on.
+ */
+typedef struct check_timer_t {
+    timer_entry_t entry;
+    uint64_t      expected_tick;
+    int           expired_count;
+} check_timer_t;
+
+/**
+ * @brief What the timer callback has seen so far.
+ */
+typedef struct timer_log_t {
+    timer_wheel_t* p_wheel;
+    uint64_t       last_tick;
+    size_t         expired;
+} timer_log_t;
+
+/**
+ * @brief Records a failed check if a condition does not hold.
+ * @param[in] p_name The name of the check.
+ * @param[in] b_ok The condition.
+ */
+static void expect_true(const char* p_name, bool b_ok)
+{
+    if (false == b_ok)
+    {
+        fprintf(stderr, "%s: failed\n", p_name);
+        g_failures++;
+    }
+} /* expect_true */
+
+/**
+ * @brief Records a failed check if a value is not the expected one.
+ * @param[in] p_name The name of the check.
+ * @param[in] value The value found.
+ * @param[in] expected The value expected.
+ */
+static void expect_int(const char* p_name, int value, int expected)
+{
+    if (expected != value)
+    {
+        fprintf(stderr,
+                "%s: expected [%d], got [%d]\n",
+                p_name,
+                expected,
+                value);
+        g_failures++;
+    }
+} /* expect_int */
+
+/**
+ * @brief Counts an fd taken off the ring.
+ */
+static void ring_record(int fd)
+{
+    if (0 > fd || CHECK_RING_FDS <= fd)
+    {
+        fprintf(stderr, "ring: dequeued unknown fd [%d]\n", fd);
+        g_failures++;
+        return;
+    }
+    atomic_fetch_add(&(g_ring_seen[fd]), 1);
+    atomic_fetch_add(&g_ring_consumed, 1);
+} /* ring_record */
+
+/**
+ * @brief Enqueues its own range of fds, retrying while the ring is full.
+ * @param[in] p_arg The producer's index, cast to a pointer.
+ */
+static void* ring_producer(void* p_arg)
+{
+    int first = (int)(intptr_t)p_arg * CHECK_RING_PER_PRODUCER;
+    for (int fd = first; fd < first + CHECK_RING_PER_PRODUCER; fd++)
+    {
+        while (false == fd_queue_enqueue(&g_ring, fd))
+        {
+            sched_yield();
+        }
+    }
+    return NULL;
+} /* ring_producer */
+
+/**
+ * @brief Sleeps on the ring for fds until woken without one once every fd
+ *        has been consumed.
+ */
+static void* ring_waiter(void* p_arg)
+{
+    (void)p_arg;
+    for (;;)
+    {
+        int fd = fd_queue_dequeue_wait(&g_ring);
+        if (FD_QUEUE_EMPTY != fd)
+        {
+            ring_record(fd);
+        }
+        else if (CHECK_RING_FDS == atomic_load(&g_ring_consumed))
+        {
+            return NULL;
+        }
+    }
+} /* ring_waiter */
+
+/**
+ * @brief Polls the ring for batches of fds until every fd has been consumed.
+ */
+static void* ring_batcher(void* p_arg)
+{
+    int fds[CHECK_RING_BATCH];
+    (void)p_arg;
+    while (CHECK_RING_FDS > atomic_load(&g_ring_consumed))
+    {
+        size_t count = fd_queue_dequeue_batch(&g_ring, fds, CHECK_RING_BATCH);
+        if (0 == count)
+        {
+            sched_yield();
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            ring_record(fds[i]);
+        }
+    }
+    return NULL;
+} /* ring_batcher */
+
+/**
+ * @brief Runs producers against sleeping and polling consumers on a small
+ *        ring, so it wraps and fills many times, and checks that every fd
+ *        came out exactly once.
+ */
+static void check_fd_ring(void)
+{
+    pthread_t producers[CHECK_RING_PRODUCERS];
+    pthread_t waiters[CHECK_RING_WAITERS];
+    pthread_t batchers[CHECK_RING_BATCHERS];
+
+    if (FD_QUEUE_INIT_SUCCESS != fd_queue_init(&g_ring, CHECK_RING_DEPTH))
+    {
+        g_failures++;
+        return;
+    }
+    for (int i = 0; i < CHECK_RING_WAITERS; i++)
+    {
+        pthread_create(&(waiters[i]), NULL, &ring_waiter, NULL);
+    }
+    for (int i = 0; i < CHECK_RING_BATCHERS; i++)
+    {
+        pthread_create(&(batchers[i]), NULL, &ring_batcher, NULL);
+    }
+    for (int i = 0; i < CHECK_RING_PRODUCERS; i++)
+    {
+        pthread_create(&(producers[i]),
+                       NULL,
+                       &ring_producer,
+                       (void*)(intptr_t)i);
+    }
+
+    for (int i = 0; i < CHECK_RING_PRODUCERS; i++)
+    {
+        pthread_join(producers[i], NULL);
+    }
+    for (int i = 0; i < CHECK_RING_BATCHERS; i++)
+    {
+        pthread_join(batchers[i], NULL);
+    }
+
+    // The batchers only stop once every fd is consumed, so all that is left
+    // is to wake the waiters.
+    //
+    fd_queue_wake_all(&g_ring, CHECK_RING_WAITERS);
+    for (int i = 0; i < CHECK_RING_WAITERS; i++)
+    {
+        pthread_join(waiters[i], NULL);
+    }
+
+    int lost       = 0;
+    int duplicated = 0;
+    for (int fd = 0; fd < CHECK_RING_FDS; fd++)
+    {
+        int seen = atomic_load(&(g_ring_seen[fd]));
+        lost       += (0 == seen) ? 1 : 0;
+        duplicated += (1 < seen) ? 1 : 0;
+    }
+    expect_int("ring: fds lost", lost, 0);
+    expect_int("ring: fds duplicated", duplicated, 0);
+
+    int fds[CHECK_RING_BATCH];
+    expect_int("ring: empty after the run",
+               (int)fd_queue_dequeue_batch(&g_ring, fds, CHECK_RING_BATCH),
+               0);
+    fd_queue_destroy(&g_ring);
+} /* check_fd_ring */
+
+/**
+ * @brief Checks that a burst shorter than an interval is absorbed, that
+ *        waiters are then shed at interval / sqrt(drops), and that a queue
+ *        that has drained gives the next waiters a whole interval again.
+ */
+static void check_admission(void)
+{
+    admit_queue_t queue;
+    bool          b_shed = false;
+    if (ADMIT_INIT_SUCCESS != admit_queue_init(&queue,
+                                               CHECK_ADMIT_DEPTH,
+                                               CHECK_ADMIT_TARGET_NS))
+    {
+        g_failures++;
+        return;
+    }
+
+    for (int fd = 0; fd < CHECK_ADMIT_DEPTH; fd++)
+    {
+        expect_true("admit: push", admit_queue_push(&queue, fd, 0));
+    }
+    expect_true("admit: push when full",
+                false == admit_queue_push(&queue, CHECK_ADMIT_DEPTH, 0));
+
+    // Waiting under the target, or over it for less than an interval, is
+    // not shed.
+    //
+    uint64_t above_ns = CHECK_ADMIT_TARGET_NS;
+    uint64_t drop_ns  = above_ns + CHECK_ADMIT_INTERVAL_NS;
+    expect_int("admit: under target",
+               admit_queue_shed(&queue, CHECK_ADMIT_TARGET_NS - 1),
+               ADMIT_EMPTY);
+    expect_int("admit: first above target",
+               admit_queue_shed(&queue, above_ns),
+               ADMIT_EMPTY);
+    expect_int("admit: above target for less than an interval",
+               admit_queue_shed(&queue, drop_ns - 1),
+               ADMIT_EMPTY);
+
+    // Then the oldest waiters go, each drop closer to the last.
+    //
+    int next_fd = 0;
+    for (uint32_t drops = 1; drops <= 4; drops++)
+    {
+        expect_int("admit: drop on schedule",
+                   admit_queue_shed(&queue, drop_ns),
+                   next_fd++);
+        expect_int("admit: one drop per schedule",
+                   admit_queue_shed(&queue, drop_ns),
+                   ADMIT_EMPTY);
+        drop_ns += (uint64_t)((double)CHECK_ADMIT_INTERVAL_NS /
+                              sqrt((double)drops));
+        expect_int("admit: no drop before schedule",
+                   admit_queue_shed(&queue, drop_ns - 1),
+                   ADMIT_EMPTY);
+    }
+
+    // A slot freeing up still takes the waiters in order, and the queue
+    // forgets the overload once it is empty.
+    //
+    while (next_fd < CHECK_ADMIT_DEPTH)
+    {
+        expect_int("admit: pop in order",
+                   admit_queue_pop(&queue, drop_ns, &b_shed),
+                   next_fd++);
+    }
+    expect_int("admit: pop when empty",
+               admit_queue_pop(&queue, drop_ns, &b_shed),
+               ADMIT_EMPTY);
+
+    uint64_t arrival_ns = drop_ns + CHECK_ADMIT_INTERVAL_NS;
+    expect_true("admit: push after recovery",
+                admit_queue_push(&queue, next_fd, arrival_ns));
+    expect_int("admit: recovered above target",
+               admit_queue_shed(&queue, arrival_ns + CHECK_ADMIT_TARGET_NS),
+               ADMIT_EMPTY);
+    expect_int("admit: recovered for less than an interval",
+               admit_queue_shed(&queue,
+                                arrival_ns + CHECK_ADMIT_TARGET_NS +
+                                    CHECK_ADMIT_INTERVAL_NS - 1),
+               ADMIT_EMPTY);
+    expect_int("admit: under target after recovery",
+               admit_queue_pop(&queue,
+                               arrival_ns + CHECK_ADMIT_TARGET_NS - 1,
+                               &b_shed),
+               next_fd);
+    expect_true("admit: not shed after recovery", false == b_shed);
+    admit_queue_destroy(&queue);
+} /* check_admission */
+
+/**
+ * @brief Checks that an entry expires on the tick it was scheduled for, and
+ *        that ticks come in order.
+ */
+static void timer_expired(timer_entry_t* p_entry, void* p_context)
+{
+    check_timer_t* p_timer = (check_timer_t*)p_entry;
+    timer_log_t*   p_log   = (timer_log_t*)p_context;
+    uint64_t       tick    = p_log->p_wheel->next_tick - 1;
+
+    if (tick != p_timer->expected_tick)
+    {
+        fprintf(stderr,
+                "timer: expected to expire on tick [%llu], did on [%llu]\n",
+                (unsigned long long)p_timer->expected_tick,
+                (unsigned long long)tick);
+        g_failures++;
+    }
+    expect_true("timer: ticks in order", tick >= p_log->last_tick);
+    p_log->last_tick = tick;
+    p_log->expired++;
+    p_timer->expired_count++;
+} /* timer_expired */
+
+/**
+ * @brief Schedules entries on both sides of every level boundary and past
+ *        the top level's span, cancels and moves some, and turns the wheel
+ *        in uneven steps to check each live entry expires exactly once on
+ *        its own tick.
+ */
+static void check_timer_wheel(void)
+{
+    static const uint64_t ticks[CHECK_TIMER_COUNT] = {
+        0, 1, 63, 64, 65, 127, 128, 4095, 4096, 4097, 8191, 8192,
+        262143, 262144, 262145, 300000, 5000000, 16777215, 16777216,
+        16777217, 20000000, 33554431, 33554432, 40000000
+    };
+    static check_timer_t timers[CHECK_TIMER_COUNT];
+    timer_wheel_t*       p_wheel = malloc(sizeof(timer_wheel_t));
+    if (NULL == p_wheel)
+    {
+        g_failures++;
+        return;
+    }
+
+    // One nanosecond ticks keep deadlines and ticks the same numbers.
+    //
+    timer_log_t log = { .p_wheel = p_wheel, .last_tick = 0, .expired = 0 };
+    timer_wheel_init(p_wheel, 1, 0);
+    for (int i = CHECK_TIMER_COUNT - 1; i >= 0; i--)
+    {
+        timer_entry_init(&(timers[i].entry));
+        timers[i].expected_tick = ticks[i];
+        timers[i].expired_count = 0;
+        timer_wheel_schedule(p_wheel, &(timers[i].entry), ticks[i]);
+    }
+
+    // Cancel one entry on each of the upper levels, and move one later and
+    // one earlier across a level boundary.
+    //
+    check_timer_t* p_cancelled[CHECK_TIMER_CANCELLED] = {
+        &(timers[4]), &(timers[10]), &(timers[17])
+    };
+    for (int i = 0; i < CHECK_TIMER_CANCELLED; i++)
+    {
+        timer_wheel_cancel(p_wheel, &(p_cancelled[i]->entry));
+        expect_true("timer: cancelled is not pending",
+                    false == timer_entry_pending(&(p_cancelled[i]->entry)));
+    }
+    timers[2].expected_tick = 70000;
+    timer_wheel_schedule(p_wheel, &(timers[2].entry), 70000);
+    timers[23].expected_tick = 100;
+    timer_wheel_schedule(p_wheel, &(timers[23].entry), 100);
+
+    // Turn the wheel a tick at a time through the first cascades, then in
+    // steps that land on and between boundaries.
+    //
+    uint64_t now = 0;
+    while (now < 300)
+    {
+        timer_wheel_advance(p_wheel, now++, &timer_expired, &log);
+    }
+    while (now < CHECK_TIMER_SPAN * 3)
+    {
+        timer_wheel_advance(p_wheel, now, &timer_expired, &log);
+        now += 4093;
+    }
+
+    // One entry cancelled after it cascaded to the lowest level, which
+    // happens as the wheel reaches the start of its block of slots.
+    //
+    check_timer_t late;
+    uint64_t      block = (now + (2 * TIMER_WHEEL_SLOTS * TIMER_WHEEL_SLOTS)) &
+                          ~(uint64_t)TIMER_WHEEL_MASK;
+    timer_entry_init(&(late.entry));
+    late.expected_tick = block + (TIMER_WHEEL_SLOTS / 2);
+    late.expired_count = 0;
+    timer_wheel_schedule(p_wheel, &(late.entry), late.expected_tick);
+    timer_wheel_advance(p_wheel, block, &timer_expired, &log);
+    expect_true("timer: cascaded to the lowest level",
+                &(p_wheel->slots[0][TIMER_WHEEL_SLOTS / 2]) ==
+                    late.entry.p_prev);
+    timer_wheel_cancel(p_wheel, &(late.entry));
+    timer_wheel_advance(p_wheel, block + TIMER_WHEEL_SLOTS, &timer_expired,
+                        &log);
+    expect_int("timer: cancelled after cascading", late.expired_count, 0);
+
+    for (int i = 0; i < CHECK_TIMER_COUNT; i++)
+    {
+        bool b_cancelled = (&(timers[i]) == p_cancelled[0] ||
+                            &(timers[i]) == p_cancelled[1] ||
+                            &(timers[i]) == p_cancelled[2]);
+        expect_int("timer: expiries per entry",
+                   timers[i].expired_count,
+                   b_cancelled ? 0 : 1);
+    }
+    expect_int("timer: total expired",
+               (int)log.expired,
+               CHECK_TIMER_COUNT - CHECK_TIMER_CANCELLED);
+    expect_int("timer: wheel empty", (int)p_wheel->count, 0);
+    free(p_wheel);
+} /* check_timer_wheel */
+
+int main(void)
+{
+    check_fd_ring();
+    check_admission();
+    check_timer_wheel();
+
+    if (0 != g_failures)
+    {
+        fprintf(stderr, "[%d] checks failed.\n", g_failures);
+        return EXIT_FAILURE;
+    }
+    printf("All queue checks passed.\n");
+    return EXIT_SUCCESS;
+} /* main */
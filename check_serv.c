@@ -0,0 +1,192 @@
+/** @file check_serv.c
+ *
+ * @brief Checks of the server's evaluation paths that need no socket:
+ *        operands longer than EVAL_MAX_NUMBER_LENGTH must be rejected
+ *        whether an equation arrives whole, in one streamed chunk, split
+ *        across streamed chunks at any point, or is compiled or prepared.
+ *        A streamed equation must also end at the first newline or null,
+ *        as a sanitized one does.
+ *        Prints each failure and exits with EXIT_FAILURE if there was one.
+ * @par
+ * COPYRIGHT NOTICE: (c) 2018 Barr Group. All rights reserved.
+ */
+
+#include <stdbool.h>
+#include <stdio.h> // fprintf
+#include <stdlib.h> // EXIT_FAILURE
+#include <string.h> // memset, strlen
+
+#include "serv_eval.h"
+
+#define CHECK_LONG_DIGITS 150
+#define CHECK_STREAM_CHUNK 16
+#define CHECK_STREAM_MEMORY 4096
+#define CHECK_EQUATION_SIZE (CHECK_LONG_DIGITS + 8)
+#define CHECK_ENDED_ANSWER 3.0
+
+static int g_failures = 0;
+
+/**
+ * @brief Records a failed check if an error code is not the expected one.
+ * @param[in] p_name The name of the check.
+ * @param[in] err The error code returned.
+ * @param[in] expected The error code expected.
+ */
+static void expect_err(const char* p_name, int err, int expected)
+{
+    if (expected != err)
+    {
+        fprintf(stderr,
+                "%s: expected error [%d], got [%d]\n",
+                p_name,
+                expected,
+                err);
+        g_failures++;
+    }
+} /* expect_err */
+
+/**
+ * @brief Builds "<digits> 1 +" with an operand of the given number of nines.
+ * @param[out] p_equation A pointer to CHECK_EQUATION_SIZE bytes.
+ * @param[in] digits The number of nines, at most CHECK_LONG_DIGITS.
+ * @return The length of the equation.
+ */
+static size_t long_operand_equation(char* p_equation, int digits)
+{
+    memset(p_equation, '9', digits);
+    strcpy(p_equation + digits, " 1 +");
+    return strlen(p_equation);
+} /* long_operand_equation */
+
+/**
+ * @brief Streams an equation, cutting it after split bytes and then every
+ *        chunk bytes.
+ * @param[in] p_equation A pointer to the equation.
+ * @param[in] length The length of the equation.
+ * @param[in] split The length of the first chunk.
+ * @param[in] chunk The length of every later chunk.
+ * @param[out] p_result A pointer to store the result in.
+ * @return EVAL_SUCCESS or the evaluation error.
+ */
+static int stream_equation(const char* p_equation,
+                           size_t      length,
+                           size_t      split,
+                           size_t      chunk,
+                           double*     p_result)
+{
+    eval_stream_t stream;
+    eval_stream_begin(&stream, CHECK_STREAM_MEMORY);
+    size_t offset = (split < length) ? split : length;
+    eval_stream_feed(&stream, p_equation, offset);
+    while (offset < length)
+    {
+        size_t size = (chunk < (length - offset)) ? chunk : (length - offset);
+        eval_stream_feed(&stream, p_equation + offset, size);
+        offset += size;
+    }
+    return eval_stream_finish(&stream, p_result);
+} /* stream_equation */
+
+/**
+ * @brief Checks that an operand of the given length is accepted or
+ *        rejected on every path that parses text.
+ * @param[in] digits The length of the operand.
+ * @param[in] expected The error code every path should return.
+ */
+static void check_long_operand(int digits, int expected)
+{
+    char   equation[CHECK_EQUATION_SIZE];
+    char   name[64];
+    double result = 0.0;
+    size_t length = long_operand_equation(equation, digits);
+
+    snprintf(name, sizeof(name), "eval_postfix %d digits", digits);
+    expect_err(name, eval_postfix(equation, &result), expected);
+
+    snprintf(name, sizeof(name), "one chunk %d digits", digits);
+    expect_err(name,
+               stream_equation(equation, length, length, length, &result),
+               expected);
+
+    snprintf(name, sizeof(name), "%d byte chunks %d digits",
+             CHECK_STREAM_CHUNK, digits);
+    expect_err(name,
+               stream_equation(equation,
+                               length,
+                               CHECK_STREAM_CHUNK,
+                               CHECK_STREAM_CHUNK,
+                               &result),
+               expected);
+
+    eval_program_t program;
+    snprintf(name, sizeof(name), "eval_compile %d digits", digits);
+    expect_err(name, eval_compile(equation, length, &program), expected);
+
+    // A prepared constant must be rejected, not stored rounded, even
+    // next to a variable.
+    //
+    equation[length - 3] = 'x';
+    snprintf(name, sizeof(name), "eval_prepare %d digits", digits);
+    expect_err(name, eval_prepare(equation, length, &program), expected);
+    equation[length - 3] = '1';
+
+    for (size_t split = 1; split < length; split++)
+    {
+        snprintf(name, sizeof(name), "split at %zu %d digits", split, digits);
+        expect_err(name,
+                   stream_equation(equation, length, split, length, &result),
+                   expected);
+    }
+} /* check_long_operand */
+
+/**
+ * @brief Checks that a streamed equation stops at a terminator, however it
+ *        is split, and that nothing after the terminator is evaluated.
+ * @param[in] terminator The byte that should end the equation.
+ */
+static void check_stream_terminator(char terminator)
+{
+    // Everything after the terminator would change the answer or fail the
+    // equation if it were evaluated.
+    //
+    char   equation[] = "1 2 +#12 * 7 3 0 / -";
+    size_t length     = sizeof(equation) - 1;
+    char   name[64];
+    equation[5] = terminator;
+
+    for (size_t split = 1; split <= length; split++)
+    {
+        double result = 0.0;
+        int    err    = stream_equation(equation,
+                                        length,
+                                        split,
+                                        CHECK_STREAM_CHUNK,
+                                        &result);
+        snprintf(name, sizeof(name), "terminator [%d] split at %zu",
+                 terminator, split);
+        expect_err(name, err, EVAL_SUCCESS);
+        if (EVAL_SUCCESS == err && CHECK_ENDED_ANSWER != result)
+        {
+            fprintf(stderr, "%s: expected [%f], got [%f]\n",
+                    name, CHECK_ENDED_ANSWER, result);
+            g_failures++;
+        }
+    }
+} /* check_stream_terminator */
+
+int main(void)
+{
+    check_long_operand(EVAL_MAX_NUMBER_LENGTH, EVAL_SUCCESS);
+    check_long_operand(EVAL_MAX_NUMBER_LENGTH + 1, EVAL_INVALID_NUMBER);
+    check_long_operand(CHECK_LONG_DIGITS, EVAL_INVALID_NUMBER);
+    check_stream_terminator('\n');
+    check_stream_terminator('\0');
+
+    if (0 != g_failures)
+    {
+        fprintf(stderr, "[%d] checks failed.\n", g_failures);
+        return EXIT_FAILURE;
+    }
+    printf("All server checks passed.\n");
+    return EXIT_SUCCESS;
+} /* main */
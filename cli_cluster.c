@@ -0,0 +1,581 @@
+/** @file cli_cluster.c
+ *
+ * @brief Spreads one client's requests over several servers, each reached
+ *        through its own connection pool, so throughput is not capped by a
+ *        single server process and no separate load balancer is needed.
+ * @par
+ * COPYRIGHT NOTICE: (c) 2018 Barr Group. All rights reserved.
+ */
+
+#define _XOPEN_SOURCE 700 // pthread_rwlock_t, strtok_r
+#include <arpa/inet.h> // htons, inet_pton
+#include <errno.h> // errno
+#include <limits.h> // INT_MAX
+#include <netinet/in.h> // sockaddr_in
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h> // uint64_t
+#include <stdio.h> // stderr
+#include <stdlib.h> // free, malloc
+#include <string.h> // memcpy, memset, strerror, strlen, strrchr, strtok_r
+#include <sys/un.h> // sockaddr_un
+#include <time.h> // clock_gettime
+
+#include "cli_cluster.h"
+
+/**
+ * @brief A request sent through the cluster. It keeps its own copy of the
+ *        equation so it can be sent to another endpoint if the first one
+ *        gives up on it.
+ */
+typedef struct cluster_request_t {
+    cli_cluster_t*       p_cluster;
+    int                  endpoint;
+    int                  attempts;
+    cli_pool_callback_fn p_callback;
+    void*                p_context;
+    char                 postfix[];
+} cluster_request_t;
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000ull) + (uint64_t)now.tv_nsec;
+} /* monotonic_ns */
+
+/**
+ * @brief Parses one endpoint, either IPV4:PORT or the absolute path of a
+ *        unix domain socket.
+ * @return true if the endpoint is valid
+ *         false otherwise.
+ */
+static bool parse_endpoint(const char* p_spec, cli_endpoint_t* p_endpoint)
+{
+    size_t length = strlen(p_spec);
+    if (CLI_CLUSTER_ENDPOINT_NAME_SIZE <= length)
+    {
+        fprintf(stderr, "Server [%s] is too long.\n", p_spec);
+        return false;
+    }
+    memcpy(p_endpoint->name, p_spec, length + 1);
+
+    if ('/' == p_spec[0])
+    {
+        p_endpoint->addr_length = sizeof(struct sockaddr_un);
+        return cli_unix_address(p_spec,
+                                (struct sockaddr_un*)&(p_endpoint->addr));
+    }
+
+    char  host[CLI_CLUSTER_ENDPOINT_NAME_SIZE];
+    char* p_colon = strrchr(p_endpoint->name, ':');
+    if (NULL == p_colon)
+    {
+        fprintf(stderr, "Server [%s] needs an IPV4:PORT or a path.\n", p_spec);
+        return false;
+    }
+    memcpy(host, p_spec, p_colon - p_endpoint->name);
+    host[p_colon - p_endpoint->name] = '\0';
+
+    char port[CLI_CLUSTER_ENDPOINT_NAME_SIZE];
+    strcpy(port, p_colon + 1);
+    int                 port_number = convert_port_number(port);
+    struct sockaddr_in* p_addr      = (struct sockaddr_in*)&(p_endpoint->addr);
+    p_addr->sin_family = AF_INET;
+    p_addr->sin_port   = htons(port_number);
+    if (0 > port_number || 1 > inet_pton(AF_INET, host, &(p_addr->sin_addr)))
+    {
+        fprintf(stderr, "Server [%s] is not a valid IPV4:PORT.\n", p_spec);
+        return false;
+    }
+    p_endpoint->addr_length = sizeof(struct sockaddr_in);
+    return true;
+} /* parse_endpoint */
+
+/**
+ * @brief Stops sending requests to an endpoint until a backoff has passed,
+ *        doubling the backoff each time it is evicted again.
+ */
+static void evict_endpoint(cli_endpoint_t* p_endpoint,
+                           uint64_t        now_ns,
+                           const char*     p_reason)
+{
+    int evict_ms = CLI_CLUSTER_MAX_EVICT_MS;
+    if (p_endpoint->evictions < 16)
+    {
+        evict_ms = CLI_CLUSTER_MIN_EVICT_MS << p_endpoint->evictions;
+        if (CLI_CLUSTER_MAX_EVICT_MS < evict_ms)
+        {
+            evict_ms = CLI_CLUSTER_MAX_EVICT_MS;
+        }
+    }
+    p_endpoint->evictions++;
+    p_endpoint->retry_ns = now_ns + ((uint64_t)evict_ms * 1000000ull);
+    atomic_store(&(p_endpoint->b_healthy), false);
+    fprintf(stderr,
+            "Server [%s] %s, evicted for [%d] ms.\n",
+            p_endpoint->name,
+            p_reason,
+            evict_ms);
+} /* evict_endpoint */
+
+/**
+ * @brief Updates an endpoint's health. An endpoint that cannot be opened,
+ *        has no connection up, or had a connection turned away at the
+ *        server's connection limit since the last check is evicted. An
+ *        evicted endpoint is admitted again once its backoff has passed and
+ *        a connection is up, and its backoff resets after it stays healthy
+ *        for CLI_CLUSTER_MAX_EVICT_MS. Only the health thread, or
+ *        cli_cluster_init before it starts, calls this.
+ */
+static void check_endpoint(cli_cluster_t*  p_cluster,
+                           cli_endpoint_t* p_endpoint,
+                           uint64_t        now_ns)
+{
+    bool b_healthy = atomic_load(&(p_endpoint->b_healthy));
+    if (false == atomic_load(&(p_endpoint->b_open)))
+    {
+        if (now_ns < p_endpoint->retry_ns)
+        {
+            return;
+        }
+        if (CLI_POOL_INIT_SUCCESS != cli_pool_init(
+                &(p_endpoint->pool),
+                (struct sockaddr*)&(p_endpoint->addr),
+                p_endpoint->addr_length,
+                p_cluster->connections,
+                p_cluster->b_bytecode))
+        {
+            // A pool stays closed if one of its connections is turned away,
+            // which means the server is at its limit, not unreachable.
+            //
+            evict_endpoint(p_endpoint,
+                           now_ns,
+                           (0 < atomic_load(&(p_endpoint->pool.rejections))) ?
+                               "is at its connection limit" :
+                               "could not be opened");
+            return;
+        }
+        p_endpoint->seen_rejections = 0;
+        atomic_store(&(p_endpoint->b_open), true);
+    }
+    else
+    {
+        unsigned rejections = atomic_load(&(p_endpoint->pool.rejections));
+        if (rejections != p_endpoint->seen_rejections)
+        {
+            p_endpoint->seen_rejections = rejections;
+            evict_endpoint(p_endpoint, now_ns, "is at its connection limit");
+            return;
+        }
+        if (0 == atomic_load(&(p_endpoint->pool.connected_count)))
+        {
+            if (b_healthy)
+            {
+                evict_endpoint(p_endpoint, now_ns, "has no connection up");
+            }
+            return;
+        }
+        if (b_healthy)
+        {
+            if (0 < p_endpoint->evictions &&
+                now_ns - p_endpoint->admitted_ns >=
+                (uint64_t)CLI_CLUSTER_MAX_EVICT_MS * 1000000ull)
+            {
+                p_endpoint->evictions = 0;
+            }
+            return;
+        }
+        if (now_ns < p_endpoint->retry_ns)
+        {
+            return;
+        }
+    }
+
+    p_endpoint->admitted_ns = now_ns;
+    atomic_store(&(p_endpoint->b_healthy), true);
+    if (0 < p_endpoint->evictions)
+    {
+        fprintf(stderr, "Server [%s] admitted again.\n", p_endpoint->name);
+    }
+} /* check_endpoint */
+
+/**
+ * @brief Health thread body. Checks every endpoint each
+ *        CLI_CLUSTER_CHECK_MS until the cluster is destroyed.
+ * @param[in] args A pointer to the cli_cluster_t to watch.
+ * @return NULL on thread exit
+ */
+static void* health_handler(void* args)
+{
+    cli_cluster_t* p_cluster = (cli_cluster_t*)args;
+    while (true)
+    {
+        struct timespec until;
+        clock_gettime(CLOCK_MONOTONIC, &until);
+        uint64_t nsec = (uint64_t)until.tv_nsec +
+                        ((uint64_t)CLI_CLUSTER_CHECK_MS * 1000000ull);
+        until.tv_sec  += nsec / 1000000000ull;
+        until.tv_nsec  = nsec % 1000000000ull;
+
+        pthread_mutex_lock(&(p_cluster->stop_lock));
+        if (atomic_load(&(p_cluster->b_running)))
+        {
+            pthread_cond_timedwait(&(p_cluster->stop_wake),
+                                   &(p_cluster->stop_lock),
+                                   &until);
+        }
+        pthread_mutex_unlock(&(p_cluster->stop_lock));
+        if (false == atomic_load(&(p_cluster->b_running)))
+        {
+            break;
+        }
+
+        uint64_t now_ns = monotonic_ns();
+        for (int i = 0; i < p_cluster->endpoint_count; i++)
+        {
+            check_endpoint(p_cluster, &(p_cluster->endpoints[i]), now_ns);
+        }
+    }
+    return NULL;
+} /* health_handler */
+
+/**
+ * @brief Picks the healthy endpoint with the fewest requests outstanding,
+ *        starting the scan at a different endpoint each time so ties are
+ *        shared. If none is healthy, any open endpoint will do; its pool
+ *        holds the request until it reconnects.
+ * @param[in] exclude An endpoint not to pick, or -1.
+ * @return The index of the endpoint
+ *         -1 if none is open.
+ */
+static int pick_endpoint(cli_cluster_t* p_cluster, int exclude)
+{
+    unsigned start = atomic_fetch_add(&(p_cluster->next_endpoint), 1);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        int best             = -1;
+        int best_outstanding = INT_MAX;
+        for (int i = 0; i < p_cluster->endpoint_count; i++)
+        {
+            int             index      = (int)((start + (unsigned)i) %
+                                               p_cluster->endpoint_count);
+            cli_endpoint_t* p_endpoint = &(p_cluster->endpoints[index]);
+            if (index == exclude ||
+                false == atomic_load(&(p_endpoint->b_open)) ||
+                (0 == pass && false == atomic_load(&(p_endpoint->b_healthy))))
+            {
+                continue;
+            }
+            int outstanding = atomic_load(&(p_endpoint->outstanding));
+            if (outstanding < best_outstanding)
+            {
+                best             = index;
+                best_outstanding = outstanding;
+            }
+        }
+        if (0 <= best)
+        {
+            return best;
+        }
+    }
+    return -1;
+} /* pick_endpoint */
+
+static void complete_cluster_request(int                   status,
+                                     const cli_response_t* p_response,
+                                     void*                 p_context);
+
+/**
+ * @brief Sends a request an endpoint gave up on to another endpoint. Runs on
+ *        a pool's receiver thread, so it never waits for room. The read lock
+ *        keeps cli_cluster_destroy from closing pools meanwhile.
+ * @return true if the request was sent again and will complete later
+ *         false if it should complete now with its failure.
+ */
+static bool fail_over(cluster_request_t* p_request)
+{
+    cli_cluster_t* p_cluster = p_request->p_cluster;
+    bool           b_sent    = false;
+    pthread_rwlock_rdlock(&(p_cluster->failover_lock));
+    int index = pick_endpoint(p_cluster, p_request->endpoint);
+    if (atomic_load(&(p_cluster->b_running)) && 0 <= index &&
+        p_cluster->endpoint_count > p_request->attempts)
+    {
+        atomic_int* p_outstanding = &(p_cluster->endpoints[index].outstanding);
+        p_request->endpoint = index;
+        p_request->attempts++;
+        atomic_fetch_add(p_outstanding, 1);
+        b_sent = cli_pool_try_submit(&(p_cluster->endpoints[index].pool),
+                                     p_request->postfix,
+                                     &complete_cluster_request,
+                                     p_request);
+        if (false == b_sent)
+        {
+            atomic_fetch_sub(p_outstanding, 1);
+        }
+    }
+    pthread_rwlock_unlock(&(p_cluster->failover_lock));
+    return b_sent;
+} /* fail_over */
+
+/**
+ * @brief Pool callback for every cluster request. Fails the request over
+ *        if its endpoint gave up on it, otherwise passes the outcome on.
+ */
+static void complete_cluster_request(int                   status,
+                                     const cli_response_t* p_response,
+                                     void*                 p_context)
+{
+    cluster_request_t* p_request = (cluster_request_t*)p_context;
+    cli_cluster_t*     p_cluster = p_request->p_cluster;
+    atomic_fetch_sub(&(p_cluster->endpoints[p_request->endpoint].outstanding),
+                     1);
+    if (CLI_POOL_DISCONNECTED == status && fail_over(p_request))
+    {
+        return;
+    }
+    p_request->p_callback(status, p_response, p_request->p_context);
+    free(p_request);
+} /* complete_cluster_request */
+
+/**
+ * @brief Closes every open pool and releases the cluster's locks.
+ */
+static void close_cluster(cli_cluster_t* p_cluster)
+{
+    for (int i = 0; i < p_cluster->endpoint_count; i++)
+    {
+        if (atomic_load(&(p_cluster->endpoints[i].b_open)))
+        {
+            cli_pool_destroy(&(p_cluster->endpoints[i].pool));
+        }
+    }
+    pthread_rwlock_destroy(&(p_cluster->failover_lock));
+    pthread_cond_destroy(&(p_cluster->stop_wake));
+    pthread_mutex_destroy(&(p_cluster->stop_lock));
+} /* close_cluster */
+
+/**
+ * @brief Opens a cluster of servers. Servers that cannot be reached yet are
+ *        retried in the background.
+ * @param[out] p_cluster A pointer to the cluster to initialize.
+ * @param[in] p_endpoints A comma separated list of up to
+ *                        CLI_CLUSTER_MAX_ENDPOINTS servers, each IPV4:PORT or
+ *                        the absolute path of a unix domain socket.
+ * @param[in] connections The number of connections to keep open to each
+ *                        server.
+ * @param[in] b_bytecode True to send equations pre-compiled.
+ * @return CLI_CLUSTER_INIT_SUCCESS if at least one server is open.
+ *         CLI_CLUSTER_INIT_FAILURE otherwise.
+ */
+int cli_cluster_init(cli_cluster_t* p_cluster,
+                     const char*    p_endpoints,
+                     int            connections,
+                     bool           b_bytecode)
+{
+    memset(p_cluster, 0, sizeof(*p_cluster));
+    p_cluster->connections = connections;
+    p_cluster->b_bytecode  = b_bytecode;
+
+    size_t length = strlen(p_endpoints);
+    char*  p_list = malloc(length + 1);
+    if (NULL == p_list)
+    {
+        fprintf(stderr,
+                "Unable to copy server list. [%s]\n",
+                strerror(errno));
+        return CLI_CLUSTER_INIT_FAILURE;
+    }
+    memcpy(p_list, p_endpoints, length + 1);
+
+    bool  b_valid = true;
+    char* p_save  = NULL;
+    for (char* p_spec = strtok_r(p_list, ",", &p_save);
+         b_valid && NULL != p_spec;
+         p_spec = strtok_r(NULL, ",", &p_save))
+    {
+        if (CLI_CLUSTER_MAX_ENDPOINTS == p_cluster->endpoint_count)
+        {
+            fprintf(stderr,
+                    "At most [%d] servers are supported.\n",
+                    CLI_CLUSTER_MAX_ENDPOINTS);
+            b_valid = false;
+            break;
+        }
+        cli_endpoint_t* p_endpoint =
+            &(p_cluster->endpoints[p_cluster->endpoint_count]);
+        b_valid = parse_endpoint(p_spec, p_endpoint);
+        atomic_init(&(p_endpoint->b_open), false);
+        atomic_init(&(p_endpoint->b_healthy), false);
+        atomic_init(&(p_endpoint->outstanding), 0);
+        p_cluster->endpoint_count++;
+    }
+    free(p_list);
+    if (b_valid && 0 == p_cluster->endpoint_count)
+    {
+        fprintf(stderr, "A list of servers is needed.\n");
+        b_valid = false;
+    }
+    if (false == b_valid)
+    {
+        return CLI_CLUSTER_INIT_FAILURE;
+    }
+
+    atomic_init(&(p_cluster->b_running), true);
+    atomic_init(&(p_cluster->next_endpoint), 0);
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&(p_cluster->stop_wake), &attributes);
+    pthread_condattr_destroy(&attributes);
+    pthread_mutex_init(&(p_cluster->stop_lock), NULL);
+    pthread_rwlock_init(&(p_cluster->failover_lock), NULL);
+
+    // Open every endpoint now so the first requests have somewhere to go.
+    //
+    uint64_t now_ns = monotonic_ns();
+    int      opened = 0;
+    for (int i = 0; i < p_cluster->endpoint_count; i++)
+    {
+        check_endpoint(p_cluster, &(p_cluster->endpoints[i]), now_ns);
+        opened += atomic_load(&(p_cluster->endpoints[i].b_open)) ? 1 : 0;
+    }
+
+    if (0 == opened)
+    {
+        fprintf(stderr, "No server could be reached.\n");
+        close_cluster(p_cluster);
+        return CLI_CLUSTER_INIT_FAILURE;
+    }
+
+    int err = pthread_create(&(p_cluster->health_id),
+                             NULL,
+                             &health_handler,
+                             p_cluster);
+    if (0 != err)
+    {
+        fprintf(stderr, "Thread unable to be created. [%s]\n", strerror(err));
+        atomic_store(&(p_cluster->b_running), false);
+        close_cluster(p_cluster);
+        return CLI_CLUSTER_INIT_FAILURE;
+    }
+    return CLI_CLUSTER_INIT_SUCCESS;
+} /* cli_cluster_init */
+
+/**
+ * @brief Stops the health thread and closes every server's pool. Requests
+ *        still in flight complete with CLI_POOL_CLOSED. No thread may be
+ *        submitting to the cluster.
+ * @param[in] p_cluster A pointer to an initialized cluster.
+ */
+void cli_cluster_destroy(cli_cluster_t* p_cluster)
+{
+    // Once the write lock is released no fail over is under way, and none
+    // will start, so each pool can be closed without another's receivers
+    // submitting to it.
+    //
+    pthread_rwlock_wrlock(&(p_cluster->failover_lock));
+    atomic_store(&(p_cluster->b_running), false);
+    pthread_rwlock_unlock(&(p_cluster->failover_lock));
+
+    pthread_mutex_lock(&(p_cluster->stop_lock));
+    pthread_cond_broadcast(&(p_cluster->stop_wake));
+    pthread_mutex_unlock(&(p_cluster->stop_lock));
+    int err = pthread_join(p_cluster->health_id, NULL);
+    if (0 != err)
+    {
+        fprintf(stderr, "Error joining thread. [%s]\n", strerror(err));
+    }
+
+    close_cluster(p_cluster);
+} /* cli_cluster_destroy */
+
+/**
+ * @brief Sends a request to the least loaded healthy server without waiting
+ *        for its response.
+ * @param[in] p_cluster A pointer to an initialized cluster.
+ * @param[in] p_postfix A pointer to a valid postfix notation string of any
+ *                      length. It is copied.
+ * @param[in] p_callback Called once with the outcome of the request, as for
+ *                       cli_pool_submit.
+ * @param[in] p_context Passed to the callback.
+ * @return true if the request was submitted and the callback will run
+ *         false if no server is open, the cluster is closed or the equation
+ *         does not encode.
+ */
+bool cli_cluster_submit(cli_cluster_t*       p_cluster,
+                        const char*          p_postfix,
+                        cli_pool_callback_fn p_callback,
+                        void*                p_context)
+{
+    if (NULL == p_postfix || NULL == p_callback ||
+        false == atomic_load(&(p_cluster->b_running)))
+    {
+        return false;
+    }
+
+    size_t             length    = strlen(p_postfix);
+    cluster_request_t* p_request = malloc(sizeof(cluster_request_t) +
+                                          length + 1);
+    if (NULL == p_request)
+    {
+        fprintf(stderr,
+                "Unable to copy postfix string. [%s]\n",
+                strerror(errno));
+        return false;
+    }
+    p_request->p_cluster  = p_cluster;
+    p_request->attempts   = 1;
+    p_request->p_callback = p_callback;
+    p_request->p_context  = p_context;
+    memcpy(p_request->postfix, p_postfix, length + 1);
+
+    p_request->endpoint = pick_endpoint(p_cluster, -1);
+    if (0 > p_request->endpoint)
+    {
+        fprintf(stderr, "No server is available.\n");
+        free(p_request);
+        return false;
+    }
+    cli_endpoint_t* p_endpoint = &(p_cluster->endpoints[p_request->endpoint]);
+    atomic_fetch_add(&(p_endpoint->outstanding), 1);
+    if (false == cli_pool_submit(&(p_endpoint->pool),
+                                 p_request->postfix,
+                                 &complete_cluster_request,
+                                 p_request))
+    {
+        atomic_fetch_sub(&(p_endpoint->outstanding), 1);
+        free(p_request);
+        return false;
+    }
+    return true;
+} /* cli_cluster_submit */
+
+/**
+ * @brief Evaluates one equation on the cluster and waits for the answer.
+ * @param[in] p_cluster A pointer to an initialized cluster.
+ * @param[in] p_postfix A pointer to a valid postfix notation string.
+ * @param[out] p_response Set to the server's response if the status is
+ *                        CLI_POOL_OK.
+ * @return CLI_POOL_OK, CLI_POOL_DISCONNECTED or CLI_POOL_CLOSED.
+ *         CLI_POOL_REJECTED if the request could not be submitted.
+ */
+int cli_cluster_evaluate(cli_cluster_t*  p_cluster,
+                         const char*     p_postfix,
+                         cli_response_t* p_response)
+{
+    cli_future_t future;
+    cli_future_init(&future);
+    int status = CLI_POOL_REJECTED;
+    if (cli_cluster_submit(p_cluster,
+                           p_postfix,
+                           &cli_future_complete,
+                           &future))
+    {
+        status = cli_future_wait(&future, p_response);
+    }
+    cli_future_destroy(&future);
+    return status;
+} /* cli_cluster_evaluate */
@@ -0,0 +1,75 @@
+#ifndef CLI_CLUSTER_H
+#define CLI_CLUSTER_H
+
+#include <pthread.h> // pthread_t, pthread_mutex_t, pthread_rwlock_t
+#include <stdatomic.h> // atomic_bool, atomic_int, atomic_uint
+#include <stdbool.h>
+#include <stdint.h> // uint64_t
+#include <sys/socket.h> // sockaddr_storage, socklen_t
+
+#include "cli_lib.h"
+#include "cli_pool.h"
+
+#define CLI_CLUSTER_INIT_SUCCESS 0
+#define CLI_CLUSTER_INIT_FAILURE -1
+#define CLI_CLUSTER_MAX_ENDPOINTS 16
+#define CLI_CLUSTER_ENDPOINT_NAME_SIZE 128
+#define CLI_CLUSTER_CHECK_MS 100
+#define CLI_CLUSTER_MIN_EVICT_MS 250
+#define CLI_CLUSTER_MAX_EVICT_MS 8000
+
+/**
+ * @brief One server of a cluster. Its pool is opened by the health thread,
+ *        which alone writes the fields below b_healthy; submitters only read
+ *        b_open, b_healthy and outstanding.
+ */
+typedef struct cli_endpoint_t {
+    char                    name[CLI_CLUSTER_ENDPOINT_NAME_SIZE];
+    struct sockaddr_storage addr;
+    socklen_t               addr_length;
+    cli_pool_t              pool;
+    atomic_bool             b_open;
+    atomic_bool             b_healthy;
+    atomic_int              outstanding;
+    unsigned                seen_rejections;
+    int                     evictions;
+    uint64_t                retry_ns;
+    uint64_t                admitted_ns;
+} cli_endpoint_t;
+
+/**
+ * @brief A set of servers that share the load of one client. Each request
+ *        goes to the healthy endpoint with the fewest requests outstanding,
+ *        so a slow or distant server is given less work. A health thread
+ *        evicts an endpoint whose server turns connections away at its
+ *        connection limit or has no connection up, and admits it again
+ *        after a backoff that doubles while the trouble lasts. Requests an
+ *        endpoint gives up on are sent to another one.
+ */
+typedef struct cli_cluster_t {
+    int              endpoint_count;
+    int              connections;
+    bool             b_bytecode;
+    atomic_bool      b_running;
+    atomic_uint      next_endpoint;
+    pthread_t        health_id;
+    pthread_mutex_t  stop_lock;
+    pthread_cond_t   stop_wake;
+    pthread_rwlock_t failover_lock;
+    cli_endpoint_t   endpoints[CLI_CLUSTER_MAX_ENDPOINTS];
+} cli_cluster_t;
+
+int  cli_cluster_init(cli_cluster_t* p_cluster,
+                      const char*    p_endpoints,
+                      int            connections,
+                      bool           b_bytecode);
+void cli_cluster_destroy(cli_cluster_t* p_cluster);
+bool cli_cluster_submit(cli_cluster_t*       p_cluster,
+                        const char*          p_postfix,
+                        cli_pool_callback_fn p_callback,
+                        void*                p_context);
+int  cli_cluster_evaluate(cli_cluster_t*  p_cluster,
+                          const char*     p_postfix,
+                          cli_response_t* p_response);
+
+#endif /* CLI_CLUSTER_H */
@@ -8,7 +8,10 @@
 #include <string.h> // strnlen
 #include <strings.h> // strerror
 #include <sys/socket.h> // send, recv
+#include <sys/un.h> // sockaddr_un
+#include <unistd.h> // close
 #include "cli_lib.h"
+#include "dtoa.h"
 
 /**
  * @brief Attempt to convert a string to a port number.
@@ -103,7 +106,489 @@ int check_for_exit(char *p_string)
 } /* check_for_exit */
 
 /**
- * @brief Send a given postfix string via a given socket.
+ * @brief Gets the binding strength of an operator on the conversion stack.
+ *        'u' marks a unary minus, which binds tighter than any binary
+ *        operator.
+ * @param[in] op An operator character from the conversion stack.
+ * @return The precedence of the operator. 0 for an open parenthesis.
+ */
+static int operator_precedence(char op)
+{
+    switch (op)
+    {
+        case '+':
+        case '-':
+            return 1;
+        case '*':
+        case '/':
+        case '%':
+            return 2;
+        case 'u':
+            return 3;
+        default:
+            return 0;
+    }
+} /* operator_precedence */
+
+/**
+ * @brief Appends one postfix token to the output, separated from the previous
+ *        token by a space.
+ * @param[in] p_postfix A pointer to the output buffer.
+ * @param[in,out] p_length A pointer to the length of the output so far.
+ * @param[in] postfix_size The size of the output buffer.
+ * @param[in] p_token A pointer to the token to append.
+ * @param[in] token_length The length of the token.
+ * @return True if the token fit in the output buffer.
+ *         False if the output buffer is too small.
+ */
+static bool emit_token(char*       p_postfix,
+                       size_t*     p_length,
+                       size_t      postfix_size,
+                       const char* p_token,
+                       size_t      token_length)
+{
+    size_t length    = *p_length;
+    size_t separator = (0 == length) ? 0 : 1;
+    if (postfix_size <= length + separator + token_length)
+    {
+        return false;
+    }
+    if (separator)
+    {
+        p_postfix[length++] = ' ';
+    }
+    memcpy(p_postfix + length, p_token, token_length);
+    *p_length = length + token_length;
+    return true;
+} /* emit_token */
+
+/**
+ * @brief Emits an operator popped off the conversion stack.
+ */
+static bool emit_operator(char*   p_postfix,
+                          size_t* p_length,
+                          size_t  postfix_size,
+                          char    op)
+{
+    // A unary minus is emitted as a subtraction from the 0 that was emitted
+    // in front of its operand.
+    //
+    char token = ('u' == op) ? '-' : op;
+    return emit_token(p_postfix, p_length, postfix_size, &token, 1);
+} /* emit_operator */
+
+/**
+ * @brief Checks if a character can start a variable name.
+ */
+static bool is_name_start(char c)
+{
+    return isalpha((unsigned char)c) || '_' == c;
+} /* is_name_start */
+
+/**
+ * @brief Converts an infix equation to postfix notation in a single pass
+ *        using the shunting-yard algorithm.
+ * @param[in] p_infix A pointer to a null terminated infix equation.
+ * @param[out] p_postfix A pointer to a buffer to store the postfix equation.
+ * @param[in] postfix_size The size of the postfix buffer.
+ * @param[in] b_variables True if variable names are operands, false if they
+ *                        are invalid characters.
+ * @return CONVERT_SUCCESS or any of the infix_to_postfix errors.
+ */
+static int convert_infix(const char* p_infix,
+                         char*       p_postfix,
+                         size_t      postfix_size,
+                         bool        b_variables)
+{
+    if (NULL == p_infix || NULL == p_postfix || 0 == postfix_size)
+    {
+        fprintf(stderr, "No string provided to convert.\n");
+        return CONVERT_EMPTY;
+    }
+
+    char        stack[CONVERT_STACK_SIZE];
+    int         depth           = 0;
+    size_t      length          = 0;
+    bool        b_expect_number = true;
+    const char* p_cursor        = p_infix;
+
+    p_postfix[0] = '\0';
+    while ('\0' != *p_cursor && '\n' != *p_cursor)
+    {
+        char c = *p_cursor;
+        if (isspace((unsigned char)c))
+        {
+            p_cursor++;
+        }
+        else if (isdigit((unsigned char)c) || '.' == c)
+        {
+            if (false == b_expect_number)
+            {
+                return CONVERT_MISSING_OPERATOR;
+            }
+            const char* p_start      = p_cursor;
+            bool        b_seen_point = false;
+            bool        b_seen_digit = false;
+            while (isdigit((unsigned char)*p_cursor) || '.' == *p_cursor)
+            {
+                if ('.' == *p_cursor)
+                {
+                    if (b_seen_point)
+                    {
+                        return CONVERT_INVALID_NUMBER;
+                    }
+                    b_seen_point = true;
+                }
+                else
+                {
+                    b_seen_digit = true;
+                }
+                p_cursor++;
+            }
+            if (false == b_seen_digit)
+            {
+                return CONVERT_INVALID_NUMBER;
+            }
+            if (false == emit_token(p_postfix,
+                                    &length,
+                                    postfix_size,
+                                    p_start,
+                                    p_cursor - p_start))
+            {
+                return CONVERT_BUFFER_TOO_SMALL;
+            }
+            b_expect_number = false;
+        }
+        else if (b_variables && is_name_start(c))
+        {
+            if (false == b_expect_number)
+            {
+                return CONVERT_MISSING_OPERATOR;
+            }
+            const char* p_start = p_cursor;
+            while (is_name_start(*p_cursor) ||
+                   isdigit((unsigned char)*p_cursor))
+            {
+                p_cursor++;
+            }
+            if (false == emit_token(p_postfix,
+                                    &length,
+                                    postfix_size,
+                                    p_start,
+                                    p_cursor - p_start))
+            {
+                return CONVERT_BUFFER_TOO_SMALL;
+            }
+            b_expect_number = false;
+        }
+        else if ('(' == c)
+        {
+            if (false == b_expect_number)
+            {
+                return CONVERT_MISSING_OPERATOR;
+            }
+            if (CONVERT_STACK_SIZE == depth)
+            {
+                return CONVERT_TOO_DEEP;
+            }
+            stack[depth++] = c;
+            p_cursor++;
+        }
+        else if (')' == c)
+        {
+            if (b_expect_number)
+            {
+                return CONVERT_MISSING_OPERAND;
+            }
+            while (0 < depth && '(' != stack[depth - 1])
+            {
+                if (false == emit_operator(p_postfix,
+                                           &length,
+                                           postfix_size,
+                                           stack[--depth]))
+                {
+                    return CONVERT_BUFFER_TOO_SMALL;
+                }
+            }
+            if (0 == depth)
+            {
+                return CONVERT_MISMATCHED_PARENTHESES;
+            }
+            depth--;
+            p_cursor++;
+        }
+        else if (b_expect_number && ('-' == c || '+' == c))
+        {
+            // Unary plus changes nothing. Unary minus becomes (0 - operand).
+            //
+            if ('-' == c)
+            {
+                if (CONVERT_STACK_SIZE == depth)
+                {
+                    return CONVERT_TOO_DEEP;
+                }
+                if (false == emit_token(p_postfix,
+                                        &length,
+                                        postfix_size,
+                                        "0",
+                                        1))
+                {
+                    return CONVERT_BUFFER_TOO_SMALL;
+                }
+                stack[depth++] = 'u';
+            }
+            p_cursor++;
+        }
+        else if (0 < operator_precedence(c) && 'u' != c)
+        {
+            if (b_expect_number)
+            {
+                return CONVERT_MISSING_OPERAND;
+            }
+            int precedence = operator_precedence(c);
+            while (0 < depth &&
+                   operator_precedence(stack[depth - 1]) >= precedence)
+            {
+                if (false == emit_operator(p_postfix,
+                                           &length,
+                                           postfix_size,
+                                           stack[--depth]))
+                {
+                    return CONVERT_BUFFER_TOO_SMALL;
+                }
+            }
+            if (CONVERT_STACK_SIZE == depth)
+            {
+                return CONVERT_TOO_DEEP;
+            }
+            stack[depth++]  = c;
+            b_expect_number = true;
+            p_cursor++;
+        }
+        else
+        {
+            return CONVERT_INVALID_CHARACTER;
+        }
+    }
+
+    if (0 == length && 0 == depth)
+    {
+        return CONVERT_EMPTY;
+    }
+    if (b_expect_number)
+    {
+        return CONVERT_MISSING_OPERAND;
+    }
+    while (0 < depth)
+    {
+        if ('(' == stack[--depth])
+        {
+            return CONVERT_MISMATCHED_PARENTHESES;
+        }
+        if (false == emit_operator(p_postfix,
+                                   &length,
+                                   postfix_size,
+                                   stack[depth]))
+        {
+            return CONVERT_BUFFER_TOO_SMALL;
+        }
+    }
+    p_postfix[length] = '\0';
+    return CONVERT_SUCCESS;
+} /* convert_infix */
+
+/**
+ * @brief Converts an infix equation to postfix notation in a single pass
+ *        using the shunting-yard algorithm. Supports (* + - / %),
+ *        parentheses, decimal numbers and unary minus. Uses a fixed size
+ *        operator stack and never allocates.
+ * @param[in] p_infix A pointer to a null terminated infix equation. Input
+ *                    stops at the first newline.
+ * @param[out] p_postfix A pointer to a buffer to store the postfix equation.
+ * @param[in] postfix_size The size of the postfix buffer.
+ * @return CONVERT_SUCCESS if the equation was converted.
+ *         CONVERT_INVALID_CHARACTER if the equation has an unknown character.
+ *         CONVERT_MISMATCHED_PARENTHESES if parentheses do not pair up.
+ *         CONVERT_MISSING_OPERAND if an operator is missing an operand.
+ *         CONVERT_MISSING_OPERATOR if two operands are not separated by an
+ *             operator.
+ *         CONVERT_INVALID_NUMBER if a number is malformed.
+ *         CONVERT_BUFFER_TOO_SMALL if the postfix buffer is too small.
+ *         CONVERT_TOO_DEEP if operators nest deeper than CONVERT_STACK_SIZE.
+ *         CONVERT_EMPTY if there is nothing to convert.
+ */
+int infix_to_postfix(const char* p_infix,
+                     char*       p_postfix,
+                     size_t      postfix_size)
+{
+    return convert_infix(p_infix, p_postfix, postfix_size, false);
+} /* infix_to_postfix */
+
+/**
+ * @brief Converts an infix formula that may name variables to postfix
+ *        notation, for preparing with cli_prepare. A name is a letter or
+ *        underscore followed by letters, digits or underscores, and is an
+ *        operand like a number.
+ * @param[in] p_infix A pointer to a null terminated infix formula. Input
+ *                    stops at the first newline.
+ * @param[out] p_postfix A pointer to a buffer to store the postfix formula.
+ * @param[in] postfix_size The size of the postfix buffer.
+ * @return CONVERT_SUCCESS or any of the infix_to_postfix errors.
+ */
+int formula_to_postfix(const char* p_infix,
+                       char*       p_postfix,
+                       size_t      postfix_size)
+{
+    return convert_infix(p_infix, p_postfix, postfix_size, true);
+} /* formula_to_postfix */
+
+/**
+ * @brief Encodes a postfix string as MSG_BYTECODE operations, so the server
+ *        never has to parse its text or convert its numbers.
+ * @param[in] p_postfix A pointer to a postfix string from infix_to_postfix.
+ * @param[out] p_bytecode A pointer to the buffer to store the bytecode in.
+ * @param[in] bytecode_size The size of the bytecode buffer.
+ * @return The length of the bytecode if the string was encoded.
+ *         CONVERT_INVALID_CHARACTER if the string is not postfix.
+ *         CONVERT_INVALID_NUMBER if an operand is malformed.
+ *         CONVERT_BUFFER_TOO_SMALL if the bytecode does not fit.
+ */
+int postfix_to_bytecode(const char* p_postfix,
+                        uint8_t*    p_bytecode,
+                        size_t      bytecode_size)
+{
+    size_t      length   = 0;
+    const char* p_cursor = p_postfix;
+    while ('\0' != *p_cursor)
+    {
+        char    c  = *p_cursor;
+        uint8_t op = 0;
+        switch (c)
+        {
+            case ' ':
+                p_cursor++;
+                continue;
+            case '+':
+                op = PROTO_OP_ADD;
+            break;
+            case '-':
+                op = PROTO_OP_SUB;
+            break;
+            case '*':
+                op = PROTO_OP_MUL;
+            break;
+            case '/':
+                op = PROTO_OP_DIV;
+            break;
+            case '%':
+                op = PROTO_OP_MOD;
+            break;
+            default:
+            break;
+        }
+
+        if (0 != op)
+        {
+            if (bytecode_size - length < 1)
+            {
+                return CONVERT_BUFFER_TOO_SMALL;
+            }
+            p_bytecode[length++] = op;
+            p_cursor++;
+            continue;
+        }
+
+        if (false == isdigit((unsigned char)c) && '.' != c)
+        {
+            return CONVERT_INVALID_CHARACTER;
+        }
+        char*  p_end = NULL;
+        double value = strtod(p_cursor, &p_end);
+        if (p_end == p_cursor)
+        {
+            return CONVERT_INVALID_NUMBER;
+        }
+        if (bytecode_size - length < PROTO_PUSH_SIZE)
+        {
+            return CONVERT_BUFFER_TOO_SMALL;
+        }
+        p_bytecode[length] = PROTO_OP_PUSH;
+        proto_put_f64(p_bytecode + length + 1, value);
+        length   += PROTO_PUSH_SIZE;
+        p_cursor  = p_end;
+    }
+    return (int)length;
+} /* postfix_to_bytecode */
+
+/**
+ * @brief Describes a conversion error code.
+ * @param[in] err An error code returned by infix_to_postfix.
+ * @return A pointer to a static description of the error.
+ */
+const char* convert_strerror(int err)
+{
+    switch (err)
+    {
+        case CONVERT_SUCCESS:
+            return "Success";
+        case CONVERT_INVALID_CHARACTER:
+            return "Invalid character in equation";
+        case CONVERT_MISMATCHED_PARENTHESES:
+            return "Mismatched parentheses";
+        case CONVERT_MISSING_OPERAND:
+            return "Operator is missing an operand";
+        case CONVERT_MISSING_OPERATOR:
+            return "Operands must be separated by an operator";
+        case CONVERT_INVALID_NUMBER:
+            return "Malformed number";
+        case CONVERT_BUFFER_TOO_SMALL:
+            return "Equation is too long";
+        case CONVERT_TOO_DEEP:
+            return "Equation is nested too deeply";
+        case CONVERT_EMPTY:
+            return "Empty equation";
+        default:
+            return "Unknown error";
+    }
+} /* convert_strerror */
+
+/**
+ * @brief Sends a whole buffer, retrying partial sends.
+ * @param[in] fd A connected socket file descriptor.
+ * @param[in] p_data A pointer to the data to send.
+ * @param[in] length The length of the data.
+ * @param[in] flags Flags for send, in addition to MSG_NOSIGNAL.
+ * @return true if everything was sent
+ *         false if the connection failed.
+ */
+static bool send_all(int fd, const void* p_data, size_t length, int flags)
+{
+    size_t offset = 0;
+    while (offset < length)
+    {
+        ssize_t err = send(fd,
+                           (const char*)p_data + offset,
+                           length - offset,
+                           flags | MSG_NOSIGNAL);
+        if (0 > err)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            fprintf(stderr,
+                    "Unable to send message to server. [%s]\n",
+                    strerror(errno));
+            return false;
+        }
+        offset += err;
+    }
+    return true;
+} /* send_all */
+
+/**
+ * @brief Send a given postfix string via a given socket. The string is
+ *        newline terminated, so strings of any length are answered once.
  * @param[in] p_postfix A pointer to a valid postfix notation string.
  * @param[in] client_socket_fd The socket file descriptor for the client.
  * @return true if successfuly sent
@@ -117,22 +602,31 @@ bool send_postfix(char* p_postfix, int client_socket_fd)
         return false;
     }
 
+    // A short string goes out in one write with its terminator, since the
+    // server ends an unterminated one at the end of a burst. MSG_MORE holds
+    // a long one back until its terminator is sent, on TCP at least.
+    //
     printf("Sending postfix to server\n");
-    int err = send(client_socket_fd,
-                   p_postfix,
-                   strnlen(p_postfix, MAX_BUFFER_SIZE),
-                   0);
-    if(strnlen(p_postfix, MAX_BUFFER_SIZE) > err)
+    size_t length = strlen(p_postfix);
+    if (MAX_BUFFER_SIZE >= length)
+    {
+        char line[MAX_BUFFER_SIZE + 1];
+        memcpy(line, p_postfix, length);
+        line[length] = '\n';
+        if (false == send_all(client_socket_fd, line, length + 1, 0))
+        {
+            return false;
+        }
+    }
+    else if (false == send_all(client_socket_fd, p_postfix, length, MSG_MORE) ||
+             false == send_all(client_socket_fd, "\n", 1, 0))
     {
-        fprintf(stderr,
-                "Unable to send message to server. [%s]\n",
-                strerror(errno));
         return false;
     }
 
     char response[MAX_BUFFER_SIZE] = { 0 };
     printf("Waiting for receive\n");
-    err = recv(client_socket_fd, &response, MAX_BUFFER_SIZE, 0);
+    int err = recv(client_socket_fd, &response, MAX_BUFFER_SIZE, 0);
     if (0 == err)
     {
         fprintf(stderr,
@@ -150,4 +644,871 @@ bool send_postfix(char* p_postfix, int client_socket_fd)
 
     printf("Server responded with: \n%s\n", response);
     return true;
-} /* send_postfix */
\ No newline at end of file
+} /* send_postfix */
+
+/**
+ * @brief Creates a socket and connects it to the server.
+ * @param[in] p_addr A pointer to the server's address.
+ * @param[in] addr_length The size of the address.
+ * @return A connected socket file descriptor
+ *         -1 if connecting failed.
+ */
+int cli_connect(const struct sockaddr* p_addr, socklen_t addr_length)
+{
+    int fd = socket(p_addr->sa_family, SOCK_STREAM, 0);
+    if (0 > fd)
+    {
+        fprintf(stderr,
+                "Failed to create client socket. [%s]\n",
+                strerror(errno));
+        return -1;
+    }
+    if (0 > connect(fd, p_addr, addr_length))
+    {
+        fprintf(stderr,
+                "Unable to connect to server. [%s]\n",
+                strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+} /* cli_connect */
+
+/**
+ * @brief Builds the address of a server listening on a unix domain socket.
+ * @param[in] p_path The path of the server's socket.
+ * @param[out] p_addr A pointer to the address to fill in.
+ * @return true if the address is valid
+ *         false if the path does not fit.
+ */
+bool cli_unix_address(const char* p_path, struct sockaddr_un* p_addr)
+{
+    memset(p_addr, 0, sizeof(*p_addr));
+    p_addr->sun_family = AF_UNIX;
+    if (sizeof(p_addr->sun_path) <= strlen(p_path))
+    {
+        fprintf(stderr, "Unix socket path [%s] is too long.\n", p_path);
+        return false;
+    }
+    strcpy(p_addr->sun_path, p_path);
+    return true;
+} /* cli_unix_address */
+
+/**
+ * @brief Connects to a server listening on a unix domain socket.
+ * @param[in] p_path The path of the server's socket.
+ * @return A connected socket file descriptor
+ *         -1 if connecting failed.
+ */
+int cli_connect_unix(const char* p_path)
+{
+    struct sockaddr_un addr;
+    if (false == cli_unix_address(p_path, &addr))
+    {
+        return -1;
+    }
+    return cli_connect((struct sockaddr*)&addr, sizeof(addr));
+} /* cli_connect_unix */
+
+/**
+ * @brief Asks a server on the same host to carry the connection's frames
+ *        over shared memory. The request also selects the framed protocol,
+ *        so a declined connection carries on framed over the socket.
+ * @param[in] p_conn A pointer to a connection over a unix domain socket.
+ * @return true if the connection is ready for framed requests
+ *         false if the server did not answer or its region was unusable.
+ */
+static bool request_shm(cli_conn_t* p_conn)
+{
+    uint8_t select = PROTO_SELECT_SHM;
+    uint8_t reply  = PROTO_SHM_DECLINED;
+    int     memfd  = SHM_NO_FD;
+    p_conn->proto  = CLI_PROTO_FRAMED;
+    if (false == send_all(p_conn->fd, &select, 1, 0) ||
+        false == shm_receive_reply(p_conn->fd, &reply, &memfd))
+    {
+        fprintf(stderr, "Server did not answer the shared memory request.\n");
+        return false;
+    }
+    if (SHM_NO_FD != memfd)
+    {
+        if (PROTO_SHM_ACCEPTED == reply)
+        {
+            p_conn->p_shm = shm_region_map(memfd);
+        }
+        close(memfd);
+    }
+    return (PROTO_SHM_ACCEPTED != reply) || (NULL != p_conn->p_shm);
+} /* request_shm */
+
+/**
+ * @brief Reads the server's handshake byte and selects the protocol for the
+ *        connection. Framed connections over a unix domain socket move onto
+ *        shared memory when the server offers it.
+ * @param[out] p_conn A pointer to the connection to initialize.
+ * @param[in] fd A connected socket file descriptor.
+ * @param[in] b_want_framed True to use the framed protocol if the server
+ *                          supports it.
+ * @return true if the handshake succeeded
+ *         false if the server did not send a valid handshake, or rejected
+ *         the connection, which sets b_rejected.
+ */
+bool cli_handshake(cli_conn_t* p_conn, int fd, bool b_want_framed)
+{
+    p_conn->fd         = fd;
+    p_conn->proto      = CLI_PROTO_TEXT;
+    p_conn->p_shm      = NULL;
+    p_conn->b_bytecode = false;
+    p_conn->b_rejected = false;
+    atomic_init(&(p_conn->b_shut_down), false);
+    p_conn->in_length  = 0;
+    p_conn->out_length = 0;
+
+    char version = 0;
+    int  err     = recv(fd, &version, 1, 0);
+    if (1 == err && PROTO_REJECTED_MESSAGE[0] == version)
+    {
+        fprintf(stderr, "Server is at its connection limit.\n");
+        p_conn->b_rejected = true;
+        return false;
+    }
+    if (1 != err || PROTO_VERSION_TEXT > version || '9' < version)
+    {
+        fprintf(stderr,
+                "Server handshake error. [%s]\n",
+                (0 > err) ? strerror(errno) : "Unexpected handshake");
+        return false;
+    }
+
+    if (b_want_framed && PROTO_VERSION_SHM <= version &&
+        shm_socket_is_local(fd))
+    {
+        return request_shm(p_conn);
+    }
+    if (b_want_framed && PROTO_VERSION_FRAMED <= version)
+    {
+        p_conn->out_buffer[0] = PROTO_SELECT_FRAMED;
+        p_conn->out_length    = 1;
+        p_conn->proto         = CLI_PROTO_FRAMED;
+    }
+    return true;
+} /* cli_handshake */
+
+/**
+ * @brief Wakes any thread waiting to send on or receive from a connection,
+ *        failing its wait. The connection can only be closed afterwards.
+ * @param[in] p_conn A pointer to a handshaked connection.
+ */
+void cli_shutdown(cli_conn_t* p_conn)
+{
+    atomic_store(&(p_conn->b_shut_down), true);
+    shutdown(p_conn->fd, SHUT_RDWR);
+    if (NULL != p_conn->p_shm)
+    {
+        shm_ring_close(&(p_conn->p_shm->requests));
+        shm_ring_close(&(p_conn->p_shm->responses));
+    }
+} /* cli_shutdown */
+
+/**
+ * @brief Closes a connection and releases its shared memory.
+ * @param[in] p_conn A pointer to a handshaked connection.
+ */
+void cli_close(cli_conn_t* p_conn)
+{
+    if (NULL != p_conn->p_shm)
+    {
+        shm_ring_close(&(p_conn->p_shm->requests));
+        shm_ring_close(&(p_conn->p_shm->responses));
+        shm_region_unmap(p_conn->p_shm);
+        p_conn->p_shm = NULL;
+    }
+    close(p_conn->fd);
+} /* cli_close */
+
+/**
+ * @brief Sends bytes to the server over whichever transport the connection
+ *        uses, waiting for room in the shared request ring when it is full.
+ * @return true if everything was sent
+ *         false if the connection failed.
+ */
+static bool send_to_server(cli_conn_t* p_conn,
+                           const void* p_data,
+                           size_t      length)
+{
+    if (NULL == p_conn->p_shm)
+    {
+        return send_all(p_conn->fd, p_data, length, 0);
+    }
+
+    size_t offset = 0;
+    while (offset < length)
+    {
+        size_t written = shm_ring_write(&(p_conn->p_shm->requests),
+                                        (const uint8_t*)p_data + offset,
+                                        length - offset);
+        if (0 == written &&
+            false == shm_ring_wait_writable(&(p_conn->p_shm->requests),
+                                            p_conn->fd))
+        {
+            fprintf(stderr, "Connection to server lost.\n");
+            return false;
+        }
+        offset += written;
+    }
+    return true;
+} /* send_to_server */
+
+/**
+ * @brief Sends every buffered request.
+ * @param[in] p_conn A pointer to a handshaked connection.
+ * @return true if everything was sent
+ *         false if the connection failed.
+ */
+bool cli_flush(cli_conn_t* p_conn)
+{
+    if (false == send_to_server(p_conn,
+                                p_conn->out_buffer,
+                                p_conn->out_length))
+    {
+        return false;
+    }
+    p_conn->out_length = 0;
+    return true;
+} /* cli_flush */
+
+/**
+ * @brief Sends an equation too long to queue as one MSG_EQUATION frame,
+ *        straight from the caller's string after anything already queued.
+ *        The server evaluates it as it arrives.
+ * @param[in] p_conn A pointer to a connection using the framed protocol.
+ * @param[in] id An id the response will be tagged with.
+ * @param[in] p_postfix A pointer to a valid postfix notation string.
+ * @param[in] length The length of the string.
+ * @return true if the request was sent
+ *         false if the connection failed.
+ */
+static bool submit_long_equation(cli_conn_t* p_conn,
+                                 uint32_t    id,
+                                 const char* p_postfix,
+                                 size_t      length)
+{
+    frame_header_t header = { 0 };
+    header.length = (uint32_t)length;
+    header.id     = id;
+    header.type   = MSG_EQUATION;
+    if (CLI_OUT_BUFFER_SIZE - p_conn->out_length < FRAME_HEADER_SIZE &&
+        false == cli_flush(p_conn))
+    {
+        return false;
+    }
+    proto_write_header(p_conn->out_buffer + p_conn->out_length, &header);
+    p_conn->out_length += FRAME_HEADER_SIZE;
+    if (false == cli_flush(p_conn))
+    {
+        return false;
+    }
+    return send_to_server(p_conn, p_postfix, length);
+} /* submit_long_equation */
+
+/**
+ * @brief Queues one framed request, encoded as bytecode if the connection's
+ *        b_bytecode is set. Requests are buffered and sent together by
+ *        cli_flush or the next cli_receive, so many requests can be in flight
+ *        at once. Equations longer than MAX_BUFFER_SIZE are always sent as
+ *        text, and immediately.
+ * @param[in] p_conn A pointer to a connection using the framed protocol.
+ * @param[in] id An id the response will be tagged with.
+ * @param[in] p_postfix A pointer to a valid postfix notation string.
+ * @return true if the request was queued
+ *         false if the connection failed or the equation does not encode.
+ */
+bool cli_submit(cli_conn_t* p_conn, uint32_t id, const char* p_postfix)
+{
+    size_t length = strlen(p_postfix);
+    if (MAX_BUFFER_SIZE < length)
+    {
+        return submit_long_equation(p_conn, id, p_postfix, length);
+    }
+
+    // Bytecode is never larger than PROTO_MAX_BYTECODE_SIZE, so reserve room
+    // for whichever encoding is used before encoding in place.
+    //
+    size_t reserve = p_conn->b_bytecode ? PROTO_MAX_BYTECODE_SIZE : length;
+    if (CLI_OUT_BUFFER_SIZE - p_conn->out_length < FRAME_HEADER_SIZE + reserve)
+    {
+        if (false == cli_flush(p_conn))
+        {
+            return false;
+        }
+    }
+
+    uint8_t*       p_payload = p_conn->out_buffer + p_conn->out_length +
+                               FRAME_HEADER_SIZE;
+    frame_header_t header    = { 0 };
+    header.id   = id;
+    header.type = MSG_EQUATION;
+    if (p_conn->b_bytecode)
+    {
+        int encoded = postfix_to_bytecode(p_postfix,
+                                          p_payload,
+                                          PROTO_MAX_BYTECODE_SIZE);
+        if (0 > encoded)
+        {
+            fprintf(stderr,
+                    "Unable to encode postfix string. [%s]\n",
+                    convert_strerror(encoded));
+            return false;
+        }
+        length      = encoded;
+        header.type = MSG_BYTECODE;
+    }
+    else
+    {
+        memcpy(p_payload, p_postfix, length);
+    }
+    header.length = (uint32_t)length;
+    proto_write_header(p_conn->out_buffer + p_conn->out_length, &header);
+    p_conn->out_length += FRAME_HEADER_SIZE + length;
+    return true;
+} /* cli_submit */
+
+/**
+ * @brief Queues a request to compile a postfix formula that may name
+ *        variables. The MSG_PREPARED response carries the handle to pass to
+ *        cli_execute and the number of variables, which are numbered in
+ *        order of first appearance.
+ * @param[in] p_conn A pointer to a connection using the framed protocol.
+ * @param[in] id An id the response will be tagged with.
+ * @param[in] p_postfix A pointer to a postfix formula.
+ * @return true if the request was queued
+ *         false if the connection failed or the formula is too long.
+ */
+bool cli_prepare(cli_conn_t* p_conn, uint32_t id, const char* p_postfix)
+{
+    size_t length = strlen(p_postfix);
+    if (PROTO_MAX_PAYLOAD < length)
+    {
+        fprintf(stderr, "Formula is too long to prepare.\n");
+        return false;
+    }
+    if (CLI_OUT_BUFFER_SIZE - p_conn->out_length < FRAME_HEADER_SIZE + length &&
+        false == cli_flush(p_conn))
+    {
+        return false;
+    }
+
+    frame_header_t header = { 0 };
+    header.length = (uint32_t)length;
+    header.id     = id;
+    header.type   = MSG_PREPARE;
+    proto_write_header(p_conn->out_buffer + p_conn->out_length, &header);
+    memcpy(p_conn->out_buffer + p_conn->out_length + FRAME_HEADER_SIZE,
+           p_postfix,
+           length);
+    p_conn->out_length += FRAME_HEADER_SIZE + length;
+    return true;
+} /* cli_prepare */
+
+/**
+ * @brief Queues a request to run a prepared formula with its variables
+ *        bound to values. The response is a MSG_VALUE frame.
+ * @param[in] p_conn A pointer to a connection using the framed protocol.
+ * @param[in] id An id the response will be tagged with.
+ * @param[in] handle The handle the formula was prepared as.
+ * @param[in] p_values A pointer to one value per variable.
+ * @param[in] count The number of values, at most PROTO_MAX_VARIABLES.
+ * @return true if the request was queued
+ *         false if the connection failed or there are too many values.
+ */
+bool cli_execute(cli_conn_t*   p_conn,
+                 uint32_t      id,
+                 uint32_t      handle,
+                 const double* p_values,
+                 int           count)
+{
+    if (0 > count || PROTO_MAX_VARIABLES < count)
+    {
+        fprintf(stderr, "Too many values to bind.\n");
+        return false;
+    }
+    size_t length = PROTO_HANDLE_SIZE + ((size_t)count * PROTO_BINDING_SIZE);
+    if (CLI_OUT_BUFFER_SIZE - p_conn->out_length < FRAME_HEADER_SIZE + length &&
+        false == cli_flush(p_conn))
+    {
+        return false;
+    }
+
+    uint8_t*       p_payload = p_conn->out_buffer + p_conn->out_length +
+                               FRAME_HEADER_SIZE;
+    frame_header_t header    = { 0 };
+    header.length = (uint32_t)length;
+    header.id     = id;
+    header.type   = MSG_EXECUTE;
+    proto_write_header(p_conn->out_buffer + p_conn->out_length, &header);
+    proto_put_u32(p_payload, handle);
+    for (int i = 0; i < count; i++)
+    {
+        proto_put_f64(p_payload + PROTO_HANDLE_SIZE + (i * PROTO_BINDING_SIZE),
+                      p_values[i]);
+    }
+    p_conn->out_length += FRAME_HEADER_SIZE + length;
+    return true;
+} /* cli_execute */
+
+/**
+ * @brief Finds how many rows of columns fit in one MSG_EXECUTE_COLUMNS
+ *        request.
+ * @param[in] column_count The number of columns, one per variable.
+ * @return The most rows one request may carry.
+ */
+int cli_column_rows(int column_count)
+{
+    size_t room = PROTO_MAX_PAYLOAD - PROTO_COLUMNS_HEADER_SIZE;
+    size_t rows = (0 < column_count) ?
+                  room / ((size_t)column_count * PROTO_BINDING_SIZE) :
+                  PROTO_MAX_COLUMN_ROWS;
+    return (PROTO_MAX_COLUMN_ROWS < rows) ? PROTO_MAX_COLUMN_ROWS : (int)rows;
+} /* cli_column_rows */
+
+/**
+ * @brief Queues a request to run a prepared formula over rows of values,
+ *        one column per variable. The server runs the rows in vector
+ *        registers and answers with one MSG_COLUMN_RESULT; send longer
+ *        columns as several requests of at most cli_column_rows rows.
+ * @param[in] p_conn A pointer to a connection using the framed protocol.
+ * @param[in] id An id the response will be tagged with.
+ * @param[in] handle The handle the formula was prepared as.
+ * @param[in] pp_columns One pointer per variable to its first row's value.
+ * @param[in] column_count The number of columns.
+ * @param[in] rows The number of rows, at most cli_column_rows.
+ * @return true if the request was queued
+ *         false if the connection failed or there are too many rows.
+ */
+bool cli_execute_columns(cli_conn_t*          p_conn,
+                         uint32_t             id,
+                         uint32_t             handle,
+                         const double* const* pp_columns,
+                         int                  column_count,
+                         int                  rows)
+{
+    if (0 > column_count || PROTO_MAX_VARIABLES < column_count ||
+        0 > rows || cli_column_rows(column_count) < rows)
+    {
+        fprintf(stderr, "Too many values to bind.\n");
+        return false;
+    }
+    size_t length = PROTO_COLUMNS_HEADER_SIZE +
+                    ((size_t)column_count * rows * PROTO_BINDING_SIZE);
+    if (CLI_OUT_BUFFER_SIZE - p_conn->out_length < FRAME_HEADER_SIZE + length &&
+        false == cli_flush(p_conn))
+    {
+        return false;
+    }
+
+    uint8_t*       p_payload = p_conn->out_buffer + p_conn->out_length +
+                               FRAME_HEADER_SIZE;
+    frame_header_t header    = { 0 };
+    header.length = (uint32_t)length;
+    header.id     = id;
+    header.type   = MSG_EXECUTE_COLUMNS;
+    proto_write_header(p_conn->out_buffer + p_conn->out_length, &header);
+    proto_put_u32(p_payload, handle);
+    proto_put_u32(p_payload + PROTO_HANDLE_SIZE, (uint32_t)rows);
+    p_payload += PROTO_COLUMNS_HEADER_SIZE;
+    for (int column = 0; column < column_count; column++)
+    {
+        for (int row = 0; row < rows; row++)
+        {
+            proto_put_f64(p_payload, pp_columns[column][row]);
+            p_payload += PROTO_BINDING_SIZE;
+        }
+    }
+    p_conn->out_length += FRAME_HEADER_SIZE + length;
+    return true;
+} /* cli_execute_columns */
+
+/**
+ * @brief Reports that the server closed the connection, unless this side
+ *        shut it down on purpose.
+ */
+static void report_lost_connection(cli_conn_t* p_conn)
+{
+    if (false == atomic_load(&(p_conn->b_shut_down)))
+    {
+        fprintf(stderr, "Connection to server lost.\n");
+    }
+} /* report_lost_connection */
+
+/**
+ * @brief Waits until a whole frame is buffered at the start of the input
+ *        buffer. Its payload follows the header in place.
+ * @param[in] p_conn A pointer to a connection using the framed protocol.
+ * @param[out] p_header A pointer to store the frame's header in.
+ * @return true if a frame is ready
+ *         false if the connection is closed or connection failed.
+ */
+static bool receive_frame(cli_conn_t* p_conn, frame_header_t* p_header)
+{
+    while (true)
+    {
+        if (FRAME_HEADER_SIZE <= p_conn->in_length)
+        {
+            proto_read_header(p_conn->in_buffer, p_header);
+            size_t frame_length = FRAME_HEADER_SIZE + p_header->length;
+            if (CLI_IN_BUFFER_SIZE < frame_length)
+            {
+                fprintf(stderr, "Server sent an oversized frame.\n");
+                return false;
+            }
+            if (frame_length <= p_conn->in_length)
+            {
+                return true;
+            }
+        }
+
+        if (NULL != p_conn->p_shm)
+        {
+            size_t bytes_read =
+                shm_ring_read(&(p_conn->p_shm->responses),
+                              p_conn->in_buffer + p_conn->in_length,
+                              CLI_IN_BUFFER_SIZE - p_conn->in_length);
+            if (0 == bytes_read &&
+                false == shm_ring_wait_readable(&(p_conn->p_shm->responses),
+                                                p_conn->fd))
+            {
+                report_lost_connection(p_conn);
+                return false;
+            }
+            p_conn->in_length += bytes_read;
+            continue;
+        }
+
+        int err = recv(p_conn->fd,
+                       p_conn->in_buffer + p_conn->in_length,
+                       CLI_IN_BUFFER_SIZE - p_conn->in_length,
+                       0);
+        if (0 == err)
+        {
+            report_lost_connection(p_conn);
+            return false;
+        }
+        else if (0 > err)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            if (atomic_load(&(p_conn->b_shut_down)))
+            {
+                return false;
+            }
+            fprintf(stderr,
+                    "Unable to receive message on socket. [%s]\n",
+                    strerror(errno));
+            return false;
+        }
+        p_conn->in_length += err;
+    }
+} /* receive_frame */
+
+/**
+ * @brief Drops the frame at the start of the input buffer.
+ */
+static void consume_frame(cli_conn_t* p_conn, const frame_header_t* p_header)
+{
+    size_t frame_length = FRAME_HEADER_SIZE + p_header->length;
+    p_conn->in_length  -= frame_length;
+    memmove(p_conn->in_buffer,
+            p_conn->in_buffer + frame_length,
+            p_conn->in_length);
+} /* consume_frame */
+
+/**
+ * @brief Sends any queued requests and waits for the next response frame.
+ *        Responses may arrive in any order; match them by id.
+ * @param[in] p_conn A pointer to a connection using the framed protocol.
+ * @param[out] p_response A pointer to store the response in.
+ * @return true if a response was received
+ *         false if the connection is closed or connection failed.
+ */
+bool cli_receive(cli_conn_t* p_conn, cli_response_t* p_response)
+{
+    return cli_flush(p_conn) && cli_wait_response(p_conn, p_response);
+} /* cli_receive */
+
+/**
+ * @brief Waits for the next response frame without sending queued
+ *        requests, for a receiving thread while other threads submit and
+ *        flush.
+ * @param[in] p_conn A pointer to a connection using the framed protocol.
+ * @param[out] p_response A pointer to store the response in.
+ * @return true if a response was received
+ *         false if the connection is closed or connection failed.
+ */
+bool cli_wait_response(cli_conn_t* p_conn, cli_response_t* p_response)
+{
+    frame_header_t header;
+    if (false == receive_frame(p_conn, &header))
+    {
+        return false;
+    }
+
+    const uint8_t* p_payload = p_conn->in_buffer + FRAME_HEADER_SIZE;
+    p_response->id             = header.id;
+    p_response->type           = header.type;
+    p_response->status         = header.status;
+    p_response->eval_status    = PROTO_EVAL_OK;
+    p_response->value          = 0.0;
+    p_response->handle         = 0;
+    p_response->variable_count = 0;
+    if (MSG_PREPARED == header.type && PROTO_PREPARED_SIZE <= header.length)
+    {
+        p_response->eval_status    = proto_get_u16(p_payload);
+        p_response->handle         = proto_get_u32(p_payload + 2);
+        p_response->variable_count = proto_get_u16(p_payload + 6);
+        int length = (PROTO_EVAL_OK == p_response->eval_status) ?
+            snprintf(p_response->text,
+                     sizeof(p_response->text),
+                     "Prepared as [%u] with [%d] variables",
+                     p_response->handle,
+                     p_response->variable_count) :
+            snprintf(p_response->text,
+                     sizeof(p_response->text),
+                     "Error: %s",
+                     proto_eval_strerror(p_response->eval_status));
+        p_response->length = ((int)sizeof(p_response->text) <= length) ?
+                             sizeof(p_response->text) - 1 : (size_t)length;
+        consume_frame(p_conn, &header);
+        return true;
+    }
+    if (MSG_COLUMN_RESULT == header.type &&
+        PROTO_COLUMN_RESULT_HEADER_SIZE <= header.length)
+    {
+        // Only summarize the rows; cli_receive_columns returns them.
+        //
+        p_response->eval_status = proto_get_u16(p_payload);
+        int length = (PROTO_EVAL_OK == p_response->eval_status) ?
+            snprintf(p_response->text,
+                     sizeof(p_response->text),
+                     "[%u] rows",
+                     proto_get_u32(p_payload + 2)) :
+            snprintf(p_response->text,
+                     sizeof(p_response->text),
+                     "Error: %s",
+                     proto_eval_strerror(p_response->eval_status));
+        p_response->length = ((int)sizeof(p_response->text) <= length) ?
+                             sizeof(p_response->text) - 1 : (size_t)length;
+        consume_frame(p_conn, &header);
+        return true;
+    }
+    if (MSG_VALUE == header.type && PROTO_VALUE_SIZE <= header.length)
+    {
+        // Render the value the way the server renders text answers.
+        //
+        p_response->eval_status = proto_get_u16(p_payload);
+        p_response->value       = proto_get_f64(p_payload + 2);
+        int length = (PROTO_EVAL_OK == p_response->eval_status) ?
+            dtoa_shortest(p_response->value, p_response->text) :
+            snprintf(p_response->text,
+                     sizeof(p_response->text),
+                     "Error: %s",
+                     proto_eval_strerror(p_response->eval_status));
+        p_response->length = ((int)sizeof(p_response->text) <= length) ?
+                             sizeof(p_response->text) - 1 : (size_t)length;
+        consume_frame(p_conn, &header);
+        return true;
+    }
+
+    size_t text_length = (MAX_BUFFER_SIZE < header.length) ?
+                         MAX_BUFFER_SIZE : header.length;
+    p_response->length = text_length;
+    memcpy(p_response->text, p_payload, text_length);
+    p_response->text[text_length] = '\0';
+    consume_frame(p_conn, &header);
+    return true;
+} /* cli_wait_response */
+
+/**
+ * @brief Sends one postfix string over a handshaked connection and prints the
+ *        server's answer, using whichever protocol the connection selected.
+ * @param[in] p_conn A pointer to a handshaked connection.
+ * @param[in] p_postfix A pointer to a valid postfix notation string.
+ * @return true if successfuly sent
+ *         false if connection is closed or connection failed.
+ */
+bool cli_send_postfix(cli_conn_t* p_conn, char* p_postfix)
+{
+    if (CLI_PROTO_TEXT == p_conn->proto)
+    {
+        return send_postfix(p_postfix, p_conn->fd);
+    }
+
+    cli_response_t response;
+    if (false == cli_submit(p_conn, 0, p_postfix) ||
+        false == cli_receive(p_conn, &response))
+    {
+        return false;
+    }
+    printf("Server responded with: \n%s\n", response.text);
+    return true;
+} /* cli_send_postfix */
+
+/**
+ * @brief Empties a batch so it can be filled again.
+ * @param[in] p_batch A pointer to the batch to reset.
+ */
+void cli_batch_reset(cli_batch_t* p_batch)
+{
+    p_batch->count  = 0;
+    p_batch->length = 2;
+} /* cli_batch_reset */
+
+/**
+ * @brief Appends one postfix string to a batch.
+ * @param[in] p_batch A pointer to a reset batch.
+ * @param[in] p_postfix A pointer to a valid postfix notation string.
+ * @return true if the string was added
+ *         false if the batch is full; submit it and reset it first.
+ */
+bool cli_batch_add(cli_batch_t* p_batch, const char* p_postfix)
+{
+    size_t length = strnlen(p_postfix, MAX_POSTFIX_SIZE);
+    if (PROTO_MAX_BATCH == p_batch->count ||
+        PROTO_MAX_PAYLOAD - p_batch->length < 2 + length)
+    {
+        return false;
+    }
+
+    proto_put_u16(p_batch->payload + p_batch->length, (uint16_t)length);
+    memcpy(p_batch->payload + p_batch->length + 2, p_postfix, length);
+    p_batch->length += 2 + length;
+    p_batch->count++;
+    proto_put_u16(p_batch->payload, (uint16_t)p_batch->count);
+    return true;
+} /* cli_batch_add */
+
+/**
+ * @brief Queues a batch request. The whole batch is answered by one
+ *        MSG_BATCH_RESULT frame.
+ * @param[in] p_conn A pointer to a connection using the framed protocol.
+ * @param[in] id The id to tag the request with.
+ * @param[in] p_batch A pointer to the batch to send.
+ * @return true if the request was queued
+ *         false if connection failed.
+ */
+bool cli_submit_batch(cli_conn_t*        p_conn,
+                      uint32_t           id,
+                      const cli_batch_t* p_batch)
+{
+    if (CLI_OUT_BUFFER_SIZE - p_conn->out_length <
+        FRAME_HEADER_SIZE + p_batch->length)
+    {
+        if (false == cli_flush(p_conn))
+        {
+            return false;
+        }
+    }
+
+    frame_header_t header = { 0 };
+    header.length = (uint32_t)p_batch->length;
+    header.id     = id;
+    header.type   = MSG_EQUATION_BATCH;
+    proto_write_header(p_conn->out_buffer + p_conn->out_length, &header);
+    memcpy(p_conn->out_buffer + p_conn->out_length + FRAME_HEADER_SIZE,
+           p_batch->payload,
+           p_batch->length);
+    p_conn->out_length += FRAME_HEADER_SIZE + p_batch->length;
+    return true;
+} /* cli_submit_batch */
+
+/**
+ * @brief Sends any queued requests and waits for the next batch response.
+ *        A batch the server rejected has a non-zero status and no items.
+ * @param[in] p_conn A pointer to a connection using the framed protocol.
+ * @param[out] p_response A pointer to store the response in.
+ * @return true if a response was received
+ *         false if the connection is closed or connection failed.
+ */
+bool cli_receive_batch(cli_conn_t*           p_conn,
+                       cli_batch_response_t* p_response)
+{
+    frame_header_t header;
+    if (false == cli_flush(p_conn) || false == receive_frame(p_conn, &header))
+    {
+        return false;
+    }
+
+    const uint8_t* p_payload = p_conn->in_buffer + FRAME_HEADER_SIZE;
+    p_response->id     = header.id;
+    p_response->status = header.status;
+    p_response->count  = 0;
+    if (MSG_BATCH_RESULT == header.type && 2 <= header.length)
+    {
+        int count = proto_get_u16(p_payload);
+        if (PROTO_MAX_BATCH >= count &&
+            2 + ((size_t)count * PROTO_BATCH_ITEM_RESULT_SIZE) <=
+                header.length)
+        {
+            p_response->count = count;
+        }
+    }
+
+    p_payload += 2;
+    for (int i = 0; i < p_response->count; i++)
+    {
+        p_response->item_status[i] = proto_get_u16(p_payload);
+        p_response->results[i]     = proto_get_f64(p_payload + 2);
+        p_payload += PROTO_BATCH_ITEM_RESULT_SIZE;
+    }
+    consume_frame(p_conn, &header);
+    return true;
+} /* cli_receive_batch */
+
+/**
+ * @brief Sends any queued requests and waits for the next column response.
+ * @param[in] p_conn A pointer to a connection using the framed protocol.
+ * @param[out] p_response A pointer to store the response in.
+ * @return true if a response was received
+ *         false if the connection is closed or connection failed.
+ */
+bool cli_receive_columns(cli_conn_t*            p_conn,
+                         cli_column_response_t* p_response)
+{
+    frame_header_t header;
+    if (false == cli_flush(p_conn) || false == receive_frame(p_conn, &header))
+    {
+        return false;
+    }
+
+    const uint8_t* p_payload = p_conn->in_buffer + FRAME_HEADER_SIZE;
+    p_response->id          = header.id;
+    p_response->status      = header.status;
+    p_response->eval_status = PROTO_EVAL_OK;
+    p_response->rows        = 0;
+    if (MSG_COLUMN_RESULT == header.type &&
+        PROTO_COLUMN_RESULT_HEADER_SIZE <= header.length)
+    {
+        uint32_t rows = proto_get_u32(p_payload + 2);
+        p_response->eval_status = proto_get_u16(p_payload);
+        if (PROTO_MAX_COLUMN_ROWS >= rows &&
+            PROTO_COLUMN_RESULT_HEADER_SIZE +
+                ((size_t)rows * PROTO_COLUMN_ITEM_RESULT_SIZE) <=
+                header.length)
+        {
+            p_response->rows = (int)rows;
+        }
+    }
+
+    p_payload += PROTO_COLUMN_RESULT_HEADER_SIZE;
+    const uint8_t* p_status = p_payload +
+                              ((size_t)p_response->rows * PROTO_BINDING_SIZE);
+    for (int i = 0; i < p_response->rows; i++)
+    {
+        p_response->results[i]    = proto_get_f64(p_payload);
+        p_response->row_status[i] = p_status[i];
+        p_payload += PROTO_BINDING_SIZE;
+    }
+    consume_frame(p_conn, &header);
+    return true;
+} /* cli_receive_columns */
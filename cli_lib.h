@@ -1,7 +1,151 @@
+#ifndef CLI_LIB_H
+#define CLI_LIB_H
+
+#include <stdatomic.h> // atomic_bool
+#include <stdbool.h>
+#include <stddef.h> // size_t
+#include <stdint.h> // uint32_t
+#include <sys/socket.h> // sockaddr, socklen_t
+#include <sys/un.h> // sockaddr_un
+
+#include "postfix_proto.h"
+#include "shm_ring.h"
+
 #define INVALID_PORT -1
 #define MAX_BUFFER_SIZE 100
+#define MAX_POSTFIX_SIZE (4 * MAX_BUFFER_SIZE)
+#define CONVERT_SUCCESS 0
+#define CONVERT_INVALID_CHARACTER -1
+#define CONVERT_MISMATCHED_PARENTHESES -2
+#define CONVERT_MISSING_OPERAND -3
+#define CONVERT_MISSING_OPERATOR -4
+#define CONVERT_INVALID_NUMBER -5
+#define CONVERT_BUFFER_TOO_SMALL -6
+#define CONVERT_TOO_DEEP -7
+#define CONVERT_EMPTY -8
+#define CONVERT_STACK_SIZE 128
+#define CLI_PROTO_TEXT 0
+#define CLI_PROTO_FRAMED 1
+#define CLI_IN_BUFFER_SIZE 4096
+#define CLI_OUT_BUFFER_SIZE (FRAME_HEADER_SIZE + PROTO_MAX_PAYLOAD)
+#define CLI_MAX_IN_FLIGHT 64
+
+/**
+ * @brief A handshaked connection to a postfix server. With the framed
+ *        protocol any number of requests may be submitted before their
+ *        responses are received, and b_bytecode sends them pre-compiled.
+ *        Frames go through p_shm instead of the socket when the server
+ *        accepted shared memory during the handshake. b_rejected is set
+ *        when a handshake fails because the server is at its connection
+ *        limit. b_shut_down is set by cli_shutdown, so a receive it cuts
+ *        short fails quietly.
+ */
+typedef struct cli_conn_t {
+    int           fd;
+    int           proto;
+    shm_region_t* p_shm;
+    bool          b_bytecode;
+    bool          b_rejected;
+    atomic_bool   b_shut_down;
+    size_t        in_length;
+    size_t        out_length;
+    uint8_t       in_buffer[CLI_IN_BUFFER_SIZE];
+    uint8_t       out_buffer[CLI_OUT_BUFFER_SIZE];
+} cli_conn_t;
+
+/**
+ * @brief One response frame. handle and variable_count are only set by a
+ *        MSG_PREPARED response.
+ */
+typedef struct cli_response_t {
+    uint32_t id;
+    uint16_t type;
+    uint16_t status;
+    uint16_t eval_status;
+    double   value;
+    uint32_t handle;
+    int      variable_count;
+    size_t   length;
+    char     text[MAX_BUFFER_SIZE + 1];
+} cli_response_t;
+
+/**
+ * @brief Equations collected for one MSG_EQUATION_BATCH request, already in
+ *        wire format.
+ */
+typedef struct cli_batch_t {
+    int     count;
+    size_t  length;
+    uint8_t payload[PROTO_MAX_PAYLOAD];
+} cli_batch_t;
+
+/**
+ * @brief The answer to one MSG_EXECUTE_COLUMNS request. A request the
+ *        server refused has no rows and eval_status says why.
+ */
+typedef struct cli_column_response_t {
+    uint32_t id;
+    uint16_t status;
+    uint16_t eval_status;
+    int      rows;
+    uint8_t  row_status[PROTO_MAX_COLUMN_ROWS];
+    double   results[PROTO_MAX_COLUMN_ROWS];
+} cli_column_response_t;
+
+typedef struct cli_batch_response_t {
+    uint32_t id;
+    uint16_t status;
+    int      count;
+    uint16_t item_status[PROTO_MAX_BATCH];
+    double   results[PROTO_MAX_BATCH];
+} cli_batch_response_t;
 
 int  convert_port_number(char* p_string);
 void purge_buffer();
 int  check_for_exit(char *str);
-bool send_postfix(char* p_postfix, int client_socket_fd);
\ No newline at end of file
+int  infix_to_postfix(const char* p_infix,
+                      char*       p_postfix,
+                      size_t      postfix_size);
+int  formula_to_postfix(const char* p_infix,
+                        char*       p_postfix,
+                        size_t      postfix_size);
+int  postfix_to_bytecode(const char* p_postfix,
+                         uint8_t*    p_bytecode,
+                         size_t      bytecode_size);
+const char* convert_strerror(int err);
+bool send_postfix(char* p_postfix, int client_socket_fd);
+int  cli_connect(const struct sockaddr* p_addr, socklen_t addr_length);
+bool cli_unix_address(const char* p_path, struct sockaddr_un* p_addr);
+int  cli_connect_unix(const char* p_path);
+bool cli_handshake(cli_conn_t* p_conn, int fd, bool b_want_framed);
+void cli_shutdown(cli_conn_t* p_conn);
+void cli_close(cli_conn_t* p_conn);
+bool cli_submit(cli_conn_t* p_conn, uint32_t id, const char* p_postfix);
+bool cli_prepare(cli_conn_t* p_conn, uint32_t id, const char* p_postfix);
+bool cli_execute(cli_conn_t*   p_conn,
+                 uint32_t      id,
+                 uint32_t      handle,
+                 const double* p_values,
+                 int           count);
+int  cli_column_rows(int column_count);
+bool cli_execute_columns(cli_conn_t*          p_conn,
+                         uint32_t             id,
+                         uint32_t             handle,
+                         const double* const* pp_columns,
+                         int                  column_count,
+                         int                  rows);
+bool cli_flush(cli_conn_t* p_conn);
+bool cli_receive(cli_conn_t* p_conn, cli_response_t* p_response);
+bool cli_wait_response(cli_conn_t* p_conn, cli_response_t* p_response);
+bool cli_send_postfix(cli_conn_t* p_conn, char* p_postfix);
+void cli_batch_reset(cli_batch_t* p_batch);
+bool cli_batch_add(cli_batch_t* p_batch, const char* p_postfix);
+bool cli_submit_batch(cli_conn_t*        p_conn,
+                      uint32_t           id,
+                      const cli_batch_t* p_batch);
+bool cli_receive_batch(cli_conn_t*           p_conn,
+                       cli_batch_response_t* p_response);
+bool cli_receive_columns(cli_conn_t*            p_conn,
+                         cli_column_response_t* p_response);
+
+#endif /* CLI_LIB_H */
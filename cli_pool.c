@@ -0,0 +1,718 @@
+/** @file cli_pool.c
+ *
+ * @brief Connection pool for applications that evaluate equations from many
+ *        threads. Submitting a request only queues and sends it; each
+ *        connection's receiver thread completes requests as their responses
+ *        arrive, through a callback or a future. A lost connection is
+ *        reopened in the background with exponential backoff and its
+ *        outstanding requests sent again, so callers only see the failure
+ *        once CLI_POOL_RETRY_LIMIT attempts in a row have failed.
+ * @par
+ * COPYRIGHT NOTICE: (c) 2018 Barr Group. All rights reserved.
+ */
+
+#define _XOPEN_SOURCE 700
+#include <errno.h> // errno, EINTR
+#include <pthread.h>
+#include <semaphore.h> // sem_init, sem_post, sem_wait
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h> // uint8_t, uint32_t, uint64_t
+#include <stdio.h> // stderr
+#include <stdlib.h> // calloc, free, malloc
+#include <string.h> // memcpy, memset, strerror, strlen
+#include <time.h> // clock_gettime
+#include <unistd.h> // close
+
+#include "cli_lib.h"
+#include "cli_pool.h"
+
+/**
+ * @brief Opens and handshakes one of the pool's connections.
+ * @return true if the connection is ready for framed requests
+ *         false if connecting failed or the server only speaks text.
+ */
+static bool open_pool_connection(cli_pool_conn_t* p_pool_conn)
+{
+    cli_pool_t* p_pool = p_pool_conn->p_pool;
+    int         fd     = cli_connect((struct sockaddr*)&(p_pool->addr),
+                                     p_pool->addr_length);
+    if (0 > fd)
+    {
+        return false;
+    }
+    if (false == cli_handshake(p_pool_conn->p_conn, fd, true))
+    {
+        if (p_pool_conn->p_conn->b_rejected)
+        {
+            atomic_fetch_add(&(p_pool->rejections), 1);
+        }
+        close(fd);
+        return false;
+    }
+    if (CLI_PROTO_FRAMED != p_pool_conn->p_conn->proto)
+    {
+        fprintf(stderr, "Server does not support framed requests.\n");
+        cli_close(p_pool_conn->p_conn);
+        return false;
+    }
+    p_pool_conn->p_conn->b_bytecode = p_pool->b_bytecode;
+
+    // Select the framed protocol now rather than with the first request, so
+    // the server does not time the connection out as an unfinished handshake.
+    //
+    if (false == cli_flush(p_pool_conn->p_conn))
+    {
+        cli_close(p_pool_conn->p_conn);
+        return false;
+    }
+    return true;
+} /* open_pool_connection */
+
+/**
+ * @brief Sends one request. If sending fails the connection is shut down,
+ *        so its receiver reconnects and sends the request again. Called
+ *        with the connection locked and connected.
+ */
+static void send_request(cli_pool_conn_t* p_pool_conn, int id)
+{
+    cli_pool_request_t* p_request = &(p_pool_conn->requests[id]);
+    const char*         p_postfix = (NULL != p_request->p_long_postfix) ?
+                                    p_request->p_long_postfix :
+                                    p_request->postfix;
+    if (false == cli_submit(p_pool_conn->p_conn, (uint32_t)id, p_postfix) ||
+        false == cli_flush(p_pool_conn->p_conn))
+    {
+        cli_shutdown(p_pool_conn->p_conn);
+    }
+} /* send_request */
+
+/**
+ * @brief Frees a request's slot and runs its callback.
+ * @return true if the request was in flight
+ *         false if no request has that id.
+ */
+static bool complete_request(cli_pool_conn_t*      p_pool_conn,
+                             uint32_t              id,
+                             int                   status,
+                             const cli_response_t* p_response)
+{
+    if (CLI_MAX_IN_FLIGHT <= id)
+    {
+        return false;
+    }
+
+    cli_pool_request_t* p_request = &(p_pool_conn->requests[id]);
+    pthread_mutex_lock(&(p_pool_conn->lock));
+    if (false == p_request->b_in_use)
+    {
+        pthread_mutex_unlock(&(p_pool_conn->lock));
+        return false;
+    }
+    cli_pool_callback_fn p_callback = p_request->p_callback;
+    void*                p_context  = p_request->p_context;
+    free(p_request->p_long_postfix);
+    p_request->p_long_postfix = NULL;
+    p_request->b_in_use       = false;
+    p_pool_conn->in_flight--;
+    pthread_mutex_unlock(&(p_pool_conn->lock));
+
+    sem_post(&(p_pool_conn->p_pool->free_slots));
+    p_callback(status, p_response, p_context);
+    return true;
+} /* complete_request */
+
+/**
+ * @brief Completes every request in flight on a connection without a
+ *        response.
+ */
+static void fail_requests(cli_pool_conn_t* p_pool_conn, int status)
+{
+    for (uint32_t id = 0; id < CLI_MAX_IN_FLIGHT; id++)
+    {
+        complete_request(p_pool_conn, id, status, NULL);
+    }
+} /* fail_requests */
+
+/**
+ * @brief Marks a connection lost and closes it. Submitters stop using it as
+ *        soon as it is marked, so it can be closed outside the lock.
+ */
+static void drop_connection(cli_pool_conn_t* p_pool_conn)
+{
+    pthread_mutex_lock(&(p_pool_conn->lock));
+    p_pool_conn->b_connected = false;
+    pthread_mutex_unlock(&(p_pool_conn->lock));
+    atomic_fetch_sub(&(p_pool_conn->p_pool->connected_count), 1);
+    cli_close(p_pool_conn->p_conn);
+} /* drop_connection */
+
+/**
+ * @brief Sleeps before the next reconnect attempt, waking early if the pool
+ *        is destroyed.
+ */
+static void wait_backoff(cli_pool_t* p_pool, int failed_attempts)
+{
+    int backoff_ms = CLI_POOL_MAX_BACKOFF_MS;
+    if (failed_attempts < 16)
+    {
+        backoff_ms = CLI_POOL_MIN_BACKOFF_MS << (failed_attempts - 1);
+        if (CLI_POOL_MAX_BACKOFF_MS < backoff_ms)
+        {
+            backoff_ms = CLI_POOL_MAX_BACKOFF_MS;
+        }
+    }
+
+    struct timespec until;
+    clock_gettime(CLOCK_MONOTONIC, &until);
+    uint64_t nsec = (uint64_t)until.tv_nsec +
+                    ((uint64_t)backoff_ms * 1000000ull);
+    until.tv_sec  += nsec / 1000000000ull;
+    until.tv_nsec  = nsec % 1000000000ull;
+
+    pthread_mutex_lock(&(p_pool->stop_lock));
+    if (atomic_load(&(p_pool->b_running)))
+    {
+        pthread_cond_timedwait(&(p_pool->stop_wake),
+                               &(p_pool->stop_lock),
+                               &until);
+    }
+    pthread_mutex_unlock(&(p_pool->stop_lock));
+} /* wait_backoff */
+
+/**
+ * @brief Makes one attempt to reopen a lost connection and send its
+ *        outstanding requests again. Once CLI_POOL_RETRY_LIMIT attempts in
+ *        a row have failed, the requests waiting on it are failed too;
+ *        attempts carry on at the longest backoff for later requests.
+ */
+static void reconnect(cli_pool_conn_t* p_pool_conn)
+{
+    cli_pool_t* p_pool = p_pool_conn->p_pool;
+    if (0 < p_pool_conn->failed_attempts)
+    {
+        wait_backoff(p_pool, p_pool_conn->failed_attempts);
+    }
+    if (false == atomic_load(&(p_pool->b_running)))
+    {
+        return;
+    }
+
+    if (false == open_pool_connection(p_pool_conn))
+    {
+        p_pool_conn->failed_attempts++;
+        if (CLI_POOL_RETRY_LIMIT <= p_pool_conn->failed_attempts)
+        {
+            fail_requests(p_pool_conn, CLI_POOL_DISCONNECTED);
+        }
+        return;
+    }
+
+    // Checked under the lock, so cli_pool_destroy either sees the
+    // connection and shuts it down, or this sees the pool stopping.
+    //
+    pthread_mutex_lock(&(p_pool_conn->lock));
+    if (false == atomic_load(&(p_pool->b_running)))
+    {
+        pthread_mutex_unlock(&(p_pool_conn->lock));
+        cli_close(p_pool_conn->p_conn);
+        return;
+    }
+    p_pool_conn->failed_attempts = 0;
+    p_pool_conn->b_connected     = true;
+    atomic_fetch_add(&(p_pool->connected_count), 1);
+    for (int id = 0; id < CLI_MAX_IN_FLIGHT; id++)
+    {
+        if (p_pool_conn->requests[id].b_in_use)
+        {
+            send_request(p_pool_conn, id);
+        }
+    }
+    pthread_mutex_unlock(&(p_pool_conn->lock));
+} /* reconnect */
+
+/**
+ * @brief Receiver thread body. Completes requests as their responses arrive
+ *        and reconnects whenever the connection is lost, until the pool is
+ *        destroyed.
+ * @param[in] args A pointer to the cli_pool_conn_t to receive on.
+ * @return NULL on thread exit
+ */
+static void* receiver_handler(void* args)
+{
+    cli_pool_conn_t* p_pool_conn = (cli_pool_conn_t*)args;
+    cli_pool_t*      p_pool      = p_pool_conn->p_pool;
+    cli_response_t   response;
+
+    // Only this thread changes b_connected, so it reads it without the lock.
+    //
+    while (atomic_load(&(p_pool->b_running)))
+    {
+        if (false == p_pool_conn->b_connected)
+        {
+            reconnect(p_pool_conn);
+            continue;
+        }
+        if (cli_wait_response(p_pool_conn->p_conn, &response) &&
+            complete_request(p_pool_conn,
+                             response.id,
+                             CLI_POOL_OK,
+                             &response))
+        {
+            continue;
+        }
+        drop_connection(p_pool_conn);
+    }
+
+    if (p_pool_conn->b_connected)
+    {
+        drop_connection(p_pool_conn);
+    }
+    fail_requests(p_pool_conn, CLI_POOL_CLOSED);
+    return NULL;
+} /* receiver_handler */
+
+/**
+ * @brief Stops the first count receivers and closes their connections.
+ */
+static void stop_receivers(cli_pool_t* p_pool, int count)
+{
+    atomic_store(&(p_pool->b_running), false);
+    pthread_mutex_lock(&(p_pool->stop_lock));
+    pthread_cond_broadcast(&(p_pool->stop_wake));
+    pthread_mutex_unlock(&(p_pool->stop_lock));
+
+    for (int i = 0; i < count; i++)
+    {
+        cli_pool_conn_t* p_pool_conn = &(p_pool->p_connections[i]);
+        pthread_mutex_lock(&(p_pool_conn->lock));
+        if (p_pool_conn->b_connected)
+        {
+            cli_shutdown(p_pool_conn->p_conn);
+        }
+        pthread_mutex_unlock(&(p_pool_conn->lock));
+    }
+    for (int i = 0; i < count; i++)
+    {
+        int err = pthread_join(p_pool->p_connections[i].receiver_id, NULL);
+        if (0 != err)
+        {
+            fprintf(stderr, "Error joining thread. [%s]\n", strerror(err));
+        }
+    }
+} /* stop_receivers */
+
+/**
+ * @brief Frees the pool's connections and synchronization objects.
+ */
+static void free_pool(cli_pool_t* p_pool)
+{
+    for (int i = 0; i < p_pool->connection_count; i++)
+    {
+        pthread_mutex_destroy(&(p_pool->p_connections[i].lock));
+        free(p_pool->p_connections[i].p_conn);
+    }
+    free(p_pool->p_connections);
+    p_pool->p_connections = NULL;
+    sem_destroy(&(p_pool->free_slots));
+    pthread_cond_destroy(&(p_pool->stop_wake));
+    pthread_mutex_destroy(&(p_pool->stop_lock));
+} /* free_pool */
+
+/**
+ * @brief Opens a pool of connections to a server and starts their
+ *        receivers.
+ * @param[out] p_pool A pointer to the pool to initialize.
+ * @param[in] p_addr A pointer to the server's address, TCP or unix domain.
+ *                   Unix domain connections use shared memory when the
+ *                   server offers it.
+ * @param[in] addr_length The size of the address.
+ * @param[in] connection_count The number of connections to keep open, from
+ *                             1 to CLI_POOL_MAX_CONNECTIONS.
+ * @param[in] b_bytecode True to send equations pre-compiled.
+ * @return CLI_POOL_INIT_SUCCESS if every connection is open.
+ *         CLI_POOL_INIT_FAILURE if any could not be opened; nothing is left
+ *         open, but rejections counts any the server turned away.
+ */
+int cli_pool_init(cli_pool_t*            p_pool,
+                  const struct sockaddr* p_addr,
+                  socklen_t              addr_length,
+                  int                    connection_count,
+                  bool                   b_bytecode)
+{
+    if (1 > connection_count ||
+        CLI_POOL_MAX_CONNECTIONS < connection_count ||
+        sizeof(p_pool->addr) < addr_length)
+    {
+        fprintf(stderr, "Invalid connection pool settings.\n");
+        return CLI_POOL_INIT_FAILURE;
+    }
+
+    memset(p_pool, 0, sizeof(*p_pool));
+    memcpy(&(p_pool->addr), p_addr, addr_length);
+    p_pool->addr_length      = addr_length;
+    p_pool->b_bytecode       = b_bytecode;
+    p_pool->connection_count = connection_count;
+    atomic_init(&(p_pool->b_running), true);
+    atomic_init(&(p_pool->next_connection), 0);
+    atomic_init(&(p_pool->connected_count), connection_count);
+    atomic_init(&(p_pool->rejections), 0);
+    p_pool->p_connections = calloc(connection_count, sizeof(cli_pool_conn_t));
+    if (NULL == p_pool->p_connections)
+    {
+        fprintf(stderr,
+                "Unable to allocate connection pool. [%s]\n",
+                strerror(errno));
+        return CLI_POOL_INIT_FAILURE;
+    }
+
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&(p_pool->stop_wake), &attributes);
+    pthread_condattr_destroy(&attributes);
+    pthread_mutex_init(&(p_pool->stop_lock), NULL);
+    sem_init(&(p_pool->free_slots),
+             0,
+             (unsigned)(connection_count * CLI_MAX_IN_FLIGHT));
+
+    int opened = 0;
+    for (; opened < connection_count; opened++)
+    {
+        cli_pool_conn_t* p_pool_conn = &(p_pool->p_connections[opened]);
+        p_pool_conn->p_pool = p_pool;
+        pthread_mutex_init(&(p_pool_conn->lock), NULL);
+        p_pool_conn->p_conn = malloc(sizeof(cli_conn_t));
+        if (NULL == p_pool_conn->p_conn)
+        {
+            fprintf(stderr,
+                    "Error allocating connection state. [%s]\n",
+                    strerror(errno));
+            break;
+        }
+        if (false == open_pool_connection(p_pool_conn))
+        {
+            break;
+        }
+        p_pool_conn->b_connected = true;
+    }
+    if (opened < connection_count)
+    {
+        for (int i = 0; i < opened; i++)
+        {
+            cli_close(p_pool->p_connections[i].p_conn);
+        }
+        free_pool(p_pool);
+        return CLI_POOL_INIT_FAILURE;
+    }
+
+    for (int i = 0; i < connection_count; i++)
+    {
+        int err = pthread_create(&(p_pool->p_connections[i].receiver_id),
+                                 NULL,
+                                 &receiver_handler,
+                                 &(p_pool->p_connections[i]));
+        if (0 != err)
+        {
+            fprintf(stderr,
+                    "Thread unable to be created. [%s]\n",
+                    strerror(err));
+            stop_receivers(p_pool, i);
+            for (; i < connection_count; i++)
+            {
+                cli_close(p_pool->p_connections[i].p_conn);
+            }
+            free_pool(p_pool);
+            return CLI_POOL_INIT_FAILURE;
+        }
+    }
+    return CLI_POOL_INIT_SUCCESS;
+} /* cli_pool_init */
+
+/**
+ * @brief Closes every connection. Requests still in flight complete with
+ *        CLI_POOL_CLOSED. No thread may be submitting to the pool.
+ * @param[in] p_pool A pointer to an initialized pool.
+ */
+void cli_pool_destroy(cli_pool_t* p_pool)
+{
+    if (NULL == p_pool->p_connections)
+    {
+        return;
+    }
+    stop_receivers(p_pool, p_pool->connection_count);
+    free_pool(p_pool);
+} /* cli_pool_destroy */
+
+/**
+ * @brief Picks a connection with room for another request, preferring one
+ *        that is connected. Only one connection is locked at a time, so
+ *        submitters never wait on each other in a cycle.
+ * @return A pointer to the chosen connection, locked.
+ */
+static cli_pool_conn_t* claim_connection(cli_pool_t* p_pool)
+{
+    while (true)
+    {
+        unsigned start    = atomic_fetch_add(&(p_pool->next_connection), 1);
+        int      fallback = -1;
+        for (int i = 0; i < p_pool->connection_count; i++)
+        {
+            int              index       = (int)((start + (unsigned)i) %
+                                                 p_pool->connection_count);
+            cli_pool_conn_t* p_pool_conn = &(p_pool->p_connections[index]);
+            pthread_mutex_lock(&(p_pool_conn->lock));
+            if (CLI_MAX_IN_FLIGHT > p_pool_conn->in_flight)
+            {
+                if (p_pool_conn->b_connected)
+                {
+                    return p_pool_conn;
+                }
+                if (0 > fallback)
+                {
+                    fallback = index;
+                }
+            }
+            pthread_mutex_unlock(&(p_pool_conn->lock));
+        }
+
+        // Every connection with room is reconnecting; queue on one of them
+        // and the request is sent once it is back.
+        //
+        if (0 <= fallback)
+        {
+            cli_pool_conn_t* p_pool_conn = &(p_pool->p_connections[fallback]);
+            pthread_mutex_lock(&(p_pool_conn->lock));
+            if (CLI_MAX_IN_FLIGHT > p_pool_conn->in_flight)
+            {
+                return p_pool_conn;
+            }
+            pthread_mutex_unlock(&(p_pool_conn->lock));
+        }
+    }
+} /* claim_connection */
+
+/**
+ * @brief Queues a request on a connection with room for it and sends it.
+ * @param[in] b_wait True to wait for room if every connection is full,
+ *                   false to give up instead.
+ * @return true if the request was submitted and the callback will run
+ *         false otherwise.
+ */
+static bool submit_request(cli_pool_t*          p_pool,
+                           const char*          p_postfix,
+                           cli_pool_callback_fn p_callback,
+                           void*                p_context,
+                           bool                 b_wait)
+{
+    if (NULL == p_postfix || NULL == p_callback ||
+        false == atomic_load(&(p_pool->b_running)))
+    {
+        return false;
+    }
+
+    // Reject an equation that does not encode now, rather than failing the
+    // connection it is sent on.
+    //
+    size_t length = strlen(p_postfix);
+    if (p_pool->b_bytecode && MAX_BUFFER_SIZE >= length)
+    {
+        uint8_t bytecode[PROTO_MAX_BYTECODE_SIZE];
+        int     encoded = postfix_to_bytecode(p_postfix,
+                                              bytecode,
+                                              sizeof(bytecode));
+        if (0 > encoded)
+        {
+            fprintf(stderr,
+                    "Unable to encode postfix string. [%s]\n",
+                    convert_strerror(encoded));
+            return false;
+        }
+    }
+
+    char* p_long_postfix = NULL;
+    if (MAX_POSTFIX_SIZE <= length)
+    {
+        p_long_postfix = malloc(length + 1);
+        if (NULL == p_long_postfix)
+        {
+            fprintf(stderr,
+                    "Unable to copy postfix string. [%s]\n",
+                    strerror(errno));
+            return false;
+        }
+        memcpy(p_long_postfix, p_postfix, length + 1);
+    }
+
+    while (0 != (b_wait ? sem_wait(&(p_pool->free_slots)) :
+                          sem_trywait(&(p_pool->free_slots))))
+    {
+        if (EINTR != errno)
+        {
+            free(p_long_postfix);
+            return false;
+        }
+    }
+
+    cli_pool_conn_t* p_pool_conn = claim_connection(p_pool);
+    int              id          = 0;
+    while (p_pool_conn->requests[id].b_in_use)
+    {
+        id++;
+    }
+    cli_pool_request_t* p_request = &(p_pool_conn->requests[id]);
+    p_request->b_in_use       = true;
+    p_request->p_callback     = p_callback;
+    p_request->p_context      = p_context;
+    p_request->p_long_postfix = p_long_postfix;
+    if (NULL == p_long_postfix)
+    {
+        memcpy(p_request->postfix, p_postfix, length + 1);
+    }
+    p_pool_conn->in_flight++;
+    if (p_pool_conn->b_connected)
+    {
+        send_request(p_pool_conn, id);
+    }
+    pthread_mutex_unlock(&(p_pool_conn->lock));
+    return true;
+} /* submit_request */
+
+/**
+ * @brief Sends a request without waiting for its response. Waits only if
+ *        every connection already has CLI_MAX_IN_FLIGHT requests in flight.
+ * @param[in] p_pool A pointer to an initialized pool.
+ * @param[in] p_postfix A pointer to a valid postfix notation string of any
+ *                      length. It is copied.
+ * @param[in] p_callback Called once with the outcome of the request.
+ * @param[in] p_context Passed to the callback.
+ * @return true if the request was submitted and the callback will run
+ *         false if the pool is closed or the equation does not encode.
+ */
+bool cli_pool_submit(cli_pool_t*          p_pool,
+                     const char*          p_postfix,
+                     cli_pool_callback_fn p_callback,
+                     void*                p_context)
+{
+    return submit_request(p_pool, p_postfix, p_callback, p_context, true);
+} /* cli_pool_submit */
+
+/**
+ * @brief Sends a request like cli_pool_submit, but never waits, so it may be
+ *        called from another pool's callback.
+ * @return true if the request was submitted and the callback will run
+ *         false if every connection is full, the pool is closed or the
+ *         equation does not encode.
+ */
+bool cli_pool_try_submit(cli_pool_t*          p_pool,
+                         const char*          p_postfix,
+                         cli_pool_callback_fn p_callback,
+                         void*                p_context)
+{
+    return submit_request(p_pool, p_postfix, p_callback, p_context, false);
+} /* cli_pool_try_submit */
+
+/**
+ * @brief Records a request's outcome in its future and wakes the waiter.
+ *        Any submit function can take it as the callback, with the future as
+ *        the context.
+ */
+void cli_future_complete(int                   status,
+                         const cli_response_t* p_response,
+                         void*                 p_context)
+{
+    cli_future_t* p_future = (cli_future_t*)p_context;
+    pthread_mutex_lock(&(p_future->lock));
+    p_future->status = status;
+    if (NULL != p_response)
+    {
+        p_future->response = *p_response;
+    }
+    p_future->b_done = true;
+    pthread_cond_signal(&(p_future->done));
+    pthread_mutex_unlock(&(p_future->lock));
+} /* cli_future_complete */
+
+/**
+ * @brief Prepares a future for one request.
+ * @param[out] p_future A pointer to the future to initialize.
+ */
+void cli_future_init(cli_future_t* p_future)
+{
+    pthread_mutex_init(&(p_future->lock), NULL);
+    pthread_cond_init(&(p_future->done), NULL);
+    p_future->b_done = false;
+    p_future->status = CLI_POOL_OK;
+} /* cli_future_init */
+
+/**
+ * @brief Sends a request whose outcome is collected with cli_future_wait.
+ * @param[in] p_pool A pointer to an initialized pool.
+ * @param[in] p_postfix A pointer to a valid postfix notation string.
+ * @param[in] p_future A pointer to a future initialized for this request.
+ * @return true if the request was submitted
+ *         false if the pool is closed or the equation does not encode.
+ */
+bool cli_pool_submit_future(cli_pool_t*   p_pool,
+                            const char*   p_postfix,
+                            cli_future_t* p_future)
+{
+    return cli_pool_submit(p_pool,
+                           p_postfix,
+                           &cli_future_complete,
+                           p_future);
+} /* cli_pool_submit_future */
+
+/**
+ * @brief Waits for a submitted request to complete.
+ * @param[in] p_future A pointer to a submitted future.
+ * @param[out] p_response Set to the server's response if the status is
+ *                        CLI_POOL_OK. May be NULL.
+ * @return CLI_POOL_OK, CLI_POOL_DISCONNECTED or CLI_POOL_CLOSED.
+ */
+int cli_future_wait(cli_future_t* p_future, cli_response_t* p_response)
+{
+    pthread_mutex_lock(&(p_future->lock));
+    while (false == p_future->b_done)
+    {
+        pthread_cond_wait(&(p_future->done), &(p_future->lock));
+    }
+    pthread_mutex_unlock(&(p_future->lock));
+    if (CLI_POOL_OK == p_future->status && NULL != p_response)
+    {
+        *p_response = p_future->response;
+    }
+    return p_future->status;
+} /* cli_future_wait */
+
+void cli_future_destroy(cli_future_t* p_future)
+{
+    pthread_cond_destroy(&(p_future->done));
+    pthread_mutex_destroy(&(p_future->lock));
+} /* cli_future_destroy */
+
+/**
+ * @brief Evaluates one equation and waits for the answer, for callers that
+ *        have nothing else to do meanwhile. Other threads' requests share
+ *        the same connections.
+ * @param[in] p_pool A pointer to an initialized pool.
+ * @param[in] p_postfix A pointer to a valid postfix notation string.
+ * @param[out] p_response Set to the server's response if the status is
+ *                        CLI_POOL_OK.
+ * @return CLI_POOL_OK, CLI_POOL_DISCONNECTED or CLI_POOL_CLOSED.
+ *         CLI_POOL_REJECTED if the request could not be submitted.
+ */
+int cli_pool_evaluate(cli_pool_t*     p_pool,
+                      const char*     p_postfix,
+                      cli_response_t* p_response)
+{
+    cli_future_t future;
+    cli_future_init(&future);
+    int status = CLI_POOL_REJECTED;
+    if (cli_pool_submit_future(p_pool, p_postfix, &future))
+    {
+        status = cli_future_wait(&future, p_response);
+    }
+    cli_future_destroy(&future);
+    return status;
+} /* cli_pool_evaluate */
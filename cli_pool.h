@@ -0,0 +1,126 @@
+#ifndef CLI_POOL_H
+#define CLI_POOL_H
+
+#include <pthread.h> // pthread_mutex_t, pthread_cond_t
+#include <semaphore.h> // sem_t
+#include <stdatomic.h> // atomic_bool, atomic_uint
+#include <stdbool.h>
+#include <sys/socket.h> // sockaddr, sockaddr_storage, socklen_t
+
+#include "cli_lib.h"
+
+#define CLI_POOL_INIT_SUCCESS 0
+#define CLI_POOL_INIT_FAILURE -1
+#define CLI_POOL_OK 0
+#define CLI_POOL_DISCONNECTED -1
+#define CLI_POOL_CLOSED -2
+#define CLI_POOL_REJECTED -3
+#define CLI_POOL_MAX_CONNECTIONS 64
+#define CLI_POOL_RETRY_LIMIT 8
+#define CLI_POOL_MIN_BACKOFF_MS 10
+#define CLI_POOL_MAX_BACKOFF_MS 1000
+
+/**
+ * @brief Called once per submitted request, on the thread receiving its
+ *        connection's responses, so it must not block. status is
+ *        CLI_POOL_OK with the server's response, or CLI_POOL_DISCONNECTED
+ *        or CLI_POOL_CLOSED with no response.
+ */
+typedef void (*cli_pool_callback_fn)(int                   status,
+                                     const cli_response_t* p_response,
+                                     void*                 p_context);
+
+/**
+ * @brief A request in flight on one connection, kept until its response
+ *        arrives so it can be sent again after a reconnect. Its index in the
+ *        connection's table is its request id.
+ */
+typedef struct cli_pool_request_t {
+    bool                 b_in_use;
+    cli_pool_callback_fn p_callback;
+    void*                p_context;
+    char*                p_long_postfix;
+    char                 postfix[MAX_POSTFIX_SIZE];
+} cli_pool_request_t;
+
+/**
+ * @brief One of the pool's connections. Submitters queue and send requests
+ *        under lock; a receiver thread owns the connection's input, runs
+ *        the callbacks, and reconnects when the connection is lost.
+ */
+typedef struct cli_pool_conn_t {
+    struct cli_pool_t* p_pool;
+    pthread_mutex_t    lock;
+    pthread_t          receiver_id;
+    bool               b_connected;
+    int                in_flight;
+    int                failed_attempts;
+    cli_conn_t*        p_conn;
+    cli_pool_request_t requests[CLI_MAX_IN_FLIGHT];
+} cli_pool_conn_t;
+
+/**
+ * @brief A set of warm, handshaked framed connections to one server that
+ *        any number of threads share. Requests are spread over the
+ *        connections, up to CLI_MAX_IN_FLIGHT on each; free_slots counts
+ *        the room left, so a submitter only waits when every connection is
+ *        full. Equations are pure, so requests lost with a connection are
+ *        sent again once it is back. connected_count and rejections let a
+ *        caller judge the server's health: how many connections are up, and
+ *        how many reconnects the server has turned away at its connection
+ *        limit.
+ */
+typedef struct cli_pool_t {
+    struct sockaddr_storage addr;
+    socklen_t               addr_length;
+    bool                    b_bytecode;
+    atomic_bool             b_running;
+    int                     connection_count;
+    atomic_uint             next_connection;
+    atomic_int              connected_count;
+    atomic_uint             rejections;
+    sem_t                   free_slots;
+    pthread_mutex_t         stop_lock;
+    pthread_cond_t          stop_wake;
+    cli_pool_conn_t*        p_connections;
+} cli_pool_t;
+
+/**
+ * @brief Completion of one request that a thread can wait on.
+ */
+typedef struct cli_future_t {
+    pthread_mutex_t lock;
+    pthread_cond_t  done;
+    bool            b_done;
+    int             status;
+    cli_response_t  response;
+} cli_future_t;
+
+int  cli_pool_init(cli_pool_t*            p_pool,
+                   const struct sockaddr* p_addr,
+                   socklen_t              addr_length,
+                   int                    connection_count,
+                   bool                   b_bytecode);
+void cli_pool_destroy(cli_pool_t* p_pool);
+bool cli_pool_submit(cli_pool_t*          p_pool,
+                     const char*          p_postfix,
+                     cli_pool_callback_fn p_callback,
+                     void*                p_context);
+bool cli_pool_try_submit(cli_pool_t*          p_pool,
+                         const char*          p_postfix,
+                         cli_pool_callback_fn p_callback,
+                         void*                p_context);
+bool cli_pool_submit_future(cli_pool_t*   p_pool,
+                            const char*   p_postfix,
+                            cli_future_t* p_future);
+int  cli_pool_evaluate(cli_pool_t*     p_pool,
+                       const char*     p_postfix,
+                       cli_response_t* p_response);
+void cli_future_init(cli_future_t* p_future);
+void cli_future_complete(int                   status,
+                         const cli_response_t* p_response,
+                         void*                 p_context);
+int  cli_future_wait(cli_future_t* p_future, cli_response_t* p_response);
+void cli_future_destroy(cli_future_t* p_future);
+
+#endif /* CLI_POOL_H */
@@ -6,7 +6,29 @@
  *        from the server.
  *        -i [IPv4 address]
  *        -p [PORT]
+ *        -u [PATH] (instead of -i and -p) Connect to the server's unix domain
+ *           socket. Framed connections then use shared memory if the server
+ *           offers it.
+ *        -s [SERVERS] (instead of -i, -p and -u) A comma separated list of
+ *           IPV4:PORT and unix socket paths. Requests given with -e or -f
+ *           are spread over the servers, favouring the least loaded, and
+ *           servers at their connection limit are avoided.
  *        -e ["INFIX notation string"] (optional)
+ *        -x [FILE] (optional, with -e) Prepare the -e formula once, naming
+ *           variables with letters, digits and underscores, then execute it
+ *           for each line of FILE: the values of its variables, comma
+ *           separated, in order of first appearance.
+ *        -C (optional, with -x) Send the values of -x as columns, many
+ *           rows per request, for the server to evaluate in vector
+ *           registers. Lines with the wrong number of values are skipped.
+ *        -f [FILE] (optional) One infix string per line, all pipelined.
+ *        Equations given with -e or -f may be of any length; the server
+ *          evaluates long ones as they arrive.
+ *        -B (optional) Send the lines of -f in batches of up to
+ *           PROTO_MAX_BATCH equations per request.
+ *        -b (optional) Send equations as pre-compiled bytecode.
+ *        -t (optional) Use the text protocol even if the server supports
+ *           framing.
  *        If -e is used, the program will run once with the given string.
  *          Otherwise, it will keep running, asking for an infix string.
  *        until [exit] is typed
@@ -14,22 +36,723 @@
  * COPYRIGHT NOTICE: (c) 2018 Barr Group. All rights reserved.
  */
 
+#define _XOPEN_SOURCE 700 // getline
 #include <arpa/inet.h> // inet_pton
+#include <ctype.h> // isspace
 #include <errno.h> // errno
 #include <fcntl.h> // F_SETFL, O_NONBLOCK
 #include <getopt.h> // getopt
 #include <netinet/in.h> // sockaddr_in, INADDR_ANY
 #include <sys/select.h>
 #include <stdbool.h>
+#include <stdint.h> // uint32_t
 #include <stdio.h> // stdin, EOF
-#include <stdlib.h> // EXIT_FAILURE
+#include <stdlib.h> // EXIT_FAILURE, free, realloc, strtod
 #include <string.h> // strlen
 #include <strings.h> // strerror
 #include <sys/socket.h> // connect
 #include <sys/time.h> // timevalue
 #include <unistd.h> // close
 
+#include "cli_cluster.h"
 #include "cli_lib.h"
+#include "dtoa.h"
+
+#define CLIENT_CLUSTER_CONNECTIONS 2
+#define CLIENT_COLUMN_WINDOW 8
+
+/**
+ * @brief Growable buffers for reading infix lines of any length from a file
+ *        and converting them to postfix.
+ */
+typedef struct line_reader_t {
+    FILE*    p_file;
+    uint32_t line_number;
+    char*    p_line;
+    size_t   line_size;
+    char*    p_postfix;
+    size_t   postfix_size;
+} line_reader_t;
+
+/**
+ * @brief Converts an infix string of any length to postfix, growing the
+ *        postfix buffer to fit it first.
+ * @param[in] p_infix A pointer to the infix string.
+ * @param[in,out] pp_postfix A pointer to the heap allocated postfix buffer.
+ * @param[in,out] p_postfix_size A pointer to the size of the buffer.
+ * @return CONVERT_SUCCESS or the infix_to_postfix error.
+ */
+static int convert_infix(const char* p_infix,
+                         char**      pp_postfix,
+                         size_t*     p_postfix_size)
+{
+    // Every infix character becomes at most a few postfix characters, which
+    // is the ratio MAX_POSTFIX_SIZE allows for MAX_BUFFER_SIZE.
+    //
+    size_t needed = (MAX_POSTFIX_SIZE / MAX_BUFFER_SIZE) *
+                    (strlen(p_infix) + 1);
+    if (MAX_POSTFIX_SIZE > needed)
+    {
+        needed = MAX_POSTFIX_SIZE;
+    }
+    if (*p_postfix_size < needed)
+    {
+        char* p_postfix = realloc(*pp_postfix, needed);
+        if (NULL == p_postfix)
+        {
+            return CONVERT_BUFFER_TOO_SMALL;
+        }
+        *pp_postfix     = p_postfix;
+        *p_postfix_size = needed;
+    }
+    return infix_to_postfix(p_infix, *pp_postfix, *p_postfix_size);
+} /* convert_infix */
+
+/**
+ * @brief Reads lines from a file until one converts to postfix, reporting
+ *        any lines that are skipped.
+ * @param[in,out] p_reader A pointer to the reader of an open file of infix
+ *                         strings. The converted line is left in its
+ *                         p_postfix, tagged with its line_number.
+ * @return true if a line was converted
+ *         false at the end of the file.
+ */
+static bool read_postfix_line(line_reader_t* p_reader)
+{
+    while (0 <= getline(&(p_reader->p_line),
+                        &(p_reader->line_size),
+                        p_reader->p_file))
+    {
+        p_reader->line_number++;
+        int err = convert_infix(p_reader->p_line,
+                                &(p_reader->p_postfix),
+                                &(p_reader->postfix_size));
+        if (CONVERT_SUCCESS != err)
+        {
+            fprintf(stderr,
+                    "Line [%u] could not be converted. [%s]\n",
+                    p_reader->line_number,
+                    convert_strerror(err));
+            continue;
+        }
+        return true;
+    }
+    return false;
+} /* read_postfix_line */
+
+/**
+ * @brief Converts every line of a file and sends them all to the server,
+ *        keeping up to CLI_MAX_IN_FLIGHT requests in flight when the framed
+ *        protocol is in use. Each request is tagged with its line number.
+ * @param[in] p_conn A pointer to a handshaked connection.
+ * @param[in] p_reader A pointer to a reader of an open file of infix
+ *                     strings.
+ * @return true if every request was answered
+ *         false if the connection failed.
+ */
+static bool run_equation_file(cli_conn_t* p_conn, line_reader_t* p_reader)
+{
+    cli_response_t response;
+    int            in_flight = 0;
+
+    while (read_postfix_line(p_reader))
+    {
+        if (CLI_PROTO_TEXT == p_conn->proto)
+        {
+            if (false == send_postfix(p_reader->p_postfix, p_conn->fd))
+            {
+                return false;
+            }
+            continue;
+        }
+
+        if (false == cli_submit(p_conn,
+                                p_reader->line_number,
+                                p_reader->p_postfix))
+        {
+            return false;
+        }
+        in_flight++;
+        if (CLI_MAX_IN_FLIGHT == in_flight)
+        {
+            if (false == cli_receive(p_conn, &response))
+            {
+                return false;
+            }
+            printf("[%u] %s\n", response.id, response.text);
+            in_flight--;
+        }
+    }
+
+    for (; 0 < in_flight; in_flight--)
+    {
+        if (false == cli_receive(p_conn, &response))
+        {
+            return false;
+        }
+        printf("[%u] %s\n", response.id, response.text);
+    }
+    return true;
+} /* run_equation_file */
+
+/**
+ * @brief Sends a batch and prints the result of each of its equations next
+ *        to the line it came from.
+ * @param[in] p_conn A pointer to a connection using the framed protocol.
+ * @param[in] p_batch A pointer to the batch to send.
+ * @param[in] p_line_numbers A pointer to the line number of each equation.
+ * @param[out] p_response A pointer to scratch space for the response.
+ * @return true if the batch was answered
+ *         false if the connection failed.
+ */
+static bool send_batch(cli_conn_t*           p_conn,
+                       const cli_batch_t*    p_batch,
+                       const uint32_t*       p_line_numbers,
+                       cli_batch_response_t* p_response)
+{
+    if (false == cli_submit_batch(p_conn, p_line_numbers[0], p_batch) ||
+        false == cli_receive_batch(p_conn, p_response))
+    {
+        return false;
+    }
+    if (PROTO_STATUS_OK != p_response->status ||
+        p_batch->count != p_response->count)
+    {
+        fprintf(stderr,
+                "Server rejected the batch starting at line [%u].\n",
+                p_line_numbers[0]);
+        return true;
+    }
+
+    for (int i = 0; i < p_response->count; i++)
+    {
+        if (PROTO_EVAL_OK == p_response->item_status[i])
+        {
+            char answer[DTOA_BUFFER_SIZE];
+            dtoa_shortest(p_response->results[i], answer);
+            printf("[%u] %s\n", p_line_numbers[i], answer);
+        }
+        else
+        {
+            printf("[%u] Error: %s\n",
+                   p_line_numbers[i],
+                   proto_eval_strerror(p_response->item_status[i]));
+        }
+    }
+    return true;
+} /* send_batch */
+
+/**
+ * @brief Converts every line of a file and sends them to the server in
+ *        batches of up to PROTO_MAX_BATCH equations. Lines too long to batch
+ *        are sent on their own.
+ * @param[in] p_conn A pointer to a connection using the framed protocol.
+ * @param[in] p_reader A pointer to a reader of an open file of infix
+ *                     strings.
+ * @return true if every batch was answered
+ *         false if the connection failed.
+ */
+static bool run_equation_batches(cli_conn_t* p_conn, line_reader_t* p_reader)
+{
+    static cli_batch_t          batch;
+    static cli_batch_response_t response;
+    uint32_t                    line_numbers[PROTO_MAX_BATCH];
+    cli_response_t              long_response;
+
+    cli_batch_reset(&batch);
+    while (read_postfix_line(p_reader))
+    {
+        if (MAX_BUFFER_SIZE < strlen(p_reader->p_postfix))
+        {
+            if (false == cli_submit(p_conn,
+                                    p_reader->line_number,
+                                    p_reader->p_postfix) ||
+                false == cli_receive(p_conn, &long_response))
+            {
+                return false;
+            }
+            printf("[%u] %s\n", long_response.id, long_response.text);
+            continue;
+        }
+        if (false == cli_batch_add(&batch, p_reader->p_postfix))
+        {
+            if (false == send_batch(p_conn, &batch, line_numbers, &response))
+            {
+                return false;
+            }
+            cli_batch_reset(&batch);
+            cli_batch_add(&batch, p_reader->p_postfix);
+        }
+        line_numbers[batch.count - 1] = p_reader->line_number;
+    }
+
+    if (0 < batch.count)
+    {
+        return send_batch(p_conn, &batch, line_numbers, &response);
+    }
+    return true;
+} /* run_equation_batches */
+
+/**
+ * @brief Parses one line of comma separated values.
+ * @param[in] p_line A pointer to the null terminated line.
+ * @param[out] p_values A pointer to PROTO_MAX_VARIABLES values.
+ * @return The number of values, or -1 if the line is malformed.
+ */
+static int parse_values(const char* p_line, double* p_values)
+{
+    const char* p_cursor = p_line;
+    int         count    = 0;
+    while (isspace((unsigned char)*p_cursor))
+    {
+        p_cursor++;
+    }
+    if ('\0' == *p_cursor)
+    {
+        return 0;
+    }
+    while (true)
+    {
+        char* p_end = NULL;
+        if (PROTO_MAX_VARIABLES == count)
+        {
+            return -1;
+        }
+        p_values[count] = strtod(p_cursor, &p_end);
+        if (p_end == p_cursor)
+        {
+            return -1;
+        }
+        count++;
+        p_cursor = p_end;
+        while (isspace((unsigned char)*p_cursor))
+        {
+            p_cursor++;
+        }
+        if ('\0' == *p_cursor)
+        {
+            return count;
+        }
+        if (',' != *p_cursor)
+        {
+            return -1;
+        }
+        p_cursor++;
+    }
+} /* parse_values */
+
+/**
+ * @brief Executes a prepared formula with the values on each line of a
+ *        file, keeping up to CLI_MAX_IN_FLIGHT executions in flight. Each
+ *        execution is tagged with its line number.
+ * @param[in] p_conn A pointer to a connection using the framed protocol.
+ * @param[in] p_prepared A pointer to the response that prepared the formula.
+ * @param[in] p_file A pointer to an open file of values.
+ * @return true if every line was answered
+ *         false if the connection failed.
+ */
+static bool execute_rows(cli_conn_t*           p_conn,
+                         const cli_response_t* p_prepared,
+                         FILE*                 p_file)
+{
+    cli_response_t response;
+    char*    p_line      = NULL;
+    size_t   line_size   = 0;
+    uint32_t line_number = 0;
+    int      in_flight   = 0;
+    bool     success     = true;
+    double   values[PROTO_MAX_VARIABLES];
+    while (success && 0 <= getline(&p_line, &line_size, p_file))
+    {
+        line_number++;
+        int count = parse_values(p_line, values);
+        if (0 > count)
+        {
+            fprintf(stderr,
+                    "Line [%u] is not a list of values.\n",
+                    line_number);
+            continue;
+        }
+        success = cli_execute(p_conn,
+                              line_number,
+                              p_prepared->handle,
+                              values,
+                              count);
+        in_flight++;
+        if (success && CLI_MAX_IN_FLIGHT == in_flight)
+        {
+            cli_response_t answer;
+            success = cli_receive(p_conn, &answer);
+            if (success)
+            {
+                printf("[%u] %s\n", answer.id, answer.text);
+            }
+            in_flight--;
+        }
+    }
+    free(p_line);
+
+    for (; success && 0 < in_flight; in_flight--)
+    {
+        success = cli_receive(p_conn, &response);
+        if (success)
+        {
+            printf("[%u] %s\n", response.id, response.text);
+        }
+    }
+    return success;
+} /* execute_rows */
+
+/**
+ * @brief Waits for the answer to one column request and prints each row's
+ *        result next to the line it came from.
+ * @return true if the request was answered
+ *         false if the connection failed.
+ */
+static bool print_columns(cli_conn_t*     p_conn,
+                          const uint32_t* p_line_numbers,
+                          int             rows)
+{
+    static cli_column_response_t response;
+    if (false == cli_receive_columns(p_conn, &response))
+    {
+        return false;
+    }
+    if (PROTO_STATUS_OK != response.status || rows != response.rows)
+    {
+        fprintf(stderr,
+                "Server rejected the rows starting at line [%u]. [%s]\n",
+                p_line_numbers[0],
+                proto_eval_strerror(response.eval_status));
+        return true;
+    }
+
+    for (int i = 0; i < rows; i++)
+    {
+        if (PROTO_EVAL_OK == response.row_status[i])
+        {
+            char answer[DTOA_BUFFER_SIZE];
+            dtoa_shortest(response.results[i], answer);
+            printf("[%u] %s\n", p_line_numbers[i], answer);
+        }
+        else
+        {
+            printf("[%u] Error: %s\n",
+                   p_line_numbers[i],
+                   proto_eval_strerror(response.row_status[i]));
+        }
+    }
+    return true;
+} /* print_columns */
+
+/**
+ * @brief Column requests in flight, oldest first, with the line each of
+ *        their rows came from.
+ */
+typedef struct column_window_t {
+    uint32_t next_id;
+    int      oldest;
+    int      in_flight;
+    int      rows[CLIENT_COLUMN_WINDOW];
+    uint32_t line_numbers[CLIENT_COLUMN_WINDOW][PROTO_MAX_COLUMN_ROWS];
+} column_window_t;
+
+/**
+ * @brief Prints the answer to the oldest column request in flight.
+ * @return true if the request was answered
+ *         false if the connection failed.
+ */
+static bool retire_columns(cli_conn_t* p_conn, column_window_t* p_window)
+{
+    int  slot    = p_window->oldest;
+    bool success = print_columns(p_conn,
+                                 p_window->line_numbers[slot],
+                                 p_window->rows[slot]);
+    p_window->oldest = (slot + 1) % CLIENT_COLUMN_WINDOW;
+    p_window->in_flight--;
+    return success;
+} /* retire_columns */
+
+/**
+ * @brief Executes a prepared formula over the values in a file, sent as
+ *        columns of up to cli_column_rows rows per request with up to
+ *        CLIENT_COLUMN_WINDOW requests in flight, so only that many rows
+ *        are ever held in memory.
+ * @param[in] p_conn A pointer to a connection using the framed protocol.
+ * @param[in] p_prepared A pointer to the response that prepared the formula.
+ * @param[in] p_file A pointer to an open file of values.
+ * @return true if every request was answered
+ *         false if the connection failed.
+ */
+static bool execute_columns(cli_conn_t*           p_conn,
+                            const cli_response_t* p_prepared,
+                            FILE*                 p_file)
+{
+    static double          values[PROTO_MAX_VARIABLES][PROTO_MAX_COLUMN_ROWS];
+    static column_window_t window;
+    const double*          columns[PROTO_MAX_VARIABLES];
+    double                 row[PROTO_MAX_VARIABLES];
+    int                    variables   = p_prepared->variable_count;
+    int                    max_rows    = cli_column_rows(variables);
+    int                    rows        = 0;
+    char*                  p_line      = NULL;
+    size_t                 line_size   = 0;
+    uint32_t               line_number = 0;
+    bool                   success     = true;
+
+    window.next_id   = 0;
+    window.oldest    = 0;
+    window.in_flight = 0;
+    for (int i = 0; i < variables; i++)
+    {
+        columns[i] = values[i];
+    }
+
+    bool b_more = true;
+    while (success && b_more)
+    {
+        b_more = (0 <= getline(&p_line, &line_size, p_file));
+        if (b_more)
+        {
+            line_number++;
+            if (variables != parse_values(p_line, row))
+            {
+                fprintf(stderr,
+                        "Line [%u] is not a list of [%d] values.\n",
+                        line_number,
+                        variables);
+                continue;
+            }
+            int slot = (window.oldest + window.in_flight) %
+                       CLIENT_COLUMN_WINDOW;
+            for (int i = 0; i < variables; i++)
+            {
+                values[i][rows] = row[i];
+            }
+            window.line_numbers[slot][rows++] = line_number;
+        }
+        if (0 == rows || (b_more && max_rows > rows))
+        {
+            continue;
+        }
+
+        // The columns are copied out as the request is queued, so they are
+        // refilled for the next request straight away.
+        //
+        int slot = (window.oldest + window.in_flight) % CLIENT_COLUMN_WINDOW;
+        window.rows[slot] = rows;
+        success = cli_execute_columns(p_conn,
+                                      window.next_id++,
+                                      p_prepared->handle,
+                                      columns,
+                                      variables,
+                                      rows);
+        window.in_flight++;
+        rows = 0;
+        if (success && CLIENT_COLUMN_WINDOW == window.in_flight)
+        {
+            success = retire_columns(p_conn, &window);
+        }
+    }
+    free(p_line);
+
+    while (success && 0 < window.in_flight)
+    {
+        success = retire_columns(p_conn, &window);
+    }
+    return success;
+} /* execute_columns */
+
+/**
+ * @brief Prepares a formula once, then executes it with the values on each
+ *        line of a file, either one line per request or as columns.
+ * @param[in] p_conn A pointer to a connection using the framed protocol.
+ * @param[in] p_formula A pointer to an infix formula naming variables.
+ * @param[in] p_file A pointer to an open file of values.
+ * @param[in] b_columns True to send the values as columns.
+ * @return true if the formula was prepared and every line answered
+ *         false otherwise.
+ */
+static bool run_prepared(cli_conn_t* p_conn,
+                         const char* p_formula,
+                         FILE*       p_file,
+                         bool        b_columns)
+{
+    static char    postfix[PROTO_MAX_PAYLOAD + 1];
+    cli_response_t response;
+    int            err = formula_to_postfix(p_formula,
+                                            postfix,
+                                            sizeof(postfix));
+    if (CONVERT_SUCCESS != err)
+    {
+        fprintf(stderr,
+                "Error converting provided formula. [%s]\n",
+                convert_strerror(err));
+        return false;
+    }
+    if (false == cli_prepare(p_conn, 0, postfix) ||
+        false == cli_receive(p_conn, &response))
+    {
+        return false;
+    }
+    if (MSG_PREPARED != response.type || PROTO_STATUS_OK != response.status)
+    {
+        fprintf(stderr, "Unable to prepare formula. [%s]\n", response.text);
+        return false;
+    }
+    return b_columns ? execute_columns(p_conn, &response, p_file) :
+                       execute_rows(p_conn, &response, p_file);
+} /* run_prepared */
+
+/**
+ * @brief Waits for a request sent through the cluster and prints its answer
+ *        next to the line it came from.
+ * @return true if the request was answered
+ *         false if every server that tried it gave up.
+ */
+static bool print_cluster_response(cli_future_t* p_future,
+                                   uint32_t      line_number)
+{
+    cli_response_t response;
+    int            status = cli_future_wait(p_future, &response);
+    cli_future_destroy(p_future);
+    if (CLI_POOL_OK != status)
+    {
+        fprintf(stderr, "Line [%u] was not answered.\n", line_number);
+        return false;
+    }
+    printf("[%u] %s\n", line_number, response.text);
+    return true;
+} /* print_cluster_response */
+
+/**
+ * @brief Converts every line of a file and spreads them over the cluster,
+ *        keeping up to CLI_MAX_IN_FLIGHT requests in flight. Answers are
+ *        printed in line order, whichever server they come from.
+ * @param[in] p_cluster A pointer to an initialized cluster.
+ * @param[in] p_reader A pointer to a reader of an open file of infix
+ *                     strings.
+ * @return true if every request was answered
+ *         false otherwise.
+ */
+static bool run_cluster_file(cli_cluster_t* p_cluster, line_reader_t* p_reader)
+{
+    cli_future_t futures[CLI_MAX_IN_FLIGHT];
+    uint32_t     line_numbers[CLI_MAX_IN_FLIGHT];
+    int          oldest    = 0;
+    int          in_flight = 0;
+    bool         success   = true;
+
+    while (success && read_postfix_line(p_reader))
+    {
+        if (CLI_MAX_IN_FLIGHT == in_flight)
+        {
+            success = print_cluster_response(&(futures[oldest]),
+                                             line_numbers[oldest]);
+            oldest = (oldest + 1) % CLI_MAX_IN_FLIGHT;
+            in_flight--;
+        }
+
+        int slot = (oldest + in_flight) % CLI_MAX_IN_FLIGHT;
+        cli_future_init(&(futures[slot]));
+        if (false == cli_cluster_submit(p_cluster,
+                                        p_reader->p_postfix,
+                                        &cli_future_complete,
+                                        &(futures[slot])))
+        {
+            cli_future_destroy(&(futures[slot]));
+            success = false;
+            break;
+        }
+        line_numbers[slot] = p_reader->line_number;
+        in_flight++;
+    }
+
+    for (; 0 < in_flight; in_flight--)
+    {
+        if (false == print_cluster_response(&(futures[oldest]),
+                                            line_numbers[oldest]))
+        {
+            success = false;
+        }
+        oldest = (oldest + 1) % CLI_MAX_IN_FLIGHT;
+    }
+    return success;
+} /* run_cluster_file */
+
+/**
+ * @brief Evaluates the equations given with -e or -f on a cluster of
+ *        servers.
+ * @return EXIT_SUCCESS if every equation was answered
+ *         EXIT_FAILURE otherwise.
+ */
+static int run_cluster(const char* p_servers,
+                       const char* p_infix_string,
+                       const char* p_file_name,
+                       bool        b_bytecode)
+{
+    static cli_cluster_t cluster;
+    if (CLI_CLUSTER_INIT_SUCCESS != cli_cluster_init(&cluster,
+                                                     p_servers,
+                                                     CLIENT_CLUSTER_CONNECTIONS,
+                                                     b_bytecode))
+    {
+        return EXIT_FAILURE;
+    }
+
+    bool success = false;
+    if (NULL != p_file_name)
+    {
+        FILE* p_file = fopen(p_file_name, "r");
+        if (NULL == p_file)
+        {
+            fprintf(stderr,
+                    "Unable to open [%s]. [%s]\n",
+                    p_file_name,
+                    strerror(errno));
+        }
+        else
+        {
+            line_reader_t reader = { 0 };
+            reader.p_file = p_file;
+            success = run_cluster_file(&cluster, &reader);
+            free(reader.p_line);
+            free(reader.p_postfix);
+            fclose(p_file);
+        }
+    }
+    else
+    {
+        char*  p_postfix    = NULL;
+        size_t postfix_size = 0;
+        int    err          = convert_infix(p_infix_string,
+                                            &p_postfix,
+                                            &postfix_size);
+        cli_response_t response;
+        if (CONVERT_SUCCESS != err)
+        {
+            fprintf(stderr,
+                    "Error converting provided string. [%s]\n",
+                    convert_strerror(err));
+        }
+        else if (CLI_POOL_OK != cli_cluster_evaluate(&cluster,
+                                                     p_postfix,
+                                                     &response))
+        {
+            fprintf(stderr,
+                    "An error occured while sending the equation to the server.\n");
+        }
+        else
+        {
+            printf("Server responded with: \n%s\n", response.text);
+            success = true;
+        }
+        free(p_postfix);
+    }
+
+    cli_cluster_destroy(&cluster);
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+} /* run_cluster */
 
 int main(int argc, char** argv)
 {
@@ -39,11 +762,19 @@ int main(int argc, char** argv)
     char* p_serv_ip      = NULL;
     char* p_serv_port    = NULL;
     char* p_infix_string = NULL;
+    char* p_file_name    = NULL;
+    char* p_unix_path    = NULL;
+    char* p_servers      = NULL;
+    char* p_values_name  = NULL;
+    bool  b_want_framed  = true;
+    bool  b_batch        = false;
+    bool  b_bytecode     = false;
+    bool  b_columns      = false;
     int   flags          = 0;
     int   opt;
     do
     {
-        opt = getopt(argc, argv, "i:p:e:");
+        opt = getopt(argc, argv, "i:p:u:s:e:f:x:CtBb");
         switch (opt)
         {
             case 'i':
@@ -54,6 +785,30 @@ int main(int argc, char** argv)
                 flags++;
                 p_serv_port = optarg;
             break;
+            case 'u':
+                p_unix_path = optarg;
+            break;
+            case 's':
+                p_servers = optarg;
+            break;
+            case 'f':
+                p_file_name = optarg;
+            break;
+            case 'x':
+                p_values_name = optarg;
+            break;
+            case 'C':
+                b_columns = true;
+            break;
+            case 't':
+                b_want_framed = false;
+            break;
+            case 'B':
+                b_batch = true;
+            break;
+            case 'b':
+                b_bytecode = true;
+            break;
             case 'e':
                 p_infix_string = optarg;
             default:
@@ -61,88 +816,135 @@ int main(int argc, char** argv)
         }
     } while (-1 != opt);
 
-    if (2 > flags)
+    if ((2 > flags && NULL == p_unix_path && NULL == p_servers) ||
+        (NULL != p_servers && NULL == p_infix_string && NULL == p_file_name) ||
+        (NULL != p_values_name &&
+         (NULL == p_infix_string || NULL != p_servers)))
     {
         fprintf(stderr,
-                "Usage: %s [-i SERV IP(v4)] [-p PORT] [-e INFIX STRING]\n",
+                "Usage: %s [-i SERV IP(v4)] [-p PORT] [-u UNIX SOCKET PATH]"
+                " [-s SERVERS] [-e INFIX STRING] [-x VALUES FILE] [-C]"
+                " [-f INFIX FILE] [-B] [-b] [-t]\n",
                 argv[0]);
         return EXIT_FAILURE;
     }
-
-    int port_number = convert_port_number(p_serv_port);
-    if (0 > port_number)
+    if (NULL != p_servers)
     {
-        fprintf(stderr, "Port number must be in range [0-65535].\n");
-        return EXIT_FAILURE;
+        return run_cluster(p_servers, p_infix_string, p_file_name, b_bytecode);
     }
 
-    struct sockaddr_in cli_addr = { 0 };
-    cli_addr.sin_family         = AF_INET;
-    cli_addr.sin_port           = htons(port_number);
-
-    int err = inet_pton(AF_INET, p_serv_ip, &(cli_addr.sin_addr));
-    if (1 > err)
+    int err;
+    int client_socket_fd;
+    if (NULL != p_unix_path)
     {
-        fprintf(stderr, "A valid IPv4 address is needed.\n");
-        return EXIT_FAILURE;
+        client_socket_fd = cli_connect_unix(p_unix_path);
     }
+    else
+    {
+        int port_number = convert_port_number(p_serv_port);
+        if (0 > port_number)
+        {
+            fprintf(stderr, "Port number must be in range [0-65535].\n");
+            return EXIT_FAILURE;
+        }
 
+        struct sockaddr_in cli_addr = { 0 };
+        cli_addr.sin_family         = AF_INET;
+        cli_addr.sin_port           = htons(port_number);
 
-    int client_socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+        err = inet_pton(AF_INET, p_serv_ip, &(cli_addr.sin_addr));
+        if (1 > err)
+        {
+            fprintf(stderr, "A valid IPv4 address is needed.\n");
+            return EXIT_FAILURE;
+        }
+        client_socket_fd = cli_connect((struct sockaddr*)&cli_addr,
+                                       sizeof(cli_addr));
+    }
     if (0 > client_socket_fd)
     {
-        fprintf(stderr,
-                "Failed to create client socket. [%s]\n",
-                strerror(errno));
         return EXIT_FAILURE;
     }
 
-    socklen_t clilen = sizeof(cli_addr);
-
-    err = connect(client_socket_fd, (struct sockaddr*)&cli_addr, clilen); 
-    if (0 > err)
+    cli_conn_t conn;
+    if (false == cli_handshake(&conn, client_socket_fd, b_want_framed))
     {
-        fprintf(stderr,
-                "Unable to connect to server. [%s]\n",
-                strerror(errno));
         close(client_socket_fd);
         return EXIT_FAILURE;
     }
+    conn.b_bytecode = b_bytecode && (CLI_PROTO_FRAMED == conn.proto);
 
-    char buff[2] = { 0 };
-    err = recv(client_socket_fd, buff, 1, 0);
-
-    if ('0' != buff[0] && 1 != err)
+    if (NULL != p_values_name)
     {
-        fprintf(stderr,
-                "Server handshake error. [%s]\n",
-                strerror(errno));
-        close(client_socket_fd);
-        return EXIT_FAILURE;
+        if (CLI_PROTO_FRAMED != conn.proto)
+        {
+            fprintf(stderr, "Prepared formulas need the framed protocol.\n");
+            cli_close(&conn);
+            return EXIT_FAILURE;
+        }
+        FILE* p_file = fopen(p_values_name, "r");
+        if (NULL == p_file)
+        {
+            fprintf(stderr,
+                    "Unable to open [%s]. [%s]\n",
+                    p_values_name,
+                    strerror(errno));
+            cli_close(&conn);
+            return EXIT_FAILURE;
+        }
+        bool success = run_prepared(&conn,
+                                    p_infix_string,
+                                    p_file,
+                                    b_columns);
+        fclose(p_file);
+        cli_close(&conn);
+        return success ? EXIT_SUCCESS : EXIT_FAILURE;
     }
-
-    if (NULL != p_infix_string)
+    if (NULL != p_file_name)
     {
-        if (MAX_BUFFER_SIZE < strlen(p_infix_string))
+        FILE* p_file = fopen(p_file_name, "r");
+        if (NULL == p_file)
         {
             fprintf(stderr,
-                    "Infix string is over 100 characters long.\n");
+                    "Unable to open [%s]. [%s]\n",
+                    p_file_name,
+                    strerror(errno));
+            cli_close(&conn);
             return EXIT_FAILURE;
         }
-        errno = 0;
-        char* p_postfix = "3 2 -"; // Placeholder
-        if (EINVAL == errno || NULL == p_postfix)
+        line_reader_t reader = { 0 };
+        reader.p_file = p_file;
+        bool success = (b_batch && CLI_PROTO_FRAMED == conn.proto) ?
+                       run_equation_batches(&conn, &reader) :
+                       run_equation_file(&conn, &reader);
+        free(reader.p_line);
+        free(reader.p_postfix);
+        fclose(p_file);
+        cli_close(&conn);
+        return success ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    else if (NULL != p_infix_string)
+    {
+        char*  p_postfix    = NULL;
+        size_t postfix_size = 0;
+        err = convert_infix(p_infix_string, &p_postfix, &postfix_size);
+        if (CONVERT_SUCCESS != err)
         {
-            fprintf(stderr, "Error converting provided string.\n");
+            fprintf(stderr,
+                    "Error converting provided string. [%s]\n",
+                    convert_strerror(err));
+            free(p_postfix);
+            cli_close(&conn);
+            return EXIT_FAILURE;
         }
-        bool success = send_postfix(p_postfix, client_socket_fd);
+        bool success = cli_send_postfix(&conn, p_postfix);
+        free(p_postfix);
 
-        //free(p_postfix);
         if (false == success)
         {
             fprintf(stderr,
                     "An error occured while sending the equation to the server.\n");
-            close(client_socket_fd);
+            cli_close(&conn);
             return EXIT_FAILURE;
         }
     }
@@ -155,27 +957,50 @@ int main(int argc, char** argv)
         {
             printf("Enter your math equation in Infix Notation or exit to");
             printf(" quit:\n");
-            fgets(input_buffer, MAX_BUFFER_SIZE, stdin);
-            purge_buffer();
+            if (NULL == fgets(input_buffer, MAX_BUFFER_SIZE, stdin))
+            {
+                cli_close(&conn);
+                printf("Exiting.\n");
+                return EXIT_SUCCESS;
+            }
+            // Only discard the rest of the line if it did not fit.
+            //
+            if (NULL == strchr(input_buffer, '\n'))
+            {
+                purge_buffer();
+            }
             if (check_for_exit((char*)&input_buffer))
             {
-                close(client_socket_fd);
+                cli_close(&conn);
                 printf("Exiting.\n");
                 return EXIT_SUCCESS;
             }
-            char* p_postfix = "3 2 -"; // Placeholder
-            bool success = send_postfix(p_postfix, client_socket_fd);
-            //free(p_postfix);
+            char postfix[MAX_POSTFIX_SIZE] = { 0 };
+            err = infix_to_postfix(input_buffer, postfix, MAX_POSTFIX_SIZE);
+            if (CONVERT_SUCCESS != err)
+            {
+                fprintf(stderr,
+                        "Error converting provided string. [%s]\n",
+                        convert_strerror(err));
+                continue;
+            }
+            if (MAX_BUFFER_SIZE < strlen(postfix))
+            {
+                fprintf(stderr,
+                        "Postfix string is over 100 characters long.\n");
+                continue;
+            }
+            bool success = cli_send_postfix(&conn, postfix);
             if (false == success)
             {
                 fprintf(stderr,
                         "An error occured while sending the equation to the");
                 fprintf(stderr, " server.\n");
-                close(client_socket_fd);
+                cli_close(&conn);
                 return EXIT_FAILURE;
             }
         }
     }
-    close(client_socket_fd);
+    cli_close(&conn);
     return EXIT_SUCCESS;
 } /* main */
\ No newline at end of file
@@ -0,0 +1,417 @@
+/** @file dtoa.c
+ *
+ * @brief Shortest round trip double to string conversion using Grisu2. The
+ *        digits printed always parse back to exactly the same double, and
+ *        are the shortest such digits for all but a tiny fraction of values,
+ *        which get one digit more. Unlike printf's %f no precision is lost
+ *        and the length is bounded for every value.
+ * @par
+ * COPYRIGHT NOTICE: (c) 2018 Barr Group. All rights reserved.
+ */
+
+#include <stdbool.h>
+#include <stdint.h> // uint32_t, uint64_t
+#include <string.h> // memcpy, memmove, memset
+
+#include "dtoa.h"
+
+#define DTOA_SIGNIFICAND_MASK 0x000FFFFFFFFFFFFFull
+#define DTOA_EXPONENT_MASK 0x7FF0000000000000ull
+#define DTOA_SIGN_MASK 0x8000000000000000ull
+#define DTOA_HIDDEN_BIT 0x0010000000000000ull
+#define DTOA_SIGNIFICAND_BITS 52
+#define DTOA_EXPONENT_BIAS (0x3FF + DTOA_SIGNIFICAND_BITS)
+#define DTOA_MAX_PLAIN_DIGITS 21
+
+/**
+ * @brief A floating point value f * 2^e with a 64 bit significand.
+ */
+typedef struct diy_fp_t {
+    uint64_t f;
+    int      e;
+} diy_fp_t;
+
+/**
+ * @brief Normalized powers of ten from 10^-348 to 10^340 in steps of 8.
+ */
+static const diy_fp_t g_cached_powers[] = {
+    { 0xfa8fd5a0081c0288ull, -1220 },
+    { 0xbaaee17fa23ebf76ull, -1193 },
+    { 0x8b16fb203055ac76ull, -1166 },
+    { 0xcf42894a5dce35eaull, -1140 },
+    { 0x9a6bb0aa55653b2dull, -1113 },
+    { 0xe61acf033d1a45dfull, -1087 },
+    { 0xab70fe17c79ac6caull, -1060 },
+    { 0xff77b1fcbebcdc4full, -1034 },
+    { 0xbe5691ef416bd60cull, -1007 },
+    { 0x8dd01fad907ffc3cull, -980 },
+    { 0xd3515c2831559a83ull, -954 },
+    { 0x9d71ac8fada6c9b5ull, -927 },
+    { 0xea9c227723ee8bcbull, -901 },
+    { 0xaecc49914078536dull, -874 },
+    { 0x823c12795db6ce57ull, -847 },
+    { 0xc21094364dfb5637ull, -821 },
+    { 0x9096ea6f3848984full, -794 },
+    { 0xd77485cb25823ac7ull, -768 },
+    { 0xa086cfcd97bf97f4ull, -741 },
+    { 0xef340a98172aace5ull, -715 },
+    { 0xb23867fb2a35b28eull, -688 },
+    { 0x84c8d4dfd2c63f3bull, -661 },
+    { 0xc5dd44271ad3cdbaull, -635 },
+    { 0x936b9fcebb25c996ull, -608 },
+    { 0xdbac6c247d62a584ull, -582 },
+    { 0xa3ab66580d5fdaf6ull, -555 },
+    { 0xf3e2f893dec3f126ull, -529 },
+    { 0xb5b5ada8aaff80b8ull, -502 },
+    { 0x87625f056c7c4a8bull, -475 },
+    { 0xc9bcff6034c13053ull, -449 },
+    { 0x964e858c91ba2655ull, -422 },
+    { 0xdff9772470297ebdull, -396 },
+    { 0xa6dfbd9fb8e5b88full, -369 },
+    { 0xf8a95fcf88747d94ull, -343 },
+    { 0xb94470938fa89bcfull, -316 },
+    { 0x8a08f0f8bf0f156bull, -289 },
+    { 0xcdb02555653131b6ull, -263 },
+    { 0x993fe2c6d07b7facull, -236 },
+    { 0xe45c10c42a2b3b06ull, -210 },
+    { 0xaa242499697392d3ull, -183 },
+    { 0xfd87b5f28300ca0eull, -157 },
+    { 0xbce5086492111aebull, -130 },
+    { 0x8cbccc096f5088ccull, -103 },
+    { 0xd1b71758e219652cull, -77 },
+    { 0x9c40000000000000ull, -50 },
+    { 0xe8d4a51000000000ull, -24 },
+    { 0xad78ebc5ac620000ull, 3 },
+    { 0x813f3978f8940984ull, 30 },
+    { 0xc097ce7bc90715b3ull, 56 },
+    { 0x8f7e32ce7bea5c70ull, 83 },
+    { 0xd5d238a4abe98068ull, 109 },
+    { 0x9f4f2726179a2245ull, 136 },
+    { 0xed63a231d4c4fb27ull, 162 },
+    { 0xb0de65388cc8ada8ull, 189 },
+    { 0x83c7088e1aab65dbull, 216 },
+    { 0xc45d1df942711d9aull, 242 },
+    { 0x924d692ca61be758ull, 269 },
+    { 0xda01ee641a708deaull, 295 },
+    { 0xa26da3999aef774aull, 322 },
+    { 0xf209787bb47d6b85ull, 348 },
+    { 0xb454e4a179dd1877ull, 375 },
+    { 0x865b86925b9bc5c2ull, 402 },
+    { 0xc83553c5c8965d3dull, 428 },
+    { 0x952ab45cfa97a0b3ull, 455 },
+    { 0xde469fbd99a05fe3ull, 481 },
+    { 0xa59bc234db398c25ull, 508 },
+    { 0xf6c69a72a3989f5cull, 534 },
+    { 0xb7dcbf5354e9beceull, 561 },
+    { 0x88fcf317f22241e2ull, 588 },
+    { 0xcc20ce9bd35c78a5ull, 614 },
+    { 0x98165af37b2153dfull, 641 },
+    { 0xe2a0b5dc971f303aull, 667 },
+    { 0xa8d9d1535ce3b396ull, 694 },
+    { 0xfb9b7cd9a4a7443cull, 720 },
+    { 0xbb764c4ca7a44410ull, 747 },
+    { 0x8bab8eefb6409c1aull, 774 },
+    { 0xd01fef10a657842cull, 800 },
+    { 0x9b10a4e5e9913129ull, 827 },
+    { 0xe7109bfba19c0c9dull, 853 },
+    { 0xac2820d9623bf429ull, 880 },
+    { 0x80444b5e7aa7cf85ull, 907 },
+    { 0xbf21e44003acdd2dull, 933 },
+    { 0x8e679c2f5e44ff8full, 960 },
+    { 0xd433179d9c8cb841ull, 986 },
+    { 0x9e19db92b4e31ba9ull, 1013 },
+    { 0xeb96bf6ebadf77d9ull, 1039 },
+    { 0xaf87023b9bf0ee6bull, 1066 },
+};
+
+static const uint32_t g_pow10[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+/**
+ * @brief Multiplies two values, rounding the 128 bit product to its upper
+ *        64 bits.
+ */
+static diy_fp_t diy_fp_multiply(diy_fp_t x, diy_fp_t y)
+{
+    uint64_t a   = x.f >> 32;
+    uint64_t b   = x.f & 0xFFFFFFFFull;
+    uint64_t c   = y.f >> 32;
+    uint64_t d   = y.f & 0xFFFFFFFFull;
+    uint64_t ac  = a * c;
+    uint64_t bc  = b * c;
+    uint64_t ad  = a * d;
+    uint64_t bd  = b * d;
+    uint64_t mid = (bd >> 32) + (ad & 0xFFFFFFFFull) + (bc & 0xFFFFFFFFull) +
+                   (1ull << 31);
+    diy_fp_t product = { ac + (ad >> 32) + (bc >> 32) + (mid >> 32),
+                         x.e + y.e + 64 };
+    return product;
+} /* diy_fp_multiply */
+
+/**
+ * @brief Shifts a non-zero value left until its top bit is set.
+ */
+static diy_fp_t diy_fp_normalize(diy_fp_t x)
+{
+    int shift = __builtin_clzll(x.f);
+    x.f <<= shift;
+    x.e  -= shift;
+    return x;
+} /* diy_fp_normalize */
+
+/**
+ * @brief Looks up a cached power of ten c = 10^-k that brings a value with
+ *        binary exponent e into the range Grisu generates digits from.
+ * @param[in] e The binary exponent of the upper boundary.
+ * @param[out] p_k A pointer to store the decimal exponent k in.
+ */
+static diy_fp_t cached_power(int e, int* p_k)
+{
+    double   dk    = (-61 - e) * 0.30102999566398114 + 347;
+    int      k     = (int)dk;
+    if (dk - k > 0.0)
+    {
+        k++;
+    }
+    unsigned index = (unsigned)((k >> 3) + 1);
+    *p_k = -(-348 + (int)(index * 8));
+    return g_cached_powers[index];
+} /* cached_power */
+
+/**
+ * @brief Moves the last digit towards the exact value while the result
+ *        stays inside the rounding interval.
+ */
+static void grisu_round(char*    p_digits,
+                        int      length,
+                        uint64_t delta,
+                        uint64_t rest,
+                        uint64_t ten_kappa,
+                        uint64_t distance)
+{
+    while (rest < distance && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < distance ||
+            distance - rest > rest + ten_kappa - distance))
+    {
+        p_digits[length - 1]--;
+        rest += ten_kappa;
+    }
+} /* grisu_round */
+
+/**
+ * @brief Generates the fewest digits of the scaled upper boundary that stay
+ *        within delta of it.
+ * @param[in] w The scaled value.
+ * @param[in] upper The scaled upper boundary.
+ * @param[in] delta The width of the scaled rounding interval.
+ * @param[out] p_digits A pointer to store the digits in.
+ * @param[out] p_length A pointer to store the number of digits in.
+ * @param[in,out] p_k A pointer to the decimal exponent, adjusted for the
+ *                    digits generated.
+ */
+static void digit_gen(diy_fp_t w,
+                      diy_fp_t upper,
+                      uint64_t delta,
+                      char*    p_digits,
+                      int*     p_length,
+                      int*     p_k)
+{
+    int      shift    = -upper.e;
+    uint64_t one      = 1ull << shift;
+    uint64_t distance = upper.f - w.f;
+    uint32_t p1       = (uint32_t)(upper.f >> shift);
+    uint64_t p2       = upper.f & (one - 1);
+    int      kappa    = 10;
+    while (kappa > 1 && p1 < g_pow10[kappa - 1])
+    {
+        kappa--;
+    }
+
+    *p_length = 0;
+    while (kappa > 0)
+    {
+        uint32_t digit = p1 / g_pow10[kappa - 1];
+        p1 %= g_pow10[kappa - 1];
+        if (0 != digit || 0 != *p_length)
+        {
+            p_digits[(*p_length)++] = (char)('0' + digit);
+        }
+        kappa--;
+        uint64_t rest = ((uint64_t)p1 << shift) + p2;
+        if (rest <= delta)
+        {
+            *p_k += kappa;
+            grisu_round(p_digits, *p_length, delta, rest,
+                        (uint64_t)g_pow10[kappa] << shift, distance);
+            return;
+        }
+    }
+
+    while (true)
+    {
+        p2    *= 10;
+        delta *= 10;
+        char digit = (char)(p2 >> shift);
+        if (0 != digit || 0 != *p_length)
+        {
+            p_digits[(*p_length)++] = (char)('0' + digit);
+        }
+        p2 &= one - 1;
+        kappa--;
+        if (p2 < delta)
+        {
+            *p_k += kappa;
+            grisu_round(p_digits, *p_length, delta, p2, one,
+                        (-kappa < 10) ? distance * g_pow10[-kappa] : 0);
+            return;
+        }
+    }
+} /* digit_gen */
+
+/**
+ * @brief Writes a decimal exponent with its sign, at least two digits long.
+ * @return The number of characters written.
+ */
+static int write_exponent(int exponent, char* p_out)
+{
+    char* p_start = p_out;
+    if (0 > exponent)
+    {
+        *p_out++  = '-';
+        exponent = -exponent;
+    }
+    else
+    {
+        *p_out++ = '+';
+    }
+    if (100 <= exponent)
+    {
+        *p_out++  = (char)('0' + exponent / 100);
+        exponent %= 100;
+    }
+    *p_out++ = (char)('0' + exponent / 10);
+    *p_out++ = (char)('0' + exponent % 10);
+    return (int)(p_out - p_start);
+} /* write_exponent */
+
+/**
+ * @brief Lays digits d1d2...dn * 10^k out as plain decimal where that is
+ *        short, and in exponent notation otherwise.
+ * @return The number of characters in the buffer.
+ */
+static int prettify(char* p_buffer, int length, int k)
+{
+    int point = length + k;
+    if (length <= point && point <= DTOA_MAX_PLAIN_DIGITS)
+    {
+        // 1234e7 -> 12340000000
+        //
+        memset(p_buffer + length, '0', point - length);
+        return point;
+    }
+    if (0 < point && point <= DTOA_MAX_PLAIN_DIGITS)
+    {
+        // 1234e-2 -> 12.34
+        //
+        memmove(p_buffer + point + 1, p_buffer + point, length - point);
+        p_buffer[point] = '.';
+        return length + 1;
+    }
+    if (-6 < point && point <= 0)
+    {
+        // 1234e-6 -> 0.001234
+        //
+        int offset = 2 - point;
+        memmove(p_buffer + offset, p_buffer, length);
+        p_buffer[0] = '0';
+        p_buffer[1] = '.';
+        memset(p_buffer + 2, '0', offset - 2);
+        return length + offset;
+    }
+    if (1 == length)
+    {
+        // 1e30
+        //
+        p_buffer[1] = 'e';
+        return 2 + write_exponent(point - 1, p_buffer + 2);
+    }
+
+    // 1234e30 -> 1.234e+33
+    //
+    memmove(p_buffer + 2, p_buffer + 1, length - 1);
+    p_buffer[1]          = '.';
+    p_buffer[length + 1] = 'e';
+    return length + 2 + write_exponent(point - 1, p_buffer + length + 2);
+} /* prettify */
+
+/**
+ * @brief Formats a double with the fewest digits that parse back to it.
+ * @param[in] value The value to format.
+ * @param[out] p_buffer A pointer to at least DTOA_BUFFER_SIZE bytes. Receives
+ *                      the null terminated text.
+ * @return The length of the text, excluding the null terminator.
+ */
+int dtoa_shortest(double value, char* p_buffer)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    char* p_out = p_buffer;
+    if (bits & DTOA_SIGN_MASK)
+    {
+        *p_out++ = '-';
+    }
+
+    uint64_t significand = bits & DTOA_SIGNIFICAND_MASK;
+    int      biased_e    = (int)((bits & DTOA_EXPONENT_MASK) >>
+                                 DTOA_SIGNIFICAND_BITS);
+    if (0x7FF == biased_e)
+    {
+        p_out = p_buffer + ((0 == significand) ? (p_out - p_buffer) : 0);
+        memcpy(p_out, (0 == significand) ? "inf" : "nan", 4);
+        return (int)(p_out - p_buffer) + 3;
+    }
+    if (0 == biased_e && 0 == significand)
+    {
+        memcpy(p_out, "0", 2);
+        return (int)(p_out - p_buffer) + 1;
+    }
+
+    diy_fp_t v;
+    if (0 != biased_e)
+    {
+        v.f = significand + DTOA_HIDDEN_BIT;
+        v.e = biased_e - DTOA_EXPONENT_BIAS;
+    }
+    else
+    {
+        v.f = significand;
+        v.e = 1 - DTOA_EXPONENT_BIAS;
+    }
+
+    // The boundaries halfway to the neighbouring doubles. The lower one is
+    // closer when v is the smallest significand of its binade.
+    //
+    diy_fp_t upper = { (v.f << 1) + 1, v.e - 1 };
+    upper = diy_fp_normalize(upper);
+    diy_fp_t lower = (DTOA_HIDDEN_BIT == v.f) ?
+                         (diy_fp_t){ (v.f << 2) - 1, v.e - 2 } :
+                         (diy_fp_t){ (v.f << 1) - 1, v.e - 1 };
+    lower.f <<= lower.e - upper.e;
+    lower.e   = upper.e;
+
+    int      k      = 0;
+    diy_fp_t c_mk   = cached_power(upper.e, &k);
+    diy_fp_t w      = diy_fp_multiply(diy_fp_normalize(v), c_mk);
+    diy_fp_t w_plus = diy_fp_multiply(upper, c_mk);
+    diy_fp_t w_minus = diy_fp_multiply(lower, c_mk);
+    w_minus.f++;
+    w_plus.f--;
+
+    int length = 0;
+    digit_gen(w, w_plus, w_plus.f - w_minus.f, p_out, &length, &k);
+    length = prettify(p_out, length, k);
+    p_out[length] = '\0';
+    return (int)(p_out - p_buffer) + length;
+} /* dtoa_shortest */
@@ -0,0 +1,8 @@
+#ifndef DTOA_H
+#define DTOA_H
+
+#define DTOA_BUFFER_SIZE 32
+
+int dtoa_shortest(double value, char* p_buffer);
+
+#endif /* DTOA_H */
@@ -0,0 +1,131 @@
+/** @file histogram.c
+ *
+ * @brief Fixed size log-linear latency histogram. Recording is a couple of
+ *        shifts and an increment, so it can sit on the measured path.
+ * @par
+ * COPYRIGHT NOTICE: (c) 2018 Barr Group. All rights reserved.
+ */
+
+#include <stdint.h> // uint64_t, UINT64_MAX
+#include <string.h> // memset
+
+#include "histogram.h"
+
+/**
+ * @brief Maps a value to the index of the bucket that counts it.
+ * @param[in] value The value to count.
+ * @return An index below HISTOGRAM_BUCKET_COUNT.
+ */
+int histogram_bucket_index(uint64_t value)
+{
+    int msb = 63 - __builtin_clzll(value | 1);
+    if (HISTOGRAM_SUB_BUCKET_BITS > msb)
+    {
+        return (int)value;
+    }
+    int shift = msb - HISTOGRAM_SUB_BUCKET_BITS;
+    return ((shift + 1) * HISTOGRAM_SUB_BUCKETS) +
+           (int)((value >> shift) - HISTOGRAM_SUB_BUCKETS);
+} /* histogram_bucket_index */
+
+/**
+ * @brief Maps a bucket index back to the highest value it counts.
+ */
+static uint64_t bucket_value(int index)
+{
+    if (2 * HISTOGRAM_SUB_BUCKETS > index)
+    {
+        return (uint64_t)index;
+    }
+    int      shift  = (index / HISTOGRAM_SUB_BUCKETS) - 1;
+    uint64_t lowest = (uint64_t)(HISTOGRAM_SUB_BUCKETS +
+                                 (index % HISTOGRAM_SUB_BUCKETS)) << shift;
+    return lowest + ((1ull << shift) - 1);
+} /* bucket_value */
+
+/**
+ * @brief Empties a histogram.
+ * @param[in] p_histogram A pointer to the histogram to initialize.
+ */
+void histogram_init(histogram_t* p_histogram)
+{
+    memset(p_histogram, 0, sizeof(histogram_t));
+    p_histogram->min = UINT64_MAX;
+} /* histogram_init */
+
+/**
+ * @brief Counts one value.
+ * @param[in] p_histogram A pointer to an initialized histogram.
+ * @param[in] value The value to count.
+ */
+void histogram_record(histogram_t* p_histogram, uint64_t value)
+{
+    p_histogram->buckets[histogram_bucket_index(value)]++;
+    p_histogram->count++;
+    if (value < p_histogram->min)
+    {
+        p_histogram->min = value;
+    }
+    if (value > p_histogram->max)
+    {
+        p_histogram->max = value;
+    }
+} /* histogram_record */
+
+/**
+ * @brief Adds every count of one histogram to another.
+ * @param[in] p_into A pointer to the histogram to add to.
+ * @param[in] p_from A pointer to the histogram to add.
+ */
+void histogram_merge(histogram_t* p_into, const histogram_t* p_from)
+{
+    for (int i = 0; i < HISTOGRAM_BUCKET_COUNT; i++)
+    {
+        p_into->buckets[i] += p_from->buckets[i];
+    }
+    p_into->count += p_from->count;
+    if (p_from->min < p_into->min)
+    {
+        p_into->min = p_from->min;
+    }
+    if (p_from->max > p_into->max)
+    {
+        p_into->max = p_from->max;
+    }
+} /* histogram_merge */
+
+/**
+ * @brief Finds the value at a percentile.
+ * @param[in] p_histogram A pointer to an initialized histogram.
+ * @param[in] percentile The percentile to find, from 0 to 100.
+ * @return The highest value equivalent to the value at the percentile,
+ *         capped at the largest recorded value.
+ *         0 if the histogram is empty.
+ */
+uint64_t histogram_percentile(const histogram_t* p_histogram,
+                              double             percentile)
+{
+    if (0 == p_histogram->count)
+    {
+        return 0;
+    }
+
+    uint64_t target = (uint64_t)((percentile / 100.0) *
+                                 (double)p_histogram->count + 0.5);
+    if (1 > target)
+    {
+        target = 1;
+    }
+
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKET_COUNT; i++)
+    {
+        seen += p_histogram->buckets[i];
+        if (seen >= target)
+        {
+            uint64_t value = bucket_value(i);
+            return (value > p_histogram->max) ? p_histogram->max : value;
+        }
+    }
+    return p_histogram->max;
+} /* histogram_percentile */
@@ -0,0 +1,32 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h> // uint64_t
+
+#define HISTOGRAM_SUB_BUCKET_BITS 7
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_BUCKET_COUNT ((64 - HISTOGRAM_SUB_BUCKET_BITS + 1) * \
+                                HISTOGRAM_SUB_BUCKETS)
+
+/**
+ * @brief Log-linear histogram in the style of HdrHistogram. Every power of
+ *        two range is split into HISTOGRAM_SUB_BUCKETS linear buckets, so any
+ *        recorded value is reported within 1 / HISTOGRAM_SUB_BUCKETS of its
+ *        true value across the full 64 bit range. Each histogram has a single
+ *        writer; merge per-thread histograms to report on them together.
+ */
+typedef struct histogram_t {
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[HISTOGRAM_BUCKET_COUNT];
+} histogram_t;
+
+int      histogram_bucket_index(uint64_t value);
+void     histogram_init(histogram_t* p_histogram);
+void     histogram_record(histogram_t* p_histogram, uint64_t value);
+void     histogram_merge(histogram_t* p_into, const histogram_t* p_from);
+uint64_t histogram_percentile(const histogram_t* p_histogram,
+                              double             percentile);
+
+#endif /* HISTOGRAM_H */
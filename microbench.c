@@ -0,0 +1,337 @@
+/** @file microbench.c
+ *
+ * @brief Shared harness for the parsing and evaluation microbenchmarks.
+ *        Generates repeatable equation corpora, times an operation over a
+ *        corpus and reports ns/op, bytes/s and allocations/op, either as a
+ *        table or as one JSON object per line for diffing between runs.
+ *        Allocations are counted by wrapping malloc, calloc and realloc at
+ *        link time, so only calls made from the code under test are seen.
+ * @par
+ * COPYRIGHT NOTICE: (c) 2018 Barr Group. All rights reserved.
+ */
+
+#define _XOPEN_SOURCE 700
+#include <getopt.h> // getopt
+#include <stdbool.h>
+#include <stdint.h> // uint64_t
+#include <stdio.h> // printf, snprintf
+#include <stdlib.h> // atoi, qsort
+#include <string.h> // strstr
+#include <time.h> // clock_gettime
+
+#include "microbench.h"
+
+#define MB_CALIBRATE_DIVISOR 10
+#define MB_SEED 2018u
+#define NS_PER_MS 1000000ull
+#define NS_PER_SECOND 1000000000.0
+
+typedef struct mb_mix_t {
+    const char* p_name;
+    const char* p_operators;
+} mb_mix_t;
+
+static const mb_mix_t g_mixes[] =
+{
+    { "additive", "+-" },
+    { "multiplicative", "*/" },
+    { "mixed", "+-*/%" }
+};
+
+static const int g_lengths[] = { 2, 8, 32 };
+
+mb_options_t    g_mb_options = { false, MB_DEFAULT_TARGET_MS, NULL };
+volatile double g_mb_sink    = 0.0;
+
+static uint64_t g_alloc_count = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* p_memory, size_t size);
+
+void* __wrap_malloc(size_t size)
+{
+    g_alloc_count++;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size)
+{
+    g_alloc_count++;
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* p_memory, size_t size)
+{
+    g_alloc_count++;
+    return __real_realloc(p_memory, size);
+}
+
+/**
+ * @brief Reads the monotonic clock.
+ * @return The current monotonic time in nanoseconds.
+ */
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000ull) + (uint64_t)now.tv_nsec;
+} /* now_ns */
+
+/**
+ * @brief Parses the options shared by every microbenchmark binary.
+ *        -j (optional) Print JSON lines instead of a table.
+ *        -t [MS] (optional) Target time for each measurement.
+ *        -f [FILTER] (optional) Only run benchmarks whose bench/corpus name
+ *           contains FILTER.
+ * @return true if the options are valid
+ *         false if they are not.
+ */
+bool mb_parse_args(int argc, char** argv)
+{
+    extern char* optarg;
+    int          opt;
+    while (-1 != (opt = getopt(argc, argv, "jt:f:")))
+    {
+        switch (opt)
+        {
+            case 'j':
+                g_mb_options.b_json = true;
+            break;
+            case 't':
+                g_mb_options.target_ms = atoi(optarg);
+            break;
+            case 'f':
+                g_mb_options.p_filter = optarg;
+            break;
+            default:
+                return false;
+        }
+    }
+    return (0 < g_mb_options.target_ms);
+} /* mb_parse_args */
+
+int mb_corpus_mix_count(void)
+{
+    return sizeof(g_mixes) / sizeof(g_mixes[0]);
+} /* mb_corpus_mix_count */
+
+int mb_corpus_length_count(void)
+{
+    return sizeof(g_lengths) / sizeof(g_lengths[0]);
+} /* mb_corpus_length_count */
+
+/**
+ * @brief Small linear congruential generator so corpora are identical on
+ *        every run and every platform.
+ */
+static unsigned next_random(unsigned* p_state)
+{
+    *p_state = (*p_state * 1103515245u) + 12345u;
+    return (*p_state >> 16) & 0x7fff;
+} /* next_random */
+
+/**
+ * @brief Writes one random operand, mostly integers with some decimals.
+ * @return The number of characters written.
+ */
+static int write_operand(char* p_out, size_t size, unsigned* p_state)
+{
+    if (0 == next_random(p_state) % 4)
+    {
+        return snprintf(p_out, size, "%u.%02u",
+                        1 + (next_random(p_state) % 9),
+                        next_random(p_state) % 100);
+    }
+    return snprintf(p_out, size, "%u", 1 + (next_random(p_state) % 999));
+} /* write_operand */
+
+/**
+ * @brief Fills a corpus with equations of one length and operator mix.
+ *        Each equation is a left associative chain of terms, where a term is
+ *        either an operand or a parenthesized pair of operands.
+ * @param[out] p_corpus A pointer to the corpus to fill.
+ * @param[in] length An index below mb_corpus_length_count.
+ * @param[in] mix An index below mb_corpus_mix_count.
+ */
+void mb_generate_corpus(mb_corpus_t* p_corpus, int length, int mix)
+{
+    const char* p_operators    = g_mixes[mix].p_operators;
+    size_t      operator_count = strlen(p_operators);
+    unsigned    state          = MB_SEED + (length * 31) + mix;
+
+    p_corpus->operand_count = g_lengths[length];
+    p_corpus->infix_bytes   = 0;
+    p_corpus->postfix_bytes = 0;
+    snprintf(p_corpus->name,
+             sizeof(p_corpus->name),
+             "ops%d_%s",
+             g_lengths[length],
+             g_mixes[mix].p_name);
+
+    for (int item = 0; item < MB_CORPUS_SIZE; item++)
+    {
+        char*  p_infix        = p_corpus->infix[item];
+        char*  p_postfix      = p_corpus->postfix[item];
+        size_t infix_length   = 0;
+        size_t postfix_length = 0;
+        int    operands       = 0;
+
+        while (operands < p_corpus->operand_count)
+        {
+            char op      = p_operators[next_random(&state) % operator_count];
+            bool b_first = (0 == operands);
+            if (false == b_first)
+            {
+                infix_length += snprintf(p_infix + infix_length,
+                                         MB_MAX_EXPRESSION - infix_length,
+                                         " %c ",
+                                         op);
+            }
+
+            bool b_group = (2 <= p_corpus->operand_count - operands) &&
+                           (0 == next_random(&state) % 3);
+            if (b_group)
+            {
+                char inner = p_operators[next_random(&state) %
+                                         operator_count];
+                char left[16];
+                char right[16];
+                write_operand(left, sizeof(left), &state);
+                write_operand(right, sizeof(right), &state);
+                infix_length += snprintf(p_infix + infix_length,
+                                         MB_MAX_EXPRESSION - infix_length,
+                                         "(%s %c %s)",
+                                         left, inner, right);
+                postfix_length += snprintf(p_postfix + postfix_length,
+                                           MB_MAX_EXPRESSION - postfix_length,
+                                           "%s%s %s %c",
+                                           b_first ? "" : " ",
+                                           left, right, inner);
+                operands += 2;
+            }
+            else
+            {
+                char operand[16];
+                write_operand(operand, sizeof(operand), &state);
+                infix_length += snprintf(p_infix + infix_length,
+                                         MB_MAX_EXPRESSION - infix_length,
+                                         "%s",
+                                         operand);
+                postfix_length += snprintf(p_postfix + postfix_length,
+                                           MB_MAX_EXPRESSION - postfix_length,
+                                           "%s%s",
+                                           b_first ? "" : " ",
+                                           operand);
+                operands++;
+            }
+
+            if (false == b_first)
+            {
+                postfix_length += snprintf(p_postfix + postfix_length,
+                                           MB_MAX_EXPRESSION - postfix_length,
+                                           " %c",
+                                           op);
+            }
+        }
+        p_corpus->infix_bytes   += infix_length;
+        p_corpus->postfix_bytes += postfix_length;
+    }
+} /* mb_generate_corpus */
+
+/**
+ * @brief Runs an operation over the corpus a number of times.
+ * @return The elapsed time in nanoseconds.
+ */
+static uint64_t run_iterations(mb_func_t func,
+                               void*     p_context,
+                               uint64_t  iterations)
+{
+    uint64_t start = now_ns();
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        func(p_context, (int)(i % MB_CORPUS_SIZE));
+    }
+    return now_ns() - start;
+} /* run_iterations */
+
+static int compare_doubles(const void* p_left, const void* p_right)
+{
+    double left  = *(const double*)p_left;
+    double right = *(const double*)p_right;
+    return (left > right) - (left < right);
+} /* compare_doubles */
+
+/**
+ * @brief Measures an operation and prints one result. The iteration count is
+ *        calibrated to the target time, then the median of MB_REPEATS runs is
+ *        reported.
+ * @param[in] p_name The name of the operation.
+ * @param[in] p_corpus_name The name of the corpus it runs over.
+ * @param[in] func The operation to measure.
+ * @param[in] p_context A pointer passed to every call of func.
+ * @param[in] bytes_per_op The average input bytes one call processes.
+ */
+void mb_run(const char* p_name,
+            const char* p_corpus_name,
+            mb_func_t   func,
+            void*       p_context,
+            double      bytes_per_op)
+{
+    char full_name[96];
+    snprintf(full_name, sizeof(full_name), "%s/%s", p_name, p_corpus_name);
+    if (NULL != g_mb_options.p_filter &&
+        NULL == strstr(full_name, g_mb_options.p_filter))
+    {
+        return;
+    }
+
+    // Warm up, then double the iterations until one run is long enough to
+    // scale from.
+    //
+    uint64_t target_ns  = (uint64_t)g_mb_options.target_ms * NS_PER_MS;
+    uint64_t iterations = MB_CORPUS_SIZE;
+    uint64_t elapsed    = run_iterations(func, p_context, iterations);
+    while (elapsed < target_ns / MB_CALIBRATE_DIVISOR)
+    {
+        iterations *= 2;
+        elapsed     = run_iterations(func, p_context, iterations);
+    }
+    iterations = (uint64_t)((double)iterations * target_ns / elapsed) + 1;
+
+    double   ns_per_op[MB_REPEATS];
+    uint64_t allocs = 0;
+    for (int repeat = 0; repeat < MB_REPEATS; repeat++)
+    {
+        uint64_t allocs_before = g_alloc_count;
+        elapsed = run_iterations(func, p_context, iterations);
+        allocs += g_alloc_count - allocs_before;
+        ns_per_op[repeat] = (double)elapsed / iterations;
+    }
+    qsort(ns_per_op, MB_REPEATS, sizeof(double), &compare_doubles);
+
+    double median        = ns_per_op[MB_REPEATS / 2];
+    double bytes_per_sec = bytes_per_op * NS_PER_SECOND / median;
+    double allocs_per_op = (double)allocs / (iterations * MB_REPEATS);
+    if (g_mb_options.b_json)
+    {
+        printf("{\"bench\":\"%s\",\"corpus\":\"%s\",\"ns_per_op\":%.2f,"
+               "\"min_ns_per_op\":%.2f,\"bytes_per_sec\":%.0f,"
+               "\"allocs_per_op\":%.3f,\"iterations\":%llu}\n",
+               p_name,
+               p_corpus_name,
+               median,
+               ns_per_op[0],
+               bytes_per_sec,
+               allocs_per_op,
+               (unsigned long long)iterations);
+    }
+    else
+    {
+        printf("%-40s %10.1f ns/op %10.1f MB/s %8.3f allocs/op\n",
+               full_name,
+               median,
+               bytes_per_sec / 1e6,
+               allocs_per_op);
+    }
+} /* mb_run */
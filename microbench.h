@@ -0,0 +1,52 @@
+#ifndef MICROBENCH_H
+#define MICROBENCH_H
+
+#include <stdbool.h>
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+
+#define MB_CORPUS_SIZE 256
+#define MB_MAX_EXPRESSION 512
+#define MB_REPEATS 5
+#define MB_DEFAULT_TARGET_MS 200
+
+/**
+ * @brief A repeatable set of generated equations. Every infix item has a
+ *        postfix twin with the same operands and operators, for benchmarking
+ *        the client and server sides on comparable input.
+ */
+typedef struct mb_corpus_t {
+    char   name[32];
+    int    operand_count;
+    size_t infix_bytes;
+    size_t postfix_bytes;
+    char   infix[MB_CORPUS_SIZE][MB_MAX_EXPRESSION];
+    char   postfix[MB_CORPUS_SIZE][MB_MAX_EXPRESSION];
+} mb_corpus_t;
+
+/**
+ * @brief One operation under test. Called with the index of the corpus item
+ *        to operate on.
+ */
+typedef void (*mb_func_t)(void* p_context, int item);
+
+typedef struct mb_options_t {
+    bool        b_json;
+    int         target_ms;
+    const char* p_filter;
+} mb_options_t;
+
+extern mb_options_t g_mb_options;
+extern volatile double g_mb_sink;
+
+bool        mb_parse_args(int argc, char** argv);
+int         mb_corpus_mix_count(void);
+int         mb_corpus_length_count(void);
+void        mb_generate_corpus(mb_corpus_t* p_corpus, int length, int mix);
+void        mb_run(const char* p_name,
+                   const char* p_corpus_name,
+                   mb_func_t   func,
+                   void*       p_context,
+                   double      bytes_per_op);
+
+#endif /* MICROBENCH_H */
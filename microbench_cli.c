@@ -0,0 +1,89 @@
+/** @file microbench_cli.c
+ *
+ * @brief Microbenchmarks for the client's conversion paths: infix to postfix,
+ *        postfix to bytecode and port parsing.
+ *        -j (optional) Print JSON lines instead of a table.
+ *        -t [MS] (optional) Target time for each measurement.
+ *        -f [FILTER] (optional) Only run matching benchmarks.
+ * @par
+ * COPYRIGHT NOTICE: (c) 2018 Barr Group. All rights reserved.
+ */
+
+#include <stdbool.h>
+#include <stdio.h> // stderr
+#include <stdlib.h> // EXIT_FAILURE
+
+#include "cli_lib.h"
+#include "microbench.h"
+
+#define MB_PORT_LENGTH 8
+
+typedef struct cli_context_t {
+    mb_corpus_t* p_corpus;
+    char         postfix[MB_MAX_EXPRESSION * 2];
+    uint8_t      bytecode[MB_MAX_EXPRESSION * PROTO_PUSH_SIZE];
+    char         ports[MB_CORPUS_SIZE][MB_PORT_LENGTH];
+} cli_context_t;
+
+static mb_corpus_t   g_corpus;
+static cli_context_t g_context;
+
+static void bench_port(void* p_context, int item)
+{
+    cli_context_t* p_cli = p_context;
+    g_mb_sink = convert_port_number(p_cli->ports[item]);
+}
+
+static void bench_infix_to_postfix(void* p_context, int item)
+{
+    cli_context_t* p_cli = p_context;
+    g_mb_sink = infix_to_postfix(p_cli->p_corpus->infix[item],
+                                 p_cli->postfix,
+                                 sizeof(p_cli->postfix));
+}
+
+static void bench_postfix_to_bytecode(void* p_context, int item)
+{
+    cli_context_t* p_cli = p_context;
+    g_mb_sink = postfix_to_bytecode(p_cli->p_corpus->postfix[item],
+                                    p_cli->bytecode,
+                                    sizeof(p_cli->bytecode));
+}
+
+int main(int argc, char** argv)
+{
+    if (false == mb_parse_args(argc, argv))
+    {
+        fprintf(stderr, "Usage: %s [-j] [-t MS] [-f FILTER]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    size_t   port_bytes = 0;
+    unsigned port       = 1;
+    for (int i = 0; i < MB_CORPUS_SIZE; i++)
+    {
+        port = (port * 7919) % 65535 + 1;
+        port_bytes += snprintf(g_context.ports[i], MB_PORT_LENGTH, "%u", port);
+    }
+    mb_run("cli_convert_port_number",
+           "ports",
+           &bench_port,
+           &g_context,
+           (double)port_bytes / MB_CORPUS_SIZE);
+
+    g_context.p_corpus = &g_corpus;
+    for (int length = 0; length < mb_corpus_length_count(); length++)
+    {
+        for (int mix = 0; mix < mb_corpus_mix_count(); mix++)
+        {
+            mb_generate_corpus(&g_corpus, length, mix);
+            mb_run("infix_to_postfix", g_corpus.name,
+                   &bench_infix_to_postfix, &g_context,
+                   (double)g_corpus.infix_bytes / MB_CORPUS_SIZE);
+            mb_run("postfix_to_bytecode", g_corpus.name,
+                   &bench_postfix_to_bytecode, &g_context,
+                   (double)g_corpus.postfix_bytes / MB_CORPUS_SIZE);
+        }
+    }
+    return EXIT_SUCCESS;
+} /* main */
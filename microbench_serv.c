@@ -0,0 +1,270 @@
+/** @file microbench_serv.c
+ *
+ * @brief Microbenchmarks for the server's parsing and evaluation paths:
+ *        sanitizing, operator classification, port parsing, every way of
+ *        evaluating an equation, including streamed in 16 byte chunks,
+ *        running a prepared formula row by row and over columns, and
+ *        formatting the answer.
+ *        -j (optional) Print JSON lines instead of a table.
+ *        -t [MS] (optional) Target time for each measurement.
+ *        -f [FILTER] (optional) Only run matching benchmarks.
+ * @par
+ * COPYRIGHT NOTICE: (c) 2018 Barr Group. All rights reserved.
+ */
+
+#include <stdbool.h>
+#include <stdio.h> // stderr
+#include <stdlib.h> // EXIT_FAILURE
+#include <string.h> // strlen
+
+#include "serv_lib.h"
+#include "dtoa.h"
+#include "serv_eval.h"
+#include "microbench.h"
+
+#define MB_PORT_LENGTH 8
+#define MB_STREAM_CHUNK 16
+#define MB_FORMULA "x y + z * x 7.25 - y / -"
+#define MB_FORMULA_VARIABLES 3
+
+typedef struct serv_context_t {
+    mb_corpus_t*   p_corpus;
+    eval_program_t programs[MB_CORPUS_SIZE];
+    int            compile_errs[MB_CORPUS_SIZE];
+    int            errs[MB_CORPUS_SIZE];
+    double         results[MB_CORPUS_SIZE];
+    char           ports[MB_CORPUS_SIZE][MB_PORT_LENGTH];
+    char           response[MAX_BUFFER_SIZE];
+    eval_stream_t  stream;
+    eval_program_t formula;
+    double         column_values[MB_FORMULA_VARIABLES][MB_CORPUS_SIZE];
+    const double*  columns[MB_FORMULA_VARIABLES];
+} serv_context_t;
+
+static mb_corpus_t    g_corpus;
+static serv_context_t g_context;
+
+static void bench_sanitize(void* p_context, int item)
+{
+    serv_context_t* p_serv = p_context;
+    sanitize_input_string(p_serv->p_corpus->postfix[item]);
+}
+
+static void bench_is_operator(void* p_context, int item)
+{
+    serv_context_t* p_serv    = p_context;
+    int             operators = 0;
+    for (const char* p_cursor = p_serv->p_corpus->postfix[item];
+         '\0' != *p_cursor;
+         p_cursor++)
+    {
+        operators += is_operator(*p_cursor) ? 1 : 0;
+    }
+    g_mb_sink = operators;
+}
+
+static void bench_port(void* p_context, int item)
+{
+    serv_context_t* p_serv = p_context;
+    g_mb_sink = convert_port_number(p_serv->ports[item]);
+}
+
+static void bench_eval_postfix(void* p_context, int item)
+{
+    serv_context_t* p_serv = p_context;
+    double          answer = 0.0;
+    eval_postfix(p_serv->p_corpus->postfix[item], &answer);
+    g_mb_sink = answer;
+}
+
+static void bench_eval_stream(void* p_context, int item)
+{
+    serv_context_t* p_serv  = p_context;
+    const char*     p_input = p_serv->p_corpus->postfix[item];
+    size_t          length  = strlen(p_input);
+    double          answer  = 0.0;
+
+    // Arrive in small chunks so numbers are split and carried.
+    //
+    eval_stream_begin(&(p_serv->stream), SERV_DEFAULT_STREAM_MEMORY);
+    for (size_t offset = 0; offset < length; offset += MB_STREAM_CHUNK)
+    {
+        size_t chunk = length - offset;
+        if (MB_STREAM_CHUNK < chunk)
+        {
+            chunk = MB_STREAM_CHUNK;
+        }
+        eval_stream_feed(&(p_serv->stream), p_input + offset, chunk);
+    }
+    eval_stream_finish(&(p_serv->stream), &answer);
+    g_mb_sink = answer;
+}
+
+static void bench_eval_compile(void* p_context, int item)
+{
+    serv_context_t* p_serv  = p_context;
+    const char*     p_input = p_serv->p_corpus->postfix[item];
+    g_mb_sink = eval_compile(p_input,
+                             strlen(p_input),
+                             &(p_serv->programs[item]));
+}
+
+static void bench_eval_program(void* p_context, int item)
+{
+    serv_context_t* p_serv = p_context;
+    double          answer = 0.0;
+    eval_program(&(p_serv->programs[item]), &answer);
+    g_mb_sink = answer;
+}
+
+static void bench_eval_batch(void* p_context, int item)
+{
+    serv_context_t* p_serv = p_context;
+    eval_batch(p_serv->programs,
+               p_serv->compile_errs,
+               MB_CORPUS_SIZE,
+               p_serv->results,
+               p_serv->errs);
+    g_mb_sink = p_serv->results[item];
+}
+
+static void bench_eval_execute(void* p_context, int item)
+{
+    serv_context_t* p_serv = p_context;
+    double          values[MB_FORMULA_VARIABLES];
+    double          answer = 0.0;
+    for (int i = 0; i < MB_FORMULA_VARIABLES; i++)
+    {
+        values[i] = p_serv->column_values[i][item];
+    }
+    eval_execute(&(p_serv->formula), values, &answer);
+    g_mb_sink = answer;
+}
+
+static void bench_eval_columns(void* p_context, int item)
+{
+    serv_context_t* p_serv = p_context;
+    eval_columns(&(p_serv->formula),
+                 p_serv->columns,
+                 MB_CORPUS_SIZE,
+                 p_serv->results,
+                 p_serv->errs);
+    g_mb_sink = p_serv->results[item];
+}
+
+static void bench_format_printf(void* p_context, int item)
+{
+    serv_context_t* p_serv = p_context;
+    g_mb_sink = snprintf(p_serv->response,
+                         MAX_BUFFER_SIZE,
+                         "The answer to the given equation is [%f]",
+                         p_serv->results[item]);
+}
+
+static void bench_format_response(void* p_context, int item)
+{
+    serv_context_t* p_serv = p_context;
+    g_mb_sink = format_response(p_serv->errs[item],
+                                p_serv->results[item],
+                                p_serv->response,
+                                MAX_BUFFER_SIZE);
+}
+
+static void bench_dtoa_shortest(void* p_context, int item)
+{
+    serv_context_t* p_serv = p_context;
+    g_mb_sink = dtoa_shortest(p_serv->results[item], p_serv->response);
+}
+
+int main(int argc, char** argv)
+{
+    if (false == mb_parse_args(argc, argv))
+    {
+        fprintf(stderr, "Usage: %s [-j] [-t MS] [-f FILTER]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Port parsing truncates its input in place, so every port is short
+    // enough to survive that unchanged.
+    //
+    size_t   port_bytes = 0;
+    unsigned port       = 1;
+    for (int i = 0; i < MB_CORPUS_SIZE; i++)
+    {
+        port = (port * 7919) % 65535 + 1;
+        port_bytes += snprintf(g_context.ports[i], MB_PORT_LENGTH, "%u", port);
+    }
+    mb_run("convert_port_number",
+           "ports",
+           &bench_port,
+           &g_context,
+           (double)port_bytes / MB_CORPUS_SIZE);
+
+    // One formula over a column of values per variable, run row by row and
+    // then all rows at once with the CPU's widest vector instructions.
+    //
+    eval_prepare(MB_FORMULA, strlen(MB_FORMULA), &(g_context.formula));
+    for (int i = 0; i < MB_FORMULA_VARIABLES; i++)
+    {
+        for (int row = 0; row < MB_CORPUS_SIZE; row++)
+        {
+            g_context.column_values[i][row] = (row * (i + 3)) % 97 + 0.5;
+        }
+        g_context.columns[i] = g_context.column_values[i];
+    }
+    double row_bytes = MB_FORMULA_VARIABLES * sizeof(double);
+    mb_run("eval_execute",
+           eval_columns_isa(),
+           &bench_eval_execute,
+           &g_context,
+           row_bytes);
+    mb_run("eval_columns_256",
+           eval_columns_isa(),
+           &bench_eval_columns,
+           &g_context,
+           row_bytes * MB_CORPUS_SIZE);
+
+    g_context.p_corpus = &g_corpus;
+    for (int length = 0; length < mb_corpus_length_count(); length++)
+    {
+        for (int mix = 0; mix < mb_corpus_mix_count(); mix++)
+        {
+            mb_generate_corpus(&g_corpus, length, mix);
+            double bytes = (double)g_corpus.postfix_bytes / MB_CORPUS_SIZE;
+            for (int i = 0; i < MB_CORPUS_SIZE; i++)
+            {
+                const char* p_input = g_corpus.postfix[i];
+                g_context.compile_errs[i] =
+                    eval_compile(p_input,
+                                 strlen(p_input),
+                                 &(g_context.programs[i]));
+            }
+
+            mb_run("sanitize_input_string", g_corpus.name,
+                   &bench_sanitize, &g_context, bytes);
+            mb_run("is_operator", g_corpus.name,
+                   &bench_is_operator, &g_context, bytes);
+            mb_run("eval_postfix", g_corpus.name,
+                   &bench_eval_postfix, &g_context, bytes);
+            mb_run("eval_stream_16", g_corpus.name,
+                   &bench_eval_stream, &g_context, bytes);
+            mb_run("eval_compile", g_corpus.name,
+                   &bench_eval_compile, &g_context, bytes);
+            mb_run("eval_program", g_corpus.name,
+                   &bench_eval_program, &g_context, bytes);
+            mb_run("eval_batch_256", g_corpus.name,
+                   &bench_eval_batch, &g_context,
+                   (double)g_corpus.postfix_bytes);
+
+            // The batch above leaves every answer in results.
+            //
+            mb_run("format_printf_f", g_corpus.name,
+                   &bench_format_printf, &g_context, bytes);
+            mb_run("format_response", g_corpus.name,
+                   &bench_format_response, &g_context, bytes);
+            mb_run("dtoa_shortest", g_corpus.name,
+                   &bench_dtoa_shortest, &g_context, bytes);
+        }
+    }
+    return EXIT_SUCCESS;
+} /* main */
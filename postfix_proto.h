@@ -0,0 +1,238 @@
+/** @file postfix_proto.h
+ *
+ * @brief Wire format shared by the postfix client and server.
+ *        After accepting, the server sends one handshake byte with the
+ *        highest protocol version it speaks. A client that wants framing
+ *        answers with PROTO_SELECT_FRAMED before its first frame; any other
+ *        first byte keeps the connection on the text protocol.
+ *        A server that answers PROTO_VERSION_SHM can also carry framed
+ *        traffic over shared memory. A client connected over a unix domain
+ *        socket may answer PROTO_SELECT_SHM instead, which selects framing
+ *        and asks for a shm_region_t; the server replies with one byte,
+ *        PROTO_SHM_ACCEPTED with the region's memory file attached as
+ *        SCM_RIGHTS, or PROTO_SHM_DECLINED, in which case frames keep
+ *        flowing over the socket. Once accepted, requests and responses are
+ *        written to the region's rings instead of the socket.
+ *        A server at its connection limit, or whose connection queue is
+ *        full, sends PROTO_REJECTED_MESSAGE in place of the handshake byte
+ *        and closes the connection.
+ *        Every frame starts with a FRAME_HEADER_SIZE byte header, all fields
+ *        big endian:
+ *          u32 payload length, u32 request id, u16 type, u16 status
+ *        Requests may be pipelined. Responses carry the id of the request
+ *        they answer.
+ *        MSG_EQUATION_BATCH carries u16 count followed by count
+ *        (u16 length, text) equations. MSG_BATCH_RESULT answers with u16
+ *        count followed by count (u16 item status, f64 result) pairs, in
+ *        request order.
+ *        Item statuses are the PROTO_EVAL codes.
+ *        MSG_BYTECODE carries an already converted equation as a sequence of
+ *        PROTO_OP codes, each PROTO_OP_PUSH followed by its f64 operand.
+ *        MSG_VALUE answers it with one (u16 status, f64 result) pair.
+ *        MSG_PREPARE carries a postfix equation that may name variables,
+ *        letters or underscores followed by letters, digits or underscores,
+ *        numbered in order of first appearance. The server compiles it once
+ *        and answers MSG_PREPARED with (u16 status, u32 handle, u16 variable
+ *        count). A constant longer than 127 characters is answered with
+ *        PROTO_EVAL_INVALID_NUMBER rather than stored rounded. Handles
+ *        belong to the connection, which holds at most
+ *        PROTO_MAX_PREPARED; preparing an equation again returns its
+ *        existing handle. MSG_EXECUTE carries (u32 handle) followed by one
+ *        f64 per variable and is answered with MSG_VALUE.
+ *        MSG_EXECUTE_COLUMNS runs a prepared equation over many rows at
+ *        once. It carries (u32 handle, u32 row count) followed by one column
+ *        of row count f64 values per variable, variable by variable; a
+ *        column longer than one frame allows is sent as several frames.
+ *        MSG_COLUMN_RESULT answers with (u16 status, u32 row count), then the
+ *        row count f64 results, then one u8 PROTO_EVAL code per row.
+ *        Every f64 is an IEEE-754 double sent big endian.
+ * @par
+ * COPYRIGHT NOTICE: (c) 2018 Barr Group. All rights reserved.
+ */
+
+#ifndef POSTFIX_PROTO_H
+#define POSTFIX_PROTO_H
+
+#include <stdint.h> // uint8_t, uint16_t, uint32_t, uint64_t
+#include <string.h> // memcpy
+
+#define PROTO_VERSION_TEXT '0'
+#define PROTO_VERSION_FRAMED '1'
+#define PROTO_VERSION_SHM '2'
+#define PROTO_SELECT_FRAMED 0xF1
+#define PROTO_SELECT_SHM 0xF2
+#define PROTO_SHM_ACCEPTED 'A'
+#define PROTO_SHM_DECLINED 'D'
+#define PROTO_REJECTED_MESSAGE "Unable to accept connection. Try again later.\n"
+
+#define FRAME_HEADER_SIZE 12
+#define MSG_EQUATION 1
+#define MSG_RESULT 2
+#define MSG_EQUATION_BATCH 3
+#define MSG_BATCH_RESULT 4
+#define MSG_BYTECODE 5
+#define MSG_VALUE 6
+#define MSG_PREPARE 7
+#define MSG_PREPARED 8
+#define MSG_EXECUTE 9
+#define MSG_EXECUTE_COLUMNS 10
+#define MSG_COLUMN_RESULT 11
+
+#define PROTO_MAX_PAYLOAD 16384
+#define PROTO_MAX_BATCH 256
+#define PROTO_BATCH_ITEM_RESULT_SIZE 10
+#define PROTO_MAX_BATCH_RESULT_SIZE (2 + (PROTO_MAX_BATCH * \
+                                          PROTO_BATCH_ITEM_RESULT_SIZE))
+#define PROTO_VALUE_SIZE PROTO_BATCH_ITEM_RESULT_SIZE
+
+#define PROTO_OP_PUSH 1
+#define PROTO_OP_ADD 2
+#define PROTO_OP_SUB 3
+#define PROTO_OP_MUL 4
+#define PROTO_OP_DIV 5
+#define PROTO_OP_MOD 6
+#define PROTO_PUSH_SIZE 9
+#define PROTO_MAX_OPS 128
+#define PROTO_MAX_BYTECODE_SIZE (PROTO_MAX_OPS * PROTO_PUSH_SIZE)
+
+#define PROTO_MAX_VARIABLES 32
+#define PROTO_MAX_PREPARED 64
+#define PROTO_PREPARED_SIZE 8
+#define PROTO_HANDLE_SIZE 4
+#define PROTO_BINDING_SIZE 8
+#define PROTO_MAX_EXECUTE_SIZE (PROTO_HANDLE_SIZE + \
+                                (PROTO_MAX_VARIABLES * PROTO_BINDING_SIZE))
+#define PROTO_MAX_COLUMN_ROWS 256
+#define PROTO_COLUMNS_HEADER_SIZE 8
+#define PROTO_COLUMN_RESULT_HEADER_SIZE 6
+#define PROTO_COLUMN_ITEM_RESULT_SIZE 9
+#define PROTO_MAX_COLUMN_RESULT_SIZE (PROTO_COLUMN_RESULT_HEADER_SIZE + \
+                                      (PROTO_MAX_COLUMN_ROWS *          \
+                                       PROTO_COLUMN_ITEM_RESULT_SIZE))
+
+#define PROTO_STATUS_OK 0
+#define PROTO_STATUS_EVAL_ERROR 1
+#define PROTO_STATUS_TOO_LONG 2
+#define PROTO_STATUS_BAD_TYPE 3
+#define PROTO_STATUS_BAD_FRAME 4
+
+#define PROTO_EVAL_OK 0
+#define PROTO_EVAL_STACK_UNDERFLOW 1
+#define PROTO_EVAL_DIVIDE_BY_ZERO 2
+#define PROTO_EVAL_TRAILING_OPERANDS 3
+#define PROTO_EVAL_STACK_OVERFLOW 4
+#define PROTO_EVAL_INVALID_NUMBER 5
+#define PROTO_EVAL_EMPTY_EQUATION 6
+#define PROTO_EVAL_TOO_LONG 7
+#define PROTO_EVAL_BAD_BYTECODE 8
+#define PROTO_EVAL_UNKNOWN_HANDLE 9
+#define PROTO_EVAL_BAD_BINDINGS 10
+#define PROTO_EVAL_TOO_MANY_PREPARED 11
+#define PROTO_EVAL_TOO_MANY_VARIABLES 12
+#define PROTO_EVAL_NO_MEMORY 13
+
+typedef struct frame_header_t {
+    uint32_t length;
+    uint32_t id;
+    uint16_t type;
+    uint16_t status;
+} frame_header_t;
+
+static inline void proto_put_u16(uint8_t* p_out, uint16_t value)
+{
+    p_out[0] = (uint8_t)(value >> 8);
+    p_out[1] = (uint8_t)value;
+}
+
+static inline void proto_put_u32(uint8_t* p_out, uint32_t value)
+{
+    p_out[0] = (uint8_t)(value >> 24);
+    p_out[1] = (uint8_t)(value >> 16);
+    p_out[2] = (uint8_t)(value >> 8);
+    p_out[3] = (uint8_t)value;
+}
+
+static inline uint16_t proto_get_u16(const uint8_t* p_in)
+{
+    return (uint16_t)((p_in[0] << 8) | p_in[1]);
+}
+
+static inline uint32_t proto_get_u32(const uint8_t* p_in)
+{
+    return ((uint32_t)p_in[0] << 24) | ((uint32_t)p_in[1] << 16) |
+           ((uint32_t)p_in[2] << 8)  | (uint32_t)p_in[3];
+}
+
+static inline void proto_put_f64(uint8_t* p_out, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    proto_put_u32(p_out, (uint32_t)(bits >> 32));
+    proto_put_u32(p_out + 4, (uint32_t)bits);
+}
+
+static inline double proto_get_f64(const uint8_t* p_in)
+{
+    uint64_t bits = ((uint64_t)proto_get_u32(p_in) << 32) |
+                    proto_get_u32(p_in + 4);
+    double   value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static inline const char* proto_eval_strerror(uint16_t status)
+{
+    switch (status)
+    {
+        case PROTO_EVAL_OK:
+            return "Success";
+        case PROTO_EVAL_STACK_UNDERFLOW:
+            return "Operator is missing an operand";
+        case PROTO_EVAL_DIVIDE_BY_ZERO:
+            return "Division by zero";
+        case PROTO_EVAL_TRAILING_OPERANDS:
+            return "Operands left without an operator";
+        case PROTO_EVAL_STACK_OVERFLOW:
+            return "Too many pending operands";
+        case PROTO_EVAL_INVALID_NUMBER:
+            return "Malformed number";
+        case PROTO_EVAL_EMPTY_EQUATION:
+            return "Empty equation";
+        case PROTO_EVAL_TOO_LONG:
+            return "Equation is too long";
+        case PROTO_EVAL_BAD_BYTECODE:
+            return "Malformed bytecode";
+        case PROTO_EVAL_UNKNOWN_HANDLE:
+            return "Unknown prepared equation";
+        case PROTO_EVAL_BAD_BINDINGS:
+            return "Wrong number of variable values";
+        case PROTO_EVAL_TOO_MANY_PREPARED:
+            return "Too many prepared equations";
+        case PROTO_EVAL_TOO_MANY_VARIABLES:
+            return "Too many variables";
+        case PROTO_EVAL_NO_MEMORY:
+            return "Server is out of memory";
+        default:
+            return "Unknown error";
+    }
+}
+
+static inline void proto_write_header(uint8_t*              p_out,
+                                      const frame_header_t* p_header)
+{
+    proto_put_u32(p_out, p_header->length);
+    proto_put_u32(p_out + 4, p_header->id);
+    proto_put_u16(p_out + 8, p_header->type);
+    proto_put_u16(p_out + 10, p_header->status);
+}
+
+static inline void proto_read_header(const uint8_t*  p_in,
+                                     frame_header_t* p_header)
+{
+    p_header->length = proto_get_u32(p_in);
+    p_header->id     = proto_get_u32(p_in + 4);
+    p_header->type   = proto_get_u16(p_in + 8);
+    p_header->status = proto_get_u16(p_in + 10);
+}
+
+#endif /* POSTFIX_PROTO_H */
@@ -0,0 +1,304 @@
+/** @file serv_admin.c
+ *
+ * @brief Local admin port for the postfix server. Every connection to it
+ *        receives a plain text report of the server's counters, one
+ *        "name value" pair per line, and is then closed, so the report can
+ *        be read with any line based tool. The port only listens on the
+ *        loopback interface.
+ * @par
+ * COPYRIGHT NOTICE: (c) 2018 Barr Group. All rights reserved.
+ */
+
+#define _XOPEN_SOURCE 700
+#include <errno.h> // errno, EINTR
+#include <netinet/in.h> // sockaddr_in, INADDR_LOOPBACK
+#include <pthread.h>
+#include <semaphore.h> // sem_getvalue
+#include <stdarg.h> // va_list
+#include <stdatomic.h> // atomic_load
+#include <stdbool.h>
+#include <stdio.h> // stderr, vsnprintf
+#include <stdlib.h> // malloc, free
+#include <string.h> // strerror
+#include <sys/socket.h> // accept, send, shutdown
+#include <unistd.h> // close
+
+#include "serv_lib.h"
+#include "serv_admin.h"
+#include "serv_metrics.h"
+#include "serv_pool.h"
+
+typedef struct admin_report_t {
+    size_t length;
+    char   text[ADMIN_REPORT_SIZE];
+} admin_report_t;
+
+/**
+ * @brief Appends one line to a report. Lines that do not fit are dropped.
+ */
+static void report_line(admin_report_t* p_report, const char* p_format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void report_line(admin_report_t* p_report, const char* p_format, ...)
+{
+    size_t  space = ADMIN_REPORT_SIZE - p_report->length;
+    va_list args;
+    va_start(args, p_format);
+    int length = vsnprintf(p_report->text + p_report->length,
+                           space,
+                           p_format,
+                           args);
+    va_end(args);
+    if (0 < length && (size_t)length < space)
+    {
+        p_report->length += length;
+    }
+} /* report_line */
+
+/**
+ * @brief Writes the current counters of a server into a report.
+ * @param[in] p_serv A pointer to the running server.
+ * @param[out] p_report A pointer to an empty report.
+ * @param[in] p_snapshot A pointer to scratch space for the metrics.
+ */
+static void build_report(serv_t*                  p_serv,
+                         admin_report_t*          p_report,
+                         serv_metrics_snapshot_t* p_snapshot)
+{
+    serv_metrics_snapshot(p_snapshot);
+
+    // Sharded servers report the sum over every shard.
+    //
+    int      shard_count     = 0;
+    int      threads         = 0;
+    int      max_connections = 0;
+    int      active          = 0;
+    int      pool_workers    = 0;
+    uint64_t queue_depth     = 0;
+    uint64_t queue_capacity  = 0;
+    uint64_t queue_max_depth = 0;
+    uint64_t waiting         = 0;
+    for (serv_t* p_shard = p_serv; NULL != p_shard;
+         p_shard = p_shard->p_next_shard)
+    {
+        fd_queue_stats_t queue;
+        fd_queue_get_stats(&(p_shard->connection_queue), &queue);
+
+        int free_slots = 0;
+        sem_getvalue(&(p_shard->client_count_sem), &free_slots);
+
+        shard_count++;
+        threads         += p_shard->thread_count;
+        max_connections += p_shard->max_connections;
+        active          += p_shard->max_connections - free_slots;
+        pool_workers    += work_pool_worker_count(p_shard);
+        waiting         += atomic_load(&(p_shard->admission.count));
+        queue_depth     += queue.depth;
+        queue_capacity  += queue.capacity;
+        if (queue.max_depth > queue_max_depth)
+        {
+            queue_max_depth = queue.max_depth;
+        }
+    }
+
+    report_line(p_report, "uptime_ms %llu\n",
+                (unsigned long long)((monotonic_ns() - p_serv->start_ns) /
+                                     1000000));
+    report_line(p_report, "mode %s\n",
+                (SERV_MODE_EPOLL == p_serv->mode) ? "epoll" :
+                (SERV_MODE_POOL == p_serv->mode)  ? "pool" :
+                (SERV_MODE_URING == p_serv->mode) ? "uring" : "thread");
+    report_line(p_report, "shards %d\n", shard_count);
+    report_line(p_report, "threads %d\n", threads);
+    if (SERV_MODE_POOL == p_serv->mode)
+    {
+        report_line(p_report, "pool_workers %d\n", pool_workers);
+    }
+    report_line(p_report, "max_connections %d\n", max_connections);
+    report_line(p_report, "connections_active %d\n", active);
+    report_line(p_report, "connections_waiting %llu\n",
+                (unsigned long long)waiting);
+    for (int m = 0; m < SERV_METRIC_COUNT; m++)
+    {
+        report_line(p_report, "%s %llu\n",
+                    serv_metric_name(m),
+                    (unsigned long long)p_snapshot->totals[m]);
+    }
+    report_line(p_report, "queue_depth %llu\n",
+                (unsigned long long)queue_depth);
+    report_line(p_report, "queue_capacity %llu\n",
+                (unsigned long long)queue_capacity);
+    report_line(p_report, "queue_max_depth %llu\n",
+                (unsigned long long)queue_max_depth);
+
+    for (int t = 0; t < SERV_TIMER_COUNT; t++)
+    {
+        const histogram_t* p_timer = &(p_snapshot->timers[t]);
+        const char*        p_name  = serv_timer_name(t);
+        report_line(p_report, "%s_count %llu\n",
+                    p_name, (unsigned long long)p_timer->count);
+        report_line(p_report, "%s_p50 %llu\n", p_name,
+                    (unsigned long long)histogram_percentile(p_timer, 50.0));
+        report_line(p_report, "%s_p99 %llu\n", p_name,
+                    (unsigned long long)histogram_percentile(p_timer, 99.0));
+        report_line(p_report, "%s_p999 %llu\n", p_name,
+                    (unsigned long long)histogram_percentile(p_timer, 99.9));
+        report_line(p_report, "%s_max %llu\n",
+                    p_name, (unsigned long long)p_timer->max);
+    }
+
+    // Threads are numbered in the order they first recorded anything, so the
+    // acceptor is usually thread 0.
+    //
+    for (int i = 0; i < p_snapshot->thread_count; i++)
+    {
+        report_line(p_report, "thread_%d_requests %llu\n",
+                    i, (unsigned long long)p_snapshot->thread_requests[i]);
+    }
+} /* build_report */
+
+/**
+ * @brief Admin thread body. Answers every admin connection with a report
+ *        until the admin listener is shut down.
+ * @param[in] args A pointer to the running serv_t struct.
+ * @return NULL on thread exit
+ */
+static void* admin_handler(void* args)
+{
+    serv_t*                  p_serv     = (serv_t*)args;
+    admin_report_t*          p_report   = malloc(sizeof(admin_report_t));
+    serv_metrics_snapshot_t* p_snapshot =
+        malloc(sizeof(serv_metrics_snapshot_t));
+    if (NULL == p_report || NULL == p_snapshot)
+    {
+        fprintf(stderr,
+                "Error allocating admin report. [%s]\n",
+                strerror(errno));
+        free(p_report);
+        free(p_snapshot);
+        return NULL;
+    }
+
+    while (true)
+    {
+        int client_fd = accept(p_serv->admin_fd, NULL, NULL);
+        if (0 > client_fd)
+        {
+            if (EINTR == errno || ECONNABORTED == errno)
+            {
+                continue;
+            }
+            break;
+        }
+
+        p_report->length = 0;
+        build_report(p_serv, p_report, p_snapshot);
+
+        size_t offset = 0;
+        while (offset < p_report->length)
+        {
+            ssize_t bytes_sent = send(client_fd,
+                                      p_report->text + offset,
+                                      p_report->length - offset,
+                                      MSG_NOSIGNAL);
+            if (0 > bytes_sent && EINTR == errno)
+            {
+                continue;
+            }
+            if (0 >= bytes_sent)
+            {
+                break;
+            }
+            offset += bytes_sent;
+        }
+        close(client_fd);
+    }
+
+    free(p_report);
+    free(p_snapshot);
+    return NULL;
+} /* admin_handler */
+
+/**
+ * @brief Binds the admin port on the loopback interface and starts the
+ *        thread that serves it.
+ * @param[in] p_serv A pointer to a serv_t struct with admin_port set.
+ * @return SERV_INIT_SUCCESS if the admin port is being served.
+ *         SERV_INIT_FAILURE if it could not be bound or served.
+ */
+int init_admin(serv_t* p_serv)
+{
+    p_serv->admin_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (0 > p_serv->admin_fd)
+    {
+        fprintf(stderr,
+                "Failed to create admin socket. [%s]\n",
+                strerror(errno));
+        return SERV_INIT_FAILURE;
+    }
+
+    int optval = 1;
+    setsockopt(p_serv->admin_fd,
+               SOL_SOCKET,
+               SO_REUSEADDR,
+               &optval,
+               sizeof(optval));
+
+    struct sockaddr_in admin_addr = { 0 };
+    admin_addr.sin_family      = AF_INET;
+    admin_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    admin_addr.sin_port        = htons(p_serv->admin_port);
+    if (0 > bind(p_serv->admin_fd,
+                 (struct sockaddr*)&admin_addr,
+                 sizeof(admin_addr)) ||
+        0 > listen(p_serv->admin_fd, ADMIN_LISTEN_BACKLOG))
+    {
+        fprintf(stderr,
+                "Failed to listen on admin port. [%s]\n",
+                strerror(errno));
+        close(p_serv->admin_fd);
+        return SERV_INIT_FAILURE;
+    }
+
+    int err = pthread_create(&(p_serv->admin_thread_id),
+                             NULL,
+                             &admin_handler,
+                             p_serv);
+    if (0 != err)
+    {
+        fprintf(stderr,
+                "Thread unable to be created. [%s]\n",
+                strerror(err));
+        close(p_serv->admin_fd);
+        return SERV_INIT_FAILURE;
+    }
+
+    p_serv->b_admin_running = true;
+    printf("Admin port listening on [127.0.0.1:%d]\n", p_serv->admin_port);
+    return SERV_INIT_SUCCESS;
+} /* init_admin */
+
+/**
+ * @brief Stops serving the admin port. Safe to call if it never started.
+ * @param[in] p_serv A pointer to the serv_t struct the admin port was
+ *                   started with.
+ */
+void shutdown_admin(serv_t* p_serv)
+{
+    if (false == p_serv->b_admin_running)
+    {
+        return;
+    }
+    p_serv->b_admin_running = false;
+
+    // Shutting the listener down fails the blocked accept, which ends the
+    // admin thread.
+    //
+    shutdown(p_serv->admin_fd, SHUT_RDWR);
+    int err = pthread_join(p_serv->admin_thread_id, NULL);
+    if (0 != err)
+    {
+        fprintf(stderr, "Error joining thread. [%s]\n", strerror(err));
+    }
+    close(p_serv->admin_fd);
+} /* shutdown_admin */
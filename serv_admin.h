@@ -0,0 +1,7 @@
+#include <stdbool.h>
+
+#define ADMIN_LISTEN_BACKLOG 4
+#define ADMIN_REPORT_SIZE 32768
+
+int  init_admin(serv_t* p_serv);
+void shutdown_admin(serv_t* p_serv);
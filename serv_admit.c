@@ -0,0 +1,232 @@
+/** @file serv_admit.c
+ *
+ * @brief Waiting room for clients that arrive while the server is at its
+ *        connection limit. Rather than turning every client over the limit
+ *        away at once, arrivals wait for a slot in FIFO order and are only
+ *        shed once the time they spend waiting stays above a target, using
+ *        the CoDel control law (RFC 8289) on each waiter's sojourn time.
+ * @par
+ * COPYRIGHT NOTICE: (c) 2018 Barr Group. All rights reserved.
+ */
+
+#include <errno.h> // errno
+#include <math.h> // sqrt
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h> // stderr
+#include <stdlib.h> // calloc, free
+#include <string.h> // strerror
+
+#include "serv_admit.h"
+
+/**
+ * @brief Initializes an empty waiting room.
+ * @param[in] p_queue A pointer to the queue to initialize.
+ * @param[in] capacity The most clients that may wait. 0 turns every client
+ *                     over the limit away, as if there were no queue.
+ * @param[in] target_ns The waiting time above which clients start being
+ *                      shed. The CoDel interval is ADMIT_INTERVAL_FACTOR
+ *                      times the target.
+ * @return ADMIT_INIT_SUCCESS if the queue is ready for use.
+ *         ADMIT_INIT_FAILURE if memory could not be allocated.
+ */
+int admit_queue_init(admit_queue_t* p_queue,
+                     size_t         capacity,
+                     uint64_t       target_ns)
+{
+    p_queue->p_entries = calloc((0 < capacity) ? capacity : 1,
+                                sizeof(admit_entry_t));
+    if (NULL == p_queue->p_entries)
+    {
+        fprintf(stderr,
+                "Unable to allocate admission queue. [%s]\n",
+                strerror(errno));
+        return ADMIT_INIT_FAILURE;
+    }
+
+    int err = pthread_mutex_init(&(p_queue->lock), NULL);
+    if (0 != err)
+    {
+        fprintf(stderr,
+                "Unable to initiate admission queue lock. [%s]\n",
+                strerror(err));
+        free(p_queue->p_entries);
+        p_queue->p_entries = NULL;
+        return ADMIT_INIT_FAILURE;
+    }
+
+    p_queue->capacity        = capacity;
+    p_queue->head            = 0;
+    p_queue->target_ns       = target_ns;
+    p_queue->interval_ns     = target_ns * ADMIT_INTERVAL_FACTOR;
+    p_queue->first_above_ns  = 0;
+    p_queue->drop_next_ns    = 0;
+    p_queue->drop_count      = 0;
+    p_queue->last_drop_count = 0;
+    p_queue->b_dropping      = false;
+    atomic_init(&(p_queue->count), 0);
+    return ADMIT_INIT_SUCCESS;
+} /* admit_queue_init */
+
+/**
+ * @brief Releases the queue's memory. Any clients still waiting are popped
+ *        and closed by the caller beforehand.
+ * @param[in] p_queue A pointer to an initialized queue.
+ */
+void admit_queue_destroy(admit_queue_t* p_queue)
+{
+    if (NULL == p_queue->p_entries)
+    {
+        return;
+    }
+    pthread_mutex_destroy(&(p_queue->lock));
+    free(p_queue->p_entries);
+    p_queue->p_entries = NULL;
+} /* admit_queue_destroy */
+
+/**
+ * @brief Adds a client to the back of the queue.
+ * @param[in] p_queue A pointer to an initialized queue.
+ * @param[in] fd The accepted client's socket File Descriptor
+ * @param[in] now_ns The time the client arrived.
+ * @return True if the client is waiting.
+ *         False if the queue is full.
+ */
+bool admit_queue_push(admit_queue_t* p_queue, int fd, uint64_t now_ns)
+{
+    size_t count = atomic_load(&(p_queue->count));
+    if (p_queue->capacity == count)
+    {
+        return false;
+    }
+    admit_entry_t* p_entry =
+        &(p_queue->p_entries[(p_queue->head + count) % p_queue->capacity]);
+    p_entry->fd         = fd;
+    p_entry->arrival_ns = now_ns;
+    atomic_store(&(p_queue->count), count + 1);
+    return true;
+} /* admit_queue_push */
+
+/**
+ * @brief Schedules the next drop interval / sqrt(drops) after a time.
+ */
+static uint64_t control_law(const admit_queue_t* p_queue, uint64_t time_ns)
+{
+    return time_ns + (uint64_t)((double)p_queue->interval_ns /
+                                sqrt((double)p_queue->drop_count));
+} /* control_law */
+
+/**
+ * @brief Runs the CoDel state machine for the client at the front of the
+ *        queue.
+ * @param[in] p_queue A pointer to a non-empty queue.
+ * @param[in] now_ns The current time.
+ * @return True if the client should be shed.
+ */
+static bool should_shed_head(admit_queue_t* p_queue, uint64_t now_ns)
+{
+    uint64_t sojourn_ns  = now_ns -
+                           p_queue->p_entries[p_queue->head].arrival_ns;
+    bool     b_ok_to_drop = false;
+    if (sojourn_ns < p_queue->target_ns)
+    {
+        p_queue->first_above_ns = 0;
+    }
+    else if (0 == p_queue->first_above_ns)
+    {
+        p_queue->first_above_ns = now_ns + p_queue->interval_ns;
+    }
+    else if (now_ns >= p_queue->first_above_ns)
+    {
+        b_ok_to_drop = true;
+    }
+
+    if (p_queue->b_dropping)
+    {
+        if (false == b_ok_to_drop)
+        {
+            p_queue->b_dropping = false;
+            return false;
+        }
+        if (now_ns < p_queue->drop_next_ns)
+        {
+            return false;
+        }
+        p_queue->drop_count++;
+        p_queue->drop_next_ns = control_law(p_queue, p_queue->drop_next_ns);
+        return true;
+    }
+
+    if (false == b_ok_to_drop)
+    {
+        return false;
+    }
+
+    // Resume near the previous drop rate if the last dropping state ended
+    // recently, since the overload probably has not gone away.
+    //
+    uint32_t delta = p_queue->drop_count - p_queue->last_drop_count;
+    p_queue->b_dropping = true;
+    p_queue->drop_count =
+        (1 < delta &&
+         now_ns - p_queue->drop_next_ns <
+             ADMIT_DROP_MEMORY_INTERVALS * p_queue->interval_ns) ? delta : 1;
+    p_queue->drop_next_ns    = control_law(p_queue, now_ns);
+    p_queue->last_drop_count = p_queue->drop_count;
+    return true;
+} /* should_shed_head */
+
+/**
+ * @brief Removes the client at the front of the queue.
+ */
+static int remove_head(admit_queue_t* p_queue)
+{
+    int fd = p_queue->p_entries[p_queue->head].fd;
+    p_queue->head = (p_queue->head + 1) % p_queue->capacity;
+    atomic_fetch_sub(&(p_queue->count), 1);
+    return fd;
+} /* remove_head */
+
+/**
+ * @brief Removes the client at the front of the queue because a slot is
+ *        free for it.
+ * @param[in] p_queue A pointer to an initialized queue.
+ * @param[in] now_ns The current time.
+ * @param[out] p_b_shed A pointer set to true if the client waited too long
+ *                      and should be turned away instead; pop again for the
+ *                      next client.
+ * @return The client's socket File Descriptor
+ *         ADMIT_EMPTY if no client is waiting.
+ */
+int admit_queue_pop(admit_queue_t* p_queue, uint64_t now_ns, bool* p_b_shed)
+{
+    *p_b_shed = false;
+    if (0 == atomic_load(&(p_queue->count)))
+    {
+        p_queue->first_above_ns = 0;
+        p_queue->b_dropping     = false;
+        return ADMIT_EMPTY;
+    }
+    *p_b_shed = should_shed_head(p_queue, now_ns);
+    return remove_head(p_queue);
+} /* admit_queue_pop */
+
+/**
+ * @brief Removes the client at the front of the queue only if it should be
+ *        shed. Called while no slot is free, so clients are turned away
+ *        even while every connection stays open.
+ * @param[in] p_queue A pointer to an initialized queue.
+ * @param[in] now_ns The current time.
+ * @return The socket File Descriptor of the client to turn away.
+ *         ADMIT_EMPTY if no client should be shed.
+ */
+int admit_queue_shed(admit_queue_t* p_queue, uint64_t now_ns)
+{
+    if (0 == atomic_load(&(p_queue->count)) ||
+        false == should_shed_head(p_queue, now_ns))
+    {
+        return ADMIT_EMPTY;
+    }
+    return remove_head(p_queue);
+} /* admit_queue_shed */
@@ -0,0 +1,54 @@
+#ifndef SERV_ADMIT_H
+#define SERV_ADMIT_H
+
+#include <pthread.h> // pthread_mutex_t
+#include <stdatomic.h> // atomic_size_t
+#include <stdbool.h>
+#include <stddef.h> // size_t
+#include <stdint.h> // uint32_t, uint64_t
+
+#define ADMIT_INIT_SUCCESS 0
+#define ADMIT_INIT_FAILURE -1
+#define ADMIT_EMPTY -1
+#define DEFAULT_ADMIT_DEPTH 128
+#define DEFAULT_ADMIT_TARGET_MS 5
+#define ADMIT_INTERVAL_FACTOR 20
+#define ADMIT_DROP_MEMORY_INTERVALS 16
+
+typedef struct admit_entry_t {
+    int      fd;
+    uint64_t arrival_ns;
+} admit_entry_t;
+
+/**
+ * @brief Bounded FIFO of accepted clients waiting for a connection slot.
+ *        Waiters are shed with CoDel: once every waiter has been held
+ *        longer than target_ns for a whole interval_ns, one waiter is turned
+ *        away per interval / sqrt(drops) until the delay falls below the
+ *        target again. Bursts shorter than an interval are absorbed.
+ *        Every call is made with lock held; count may be read without it.
+ */
+typedef struct admit_queue_t {
+    pthread_mutex_t lock;
+    admit_entry_t*  p_entries;
+    size_t          capacity;
+    size_t          head;
+    atomic_size_t   count;
+    uint64_t        target_ns;
+    uint64_t        interval_ns;
+    uint64_t        first_above_ns;
+    uint64_t        drop_next_ns;
+    uint32_t        drop_count;
+    uint32_t        last_drop_count;
+    bool            b_dropping;
+} admit_queue_t;
+
+int  admit_queue_init(admit_queue_t* p_queue,
+                      size_t         capacity,
+                      uint64_t       target_ns);
+void admit_queue_destroy(admit_queue_t* p_queue);
+bool admit_queue_push(admit_queue_t* p_queue, int fd, uint64_t now_ns);
+int  admit_queue_pop(admit_queue_t* p_queue, uint64_t now_ns, bool* p_b_shed);
+int  admit_queue_shed(admit_queue_t* p_queue, uint64_t now_ns);
+
+#endif /* SERV_ADMIT_H */
@@ -0,0 +1,1197 @@
+/** @file serv_conn.c
+ *
+ * @brief Incremental request parsing for a buffered client connection.
+ *        Shared by every serving mode. Text connections carry newline
+ *        terminated equations; framed connections carry length prefixed
+ *        frames, any number of which are parsed out of one read. Equations
+ *        of either protocol longer than MAX_BUFFER_SIZE are evaluated as
+ *        their bytes arrive, so their length is bounded only by the memory
+ *        their pending operands need. Framed clients may prepare equations
+ *        that name variables and then execute them by handle, one row of
+ *        values or whole columns at a time.
+ * @par
+ * COPYRIGHT NOTICE: (c) 2018 Barr Group. All rights reserved.
+ */
+
+#define _XOPEN_SOURCE 700
+#include <errno.h> // errno, EAGAIN
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h> // stderr
+#include <stdlib.h> // free, malloc, realloc
+#include <string.h> // memchr, memcmp, memmove, strerror
+#include <sys/socket.h> // send, recv, MSG_NOSIGNAL
+
+#include "serv_lib.h"
+#include "serv_conn.h"
+#include "serv_eval.h"
+#include "serv_log.h"
+#include "serv_metrics.h"
+
+/**
+ * @brief Working memory for evaluating one batch or one frame of columns.
+ *        Too large for a loop thread's stack, so each thread allocates one
+ *        on its first batch and keeps it for its lifetime.
+ */
+typedef struct batch_scratch_t {
+    eval_program_t programs[EVAL_MAX_BATCH];
+    int            compile_errs[EVAL_MAX_BATCH];
+    int            errs[EVAL_MAX_BATCH];
+    double         results[EVAL_MAX_BATCH];
+    const double*  columns[EVAL_MAX_VARIABLES];
+    double         column_values[PROTO_MAX_PAYLOAD / PROTO_BINDING_SIZE];
+    int            column_errs[EVAL_MAX_COLUMN_ROWS];
+    double         column_results[EVAL_MAX_COLUMN_ROWS];
+} batch_scratch_t;
+
+static _Thread_local batch_scratch_t* gp_batch_scratch = NULL;
+
+/**
+ * @brief Resets a connection's parse and output state.
+ * @param[in] p_conn A pointer to the connection to initialize.
+ * @param[in] fd The client's socket File Descriptor
+ */
+void conn_init(conn_t* p_conn, int fd)
+{
+    p_conn->fd                = fd;
+    p_conn->proto             = CONN_PROTO_UNKNOWN;
+    p_conn->b_shm_capable     = false;
+    p_conn->b_shm_requested   = false;
+    p_conn->in_length         = 0;
+    p_conn->skip_remaining    = 0;
+    p_conn->b_streaming       = false;
+    p_conn->b_input_pending   = false;
+    p_conn->p_prepared        = NULL;
+    p_conn->prepared_count    = 0;
+    p_conn->prepared_capacity = 0;
+    p_conn->out_offset        = 0;
+    p_conn->out_length        = 0;
+    p_conn->p_prev            = NULL;
+    p_conn->p_next            = NULL;
+    conn_timer_init(&(p_conn->timer), fd);
+    eval_stream_begin(&(p_conn->stream), g_serv_stream_memory);
+} /* conn_init */
+
+/**
+ * @brief Frees memory held by an equation that was still streaming when the
+ *        connection closed, and by the connection's prepared equations. Call
+ *        before freeing or reusing the connection.
+ * @param[in] p_conn A pointer to the connection being closed.
+ */
+void conn_release(conn_t* p_conn)
+{
+    eval_stream_release(&(p_conn->stream));
+    p_conn->b_streaming = false;
+    free(p_conn->p_prepared);
+    p_conn->p_prepared        = NULL;
+    p_conn->prepared_count    = 0;
+    p_conn->prepared_capacity = 0;
+} /* conn_release */
+
+/**
+ * @brief Checks if there is room left in the output buffer for one more
+ *        response.
+ */
+bool conn_has_response_room(conn_t* p_conn)
+{
+    return (CONN_OUT_BUFFER_SIZE - p_conn->out_length) >=
+           CONN_MAX_RESPONSE_SIZE;
+} /* conn_has_response_room */
+
+/**
+ * @brief Checks if there is room left in the output buffer for the largest
+ *        batch response.
+ */
+static bool has_batch_response_room(conn_t* p_conn)
+{
+    return (CONN_OUT_BUFFER_SIZE - p_conn->out_length) >=
+           CONN_MAX_BATCH_RESPONSE_SIZE;
+} /* has_batch_response_room */
+
+/**
+ * @brief Writes an evaluation status and answer in their binary form.
+ * @param[out] p_value A pointer to PROTO_VALUE_SIZE bytes.
+ * @param[in] eval_err EVAL_SUCCESS or the evaluation error.
+ * @param[in] answer The answer.
+ */
+static void put_value(uint8_t* p_value, int eval_err, double answer)
+{
+    proto_put_u16(p_value, (uint16_t)-eval_err);
+    proto_put_f64(p_value + 2, answer);
+} /* put_value */
+
+/**
+ * @brief Queues the answer to a text equation in the configured format.
+ * @param[in] p_conn A pointer to the connection the equation arrived on.
+ * @param[in] eval_err EVAL_SUCCESS or the evaluation error.
+ * @param[in] answer The answer, if eval_err is EVAL_SUCCESS.
+ */
+static void queue_text_answer(conn_t* p_conn, int eval_err, double answer)
+{
+    char* p_response = p_conn->out_buffer + p_conn->out_length;
+    if (SERV_RESPONSE_BINARY == g_serv_response_format)
+    {
+        put_value((uint8_t*)p_response, eval_err, answer);
+        p_conn->out_length += PROTO_VALUE_SIZE;
+        return;
+    }
+    p_conn->out_length += format_response(eval_err,
+                                          answer,
+                                          p_response,
+                                          MAX_BUFFER_SIZE);
+
+    // Bare numbers need a terminator on a stream; frames already have one.
+    //
+    if (SERV_RESPONSE_NUMBER == g_serv_response_format)
+    {
+        p_conn->out_buffer[p_conn->out_length++] = '\n';
+    }
+} /* queue_text_answer */
+
+/**
+ * @brief Evaluates one text equation and queues the response.
+ * @param[in] p_conn A pointer to the connection the equation arrived on.
+ * @param[in] p_equation A pointer to the null terminated equation.
+ */
+static void dispatch_text_equation(conn_t* p_conn, char* p_equation)
+{
+    sanitize_input_string(p_equation);
+    SERV_LOG(SERV_LOG_LEVEL_REQUEST,
+             "Server received message: [%s]\n",
+             p_equation);
+
+    double answer = 0.0;
+    int    err    = evaluate_equation(p_equation, &answer);
+    queue_text_answer(p_conn, err, answer);
+} /* dispatch_text_equation */
+
+/**
+ * @brief Queues a response frame.
+ * @param[in] p_conn A pointer to the connection to respond on.
+ * @param[in] id The id of the request being answered.
+ * @param[in] type MSG_RESULT, MSG_BATCH_RESULT, MSG_VALUE, MSG_PREPARED or
+ *                 MSG_COLUMN_RESULT.
+ * @param[in] status One of the PROTO_STATUS codes.
+ * @param[in] length The length of the payload, already written in place
+ *                   after the header.
+ */
+static void queue_frame(conn_t*  p_conn,
+                        uint32_t id,
+                        uint16_t type,
+                        uint16_t status,
+                        size_t   length)
+{
+    frame_header_t header = { 0 };
+    header.length = (uint32_t)length;
+    header.id     = id;
+    header.type   = type;
+    header.status = status;
+    proto_write_header((uint8_t*)(p_conn->out_buffer + p_conn->out_length),
+                       &header);
+    p_conn->out_length += FRAME_HEADER_SIZE + length;
+} /* queue_frame */
+
+/**
+ * @brief Queues the answer to a framed equation in the configured format.
+ * @param[in] p_conn A pointer to the connection the equation arrived on.
+ * @param[in] id The id of the request.
+ * @param[in] eval_err EVAL_SUCCESS or the evaluation error.
+ * @param[in] answer The answer, if eval_err is EVAL_SUCCESS.
+ */
+static void queue_framed_answer(conn_t*  p_conn,
+                                uint32_t id,
+                                int      eval_err,
+                                double   answer)
+{
+    char*    p_response = p_conn->out_buffer + p_conn->out_length +
+                          FRAME_HEADER_SIZE;
+    uint16_t status     = (EVAL_SUCCESS == eval_err) ?
+                              PROTO_STATUS_OK : PROTO_STATUS_EVAL_ERROR;
+
+    // Binary answers go out exactly as answers to bytecode do.
+    //
+    if (SERV_RESPONSE_BINARY == g_serv_response_format)
+    {
+        put_value((uint8_t*)p_response, eval_err, answer);
+        queue_frame(p_conn, id, MSG_VALUE, status, PROTO_VALUE_SIZE);
+        return;
+    }
+
+    int response_length = format_response(eval_err,
+                                          answer,
+                                          p_response,
+                                          MAX_BUFFER_SIZE);
+    queue_frame(p_conn, id, MSG_RESULT, status, response_length);
+} /* queue_framed_answer */
+
+/**
+ * @brief Evaluates one framed equation and queues the response frame.
+ * @param[in] p_conn A pointer to the connection the equation arrived on.
+ * @param[in] id The id of the request.
+ * @param[in] p_equation A pointer to the equation. The byte after the
+ *                       payload is borrowed as a null terminator.
+ * @param[in] length The length of the equation.
+ */
+static void dispatch_framed_equation(conn_t*  p_conn,
+                                     uint32_t id,
+                                     char*    p_equation,
+                                     size_t   length)
+{
+    char next_byte = p_equation[length];
+    p_equation[length] = '\0';
+    sanitize_input_string(p_equation);
+    SERV_LOG(SERV_LOG_LEVEL_REQUEST,
+             "Server received message: [%s]\n",
+             p_equation);
+
+    double answer   = 0.0;
+    int    eval_err = evaluate_equation(p_equation, &answer);
+    p_equation[length] = next_byte;
+    queue_framed_answer(p_conn, id, eval_err, answer);
+} /* dispatch_framed_equation */
+
+/**
+ * @brief Checks if there is room left in the output buffer for the largest
+ *        column response.
+ */
+static bool has_column_response_room(conn_t* p_conn)
+{
+    return (CONN_OUT_BUFFER_SIZE - p_conn->out_length) >=
+           CONN_MAX_COLUMN_RESPONSE_SIZE;
+} /* has_column_response_room */
+
+/**
+ * @brief Gets the loop thread's scratch memory, allocating it on first use.
+ * @return A pointer to the scratch memory, or NULL if it could not be
+ *         allocated.
+ */
+static batch_scratch_t* get_scratch(void)
+{
+    if (NULL == gp_batch_scratch)
+    {
+        gp_batch_scratch = malloc(sizeof(batch_scratch_t));
+        if (NULL == gp_batch_scratch)
+        {
+            SERV_LOG(SERV_LOG_LEVEL_ERROR,
+                     "Error allocating batch state. [%s]\n",
+                     strerror(errno));
+        }
+    }
+    return gp_batch_scratch;
+} /* get_scratch */
+
+/**
+ * @brief Compiles and evaluates every equation of a batch frame and queues
+ *        one MSG_BATCH_RESULT frame answering all of them.
+ * @param[in] p_conn A pointer to the connection the batch arrived on.
+ * @param[in] id The id of the request.
+ * @param[in] p_payload A pointer to the batch payload.
+ * @param[in] length The length of the payload.
+ */
+static void dispatch_batch(conn_t*        p_conn,
+                           uint32_t       id,
+                           const uint8_t* p_payload,
+                           size_t         length)
+{
+    batch_scratch_t* p_scratch = get_scratch();
+    if (NULL == p_scratch)
+    {
+        queue_frame(p_conn, id, MSG_BATCH_RESULT, PROTO_STATUS_EVAL_ERROR, 0);
+        return;
+    }
+
+    int    count  = (2 <= length) ? proto_get_u16(p_payload) : -1;
+    size_t offset = 2;
+    if (0 > count || EVAL_MAX_BATCH < count)
+    {
+        count = -1;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (offset + 2 > length)
+        {
+            count = -1;
+            break;
+        }
+        size_t item_length = proto_get_u16(p_payload + offset);
+        offset += 2;
+        if (offset + item_length > length)
+        {
+            count = -1;
+            break;
+        }
+        p_scratch->compile_errs[i] =
+            eval_compile((const char*)(p_payload + offset),
+                         item_length,
+                         &(p_scratch->programs[i]));
+        offset += item_length;
+    }
+    if (0 > count || offset != length)
+    {
+        serv_metrics_add(SERV_METRIC_ERRORS, 1);
+        SERV_LOG(SERV_LOG_LEVEL_WARN, "Rejecting malformed batch frame.\n");
+        queue_frame(p_conn, id, MSG_BATCH_RESULT, PROTO_STATUS_BAD_FRAME, 0);
+        return;
+    }
+
+    SERV_LOG(SERV_LOG_LEVEL_REQUEST,
+             "Server received batch of [%d] equations.\n",
+             count);
+    uint64_t start_ns = monotonic_ns();
+    eval_batch(p_scratch->programs,
+               p_scratch->compile_errs,
+               count,
+               p_scratch->results,
+               p_scratch->errs);
+    serv_metrics_record(SERV_TIMER_EVAL, monotonic_ns() - start_ns);
+    serv_metrics_add(SERV_METRIC_REQUESTS, count);
+
+    uint8_t* p_result = (uint8_t*)(p_conn->out_buffer + p_conn->out_length +
+                                   FRAME_HEADER_SIZE);
+    proto_put_u16(p_result, (uint16_t)count);
+    p_result += 2;
+    int failed = 0;
+    for (int i = 0; i < count; i++)
+    {
+        failed += (EVAL_SUCCESS != p_scratch->errs[i]);
+        proto_put_u16(p_result, (uint16_t)-(p_scratch->errs[i]));
+        proto_put_f64(p_result + 2,
+                      (EVAL_SUCCESS == p_scratch->errs[i]) ?
+                          p_scratch->results[i] : 0.0);
+        p_result += PROTO_BATCH_ITEM_RESULT_SIZE;
+    }
+    serv_metrics_add(SERV_METRIC_ERRORS, failed);
+    queue_frame(p_conn,
+                id,
+                MSG_BATCH_RESULT,
+                PROTO_STATUS_OK,
+                2 + ((size_t)count * PROTO_BATCH_ITEM_RESULT_SIZE));
+} /* dispatch_batch */
+
+/**
+ * @brief Evaluates one bytecode equation and queues a MSG_VALUE frame with
+ *        its result.
+ * @param[in] p_conn A pointer to the connection the bytecode arrived on.
+ * @param[in] id The id of the request.
+ * @param[in] p_bytecode A pointer to the bytecode.
+ * @param[in] length The length of the bytecode.
+ */
+static void dispatch_bytecode(conn_t*        p_conn,
+                              uint32_t       id,
+                              const uint8_t* p_bytecode,
+                              size_t         length)
+{
+    eval_program_t program;
+    double         answer   = 0.0;
+    uint64_t       start_ns = monotonic_ns();
+    int            err      = eval_decode(p_bytecode, length, &program);
+    if (EVAL_SUCCESS == err)
+    {
+        err = eval_program(&program, &answer);
+    }
+    serv_metrics_record(SERV_TIMER_EVAL, monotonic_ns() - start_ns);
+    serv_metrics_add(SERV_METRIC_REQUESTS, 1);
+    if (EVAL_SUCCESS != err)
+    {
+        serv_metrics_add(SERV_METRIC_ERRORS, 1);
+    }
+
+    put_value((uint8_t*)(p_conn->out_buffer + p_conn->out_length +
+                         FRAME_HEADER_SIZE),
+              err,
+              answer);
+    queue_frame(p_conn,
+                id,
+                MSG_VALUE,
+                (EVAL_SUCCESS == err) ? PROTO_STATUS_OK :
+                                        PROTO_STATUS_EVAL_ERROR,
+                PROTO_VALUE_SIZE);
+} /* dispatch_bytecode */
+
+/**
+ * @brief Checks if two prepared programs run the same operations on the
+ *        same constants and variables.
+ */
+static bool same_program(const eval_program_t* p_left,
+                         const eval_program_t* p_right)
+{
+    return p_left->shape == p_right->shape &&
+           p_left->op_count == p_right->op_count &&
+           p_left->constant_count == p_right->constant_count &&
+           p_left->variable_count == p_right->variable_count &&
+           0 == memcmp(p_left->ops, p_right->ops, p_left->op_count) &&
+           0 == memcmp(p_left->constants,
+                       p_right->constants,
+                       p_left->constant_count * sizeof(double));
+} /* same_program */
+
+/**
+ * @brief Stores a prepared program in the connection's table, unless the
+ *        same program is already there.
+ * @param[in] p_conn A pointer to the connection the program belongs to.
+ * @param[in] p_program A pointer to the prepared program.
+ * @param[out] p_handle A pointer to store the program's handle in.
+ * @return EVAL_SUCCESS, EVAL_TOO_MANY_PREPARED if the connection holds
+ *         PROTO_MAX_PREPARED equations, or EVAL_NO_MEMORY if the table
+ *         could not grow.
+ */
+static int store_prepared(conn_t*               p_conn,
+                          const eval_program_t* p_program,
+                          uint32_t*             p_handle)
+{
+    for (int i = 0; i < p_conn->prepared_count; i++)
+    {
+        if (same_program(&(p_conn->p_prepared[i]), p_program))
+        {
+            *p_handle = (uint32_t)i;
+            return EVAL_SUCCESS;
+        }
+    }
+    if (PROTO_MAX_PREPARED == p_conn->prepared_count)
+    {
+        return EVAL_TOO_MANY_PREPARED;
+    }
+
+    if (p_conn->prepared_count == p_conn->prepared_capacity)
+    {
+        int capacity = (0 == p_conn->prepared_capacity) ?
+                           4 : (2 * p_conn->prepared_capacity);
+        eval_program_t* p_grown =
+            realloc(p_conn->p_prepared, capacity * sizeof(eval_program_t));
+        if (NULL == p_grown)
+        {
+            SERV_LOG(SERV_LOG_LEVEL_ERROR,
+                     "Error allocating prepared equations. [%s]\n",
+                     strerror(errno));
+            return EVAL_NO_MEMORY;
+        }
+        p_conn->p_prepared        = p_grown;
+        p_conn->prepared_capacity = capacity;
+    }
+    p_conn->p_prepared[p_conn->prepared_count] = *p_program;
+    *p_handle = (uint32_t)p_conn->prepared_count++;
+    return EVAL_SUCCESS;
+} /* store_prepared */
+
+/**
+ * @brief Compiles an equation that may name variables and queues a
+ *        MSG_PREPARED frame with the handle to execute it by.
+ * @param[in] p_conn A pointer to the connection the equation arrived on.
+ * @param[in] id The id of the request.
+ * @param[in] p_equation A pointer to the equation.
+ * @param[in] length The length of the equation.
+ */
+static void dispatch_prepare(conn_t*     p_conn,
+                             uint32_t    id,
+                             const char* p_equation,
+                             size_t      length)
+{
+    SERV_LOG(SERV_LOG_LEVEL_REQUEST,
+             "Server received equation to prepare: [%.*s]\n",
+             (int)length,
+             p_equation);
+
+    eval_program_t program;
+    uint32_t       handle = 0;
+    int            err    = eval_prepare(p_equation, length, &program);
+    if (EVAL_SUCCESS == err)
+    {
+        err = store_prepared(p_conn, &program, &handle);
+    }
+    serv_metrics_add(SERV_METRIC_REQUESTS, 1);
+    if (EVAL_SUCCESS != err)
+    {
+        serv_metrics_add(SERV_METRIC_ERRORS, 1);
+    }
+
+    uint8_t* p_response = (uint8_t*)(p_conn->out_buffer +
+                                     p_conn->out_length + FRAME_HEADER_SIZE);
+    proto_put_u16(p_response, (uint16_t)-err);
+    proto_put_u32(p_response + 2, handle);
+    proto_put_u16(p_response + 6,
+                  (EVAL_SUCCESS == err) ? (uint16_t)program.variable_count :
+                                          0);
+    queue_frame(p_conn,
+                id,
+                MSG_PREPARED,
+                (EVAL_SUCCESS == err) ? PROTO_STATUS_OK :
+                                        PROTO_STATUS_EVAL_ERROR,
+                PROTO_PREPARED_SIZE);
+} /* dispatch_prepare */
+
+/**
+ * @brief Runs a prepared equation with the values bound by an execute frame
+ *        and queues a MSG_VALUE frame with its result.
+ * @param[in] p_conn A pointer to the connection the frame arrived on.
+ * @param[in] id The id of the request.
+ * @param[in] p_payload A pointer to the handle and the bound values.
+ * @param[in] length The length of the payload.
+ */
+static void dispatch_execute(conn_t*        p_conn,
+                             uint32_t       id,
+                             const uint8_t* p_payload,
+                             size_t         length)
+{
+    double   values[EVAL_MAX_VARIABLES];
+    double   answer   = 0.0;
+    uint64_t start_ns = monotonic_ns();
+    int      err      = EVAL_UNKNOWN_HANDLE;
+    uint32_t handle   = (PROTO_HANDLE_SIZE <= length) ?
+                            proto_get_u32(p_payload) : UINT32_MAX;
+    if (handle < (uint32_t)p_conn->prepared_count)
+    {
+        const eval_program_t* p_program = &(p_conn->p_prepared[handle]);
+        size_t                bindings  = length - PROTO_HANDLE_SIZE;
+        err = EVAL_BAD_BINDINGS;
+        if ((size_t)p_program->variable_count * PROTO_BINDING_SIZE ==
+            bindings)
+        {
+            for (int i = 0; i < p_program->variable_count; i++)
+            {
+                values[i] = proto_get_f64(p_payload + PROTO_HANDLE_SIZE +
+                                          (i * PROTO_BINDING_SIZE));
+            }
+            err = eval_execute(p_program, values, &answer);
+        }
+    }
+    serv_metrics_record(SERV_TIMER_EVAL, monotonic_ns() - start_ns);
+    serv_metrics_add(SERV_METRIC_REQUESTS, 1);
+    if (EVAL_SUCCESS != err)
+    {
+        serv_metrics_add(SERV_METRIC_ERRORS, 1);
+    }
+
+    put_value((uint8_t*)(p_conn->out_buffer + p_conn->out_length +
+                         FRAME_HEADER_SIZE),
+              err,
+              answer);
+    queue_frame(p_conn,
+                id,
+                MSG_VALUE,
+                (EVAL_SUCCESS == err) ? PROTO_STATUS_OK :
+                                        PROTO_STATUS_EVAL_ERROR,
+                PROTO_VALUE_SIZE);
+} /* dispatch_execute */
+
+/**
+ * @brief Queues a MSG_COLUMN_RESULT frame that answers no rows.
+ * @param[in] p_conn A pointer to the connection to respond on.
+ * @param[in] id The id of the request.
+ * @param[in] status One of the PROTO_STATUS codes.
+ * @param[in] eval_err The evaluation error that stopped every row.
+ */
+static void queue_column_error(conn_t*  p_conn,
+                               uint32_t id,
+                               uint16_t status,
+                               int      eval_err)
+{
+    uint8_t* p_response = (uint8_t*)(p_conn->out_buffer +
+                                     p_conn->out_length + FRAME_HEADER_SIZE);
+    proto_put_u16(p_response, (uint16_t)-eval_err);
+    proto_put_u32(p_response + 2, 0);
+    queue_frame(p_conn,
+                id,
+                MSG_COLUMN_RESULT,
+                status,
+                PROTO_COLUMN_RESULT_HEADER_SIZE);
+} /* queue_column_error */
+
+/**
+ * @brief Runs a prepared equation over every row of an execute columns
+ *        frame and queues one MSG_COLUMN_RESULT frame answering all of them.
+ * @param[in] p_conn A pointer to the connection the frame arrived on.
+ * @param[in] id The id of the request.
+ * @param[in] p_payload A pointer to the handle, row count and columns.
+ * @param[in] length The length of the payload.
+ */
+static void dispatch_columns(conn_t*        p_conn,
+                             uint32_t       id,
+                             const uint8_t* p_payload,
+                             size_t         length)
+{
+    batch_scratch_t* p_scratch = get_scratch();
+    if (NULL == p_scratch)
+    {
+        queue_column_error(p_conn, id, PROTO_STATUS_EVAL_ERROR, EVAL_SUCCESS);
+        return;
+    }
+
+    uint32_t handle = 0;
+    uint32_t rows   = EVAL_MAX_COLUMN_ROWS + 1;
+    if (PROTO_COLUMNS_HEADER_SIZE <= length)
+    {
+        handle = proto_get_u32(p_payload);
+        rows   = proto_get_u32(p_payload + PROTO_HANDLE_SIZE);
+    }
+    if (EVAL_MAX_COLUMN_ROWS < rows)
+    {
+        serv_metrics_add(SERV_METRIC_ERRORS, 1);
+        SERV_LOG(SERV_LOG_LEVEL_WARN, "Rejecting malformed columns frame.\n");
+        queue_column_error(p_conn, id, PROTO_STATUS_BAD_FRAME, EVAL_SUCCESS);
+        return;
+    }
+    if (handle >= (uint32_t)p_conn->prepared_count)
+    {
+        serv_metrics_add(SERV_METRIC_ERRORS, 1);
+        queue_column_error(p_conn,
+                           id,
+                           PROTO_STATUS_EVAL_ERROR,
+                           EVAL_UNKNOWN_HANDLE);
+        return;
+    }
+    const eval_program_t* p_program = &(p_conn->p_prepared[handle]);
+    size_t                values    = (size_t)p_program->variable_count *
+                                      rows;
+    if (PROTO_COLUMNS_HEADER_SIZE + (values * PROTO_BINDING_SIZE) != length)
+    {
+        serv_metrics_add(SERV_METRIC_ERRORS, 1);
+        queue_column_error(p_conn,
+                           id,
+                           PROTO_STATUS_EVAL_ERROR,
+                           EVAL_BAD_BINDINGS);
+        return;
+    }
+
+    SERV_LOG(SERV_LOG_LEVEL_REQUEST,
+             "Server received [%u] rows for prepared equation [%u].\n",
+             rows,
+             handle);
+    uint64_t       start_ns = monotonic_ns();
+    const uint8_t* p_value  = p_payload + PROTO_COLUMNS_HEADER_SIZE;
+    for (size_t i = 0; i < values; i++)
+    {
+        p_scratch->column_values[i] = proto_get_f64(p_value);
+        p_value += PROTO_BINDING_SIZE;
+    }
+    for (int i = 0; i < p_program->variable_count; i++)
+    {
+        p_scratch->columns[i] = p_scratch->column_values + ((size_t)i * rows);
+    }
+    eval_columns(p_program,
+                 p_scratch->columns,
+                 (int)rows,
+                 p_scratch->column_results,
+                 p_scratch->column_errs);
+    serv_metrics_record(SERV_TIMER_EVAL, monotonic_ns() - start_ns);
+    serv_metrics_add(SERV_METRIC_REQUESTS, rows);
+
+    uint8_t* p_result = (uint8_t*)(p_conn->out_buffer + p_conn->out_length +
+                                   FRAME_HEADER_SIZE);
+    uint8_t* p_status = p_result + PROTO_COLUMN_RESULT_HEADER_SIZE +
+                        ((size_t)rows * PROTO_BINDING_SIZE);
+    proto_put_u16(p_result, PROTO_EVAL_OK);
+    proto_put_u32(p_result + 2, rows);
+    p_result += PROTO_COLUMN_RESULT_HEADER_SIZE;
+    int failed = 0;
+    for (uint32_t i = 0; i < rows; i++)
+    {
+        int err = p_scratch->column_errs[i];
+        failed += (EVAL_SUCCESS != err);
+        proto_put_f64(p_result,
+                      (EVAL_SUCCESS == err) ?
+                          p_scratch->column_results[i] : 0.0);
+        p_status[i] = (uint8_t)-err;
+        p_result   += PROTO_BINDING_SIZE;
+    }
+    serv_metrics_add(SERV_METRIC_ERRORS, failed);
+    queue_frame(p_conn,
+                id,
+                MSG_COLUMN_RESULT,
+                PROTO_STATUS_OK,
+                PROTO_COLUMN_RESULT_HEADER_SIZE +
+                    ((size_t)rows * PROTO_COLUMN_ITEM_RESULT_SIZE));
+} /* dispatch_columns */
+
+/**
+ * @brief Starts streaming an equation too long to buffer.
+ * @param[in] p_conn A pointer to the connection the equation arrives on.
+ */
+static void begin_stream(conn_t* p_conn)
+{
+    eval_stream_begin(&(p_conn->stream), g_serv_stream_memory);
+    p_conn->b_streaming = true;
+    p_conn->stream_ns   = 0;
+} /* begin_stream */
+
+/**
+ * @brief Feeds the next bytes of a streamed equation to its evaluator.
+ * @param[in] p_conn A pointer to the connection the equation arrives on.
+ * @param[in] p_data A pointer to the bytes.
+ * @param[in] length The number of bytes.
+ */
+static void feed_stream(conn_t* p_conn, const char* p_data, size_t length)
+{
+    uint64_t start_ns = monotonic_ns();
+    eval_stream_feed(&(p_conn->stream), p_data, length);
+    p_conn->stream_ns += monotonic_ns() - start_ns;
+} /* feed_stream */
+
+/**
+ * @brief Ends a streamed equation, counting and logging it.
+ * @param[in] p_conn A pointer to the connection the equation arrived on.
+ * @param[out] p_answer A pointer to store the answer in.
+ * @return EVAL_SUCCESS or the evaluation error.
+ */
+static int finish_stream(conn_t* p_conn, double* p_answer)
+{
+    SERV_LOG(SERV_LOG_LEVEL_REQUEST,
+             "Server received streamed equation of [%zu] bytes.\n",
+             p_conn->stream.length);
+    uint64_t start_ns = monotonic_ns();
+    int      err      = eval_stream_finish(&(p_conn->stream), p_answer);
+    p_conn->stream_ns  += monotonic_ns() - start_ns;
+    p_conn->b_streaming = false;
+    record_evaluation(err, *p_answer, p_conn->stream_ns);
+    return err;
+} /* finish_stream */
+
+/**
+ * @brief Dispatches every newline terminated equation in the input buffer for
+ *        as long as there is room to queue responses. Equations too long to
+ *        buffer are streamed, and only a newline ends them.
+ * @param[in] p_conn A pointer to the connection to process.
+ * @return The number of input bytes consumed.
+ */
+static size_t process_lines(conn_t* p_conn)
+{
+    size_t consumed = 0;
+    char*  p_line   = p_conn->in_buffer;
+    char*  p_end    = NULL;
+    while (conn_has_response_room(p_conn) &&
+           NULL != (p_end = memchr(p_line,
+                                   '\n',
+                                   p_conn->in_length - consumed)))
+    {
+        size_t length = p_end - p_line;
+        if (p_conn->b_streaming || MAX_BUFFER_SIZE < length)
+        {
+            double answer = 0.0;
+            if (false == p_conn->b_streaming)
+            {
+                begin_stream(p_conn);
+            }
+            feed_stream(p_conn, p_line, length);
+            int err = finish_stream(p_conn, &answer);
+            queue_text_answer(p_conn, err, answer);
+        }
+        else
+        {
+            *p_end = '\0';
+            dispatch_text_equation(p_conn, p_line);
+        }
+        consumed += length + 1;
+        p_line    = p_end + 1;
+    }
+
+    // An unterminated equation that is already too long is evaluated as far
+    // as it has arrived instead of being buffered whole.
+    //
+    size_t remaining = p_conn->in_length - consumed;
+    if (conn_has_response_room(p_conn) &&
+        (p_conn->b_streaming || MAX_BUFFER_SIZE < remaining))
+    {
+        if (false == p_conn->b_streaming)
+        {
+            begin_stream(p_conn);
+        }
+        feed_stream(p_conn, p_line, remaining);
+        consumed = p_conn->in_length;
+    }
+    return consumed;
+} /* process_lines */
+
+/**
+ * @brief Looks up the largest payload accepted for a request type.
+ * @return The payload limit, or 0 if the type is not a request.
+ */
+static size_t frame_payload_limit(uint16_t type)
+{
+    switch (type)
+    {
+        case MSG_EQUATION:
+            return UINT32_MAX;
+        case MSG_EQUATION_BATCH:
+            return PROTO_MAX_PAYLOAD;
+        case MSG_BYTECODE:
+            return PROTO_MAX_BYTECODE_SIZE;
+        case MSG_PREPARE:
+            return PROTO_MAX_PAYLOAD;
+        case MSG_EXECUTE:
+            return PROTO_MAX_EXECUTE_SIZE;
+        case MSG_EXECUTE_COLUMNS:
+            return PROTO_MAX_PAYLOAD;
+        default:
+            return 0;
+    }
+} /* frame_payload_limit */
+
+/**
+ * @brief Looks up the type of the frame that answers a request type.
+ */
+static uint16_t response_type(uint16_t type)
+{
+    switch (type)
+    {
+        case MSG_EQUATION_BATCH:
+            return MSG_BATCH_RESULT;
+        case MSG_BYTECODE:
+        case MSG_EXECUTE:
+            return MSG_VALUE;
+        case MSG_PREPARE:
+            return MSG_PREPARED;
+        case MSG_EXECUTE_COLUMNS:
+            return MSG_COLUMN_RESULT;
+        default:
+            return (SERV_RESPONSE_BINARY == g_serv_response_format) ?
+                       MSG_VALUE : MSG_RESULT;
+    }
+} /* response_type */
+
+/**
+ * @brief Dispatches every complete frame in the input buffer for as long as
+ *        there is room to queue responses. Frames that are too long or of an
+ *        unknown type are answered with an error and skipped in-stream.
+ * @param[in] p_conn A pointer to the connection to process.
+ * @return The number of input bytes consumed.
+ */
+static size_t process_frames(conn_t* p_conn)
+{
+    size_t consumed = 0;
+    while (conn_has_response_room(p_conn))
+    {
+        size_t available = p_conn->in_length - consumed;
+        if (p_conn->b_streaming)
+        {
+            size_t feed = (p_conn->stream_remaining < available) ?
+                          p_conn->stream_remaining : available;
+            feed_stream(p_conn, p_conn->in_buffer + consumed, feed);
+            p_conn->stream_remaining -= feed;
+            consumed                 += feed;
+            if (0 < p_conn->stream_remaining)
+            {
+                break;
+            }
+            double answer = 0.0;
+            int    err    = finish_stream(p_conn, &answer);
+            queue_framed_answer(p_conn, p_conn->stream_id, err, answer);
+            continue;
+        }
+
+        if (0 < p_conn->skip_remaining)
+        {
+            size_t skip = (p_conn->skip_remaining < available) ?
+                          p_conn->skip_remaining : available;
+            p_conn->skip_remaining -= skip;
+            consumed               += skip;
+            if (0 < p_conn->skip_remaining)
+            {
+                break;
+            }
+            continue;
+        }
+
+        if (FRAME_HEADER_SIZE > available)
+        {
+            break;
+        }
+
+        frame_header_t header;
+        uint8_t*       p_frame = (uint8_t*)(p_conn->in_buffer + consumed);
+        proto_read_header(p_frame, &header);
+
+        size_t limit = frame_payload_limit(header.type);
+        if (0 == limit || limit < header.length)
+        {
+            serv_metrics_add(SERV_METRIC_ERRORS, 1);
+            SERV_LOG(SERV_LOG_LEVEL_WARN,
+                     "Rejecting frame of type [%u] and length [%u].\n",
+                     header.type,
+                     header.length);
+            queue_frame(p_conn,
+                        header.id,
+                        response_type(header.type),
+                        (0 == limit) ?
+                            PROTO_STATUS_BAD_TYPE : PROTO_STATUS_TOO_LONG,
+                        0);
+            consumed               += FRAME_HEADER_SIZE;
+            p_conn->skip_remaining  = header.length;
+            continue;
+        }
+
+        // Equations too long to buffer are evaluated as their payload
+        // arrives, starting with whatever has arrived already.
+        //
+        if (MSG_EQUATION == header.type && MAX_BUFFER_SIZE < header.length)
+        {
+            begin_stream(p_conn);
+            p_conn->stream_id        = header.id;
+            p_conn->stream_remaining = header.length;
+            consumed                += FRAME_HEADER_SIZE;
+            continue;
+        }
+
+        if (FRAME_HEADER_SIZE + header.length > available)
+        {
+            break;
+        }
+
+        uint8_t* p_payload = p_frame + FRAME_HEADER_SIZE;
+        switch (header.type)
+        {
+            case MSG_EQUATION_BATCH:
+                if (false == has_batch_response_room(p_conn))
+                {
+                    p_conn->b_input_pending = true;
+                    return consumed;
+                }
+                dispatch_batch(p_conn, header.id, p_payload, header.length);
+            break;
+            case MSG_BYTECODE:
+                dispatch_bytecode(p_conn, header.id, p_payload, header.length);
+            break;
+            case MSG_PREPARE:
+                dispatch_prepare(p_conn,
+                                 header.id,
+                                 (const char*)p_payload,
+                                 header.length);
+            break;
+            case MSG_EXECUTE:
+                dispatch_execute(p_conn, header.id, p_payload, header.length);
+            break;
+            case MSG_EXECUTE_COLUMNS:
+                if (false == has_column_response_room(p_conn))
+                {
+                    p_conn->b_input_pending = true;
+                    return consumed;
+                }
+                dispatch_columns(p_conn, header.id, p_payload, header.length);
+            break;
+            default:
+                dispatch_framed_equation(p_conn,
+                                         header.id,
+                                         (char*)p_payload,
+                                         header.length);
+            break;
+        }
+        consumed += FRAME_HEADER_SIZE + header.length;
+    }
+    return consumed;
+} /* process_frames */
+
+/**
+ * @brief Parses and dispatches as many complete requests as are buffered.
+ *        Sets b_input_pending if it stopped early because the output buffer
+ *        is full; flush and call again to continue.
+ * @param[in] p_conn A pointer to the connection to process.
+ */
+void conn_process_input(conn_t* p_conn)
+{
+    size_t consumed = 0;
+    p_conn->b_input_pending = false;
+    if (CONN_PROTO_UNKNOWN == p_conn->proto)
+    {
+        if (0 == p_conn->in_length)
+        {
+            return;
+        }
+        p_conn->proto = CONN_PROTO_TEXT;
+        if (PROTO_SELECT_FRAMED == (uint8_t)p_conn->in_buffer[0])
+        {
+            p_conn->proto = CONN_PROTO_FRAMED;
+            consumed      = 1;
+        }
+        else if (PROTO_SELECT_SHM == (uint8_t)p_conn->in_buffer[0])
+        {
+            p_conn->proto = CONN_PROTO_FRAMED;
+            consumed      = 1;
+            if (p_conn->b_shm_capable)
+            {
+                p_conn->b_shm_requested = true;
+            }
+            else
+            {
+                // The client waits for the answer before its first frame.
+                //
+                p_conn->out_buffer[p_conn->out_length++] =
+                    (char)PROTO_SHM_DECLINED;
+            }
+        }
+        p_conn->in_length -= consumed;
+        memmove(p_conn->in_buffer,
+                p_conn->in_buffer + consumed,
+                p_conn->in_length);
+        if (p_conn->b_shm_requested)
+        {
+            return;
+        }
+    }
+
+    if (CONN_PROTO_FRAMED == p_conn->proto)
+    {
+        consumed = process_frames(p_conn);
+    }
+    else
+    {
+        consumed = process_lines(p_conn);
+    }
+
+    p_conn->in_length -= consumed;
+    memmove(p_conn->in_buffer,
+            p_conn->in_buffer + consumed,
+            p_conn->in_length);
+    if (false == conn_has_response_room(p_conn))
+    {
+        p_conn->b_input_pending = true;
+    }
+} /* conn_process_input */
+
+/**
+ * @brief Called when a read finds no more pending data. Text clients that
+ *        do not terminate their equations send one equation per write, so
+ *        the end of a burst ends the equation. Streamed equations span many
+ *        bursts and only end at a newline.
+ * @param[in] p_conn A pointer to the connection to process.
+ */
+void conn_end_of_burst(conn_t* p_conn)
+{
+    if (CONN_PROTO_TEXT != p_conn->proto ||
+        p_conn->b_input_pending ||
+        p_conn->b_streaming)
+    {
+        return;
+    }
+
+    if (0 < p_conn->in_length)
+    {
+        p_conn->in_buffer[p_conn->in_length] = '\0';
+        dispatch_text_equation(p_conn, p_conn->in_buffer);
+    }
+    p_conn->in_length = 0;
+} /* conn_end_of_burst */
+
+/**
+ * @brief Drains a readable non-blocking client socket until it would block,
+ *        dispatching complete requests along the way. Stops reading when
+ *        the client is not consuming its responses.
+ * @param[in] p_conn A pointer to the readable connection.
+ * @return True if the connection is still usable.
+ *         False if the client disconnected or an error occurred.
+ */
+bool conn_on_readable(conn_t* p_conn)
+{
+    while (true)
+    {
+        conn_process_input(p_conn);
+        if (p_conn->b_input_pending)
+        {
+            if (false == conn_flush(p_conn))
+            {
+                return false;
+            }
+            if (0 < p_conn->out_length)
+            {
+                // Resumed by EPOLLOUT once the client reads its responses.
+                //
+                return true;
+            }
+            continue;
+        }
+
+        ssize_t bytes_read = recv(p_conn->fd,
+                                  p_conn->in_buffer + p_conn->in_length,
+                                  CONN_IN_BUFFER_SIZE - p_conn->in_length,
+                                  0);
+        if (0 == bytes_read)
+        {
+            SERV_LOG(SERV_LOG_LEVEL_INFO, "Client has disconnected.\n");
+            return false;
+        }
+        if (0 > bytes_read)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            if (EAGAIN != errno && EWOULDBLOCK != errno)
+            {
+                serv_metrics_add(SERV_METRIC_ERRORS, 1);
+                SERV_LOG(SERV_LOG_LEVEL_ERROR,
+                         "Error reading from socket. [%s]\n",
+                         strerror(errno));
+                return false;
+            }
+            conn_end_of_burst(p_conn);
+            break;
+        }
+        serv_metrics_add(SERV_METRIC_BYTES_RECEIVED, bytes_read);
+        p_conn->in_length += bytes_read;
+    }
+
+    return conn_flush(p_conn);
+} /* conn_on_readable */
+
+/**
+ * @brief Sends pending output. Blocking sockets send everything; non-blocking
+ *        sockets send as much as the socket accepts.
+ * @param[in] p_conn A pointer to the connection to flush.
+ * @return True if the connection is still usable.
+ *         False if sending failed and the connection should be closed.
+ */
+bool conn_flush(conn_t* p_conn)
+{
+    while (p_conn->out_offset < p_conn->out_length)
+    {
+        // Blocking sends are bounded by the write timeout.
+        //
+        uint64_t start_ns = monotonic_ns();
+        conn_timer_set(&(p_conn->timer), TIMEOUT_WRITE, start_ns);
+        ssize_t bytes_sent = send(p_conn->fd,
+                                  p_conn->out_buffer + p_conn->out_offset,
+                                  p_conn->out_length - p_conn->out_offset,
+                                  MSG_NOSIGNAL);
+        serv_metrics_record(SERV_TIMER_SEND, monotonic_ns() - start_ns);
+        if (0 > bytes_sent)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            if (EAGAIN == errno || EWOULDBLOCK == errno)
+            {
+                return true;
+            }
+            serv_metrics_add(SERV_METRIC_ERRORS, 1);
+            SERV_LOG(SERV_LOG_LEVEL_ERROR,
+                     "Error sending message to client. [%s]\n",
+                     strerror(errno));
+            return false;
+        }
+        serv_metrics_add(SERV_METRIC_BYTES_SENT, bytes_sent);
+        p_conn->out_offset += bytes_sent;
+    }
+    p_conn->out_offset = 0;
+    p_conn->out_length = 0;
+    return true;
+} /* conn_flush */
+
+/**
+ * @brief Starts the timeout for whatever the connection waits on next: the
+ *        client reading its responses, the rest of a request, or the next
+ *        request. Called each time the connection goes back to waiting.
+ * @param[in] p_conn A pointer to the connection.
+ */
+void conn_arm_deadline(conn_t* p_conn)
+{
+    int kind = TIMEOUT_IDLE;
+    if (p_conn->out_offset < p_conn->out_length)
+    {
+        kind = TIMEOUT_WRITE;
+    }
+    else if (0 < p_conn->in_length ||
+             0 < p_conn->skip_remaining ||
+             p_conn->b_streaming)
+    {
+        kind = TIMEOUT_READ;
+    }
+    conn_timer_set(&(p_conn->timer), kind, monotonic_ns());
+} /* conn_arm_deadline */
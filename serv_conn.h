@@ -0,0 +1,69 @@
+#ifndef SERV_CONN_H
+#define SERV_CONN_H
+
+#include <stdbool.h>
+#include <stddef.h> // size_t
+#include <stdint.h> // uint32_t, uint64_t
+
+#include "postfix_proto.h"
+#include "serv_eval.h"
+#include "serv_timer.h"
+
+#define CONN_IN_BUFFER_SIZE (FRAME_HEADER_SIZE + PROTO_MAX_PAYLOAD)
+#define CONN_OUT_BUFFER_SIZE 8192
+#define CONN_MAX_RESPONSE_SIZE (FRAME_HEADER_SIZE + MAX_BUFFER_SIZE)
+#define CONN_MAX_BATCH_RESPONSE_SIZE (FRAME_HEADER_SIZE + \
+                                      PROTO_MAX_BATCH_RESULT_SIZE)
+#define CONN_MAX_COLUMN_RESPONSE_SIZE (FRAME_HEADER_SIZE + \
+                                       PROTO_MAX_COLUMN_RESULT_SIZE)
+#define CONN_PROTO_UNKNOWN -1
+#define CONN_PROTO_TEXT 0
+#define CONN_PROTO_FRAMED 1
+
+/**
+ * @brief Buffered state of one client connection. Input is parsed
+ *        incrementally and responses are queued until flushed. Equations
+ *        longer than MAX_BUFFER_SIZE are not buffered but fed to the stream
+ *        evaluator as they arrive; stream_remaining counts the bytes of a
+ *        streamed frame still to come. A client that asks for shared
+ *        memory on a connection whose owner set b_shm_capable stops with
+ *        b_shm_requested set, for the owner to move the connection onto the
+ *        rings; on any other connection it is declined. Equations the
+ *        client prepared are kept in p_prepared, indexed by their handle,
+ *        for as long as the connection lasts.
+ */
+typedef struct conn_t {
+    int             fd;
+    conn_timer_t    timer;
+    int             proto;
+    bool            b_shm_capable;
+    bool            b_shm_requested;
+    size_t          in_length;
+    size_t          skip_remaining;
+    bool            b_streaming;
+    bool            b_input_pending;
+    uint32_t        stream_id;
+    size_t          stream_remaining;
+    uint64_t        stream_ns;
+    eval_program_t* p_prepared;
+    int             prepared_count;
+    int             prepared_capacity;
+    size_t          out_offset;
+    size_t          out_length;
+    struct conn_t*  p_prev;
+    struct conn_t*  p_next;
+    eval_stream_t   stream;
+    char            in_buffer[CONN_IN_BUFFER_SIZE + 1];
+    char            out_buffer[CONN_OUT_BUFFER_SIZE];
+} conn_t;
+
+void conn_init(conn_t* p_conn, int fd);
+void conn_release(conn_t* p_conn);
+bool conn_has_response_room(conn_t* p_conn);
+void conn_process_input(conn_t* p_conn);
+void conn_end_of_burst(conn_t* p_conn);
+bool conn_flush(conn_t* p_conn);
+bool conn_on_readable(conn_t* p_conn);
+void conn_arm_deadline(conn_t* p_conn);
+
+#endif /* SERV_CONN_H */
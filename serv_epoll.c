@@ -0,0 +1,360 @@
+/** @file serv_epoll.c
+ *
+ * @brief Edge-triggered epoll event loops for the postfix server. Each loop
+ *        thread multiplexes many non-blocking client sockets and only
+ *        dispatches complete equations to evaluation, so the number of
+ *        connected clients is not tied to the number of threads. Accepted
+ *        connections are taken from the shared connection queue in batches
+ *        whenever the acceptor wakes a loop.
+ * @par
+ * COPYRIGHT NOTICE: (c) 2018 Barr Group. All rights reserved.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h> // errno, EAGAIN
+#include <fcntl.h> // F_SETFL, O_NONBLOCK
+#include <pthread.h>
+#include <stdatomic.h> // atomic_fetch_add
+#include <stdbool.h>
+#include <stdio.h> // stderr
+#include <stdlib.h> // calloc, free, malloc
+#include <string.h> // strerror
+#include <sys/epoll.h> // epoll_create1, epoll_ctl, epoll_wait
+#include <sys/eventfd.h> // eventfd
+#include <sys/socket.h> // send, recv
+#include <unistd.h> // close, read, write
+
+#include "serv_lib.h"
+#include "serv_conn.h"
+#include "serv_epoll.h"
+#include "serv_log.h"
+#include "serv_metrics.h"
+
+typedef struct epoll_loop_t {
+    pthread_t thread_id;
+    int       epoll_fd;
+    int       wake_fd;
+    conn_t*   p_connections;
+    serv_t*   p_serv;
+} epoll_loop_t;
+
+/**
+ * @brief Closes a client connection, releases its state and frees up a
+ *        connection slot.
+ * @param[in] p_loop A pointer to the loop that owns the connection.
+ * @param[in] p_conn A pointer to the connection to close.
+ */
+static void close_connection(epoll_loop_t* p_loop, conn_t* p_conn)
+{
+    if (NULL != p_conn->p_prev)
+    {
+        p_conn->p_prev->p_next = p_conn->p_next;
+    }
+    else
+    {
+        p_loop->p_connections = p_conn->p_next;
+    }
+    if (NULL != p_conn->p_next)
+    {
+        p_conn->p_next->p_prev = p_conn->p_prev;
+    }
+
+    timeout_unwatch(&(p_loop->p_serv->reaper), &(p_conn->timer));
+    conn_release(p_conn);
+    close(p_conn->fd);
+    free(p_conn);
+    release_connection_slot(p_loop->p_serv);
+} /* close_connection */
+
+/**
+ * @brief Registers a batch of queued connections with this loop.
+ * @param[in] p_loop A pointer to the loop receiving the connections.
+ * @param[in] p_client_fds A pointer to the dequeued client fds.
+ * @param[in] count The number of client fds.
+ */
+static void register_connections(epoll_loop_t* p_loop,
+                                 int*          p_client_fds,
+                                 size_t        count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        int client_fd = p_client_fds[i];
+
+        // conn_init sets every field that is read before being written, so
+        // the buffers are left untouched until data arrives.
+        //
+        conn_t* p_conn = malloc(sizeof(conn_t));
+        if (NULL == p_conn)
+        {
+            SERV_LOG(SERV_LOG_LEVEL_ERROR,
+                     "Error allocating connection state. [%s]\n",
+                     strerror(errno));
+            close(client_fd);
+            release_connection_slot(p_loop->p_serv);
+            continue;
+        }
+        send_handshake(p_loop->p_serv, client_fd);
+        conn_init(p_conn, client_fd);
+
+        int flags = fcntl(client_fd, F_GETFL, 0);
+        fcntl(client_fd, F_SETFL, (flags | O_NONBLOCK));
+
+        struct epoll_event event = { 0 };
+        event.events   = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = p_conn;
+        if (0 > epoll_ctl(p_loop->epoll_fd, EPOLL_CTL_ADD, client_fd, &event))
+        {
+            SERV_LOG(SERV_LOG_LEVEL_ERROR,
+                     "Error registering client socket. [%s]\n",
+                     strerror(errno));
+            close(client_fd);
+            free(p_conn);
+            release_connection_slot(p_loop->p_serv);
+            continue;
+        }
+        if (false == timeout_watch(&(p_loop->p_serv->reaper),
+                                   &(p_conn->timer)))
+        {
+            close(client_fd);
+            free(p_conn);
+            release_connection_slot(p_loop->p_serv);
+            continue;
+        }
+
+        p_conn->p_next = p_loop->p_connections;
+        if (NULL != p_loop->p_connections)
+        {
+            p_loop->p_connections->p_prev = p_conn;
+        }
+        p_loop->p_connections = p_conn;
+    }
+} /* register_connections */
+
+/**
+ * @brief Clears the loop's wake up event and takes every queued connection
+ *        in batches.
+ * @param[in] p_loop A pointer to the woken loop.
+ */
+static void drain_connection_queue(epoll_loop_t* p_loop)
+{
+    uint64_t wake_count;
+    if (0 > read(p_loop->wake_fd, &wake_count, sizeof(wake_count)) &&
+        EAGAIN != errno)
+    {
+        fprintf(stderr, "Error reading wake event. [%s]\n", strerror(errno));
+    }
+
+    int    client_fds[HANDOFF_BATCH_SIZE];
+    size_t count;
+    do
+    {
+        count = fd_queue_dequeue_batch(&(p_loop->p_serv->connection_queue),
+                                       client_fds,
+                                       HANDOFF_BATCH_SIZE);
+        register_connections(p_loop, client_fds, count);
+    } while (HANDOFF_BATCH_SIZE == count);
+} /* drain_connection_queue */
+
+/**
+ * @brief Loop thread body. Waits on the loop's epoll set and services ready
+ *        connections until the server stops running.
+ * @param[in] args A pointer to the epoll_loop_t to run.
+ * @return NULL on thread exit
+ */
+static void* epoll_loop_handler(void* args)
+{
+    epoll_loop_t*      p_loop = (epoll_loop_t*)args;
+    serv_t*            p_serv = p_loop->p_serv;
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+
+    while (p_serv->b_running)
+    {
+        int count = epoll_wait(p_loop->epoll_fd, events, EPOLL_MAX_EVENTS, -1);
+        if (0 > count)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            fprintf(stderr, "Error waiting on events. [%s]\n", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            conn_t* p_conn = events[i].data.ptr;
+            if (NULL == p_conn)
+            {
+                drain_connection_queue(p_loop);
+                continue;
+            }
+
+            bool     is_connected = true;
+            uint32_t flags        = events[i].events;
+            if (flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            {
+                is_connected = conn_on_readable(p_conn);
+            }
+            if (is_connected && (flags & EPOLLOUT))
+            {
+                is_connected = conn_flush(p_conn);
+                if (is_connected && p_conn->b_input_pending)
+                {
+                    is_connected = conn_on_readable(p_conn);
+                }
+            }
+            if (false == is_connected)
+            {
+                close_connection(p_loop, p_conn);
+                continue;
+            }
+            conn_arm_deadline(p_conn);
+        }
+    }
+
+    while (NULL != p_loop->p_connections)
+    {
+        close_connection(p_loop, p_loop->p_connections);
+    }
+    return NULL;
+} /* epoll_loop_handler */
+
+/**
+ * @brief Wakes one of the loops, picked round robin, to take newly queued
+ *        connections.
+ * @param[in] p_serv A pointer to a running serv_t struct.
+ */
+void epoll_wake_loop(serv_t* p_serv)
+{
+    // Connections are released, and waiting ones admitted, on every loop
+    // thread, so the cursor is shared between them.
+    //
+    unsigned      next   = atomic_fetch_add(&(p_serv->next_loop), 1);
+    epoll_loop_t* p_loop = &(p_serv->p_loops[next %
+                                             (unsigned)p_serv->thread_count]);
+
+    uint64_t wake = 1;
+    if (sizeof(wake) != write(p_loop->wake_fd, &wake, sizeof(wake)))
+    {
+        fprintf(stderr, "Error waking loop thread. [%s]\n", strerror(errno));
+    }
+} /* epoll_wake_loop */
+
+/**
+ * @brief Stops and joins every loop thread, closing their connections.
+ * @param[in] p_serv A pointer to a serv_t struct with b_running cleared.
+ */
+void shutdown_epoll_loops(serv_t* p_serv)
+{
+    if (NULL == p_serv->p_loops)
+    {
+        return;
+    }
+
+    uint64_t wake = 1;
+    for (int i = 0; i < p_serv->thread_count; i++)
+    {
+        epoll_loop_t* p_loop = &(p_serv->p_loops[i]);
+        if (0 != p_loop->thread_id)
+        {
+            if (sizeof(wake) != write(p_loop->wake_fd, &wake, sizeof(wake)))
+            {
+                fprintf(stderr,
+                        "Error waking loop thread. [%s]\n",
+                        strerror(errno));
+            }
+            int err = pthread_join(p_loop->thread_id, NULL);
+            if (0 != err)
+            {
+                fprintf(stderr, "Error joining thread. [%s]\n", strerror(err));
+            }
+        }
+        if (0 <= p_loop->wake_fd)
+        {
+            close(p_loop->wake_fd);
+        }
+        if (0 <= p_loop->epoll_fd)
+        {
+            close(p_loop->epoll_fd);
+        }
+    }
+    free(p_serv->p_loops);
+    p_serv->p_loops = NULL;
+} /* shutdown_epoll_loops */
+
+/**
+ * @brief Creates the epoll sets, wake up events and threads for every loop.
+ * @param[in] p_serv A pointer to a serv_t struct with thread_count set.
+ * @return SERV_INIT_SUCCESS if every loop started.
+ *         SERV_INIT_FAILURE if a loop could not be started.
+ */
+int init_epoll_loops(serv_t* p_serv)
+{
+    atomic_init(&(p_serv->next_loop), 0);
+    p_serv->p_loops = calloc(p_serv->thread_count, sizeof(epoll_loop_t));
+    if (NULL == p_serv->p_loops)
+    {
+        fprintf(stderr,
+                "Unable to allocate event loops. [%s]\n",
+                strerror(errno));
+        return SERV_INIT_FAILURE;
+    }
+    for (int i = 0; i < p_serv->thread_count; i++)
+    {
+        p_serv->p_loops[i].epoll_fd = -1;
+        p_serv->p_loops[i].wake_fd  = -1;
+    }
+
+    for (int i = 0; i < p_serv->thread_count; i++)
+    {
+        epoll_loop_t* p_loop = &(p_serv->p_loops[i]);
+        p_loop->p_serv       = p_serv;
+
+        p_loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (0 > p_loop->epoll_fd)
+        {
+            fprintf(stderr,
+                    "Unable to create epoll set. [%s]\n",
+                    strerror(errno));
+            return SERV_INIT_FAILURE;
+        }
+
+        p_loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (0 > p_loop->wake_fd)
+        {
+            fprintf(stderr,
+                    "Unable to create wake up event. [%s]\n",
+                    strerror(errno));
+            return SERV_INIT_FAILURE;
+        }
+
+        struct epoll_event event = { 0 };
+        event.events   = EPOLLIN;
+        event.data.ptr = NULL;
+        if (0 > epoll_ctl(p_loop->epoll_fd,
+                          EPOLL_CTL_ADD,
+                          p_loop->wake_fd,
+                          &event))
+        {
+            fprintf(stderr,
+                    "Unable to register wake up event. [%s]\n",
+                    strerror(errno));
+            return SERV_INIT_FAILURE;
+        }
+
+        int err = pthread_create(&(p_loop->thread_id),
+                                 NULL,
+                                 &epoll_loop_handler,
+                                 p_loop);
+        if (0 != err)
+        {
+            fprintf(stderr,
+                    "Thread unable to be created. [%s]\n",
+                    strerror(err));
+            p_loop->thread_id = 0;
+            return SERV_INIT_FAILURE;
+        }
+        pin_thread(p_loop->thread_id, p_serv->cpu);
+    }
+    return SERV_INIT_SUCCESS;
+} /* init_epoll_loops */
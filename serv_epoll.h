@@ -0,0 +1,8 @@
+#include <stdbool.h>
+
+#define EPOLL_MAX_EVENTS 256
+#define HANDOFF_BATCH_SIZE 64
+
+int  init_epoll_loops(serv_t* p_serv);
+void epoll_wake_loop(serv_t* p_serv);
+void shutdown_epoll_loops(serv_t* p_serv);
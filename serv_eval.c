@@ -0,0 +1,1229 @@
+/** @file serv_eval.c
+ *
+ * @brief Postfix equation evaluator. Tokenizes a sanitized equation in place
+ *        and evaluates it on a fixed size operand stack, so evaluating an
+ *        equation never allocates. Equations can also be compiled to flat
+ *        programs; batches of programs with the same shape are evaluated
+ *        EVAL_SIMD_LANES at a time in vector registers. Clients may also
+ *        send programs already encoded as bytecode. Equations too long to
+ *        buffer are evaluated incrementally as their bytes arrive.
+ *        Prepared equations name variables whose values are bound each time
+ *        they run, one row of values at a time or over whole columns, which
+ *        run EVAL_COLUMN_LANES rows at a time with the widest vector
+ *        instructions the CPU supports.
+ * @par
+ * COPYRIGHT NOTICE: (c) 2018 Barr Group. All rights reserved.
+ */
+
+#include <math.h> // fmod
+#include <stdbool.h>
+#include <stdint.h> // uint64_t
+#include <stdlib.h> // free, malloc, realloc, strtod
+#include <string.h> // memcmp, memcpy, strlen
+
+#include "serv_eval.h"
+
+#define MAX_EXACT_MANTISSA (1ull << 53)
+#define MAX_EXACT_POWER 22
+#define FNV_OFFSET_BASIS 14695981039346656037ull
+#define FNV_PRIME 1099511628211ull
+
+typedef double eval_vec_t
+    __attribute__((vector_size(EVAL_SIMD_LANES * sizeof(double))));
+typedef long long eval_mask_t
+    __attribute__((vector_size(EVAL_SIMD_LANES * sizeof(long long))));
+typedef double eval_column_vec_t
+    __attribute__((vector_size(EVAL_COLUMN_LANES * sizeof(double))));
+typedef long long eval_column_mask_t
+    __attribute__((vector_size(EVAL_COLUMN_LANES * sizeof(long long))));
+
+static const double g_powers_of_ten[MAX_EXACT_POWER + 1] =
+{
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/**
+ * @brief Checks if a character can start or continue a number.
+ */
+static bool is_number_char(char c)
+{
+    return ('0' <= c && '9' >= c) || '.' == c;
+} /* is_number_char */
+
+/**
+ * @brief Checks if a character can start a variable name.
+ */
+static bool is_name_start(char c)
+{
+    return ('a' <= c && 'z' >= c) || ('A' <= c && 'Z' >= c) || '_' == c;
+} /* is_name_start */
+
+/**
+ * @brief Checks if a character can continue a variable name.
+ */
+static bool is_name_char(char c)
+{
+    return is_name_start(c) || ('0' <= c && '9' >= c);
+} /* is_name_char */
+
+/**
+ * @brief Maps an operator character to its program operation.
+ * @return The EVAL_OP for the operator, or 0 if c is not an operator.
+ */
+static uint8_t operator_op(char c)
+{
+    switch (c)
+    {
+        case '+':
+            return EVAL_OP_ADD;
+        case '-':
+            return EVAL_OP_SUB;
+        case '*':
+            return EVAL_OP_MUL;
+        case '/':
+            return EVAL_OP_DIV;
+        case '%':
+            return EVAL_OP_MOD;
+        default:
+            return 0;
+    }
+} /* operator_op */
+
+/**
+ * @brief Parses a decimal number starting at the given cursor.
+ *        Numbers whose digits and scale are exactly representable are
+ *        converted with a single division, which is correctly rounded.
+ *        Anything longer falls back to strtod.
+ * @param[in] p_cursor A pointer to the first character of the number.
+ * @param[in] p_limit A pointer one past the last character that may be read.
+ * @param[out] pp_end A pointer to store the first character after the number.
+ * @param[out] p_value A pointer to store the parsed value in.
+ * @return True if the number is well formed.
+ *         False if it has more than one decimal point, no digits, or more
+ *         than EVAL_MAX_NUMBER_LENGTH characters.
+ */
+static bool parse_number(const char*  p_cursor,
+                         const char*  p_limit,
+                         const char** pp_end,
+                         double*      p_value)
+{
+    const char* p_start         = p_cursor;
+    uint64_t    mantissa        = 0;
+    int         digit_count     = 0;
+    int         fraction_digits = 0;
+    bool        b_seen_point    = false;
+    bool        b_exact         = true;
+
+    for (; p_cursor < p_limit && is_number_char(*p_cursor); p_cursor++)
+    {
+        if ('.' == *p_cursor)
+        {
+            if (b_seen_point)
+            {
+                return false;
+            }
+            b_seen_point = true;
+            continue;
+        }
+
+        digit_count++;
+        if (b_seen_point)
+        {
+            fraction_digits++;
+        }
+        if (MAX_EXACT_MANTISSA <= mantissa)
+        {
+            b_exact = false;
+            continue;
+        }
+        mantissa = (mantissa * 10) + (uint64_t)(*p_cursor - '0');
+    }
+    *pp_end = p_cursor;
+
+    size_t length = p_cursor - p_start;
+    if (0 == digit_count || EVAL_MAX_NUMBER_LENGTH < length)
+    {
+        return false;
+    }
+
+    if (b_exact &&
+        MAX_EXACT_MANTISSA >= mantissa &&
+        MAX_EXACT_POWER >= fraction_digits)
+    {
+        *p_value = (double)mantissa / g_powers_of_ten[fraction_digits];
+        return true;
+    }
+
+    // The token is not null terminated, so hand strtod a bounded copy.
+    //
+    char number[EVAL_MAX_NUMBER_LENGTH + 1];
+    memcpy(number, p_start, length);
+    number[length] = '\0';
+    *p_value = strtod(number, NULL);
+    return true;
+} /* parse_number */
+
+/**
+ * @brief Applies one binary operation.
+ * @return EVAL_SUCCESS or EVAL_DIVIDE_BY_ZERO.
+ */
+static int apply_op(uint8_t op, double left, double right, double* p_result)
+{
+    switch (op)
+    {
+        case EVAL_OP_ADD:
+            *p_result = left + right;
+        break;
+        case EVAL_OP_SUB:
+            *p_result = left - right;
+        break;
+        case EVAL_OP_MUL:
+            *p_result = left * right;
+        break;
+        case EVAL_OP_DIV:
+            if (0.0 == right)
+            {
+                return EVAL_DIVIDE_BY_ZERO;
+            }
+            *p_result = left / right;
+        break;
+        default:
+            if (0.0 == right)
+            {
+                return EVAL_DIVIDE_BY_ZERO;
+            }
+            *p_result = fmod(left, right);
+        break;
+    }
+    return EVAL_SUCCESS;
+} /* apply_op */
+
+/**
+ * @brief Evaluates a sanitized postfix equation.
+ *        Operands are decimal numbers separated by spaces. Operators are one
+ *        of (* + - / %) and do not need to be separated from their operands.
+ * @param[in] p_equation A pointer to a sanitized, null terminated equation.
+ * @param[out] p_result A pointer to store the result in.
+ * @return EVAL_SUCCESS if the equation was evaluated.
+ *         EVAL_STACK_UNDERFLOW if an operator is missing an operand.
+ *         EVAL_DIVIDE_BY_ZERO if the equation divides by zero.
+ *         EVAL_TRAILING_OPERANDS if operands are left without an operator.
+ *         EVAL_STACK_OVERFLOW if more than EVAL_STACK_SIZE operands are
+ *             pending at once.
+ *         EVAL_INVALID_NUMBER if an operand is malformed or longer than
+ *             EVAL_MAX_NUMBER_LENGTH characters.
+ *         EVAL_EMPTY_EQUATION if there is nothing to evaluate.
+ */
+int eval_postfix(char* p_equation, double* p_result)
+{
+    double      stack[EVAL_STACK_SIZE];
+    int         depth    = 0;
+    const char* p_cursor = p_equation;
+    const char* p_limit  = p_equation + strlen(p_equation);
+
+    while (p_cursor < p_limit)
+    {
+        char c = *p_cursor;
+        if (is_number_char(c))
+        {
+            if (EVAL_STACK_SIZE == depth)
+            {
+                return EVAL_STACK_OVERFLOW;
+            }
+            if (false == parse_number(p_cursor,
+                                      p_limit,
+                                      &p_cursor,
+                                      &(stack[depth])))
+            {
+                return EVAL_INVALID_NUMBER;
+            }
+            depth++;
+            continue;
+        }
+
+        p_cursor++;
+        uint8_t op = operator_op(c);
+        if (0 == op)
+        {
+            // Sanitized equations only have spaces left between tokens.
+            //
+            continue;
+        }
+
+        if (2 > depth)
+        {
+            return EVAL_STACK_UNDERFLOW;
+        }
+        depth--;
+        int err = apply_op(op, stack[depth - 1], stack[depth],
+                           &(stack[depth - 1]));
+        if (EVAL_SUCCESS != err)
+        {
+            return err;
+        }
+    }
+
+    if (0 == depth)
+    {
+        return EVAL_EMPTY_EQUATION;
+    }
+    if (1 < depth)
+    {
+        return EVAL_TRAILING_OPERANDS;
+    }
+    *p_result = stack[0];
+    return EVAL_SUCCESS;
+} /* eval_postfix */
+
+/**
+ * @brief Checks that a program leaves exactly one result and computes its
+ *        shape.
+ * @param[in] p_program A pointer to the program being built.
+ * @param[in] depth The stack depth after the program's last operation.
+ * @return EVAL_SUCCESS, EVAL_EMPTY_EQUATION or EVAL_TRAILING_OPERANDS.
+ */
+static int finish_program(eval_program_t* p_program, int depth)
+{
+    if (0 == depth)
+    {
+        return EVAL_EMPTY_EQUATION;
+    }
+    if (1 < depth)
+    {
+        return EVAL_TRAILING_OPERANDS;
+    }
+
+    uint64_t shape = FNV_OFFSET_BASIS;
+    for (int i = 0; i < p_program->op_count; i++)
+    {
+        shape = (shape ^ p_program->ops[i]) * FNV_PRIME;
+    }
+    p_program->shape = shape;
+    return EVAL_SUCCESS;
+} /* finish_program */
+
+/**
+ * @brief Finds the index of a variable, numbering it if it is new.
+ * @param[in] pp_names Pointers to the names seen so far.
+ * @param[in] p_lengths The lengths of the names seen so far.
+ * @param[in,out] p_count A pointer to the number of names seen so far.
+ * @param[in] p_name A pointer to the name to look up.
+ * @param[in] length The length of the name.
+ * @return The variable's index, or EVAL_TOO_MANY_VARIABLES.
+ */
+static int variable_index(const char** pp_names,
+                          size_t*      p_lengths,
+                          int*         p_count,
+                          const char*  p_name,
+                          size_t       length)
+{
+    for (int i = 0; i < *p_count; i++)
+    {
+        if (length == p_lengths[i] && 0 == memcmp(pp_names[i], p_name, length))
+        {
+            return i;
+        }
+    }
+    if (EVAL_MAX_VARIABLES == *p_count)
+    {
+        return EVAL_TOO_MANY_VARIABLES;
+    }
+    pp_names[*p_count]  = p_name;
+    p_lengths[*p_count] = length;
+    return (*p_count)++;
+} /* variable_index */
+
+/**
+ * @brief Compiles a postfix equation to a program.
+ * @param[in] p_equation A pointer to the equation. Need not be terminated.
+ * @param[in] length The length of the equation.
+ * @param[in] b_variables True if names are variables to load, false if they
+ *                        separate tokens like any other character.
+ * @param[out] p_program A pointer to store the compiled program in.
+ * @return EVAL_SUCCESS or any of the eval_prepare errors.
+ */
+static int compile_equation(const char*     p_equation,
+                            size_t          length,
+                            bool            b_variables,
+                            eval_program_t* p_program)
+{
+    const char* p_cursor = p_equation;
+    const char* p_limit  = p_equation + length;
+    int         depth    = 0;
+    const char* names[EVAL_MAX_VARIABLES];
+    size_t      name_lengths[EVAL_MAX_VARIABLES];
+
+    p_program->op_count       = 0;
+    p_program->constant_count = 0;
+    p_program->variable_count = 0;
+    while (p_cursor < p_limit && '\n' != *p_cursor)
+    {
+        char c      = *p_cursor;
+        bool b_name = b_variables && is_name_start(c);
+        if (EVAL_MAX_OPS == p_program->op_count &&
+            (is_number_char(c) || 0 != operator_op(c) || b_name))
+        {
+            return EVAL_TOO_LONG;
+        }
+
+        if (is_number_char(c) || b_name)
+        {
+            if (EVAL_STACK_SIZE == depth)
+            {
+                return EVAL_STACK_OVERFLOW;
+            }
+            double* p_value =
+                &(p_program->constants[p_program->constant_count]);
+            uint8_t op = EVAL_OP_PUSH;
+            if (b_name)
+            {
+                const char* p_name = p_cursor;
+                while (p_cursor < p_limit && is_name_char(*p_cursor))
+                {
+                    p_cursor++;
+                }
+                int index = variable_index(names, name_lengths,
+                                           &(p_program->variable_count),
+                                           p_name, p_cursor - p_name);
+                if (0 > index)
+                {
+                    return index;
+                }
+                *p_value = index;
+                op       = EVAL_OP_LOAD;
+            }
+            else if (false == parse_number(p_cursor, p_limit, &p_cursor,
+                                           p_value))
+            {
+                return EVAL_INVALID_NUMBER;
+            }
+            p_program->constant_count++;
+            p_program->ops[p_program->op_count++] = op;
+            depth++;
+            continue;
+        }
+
+        p_cursor++;
+        uint8_t op = operator_op(c);
+        if (0 == op)
+        {
+            continue;
+        }
+        if (2 > depth)
+        {
+            return EVAL_STACK_UNDERFLOW;
+        }
+        p_program->ops[p_program->op_count++] = op;
+        depth--;
+    }
+    return finish_program(p_program, depth);
+} /* compile_equation */
+
+/**
+ * @brief Compiles a postfix equation to a program. Characters that are
+ *        neither operands nor operators separate tokens, as they would after
+ *        sanitizing. Input stops at a newline.
+ * @param[in] p_equation A pointer to the equation. Need not be terminated.
+ * @param[in] length The length of the equation.
+ * @param[out] p_program A pointer to store the compiled program in.
+ * @return EVAL_SUCCESS if the program is ready to run.
+ *         Any of the eval_postfix errors other than EVAL_DIVIDE_BY_ZERO.
+ *         EVAL_TOO_LONG if the equation needs more than EVAL_MAX_OPS
+ *             operations.
+ */
+int eval_compile(const char*     p_equation,
+                 size_t          length,
+                 eval_program_t* p_program)
+{
+    return compile_equation(p_equation, length, false, p_program);
+} /* eval_compile */
+
+/**
+ * @brief Compiles a postfix equation that may name variables, for running
+ *        many times with eval_execute. A name is a letter or underscore
+ *        followed by letters, digits or underscores; variables are numbered
+ *        in order of first appearance.
+ * @param[in] p_equation A pointer to the equation. Need not be terminated.
+ * @param[in] length The length of the equation.
+ * @param[out] p_program A pointer to store the compiled program in.
+ * @return EVAL_SUCCESS if the program is ready to run.
+ *         Any of the eval_compile errors.
+ *         EVAL_TOO_MANY_VARIABLES if the equation names more than
+ *             EVAL_MAX_VARIABLES variables.
+ */
+int eval_prepare(const char*     p_equation,
+                 size_t          length,
+                 eval_program_t* p_program)
+{
+    return compile_equation(p_equation, length, true, p_program);
+} /* eval_prepare */
+
+/**
+ * @brief Loads a program from MSG_BYTECODE operations without any text
+ *        parsing. The bytecode is checked exactly as eval_compile checks an
+ *        equation, so a decoded program can only fail on division by zero.
+ * @param[in] p_bytecode A pointer to the bytecode.
+ * @param[in] length The length of the bytecode.
+ * @param[out] p_program A pointer to store the decoded program in.
+ * @return EVAL_SUCCESS if the program is ready to run.
+ *         EVAL_BAD_BYTECODE if an operation is unknown or truncated.
+ *         Any of the eval_compile errors.
+ */
+int eval_decode(const uint8_t*  p_bytecode,
+                size_t          length,
+                eval_program_t* p_program)
+{
+    size_t offset = 0;
+    int    depth  = 0;
+
+    p_program->op_count       = 0;
+    p_program->constant_count = 0;
+    p_program->variable_count = 0;
+    while (offset < length)
+    {
+        uint8_t op = p_bytecode[offset];
+        if (EVAL_MAX_OPS == p_program->op_count)
+        {
+            return EVAL_TOO_LONG;
+        }
+
+        if (EVAL_OP_PUSH == op)
+        {
+            if (PROTO_PUSH_SIZE > length - offset)
+            {
+                return EVAL_BAD_BYTECODE;
+            }
+            if (EVAL_STACK_SIZE == depth)
+            {
+                return EVAL_STACK_OVERFLOW;
+            }
+            p_program->constants[p_program->constant_count++] =
+                proto_get_f64(p_bytecode + offset + 1);
+            depth++;
+            offset += PROTO_PUSH_SIZE;
+        }
+        else if (EVAL_OP_ADD <= op && EVAL_OP_MOD >= op)
+        {
+            if (2 > depth)
+            {
+                return EVAL_STACK_UNDERFLOW;
+            }
+            depth--;
+            offset++;
+        }
+        else
+        {
+            return EVAL_BAD_BYTECODE;
+        }
+        p_program->ops[p_program->op_count++] = op;
+    }
+    return finish_program(p_program, depth);
+} /* eval_decode */
+
+/**
+ * @brief Runs a program, loading its variables from p_values.
+ */
+static int run_program(const eval_program_t* p_program,
+                       const double*         p_values,
+                       double*               p_result)
+{
+    double stack[EVAL_STACK_SIZE];
+    int    depth    = 0;
+    int    constant = 0;
+    for (int i = 0; i < p_program->op_count; i++)
+    {
+        uint8_t op = p_program->ops[i];
+        if (EVAL_OP_PUSH == op)
+        {
+            stack[depth++] = p_program->constants[constant++];
+            continue;
+        }
+        if (EVAL_OP_LOAD == op)
+        {
+            stack[depth++] = p_values[(int)p_program->constants[constant++]];
+            continue;
+        }
+        depth--;
+        int err = apply_op(op, stack[depth - 1], stack[depth],
+                           &(stack[depth - 1]));
+        if (EVAL_SUCCESS != err)
+        {
+            return err;
+        }
+    }
+    *p_result = stack[0];
+    return EVAL_SUCCESS;
+} /* run_program */
+
+/**
+ * @brief Runs a compiled program.
+ * @param[in] p_program A pointer to a program compiled by eval_compile.
+ * @param[out] p_result A pointer to store the result in.
+ * @return EVAL_SUCCESS or EVAL_DIVIDE_BY_ZERO.
+ */
+int eval_program(const eval_program_t* p_program, double* p_result)
+{
+    return run_program(p_program, NULL, p_result);
+} /* eval_program */
+
+/**
+ * @brief Runs a prepared program with its variables bound to values.
+ * @param[in] p_program A pointer to a program compiled by eval_prepare.
+ * @param[in] p_values A pointer to one value per variable, in order of
+ *                     first appearance.
+ * @param[out] p_result A pointer to store the result in.
+ * @return EVAL_SUCCESS or EVAL_DIVIDE_BY_ZERO.
+ */
+int eval_execute(const eval_program_t* p_program,
+                 const double*         p_values,
+                 double*               p_result)
+{
+    return run_program(p_program, p_values, p_result);
+} /* eval_execute */
+
+/**
+ * @brief Runs EVAL_SIMD_LANES programs of the same shape side by side, one
+ *        program per vector lane.
+ * @param[in] pp_programs Pointers to the programs to run.
+ * @param[out] p_results Pointers to store each lane's result in.
+ * @param[out] p_errs Pointers to store each lane's status in.
+ */
+static void run_lanes(const eval_program_t** pp_programs,
+                      double**               pp_results,
+                      int**                  pp_errs)
+{
+    eval_vec_t  stack[EVAL_STACK_SIZE];
+    eval_mask_t divide_by_zero = { 0 };
+    int         depth          = 0;
+    int         constant       = 0;
+
+    const eval_program_t* p_shape = pp_programs[0];
+    for (int i = 0; i < p_shape->op_count; i++)
+    {
+        uint8_t op = p_shape->ops[i];
+        if (EVAL_OP_PUSH == op)
+        {
+            for (int lane = 0; lane < EVAL_SIMD_LANES; lane++)
+            {
+                stack[depth][lane] = pp_programs[lane]->constants[constant];
+            }
+            constant++;
+            depth++;
+            continue;
+        }
+
+        depth--;
+        eval_vec_t right = stack[depth];
+        switch (op)
+        {
+            case EVAL_OP_ADD:
+                stack[depth - 1] += right;
+            break;
+            case EVAL_OP_SUB:
+                stack[depth - 1] -= right;
+            break;
+            case EVAL_OP_MUL:
+                stack[depth - 1] *= right;
+            break;
+            case EVAL_OP_DIV:
+                divide_by_zero |= (right == 0.0);
+                stack[depth - 1] /= right;
+            break;
+            default:
+                divide_by_zero |= (right == 0.0);
+                for (int lane = 0; lane < EVAL_SIMD_LANES; lane++)
+                {
+                    stack[depth - 1][lane] = fmod(stack[depth - 1][lane],
+                                                  right[lane]);
+                }
+            break;
+        }
+    }
+
+    for (int lane = 0; lane < EVAL_SIMD_LANES; lane++)
+    {
+        *(pp_results[lane]) = stack[0][lane];
+        *(pp_errs[lane])    = divide_by_zero[lane] ? EVAL_DIVIDE_BY_ZERO :
+                                                     EVAL_SUCCESS;
+    }
+} /* run_lanes */
+
+/**
+ * @brief Checks if two compiled programs run the same operations.
+ */
+static bool same_shape(const eval_program_t* p_left,
+                       const eval_program_t* p_right)
+{
+    return p_left->shape == p_right->shape &&
+           p_left->op_count == p_right->op_count &&
+           0 == memcmp(p_left->ops, p_right->ops, p_left->op_count);
+} /* same_shape */
+
+/**
+ * @brief Evaluates a batch of compiled programs. Programs are grouped by
+ *        shape and each group runs EVAL_SIMD_LANES programs at a time in
+ *        vector registers; leftovers run one at a time.
+ * @param[in] p_programs A pointer to the compiled programs.
+ * @param[in] p_compile_errs A pointer to the eval_compile status of each
+ *                           program. Programs that failed to compile are
+ *                           skipped and keep their compile error.
+ * @param[in] count The number of programs, at most EVAL_MAX_BATCH.
+ * @param[out] p_results A pointer to store each program's result in.
+ * @param[out] p_errs A pointer to store each program's status in.
+ */
+void eval_batch(const eval_program_t* p_programs,
+                const int*            p_compile_errs,
+                int                   count,
+                double*               p_results,
+                int*                  p_errs)
+{
+    short slots[EVAL_SHAPE_SLOTS];
+    short group_first[EVAL_MAX_BATCH];
+    short group_last[EVAL_MAX_BATCH];
+    short next[EVAL_MAX_BATCH];
+    int   group_count = 0;
+
+    for (int i = 0; i < EVAL_SHAPE_SLOTS; i++)
+    {
+        slots[i] = -1;
+    }
+
+    // Chain every program onto the group for its shape.
+    //
+    for (int i = 0; i < count; i++)
+    {
+        p_errs[i] = p_compile_errs[i];
+        if (EVAL_SUCCESS != p_compile_errs[i])
+        {
+            continue;
+        }
+
+        next[i]   = -1;
+        int  slot = (int)(p_programs[i].shape % EVAL_SHAPE_SLOTS);
+        while (-1 != slots[slot] &&
+               !same_shape(&(p_programs[group_first[slots[slot]]]),
+                           &(p_programs[i])))
+        {
+            slot = (slot + 1) % EVAL_SHAPE_SLOTS;
+        }
+
+        if (-1 == slots[slot])
+        {
+            slots[slot]              = group_count;
+            group_first[group_count] = i;
+            group_last[group_count]  = i;
+            group_count++;
+        }
+        else
+        {
+            int group        = slots[slot];
+            next[group_last[group]] = i;
+            group_last[group]       = i;
+        }
+    }
+
+    for (int group = 0; group < group_count; group++)
+    {
+        const eval_program_t* lane_programs[EVAL_SIMD_LANES];
+        double*               lane_results[EVAL_SIMD_LANES];
+        int*                  lane_errs[EVAL_SIMD_LANES];
+        int                   lanes = 0;
+
+        for (int i = group_first[group]; -1 != i; i = next[i])
+        {
+            lane_programs[lanes] = &(p_programs[i]);
+            lane_results[lanes]  = &(p_results[i]);
+            lane_errs[lanes]     = &(p_errs[i]);
+            lanes++;
+            if (EVAL_SIMD_LANES == lanes)
+            {
+                run_lanes(lane_programs, lane_results, lane_errs);
+                lanes = 0;
+            }
+        }
+
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            *(lane_errs[lane]) = eval_program(lane_programs[lane],
+                                              lane_results[lane]);
+        }
+    }
+} /* eval_batch */
+
+/**
+ * @brief Runs a prepared program over EVAL_COLUMN_LANES rows of its
+ *        columns, one row per vector lane. Inlined into one copy per
+ *        instruction set, so the same vectors compile to AVX-512, AVX2 or
+ *        baseline instructions.
+ * @param[in] p_program A pointer to a program compiled by eval_prepare.
+ * @param[in] pp_columns One pointer per variable to that variable's column.
+ * @param[in] row The first row to run.
+ * @param[out] p_results A pointer to store each row's result in.
+ * @param[out] p_errs A pointer to store each row's status in.
+ */
+static inline __attribute__((always_inline))
+void run_column_lanes(const eval_program_t* p_program,
+                      const double* const*  pp_columns,
+                      int                   row,
+                      double*               p_results,
+                      int*                  p_errs)
+{
+    eval_column_vec_t  stack[EVAL_STACK_SIZE];
+    eval_column_mask_t divide_by_zero = { 0 };
+    int                depth          = 0;
+    int                constant       = 0;
+
+    for (int i = 0; i < p_program->op_count; i++)
+    {
+        uint8_t op = p_program->ops[i];
+        if (EVAL_OP_PUSH == op)
+        {
+            eval_column_vec_t zero = { 0 };
+            stack[depth++] = zero + p_program->constants[constant++];
+            continue;
+        }
+        if (EVAL_OP_LOAD == op)
+        {
+            int variable = (int)p_program->constants[constant++];
+            memcpy(&(stack[depth++]),
+                   pp_columns[variable] + row,
+                   sizeof(eval_column_vec_t));
+            continue;
+        }
+
+        depth--;
+        eval_column_vec_t right = stack[depth];
+        switch (op)
+        {
+            case EVAL_OP_ADD:
+                stack[depth - 1] += right;
+            break;
+            case EVAL_OP_SUB:
+                stack[depth - 1] -= right;
+            break;
+            case EVAL_OP_MUL:
+                stack[depth - 1] *= right;
+            break;
+            case EVAL_OP_DIV:
+                divide_by_zero |= (right == 0.0);
+                stack[depth - 1] /= right;
+            break;
+            default:
+                divide_by_zero |= (right == 0.0);
+                for (int lane = 0; lane < EVAL_COLUMN_LANES; lane++)
+                {
+                    stack[depth - 1][lane] = fmod(stack[depth - 1][lane],
+                                                  right[lane]);
+                }
+            break;
+        }
+    }
+
+    memcpy(p_results + row, &(stack[0]), sizeof(eval_column_vec_t));
+    for (int lane = 0; lane < EVAL_COLUMN_LANES; lane++)
+    {
+        p_errs[row + lane] = divide_by_zero[lane] ? EVAL_DIVIDE_BY_ZERO :
+                                                    EVAL_SUCCESS;
+    }
+} /* run_column_lanes */
+
+/**
+ * @brief Runs a prepared program over every row of its columns: whole
+ *        groups of EVAL_COLUMN_LANES rows in vector registers, and the rows
+ *        left over one at a time.
+ */
+static inline __attribute__((always_inline))
+void run_columns(const eval_program_t* p_program,
+                 const double* const*  pp_columns,
+                 int                   rows,
+                 double*               p_results,
+                 int*                  p_errs)
+{
+    int row = 0;
+    for (; row + EVAL_COLUMN_LANES <= rows; row += EVAL_COLUMN_LANES)
+    {
+        run_column_lanes(p_program, pp_columns, row, p_results, p_errs);
+    }
+
+    double values[EVAL_MAX_VARIABLES];
+    for (; row < rows; row++)
+    {
+        for (int i = 0; i < p_program->variable_count; i++)
+        {
+            values[i] = pp_columns[i][row];
+        }
+        p_errs[row] = run_program(p_program, values, &(p_results[row]));
+    }
+} /* run_columns */
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * @brief run_columns compiled for AVX-512, one instruction per vector.
+ */
+__attribute__((target("avx512f")))
+static void run_columns_avx512(const eval_program_t* p_program,
+                               const double* const*  pp_columns,
+                               int                   rows,
+                               double*               p_results,
+                               int*                  p_errs)
+{
+    run_columns(p_program, pp_columns, rows, p_results, p_errs);
+} /* run_columns_avx512 */
+
+/**
+ * @brief run_columns compiled for AVX2, two instructions per vector.
+ */
+__attribute__((target("avx2")))
+static void run_columns_avx2(const eval_program_t* p_program,
+                             const double* const*  pp_columns,
+                             int                   rows,
+                             double*               p_results,
+                             int*                  p_errs)
+{
+    run_columns(p_program, pp_columns, rows, p_results, p_errs);
+} /* run_columns_avx2 */
+#endif
+
+/**
+ * @brief run_columns compiled for the instructions every supported CPU has.
+ */
+static void run_columns_baseline(const eval_program_t* p_program,
+                                 const double* const*  pp_columns,
+                                 int                   rows,
+                                 double*               p_results,
+                                 int*                  p_errs)
+{
+    run_columns(p_program, pp_columns, rows, p_results, p_errs);
+} /* run_columns_baseline */
+
+/**
+ * @brief Runs a prepared program over columns of values, one evaluation per
+ *        row, with the widest vector instructions this CPU supports. Every
+ *        row's result is exactly what eval_execute would give it.
+ * @param[in] p_program A pointer to a program compiled by eval_prepare.
+ * @param[in] pp_columns One pointer per variable to a column of rows values,
+ *                       in order of first appearance.
+ * @param[in] rows The number of rows, at most EVAL_MAX_COLUMN_ROWS.
+ * @param[out] p_results A pointer to store each row's result in.
+ * @param[out] p_errs A pointer to store each row's status in.
+ */
+void eval_columns(const eval_program_t* p_program,
+                  const double* const*  pp_columns,
+                  int                   rows,
+                  double*               p_results,
+                  int*                  p_errs)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        run_columns_avx512(p_program, pp_columns, rows, p_results, p_errs);
+        return;
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        run_columns_avx2(p_program, pp_columns, rows, p_results, p_errs);
+        return;
+    }
+#endif
+    run_columns_baseline(p_program, pp_columns, rows, p_results, p_errs);
+} /* eval_columns */
+
+/**
+ * @brief Names the instruction set eval_columns runs with on this CPU.
+ */
+const char* eval_columns_isa(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        return "avx512f";
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return "avx2";
+    }
+#endif
+    return "baseline";
+} /* eval_columns_isa */
+
+/**
+ * @brief Pushes an operand onto a stream's stack, moving the stack to the
+ *        heap or growing it if it is full.
+ * @return True if the operand was pushed.
+ *         False if the stack is at its limit; the stream's err is set.
+ */
+static bool stream_push(eval_stream_t* p_stream, double value)
+{
+    if (p_stream->capacity == p_stream->depth)
+    {
+        size_t  capacity = p_stream->capacity * 2;
+        double* p_stack  = NULL;
+        if (p_stream->max_depth < capacity)
+        {
+            capacity = p_stream->max_depth;
+        }
+        if (p_stream->capacity < capacity)
+        {
+            if (p_stream->stack == p_stream->p_stack)
+            {
+                p_stack = malloc(capacity * sizeof(double));
+                if (NULL != p_stack)
+                {
+                    memcpy(p_stack,
+                           p_stream->stack,
+                           p_stream->depth * sizeof(double));
+                }
+            }
+            else
+            {
+                p_stack = realloc(p_stream->p_stack,
+                                  capacity * sizeof(double));
+            }
+        }
+        if (NULL == p_stack)
+        {
+            p_stream->err = EVAL_STACK_OVERFLOW;
+            return false;
+        }
+        p_stream->p_stack  = p_stack;
+        p_stream->capacity = capacity;
+    }
+    p_stream->p_stack[p_stream->depth++] = value;
+    return true;
+} /* stream_push */
+
+/**
+ * @brief Appends the start of a number that may continue in the next chunk
+ *        to a stream's carried token.
+ * @return True if the characters were carried.
+ *         False if the number is too long; the stream's err is set.
+ */
+static bool stream_carry(eval_stream_t* p_stream,
+                         const char*    p_chars,
+                         size_t         length)
+{
+    if ((size_t)(EVAL_MAX_NUMBER_LENGTH - p_stream->token_length) < length)
+    {
+        p_stream->err = EVAL_INVALID_NUMBER;
+        return false;
+    }
+    memcpy(p_stream->token + p_stream->token_length, p_chars, length);
+    p_stream->token_length += (int)length;
+    return true;
+} /* stream_carry */
+
+/**
+ * @brief Parses and pushes the number carried over from earlier chunks.
+ * @return True if the number was pushed.
+ *         False if it is malformed or the stack is full; err is set.
+ */
+static bool stream_push_token(eval_stream_t* p_stream)
+{
+    const char* p_end = NULL;
+    double      value = 0.0;
+    bool        b_ok  = parse_number(p_stream->token,
+                                     p_stream->token + p_stream->token_length,
+                                     &p_end,
+                                     &value);
+    p_stream->token_length = 0;
+    if (false == b_ok)
+    {
+        p_stream->err = EVAL_INVALID_NUMBER;
+        return false;
+    }
+    return stream_push(p_stream, value);
+} /* stream_push_token */
+
+/**
+ * @brief Finds the end of the run of number characters at a cursor.
+ */
+static const char* number_end(const char* p_cursor, const char* p_limit)
+{
+    while (p_cursor < p_limit && is_number_char(*p_cursor))
+    {
+        p_cursor++;
+    }
+    return p_cursor;
+} /* number_end */
+
+/**
+ * @brief Starts evaluating a new equation on a stream. The stream must not
+ *        hold a heap stack, so finish or release the previous equation
+ *        first.
+ * @param[out] p_stream A pointer to the stream to start.
+ * @param[in] memory_limit The most memory the operand stack may use. Never
+ *                         less than EVAL_STREAM_MIN_MEMORY.
+ */
+void eval_stream_begin(eval_stream_t* p_stream, size_t memory_limit)
+{
+    p_stream->p_stack      = p_stream->stack;
+    p_stream->depth        = 0;
+    p_stream->capacity     = EVAL_STACK_SIZE;
+    p_stream->max_depth    = memory_limit / sizeof(double);
+    p_stream->length       = 0;
+    p_stream->err          = EVAL_SUCCESS;
+    p_stream->token_length = 0;
+    p_stream->b_ended      = false;
+    if (EVAL_STACK_SIZE > p_stream->max_depth)
+    {
+        p_stream->max_depth = EVAL_STACK_SIZE;
+    }
+} /* eval_stream_begin */
+
+/**
+ * @brief Evaluates the next chunk of an equation. Tokens follow the rules of
+ *        eval_compile and may be split between chunks. Once an error, a
+ *        newline or a null is found the rest of the equation is only
+ *        counted, so a streamed equation ends where the sanitized one would.
+ * @param[in,out] p_stream A pointer to a started stream.
+ * @param[in] p_data A pointer to the chunk. Need not be terminated.
+ * @param[in] length The length of the chunk.
+ */
+void eval_stream_feed(eval_stream_t* p_stream,
+                      const char*    p_data,
+                      size_t         length)
+{
+    const char* p_cursor = p_data;
+    const char* p_limit  = p_data + length;
+    p_stream->length += length;
+    if (EVAL_SUCCESS != p_stream->err || p_stream->b_ended)
+    {
+        return;
+    }
+
+    if (0 < p_stream->token_length)
+    {
+        const char* p_end = number_end(p_cursor, p_limit);
+        if (false == stream_carry(p_stream, p_cursor, p_end - p_cursor) ||
+            p_limit == p_end)
+        {
+            return;
+        }
+        if (false == stream_push_token(p_stream))
+        {
+            return;
+        }
+        p_cursor = p_end;
+    }
+
+    while (p_cursor < p_limit)
+    {
+        char c = *p_cursor;
+        if (is_number_char(c))
+        {
+            // A number running into the end of the chunk may continue in
+            // the next one, so carry it instead of parsing it.
+            //
+            const char* p_end = number_end(p_cursor, p_limit);
+            if (p_limit == p_end)
+            {
+                stream_carry(p_stream, p_cursor, p_end - p_cursor);
+                return;
+            }
+            double value = 0.0;
+            if (false == parse_number(p_cursor, p_end, &p_end, &value))
+            {
+                p_stream->err = EVAL_INVALID_NUMBER;
+                return;
+            }
+            if (false == stream_push(p_stream, value))
+            {
+                return;
+            }
+            p_cursor = p_end;
+            continue;
+        }
+
+        // Stop where sanitize_input_string cuts a whole equation short.
+        //
+        if ('\n' == c || '\0' == c)
+        {
+            p_stream->b_ended = true;
+            return;
+        }
+
+        p_cursor++;
+        uint8_t op = operator_op(c);
+        if (0 == op)
+        {
+            continue;
+        }
+
+        if (2 > p_stream->depth)
+        {
+            p_stream->err = EVAL_STACK_UNDERFLOW;
+            return;
+        }
+        double* p_top = p_stream->p_stack + (--p_stream->depth);
+        p_stream->err = apply_op(op, p_top[-1], p_top[0], &(p_top[-1]));
+        if (EVAL_SUCCESS != p_stream->err)
+        {
+            return;
+        }
+    }
+} /* eval_stream_feed */
+
+/**
+ * @brief Ends the equation being evaluated on a stream and releases its
+ *        stack. Begin the stream again before reusing it.
+ * @param[in,out] p_stream A pointer to a started stream.
+ * @param[out] p_result A pointer to store the result in.
+ * @return EVAL_SUCCESS if the equation was evaluated.
+ *         Any of the eval_postfix errors. EVAL_STACK_OVERFLOW means more
+ *             operands were pending than the memory limit allows, and
+ *             EVAL_INVALID_NUMBER includes operands longer than
+ *             EVAL_MAX_NUMBER_LENGTH characters.
+ */
+int eval_stream_finish(eval_stream_t* p_stream, double* p_result)
+{
+    if (EVAL_SUCCESS == p_stream->err && 0 < p_stream->token_length)
+    {
+        stream_push_token(p_stream);
+    }
+
+    int err = p_stream->err;
+    if (EVAL_SUCCESS == err)
+    {
+        if (0 == p_stream->depth)
+        {
+            err = EVAL_EMPTY_EQUATION;
+        }
+        else if (1 < p_stream->depth)
+        {
+            err = EVAL_TRAILING_OPERANDS;
+        }
+        else
+        {
+            *p_result = p_stream->p_stack[0];
+        }
+    }
+    eval_stream_release(p_stream);
+    return err;
+} /* eval_stream_finish */
+
+/**
+ * @brief Frees a stream's heap stack, if it has one. Safe to call on a
+ *        stream that was begun, finished or already released.
+ * @param[in,out] p_stream A pointer to the stream.
+ */
+void eval_stream_release(eval_stream_t* p_stream)
+{
+    if (p_stream->stack != p_stream->p_stack)
+    {
+        free(p_stream->p_stack);
+    }
+    p_stream->p_stack  = p_stream->stack;
+    p_stream->depth    = 0;
+    p_stream->capacity = EVAL_STACK_SIZE;
+} /* eval_stream_release */
+
+/**
+ * @brief Describes an evaluation error code.
+ * @param[in] err An error code returned by eval_postfix.
+ * @return A pointer to a static description of the error.
+ */
+const char* eval_strerror(int err)
+{
+    return proto_eval_strerror((uint16_t)-err);
+} /* eval_strerror */
@@ -0,0 +1,114 @@
+#ifndef SERV_EVAL_H
+#define SERV_EVAL_H
+
+#include <stdbool.h>
+#include <stddef.h> // size_t
+#include <stdint.h> // uint8_t, uint64_t
+
+#include "postfix_proto.h"
+
+#define EVAL_SUCCESS 0
+#define EVAL_STACK_UNDERFLOW (-PROTO_EVAL_STACK_UNDERFLOW)
+#define EVAL_DIVIDE_BY_ZERO (-PROTO_EVAL_DIVIDE_BY_ZERO)
+#define EVAL_TRAILING_OPERANDS (-PROTO_EVAL_TRAILING_OPERANDS)
+#define EVAL_STACK_OVERFLOW (-PROTO_EVAL_STACK_OVERFLOW)
+#define EVAL_INVALID_NUMBER (-PROTO_EVAL_INVALID_NUMBER)
+#define EVAL_EMPTY_EQUATION (-PROTO_EVAL_EMPTY_EQUATION)
+#define EVAL_TOO_LONG (-PROTO_EVAL_TOO_LONG)
+#define EVAL_BAD_BYTECODE (-PROTO_EVAL_BAD_BYTECODE)
+#define EVAL_UNKNOWN_HANDLE (-PROTO_EVAL_UNKNOWN_HANDLE)
+#define EVAL_BAD_BINDINGS (-PROTO_EVAL_BAD_BINDINGS)
+#define EVAL_TOO_MANY_PREPARED (-PROTO_EVAL_TOO_MANY_PREPARED)
+#define EVAL_TOO_MANY_VARIABLES (-PROTO_EVAL_TOO_MANY_VARIABLES)
+#define EVAL_NO_MEMORY (-PROTO_EVAL_NO_MEMORY)
+#define EVAL_STACK_SIZE 64
+#define EVAL_MAX_OPS PROTO_MAX_OPS
+#define EVAL_SIMD_LANES 4
+#define EVAL_MAX_BATCH PROTO_MAX_BATCH
+#define EVAL_SHAPE_SLOTS (2 * EVAL_MAX_BATCH)
+#define EVAL_COLUMN_LANES 8
+#define EVAL_MAX_COLUMN_ROWS PROTO_MAX_COLUMN_ROWS
+#define EVAL_MAX_NUMBER_LENGTH 127
+#define EVAL_MAX_VARIABLES PROTO_MAX_VARIABLES
+#define EVAL_STREAM_MIN_MEMORY (EVAL_STACK_SIZE * sizeof(double))
+
+#define EVAL_OP_PUSH PROTO_OP_PUSH
+#define EVAL_OP_ADD PROTO_OP_ADD
+#define EVAL_OP_SUB PROTO_OP_SUB
+#define EVAL_OP_MUL PROTO_OP_MUL
+#define EVAL_OP_DIV PROTO_OP_DIV
+#define EVAL_OP_MOD PROTO_OP_MOD
+#define EVAL_OP_LOAD (PROTO_OP_MOD + 1)
+
+/**
+ * @brief An equation compiled to a flat list of operations. The stack
+ *        discipline is checked at compile time, so running a program can only
+ *        fail on division by zero. Programs with the same shape run the same
+ *        operations on different constants. Prepared programs may also
+ *        load variables; the constant of an EVAL_OP_LOAD holds the index of
+ *        the variable it loads. Bytecode never decodes to EVAL_OP_LOAD.
+ */
+typedef struct eval_program_t {
+    uint64_t shape;
+    int      op_count;
+    int      constant_count;
+    int      variable_count;
+    uint8_t  ops[EVAL_MAX_OPS];
+    double   constants[EVAL_MAX_OPS];
+} eval_program_t;
+
+/**
+ * @brief An equation evaluated as its bytes arrive. Only the operand stack
+ *        and the characters of a number split between two chunks are kept,
+ *        so the equation itself is never buffered. The stack starts in place
+ *        and moves to the heap when it outgrows it, up to max_depth operands.
+ *        Like sanitize_input_string, a newline or null ends the equation;
+ *        b_ended is set once one has been seen.
+ */
+typedef struct eval_stream_t {
+    double* p_stack;
+    size_t  depth;
+    size_t  capacity;
+    size_t  max_depth;
+    size_t  length;
+    int     err;
+    int     token_length;
+    bool    b_ended;
+    char    token[EVAL_MAX_NUMBER_LENGTH + 1];
+    double  stack[EVAL_STACK_SIZE];
+} eval_stream_t;
+
+int         eval_postfix(char* p_equation, double* p_result);
+int         eval_compile(const char*     p_equation,
+                         size_t          length,
+                         eval_program_t* p_program);
+int         eval_prepare(const char*     p_equation,
+                         size_t          length,
+                         eval_program_t* p_program);
+int         eval_decode(const uint8_t*  p_bytecode,
+                        size_t          length,
+                        eval_program_t* p_program);
+int         eval_program(const eval_program_t* p_program, double* p_result);
+int         eval_execute(const eval_program_t* p_program,
+                         const double*         p_values,
+                         double*               p_result);
+void        eval_batch(const eval_program_t* p_programs,
+                       const int*            p_compile_errs,
+                       int                   count,
+                       double*               p_results,
+                       int*                  p_errs);
+void        eval_columns(const eval_program_t* p_program,
+                         const double* const*  pp_columns,
+                         int                   rows,
+                         double*               p_results,
+                         int*                  p_errs);
+const char* eval_columns_isa(void);
+void        eval_stream_begin(eval_stream_t* p_stream, size_t memory_limit);
+void        eval_stream_feed(eval_stream_t* p_stream,
+                             const char*    p_data,
+                             size_t         length);
+int         eval_stream_finish(eval_stream_t* p_stream, double* p_result);
+void        eval_stream_release(eval_stream_t* p_stream);
+const char* eval_strerror(int err);
+
+#endif /* SERV_EVAL_H */
@@ -1,20 +1,54 @@
-#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE // pthread_setaffinity_np
 #include <ctype.h> // isdigit, isalpha
 #include <errno.h>
-#include <fcntl.h> // F_SETFL, O_NONBLOCK
+#include <netinet/in.h> // sockaddr_in, INADDR_ANY
+#include <poll.h> // poll
 #include <pthread.h>
+#include <sched.h> // cpu_set_t, CPU_SET
 #include <semaphore.h> // sem_post, sem_destroy, sem_trywait
+#include <stdalign.h> // alignas
+#include <stdatomic.h> // atomic_thread_fence
 #include <stdbool.h>
 #include <stdio.h> // stderr, EOF, NULL
-#include <stdlib.h> // strtol
+#include <stdlib.h> // strtol, aligned_alloc
 #include <string.h> // strerror
 #include <sys/types.h>
-#include <sys/socket.h> // MSG_PEEK
+#include <sys/socket.h> // recv, send, MSG_DONTWAIT
+#include <sys/un.h> // sockaddr_un
+#include <time.h> // clock_gettime
 #include <unistd.h> // close
 
 #include "serv_lib.h"
+#include "dtoa.h"
+#include "serv_admin.h"
+#include "serv_conn.h"
+#include "serv_epoll.h"
+#include "serv_eval.h"
+#include "serv_log.h"
+#include "serv_metrics.h"
+#include "serv_pool.h"
+#include "serv_shm.h"
+#include "serv_uring.h"
+#include "shm_ring.h"
 
-#define PURGE_BUFFER_SIZE 256
+/**
+ * @brief Buffers a worker thread reuses for every client it serves. The
+ *        arena starts on its own cache line, and is allocated and touched
+ *        once when the worker starts so serving a request never allocates or
+ *        faults in a page.
+ */
+typedef struct worker_arena_t {
+    alignas(CACHE_LINE_SIZE) conn_t conn;
+} worker_arena_t;
+
+int      g_serv_response_format = SERV_RESPONSE_VERBOSE;
+size_t   g_serv_stream_memory   = SERV_DEFAULT_STREAM_MEMORY;
+uint64_t g_serv_timeout_ns[TIMEOUT_KIND_COUNT] =
+{
+    DEFAULT_IDLE_TIMEOUT_S * 1000000000ull,
+    DEFAULT_READ_TIMEOUT_S * 1000000000ull,
+    DEFAULT_WRITE_TIMEOUT_S * 1000000000ull
+};
 
 /**
  * @brief Evaluate given character to see if it is a valid operator.
@@ -37,6 +71,17 @@ bool is_operator(char c)
     return false;
 }
 
+/**
+ * @brief Reads the monotonic clock.
+ * @return The current monotonic time in nanoseconds.
+ */
+uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000ull) + (uint64_t)now.tv_nsec;
+} /* monotonic_ns */
+
 /**
  * @brief Attempt to convert a string to a port number.
  * @param[in] p_string A pointer to a string containing the port number to
@@ -140,241 +185,795 @@ void sanitize_input_string(char* p_string)
 } /* sanitize_input_string */
 
 /**
- * @brief Purges excess pending socket data if incoming message is longer than
- *        100 characters.
- * @param[in] socket_fd A File Descriptor for the socket to purge.
+ * @brief Evaluates a sanitized equation, timing and counting it.
+ * @param[in] p_equation A pointer to a sanitized equation string.
+ * @param[out] p_answer A pointer to store the answer in.
+ * @return EVAL_SUCCESS or the evaluation error.
  */
-void purge_socket(int socket_fd)
+int evaluate_equation(char* p_equation, double* p_answer)
 {
-    char purge_buffer[PURGE_BUFFER_SIZE + 1] = { 0 };
-    int  bytes_read                          = 0;
+    uint64_t start_ns = monotonic_ns();
+    int      err      = eval_postfix(p_equation, p_answer);
+    record_evaluation(err, *p_answer, monotonic_ns() - start_ns);
+    return err;
+} /* evaluate_equation */
 
-    // Set socket to nonblocking so functionality can continue without blocking
-    // after purge.
-    //
-    int flags = fcntl(socket_fd, F_GETFL, 0);
-    fcntl(socket_fd, F_SETFL, (flags | O_NONBLOCK));
-    do
+/**
+ * @brief Counts and logs one evaluated equation.
+ * @param[in] eval_err EVAL_SUCCESS or the evaluation error.
+ * @param[in] answer The answer, if eval_err is EVAL_SUCCESS.
+ * @param[in] eval_ns The time spent evaluating the equation.
+ */
+void record_evaluation(int eval_err, double answer, uint64_t eval_ns)
+{
+    serv_metrics_record(SERV_TIMER_EVAL, eval_ns);
+    serv_metrics_add(SERV_METRIC_REQUESTS, 1);
+    if (EVAL_SUCCESS != eval_err)
     {
-        bytes_read = recv(socket_fd, &purge_buffer, PURGE_BUFFER_SIZE + 1, 0);
-    } while (PURGE_BUFFER_SIZE < bytes_read);
-    fcntl(socket_fd, F_SETFL, (flags & ~O_NONBLOCK));
-}
+        serv_metrics_add(SERV_METRIC_ERRORS, 1);
+        SERV_LOG(SERV_LOG_LEVEL_REQUEST,
+                 "Invalid equation given. [%s]\nNotifying client.\n",
+                 eval_strerror(eval_err));
+        return;
+    }
+
+    SERV_LOG(SERV_LOG_LEVEL_REQUEST,
+             "The answer to the equation sent by the client is [%f]\n",
+             answer);
+} /* record_evaluation */
+
+/**
+ * @brief Writes the text answer to an evaluated equation in the configured
+ *        text response format. Answers are formatted with the fewest digits
+ *        that parse back to the exact answer.
+ * @param[in] eval_err EVAL_SUCCESS or the evaluation error.
+ * @param[in] answer The answer, if eval_err is EVAL_SUCCESS.
+ * @param[out] p_response A pointer to a buffer to store the response in.
+ * @param[in] response_size The size of the response buffer, at least
+ *                          MAX_BUFFER_SIZE.
+ * @return The length of the response written, excluding the null terminator.
+ */
+int format_response(int    eval_err,
+                    double answer,
+                    char*  p_response,
+                    int    response_size)
+{
+    static const char answer_prefix[] = "The answer to the given equation is [";
+    int               length          = 0;
+
+    if (EVAL_SUCCESS != eval_err)
+    {
+        length = snprintf(p_response,
+                          response_size,
+                          (SERV_RESPONSE_NUMBER == g_serv_response_format) ?
+                              "Error: %s" :
+                              "An error occurred processing the given "
+                              "equation. [%s]",
+                          eval_strerror(eval_err));
+        return (response_size <= length) ? response_size - 1 : length;
+    }
+
+    if (SERV_RESPONSE_NUMBER == g_serv_response_format)
+    {
+        return dtoa_shortest(answer, p_response);
+    }
+
+    memcpy(p_response, answer_prefix, sizeof(answer_prefix) - 1);
+    length  = sizeof(answer_prefix) - 1;
+    length += dtoa_shortest(answer, p_response + length);
+    p_response[length++] = ']';
+    p_response[length]   = '\0';
+    return length;
+} /* format_response */
+
+/**
+ * @brief Evaluates a sanitized equation and writes the text to send back to
+ *        the client into the given response buffer.
+ * @param[in] p_equation A pointer to a sanitized equation string.
+ * @param[out] p_response A pointer to a buffer to store the response in.
+ * @param[in] response_size The size of the response buffer, at least
+ *                          MAX_BUFFER_SIZE.
+ * @param[out] p_eval_err A pointer to store the evaluation status in, or NULL.
+ * @return The length of the response written, excluding the null terminator.
+ */
+int build_response(char* p_equation,
+                   char* p_response,
+                   int   response_size,
+                   int*  p_eval_err)
+{
+    double answer = 0.0;
+    int    err    = evaluate_equation(p_equation, &answer);
+    if (NULL != p_eval_err)
+    {
+        *p_eval_err = err;
+    }
+    return format_response(err, answer, p_response, response_size);
+} /* build_response */
+
+/**
+ * @brief Notifies a given client that it is unable to accept the connection
+ *        and disconnects them.
+ * @param[in] client_fd The client's socket File Descriptor
+ */
+void notify_client_max_connections(int client_fd)
+{
+    char* message = PROTO_REJECTED_MESSAGE;
+    send(client_fd,
+         message,
+         strnlen(message, MAX_BUFFER_SIZE),
+         0);
+} /* notify_and_disconnect_client */
 
 /**
- * @brief Reads provided client socket up to 100 characters, and purges the
- *        remaining data on the socket.
+ * @brief Sends a client taken off the connection queue the handshake byte,
+ *        advertising the highest protocol version this server speaks. Only
+ *        the thread serving the client sends it, before reading from or
+ *        answering it, so a client turned away at a full queue gets
+ *        PROTO_REJECTED_MESSAGE in its place rather than after it.
+ * @param[in] p_serv A pointer to the serv_t struct serving the client.
  * @param[in] client_fd The client's socket File Descriptor
- *            p_buffer A pointer to the a buffer to store the received message
- *                     from the connected client.
- * @return SOCK_READ_SUCCESS if successful read.
- *         SOCK_READ_ERROR if problem during receive. (Closes client socket)
- *         SOCK_CLIENT_DISCONNECT if the client has disconnected.
- *         SOCK_SEND_ERROR if the client sent too many characters and an error
- *             happens during notification to client (Send)
  */
-int read_from_client(int client_fd, char* p_buffer)
+void send_handshake(serv_t* p_serv, int client_fd)
+{
+    // Only worker threads serve shared memory; the event loops cannot block
+    // on one client's rings.
+    //
+    char byte = (SERV_MODE_THREAD == p_serv->mode) ? PROTO_VERSION_SHM :
+                                                     PROTO_VERSION_FRAMED;
+    send(client_fd, &byte, 1, 0);
+} /* send_handshake */
+
+/**
+ * @brief Serves a client until it disconnects. Requests of either protocol
+ *        are parsed incrementally out of the connection's bounded input
+ *        buffer, and equations too long for it are evaluated as they arrive.
+ *        Reads after the first of a burst do not block, so the end of the
+ *        burst is seen without changing the socket's flags, and all of the
+ *        burst's responses are sent together. Every blocking read and send
+ *        is bounded by the connection's timeouts.
+ * @param[in] p_serv A pointer to the running serv_t struct.
+ * @param[in] client_fd The client's socket File Descriptor
+ * @param[in] p_arena A pointer to the serving worker's arena.
+ */
+void handle_client(serv_t* p_serv, int client_fd, worker_arena_t* p_arena)
+{
+    conn_t* p_conn     = &(p_arena->conn);
+    int     recv_flags = 0;
+    send_handshake(p_serv, client_fd);
+    conn_init(p_conn, client_fd);
+    if (false == timeout_watch(&(p_serv->reaper), &(p_conn->timer)))
+    {
+        conn_release(p_conn);
+        return;
+    }
+    p_conn->b_shm_capable = shm_socket_is_local(client_fd);
+
+    while (true)
+    {
+        if (0 == recv_flags)
+        {
+            conn_arm_deadline(p_conn);
+        }
+        ssize_t bytes_read = recv(client_fd,
+                                  p_conn->in_buffer + p_conn->in_length,
+                                  CONN_IN_BUFFER_SIZE - p_conn->in_length,
+                                  recv_flags);
+        if (0 == bytes_read)
+        {
+            SERV_LOG(SERV_LOG_LEVEL_INFO, "Client has disconnected.\n");
+            break;
+        }
+        if (0 > bytes_read)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            if (EAGAIN == errno || EWOULDBLOCK == errno)
+            {
+                conn_end_of_burst(p_conn);
+                if (false == conn_flush(p_conn))
+                {
+                    break;
+                }
+                recv_flags = 0;
+                continue;
+            }
+            serv_metrics_add(SERV_METRIC_ERRORS, 1);
+            SERV_LOG(SERV_LOG_LEVEL_ERROR,
+                     "Error reading from socket. [%s]\n",
+                     strerror(errno));
+            break;
+        }
+        serv_metrics_add(SERV_METRIC_BYTES_RECEIVED, bytes_read);
+        p_conn->in_length += bytes_read;
+
+        bool is_connected = true;
+        do
+        {
+            conn_process_input(p_conn);
+            if (p_conn->b_input_pending)
+            {
+                is_connected = conn_flush(p_conn);
+            }
+        } while (is_connected && p_conn->b_input_pending);
+        if (false == is_connected)
+        {
+            break;
+        }
+        if (p_conn->b_shm_requested && serve_shm_connection(p_conn))
+        {
+            break;
+        }
+        recv_flags = MSG_DONTWAIT;
+    }
+    timeout_unwatch(&(p_serv->reaper), &(p_conn->timer));
+    conn_release(p_conn);
+} /* handle_client */
+
+/**
+ * @brief Worker thread body. Takes accepted clients off the connection queue
+ *        and serves each one until it disconnects.
+ * @param[in] args A pointer to the running serv_t struct.
+ * @return NULL on thread exit
+ */
+void* thread_handler(void* args)
 {
-    int status = SOCK_READ_SUCCESS;
+    serv_t* p_serv = (serv_t*)args;
+    int     thread_client_fd;
 
-    int pending_socket_buffer_length;
-    int bytes_read;
+    worker_arena_t* p_arena = aligned_alloc(CACHE_LINE_SIZE,
+                                            sizeof(worker_arena_t));
+    if (NULL == p_arena)
+    {
+        fprintf(stderr,
+                "Error allocating worker arena. [%s]\n",
+                strerror(errno));
+        return NULL;
+    }
 
-    pending_socket_buffer_length = recv(client_fd,
-                                        p_buffer,
-                                        MAX_BUFFER_SIZE + 1,
-                                        MSG_PEEK);
-    // Truncate last byte to guarantee null terminator.
+    // Fault every page in now rather than on the first requests.
     //
-    p_buffer[MAX_BUFFER_SIZE] = '\0';
-    bytes_read = recv(client_fd, p_buffer, MAX_BUFFER_SIZE, 0);
-    if (MAX_BUFFER_SIZE < pending_socket_buffer_length)
-    {
-        fprintf(stderr, "Data received exceeds 100 character limit.\n");
-        char* p_message_too_long = 
-        "Received message longer than 100 characters. Flushing excess.\n";
-        int err = send(client_fd,
-                       p_message_too_long,
-                       strnlen(p_message_too_long, MAX_BUFFER_SIZE),
-                       0);
-        if (strnlen(p_message_too_long, MAX_BUFFER_SIZE) > err)
+    memset(p_arena, 0, sizeof(worker_arena_t));
+
+    while(p_serv->b_running)
+    {
+        thread_client_fd = fd_queue_dequeue_wait(&(p_serv->connection_queue));
+
+        // In the case of a wake up for exiting the server.
+        //
+        if (FD_QUEUE_EMPTY == thread_client_fd)
         {
-            fprintf(stderr,
-                    "Error sending message to client. [%s]\n",
-                    strerror(errno));
-            return SOCK_SEND_ERROR;
+            continue;
         }
-        purge_socket(client_fd);
+
+        handle_client(p_serv, thread_client_fd, p_arena);
+        close(thread_client_fd);
+        thread_client_fd = 0;
+        release_connection_slot(p_serv);
+    }
+    free(p_arena);
+    return NULL;
+} /* thread_handler */
+
+/**
+ * @brief Queues an accepted client for the workers, which send it the
+ *        handshake byte when they take it. Never waits on the workers.
+ * @param[in] p_serv A pointer to a running serv_t struct.
+ * @param[in] client_fd The client's socket File Descriptor
+ * @return True if the client was queued.
+ *         False if the connection queue is full. The caller still owns the
+ *         client.
+ */
+bool dispatch_connection(serv_t* p_serv, int client_fd)
+{
+    if (false == fd_queue_enqueue(&(p_serv->connection_queue), client_fd))
+    {
+        serv_metrics_add(SERV_METRIC_REJECTED_QUEUE_FULL, 1);
+        SERV_LOG(SERV_LOG_LEVEL_WARN, "Connection queue is full.\n");
+        return false;
+    }
+    if (SERV_MODE_EPOLL == p_serv->mode)
+    {
+        epoll_wake_loop(p_serv);
     }
+    else if (SERV_MODE_POOL == p_serv->mode)
+    {
+        work_pool_wake(p_serv);
+    }
+    else if (SERV_MODE_URING == p_serv->mode)
+    {
+        uring_wake_loop(p_serv);
+    }
+    return true;
+} /* dispatch_connection */
 
-    if (0 > bytes_read)
+/**
+ * @brief Creates, binds and listens on a unix domain socket at the server's
+ *        p_unix_path, replacing any socket left there by an earlier run.
+ * @param[in] p_serv A pointer to a serv_t struct with p_unix_path and
+ *                   listen_backlog set. Stores the listener in it.
+ * @return SERV_INIT_SUCCESS if the listener is accepting connections.
+ *         SERV_INIT_FAILURE if it could not be set up.
+ */
+static int open_unix_listener(serv_t* p_serv)
+{
+    struct sockaddr_un serv_addr = { 0 };
+    serv_addr.sun_family = AF_UNIX;
+    if (sizeof(serv_addr.sun_path) <= strlen(p_serv->p_unix_path))
     {
         fprintf(stderr,
-                "Error reading from socket. [%s]\n",
+                "Unix socket path [%s] is too long.\n",
+                p_serv->p_unix_path);
+        return SERV_INIT_FAILURE;
+    }
+    strcpy(serv_addr.sun_path, p_serv->p_unix_path);
+
+    int listener_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (0 > listener_fd)
+    {
+        fprintf(stderr,
+                "Failed to create unix listener socket. [%s]\n",
                 strerror(errno));
-        status = SOCK_READ_ERROR;
+        return SERV_INIT_FAILURE;
     }
-    else if (0 == bytes_read)
+
+    unlink(p_serv->p_unix_path);
+    if (0 > bind(listener_fd,
+                 (struct sockaddr*)&serv_addr,
+                 sizeof(serv_addr)))
     {
-        printf("Client has disconnected.\n");
-        status = SOCK_CLIENT_DISCONNECT;
+        fprintf(stderr,
+                "Failed to bind unix socket [%s]. [%s]\n",
+                p_serv->p_unix_path,
+                strerror(errno));
+        close(listener_fd);
+        return SERV_INIT_FAILURE;
     }
-    else
+    if (0 > listen(listener_fd, p_serv->listen_backlog))
     {
-        sanitize_input_string(p_buffer);
-        printf("Server received message: [%s]\n", p_buffer);
+        fprintf(stderr,
+                "Error setting unix listening state. [%s]\n",
+                strerror(errno));
+        close(listener_fd);
+        unlink(p_serv->p_unix_path);
+        return SERV_INIT_FAILURE;
     }
-    return status;
-}
+    printf("Listener bound on unix socket [%s]\n", p_serv->p_unix_path);
+    p_serv->unix_listener_fd = listener_fd;
+    return SERV_INIT_SUCCESS;
+} /* open_unix_listener */
 
 /**
- * @brief Handles a given client socket file descriptor. Processes an equation
- *        received on the given client file descriptor.
- * @param[in] client_fd The client's socket File Descriptor
- * @return True if the client is still connected.
- *         False if the client has disconnected.
+ * @brief Creates, binds and listens on the server's listener socket, and on
+ *        its unix domain socket too if p_unix_path is set.
+ * @param[in] p_serv A pointer to a serv_t struct with listen_backlog,
+ *                   b_reuseport and p_unix_path set. Stores the listeners
+ *                   in it.
+ * @param[in] port_number The port to listen on, on every interface.
+ * @return SERV_INIT_SUCCESS if the listener is accepting connections.
+ *         SERV_INIT_FAILURE if it could not be set up.
  */
-bool handle_client(int client_fd)
+int open_listener(serv_t* p_serv, int port_number)
 {
-    int  err;
-    bool is_connected = true;
+    p_serv->serv_listener_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (0 > p_serv->serv_listener_fd)
+    {
+        fprintf(stderr,
+                "Failed to create listener socket. [%s]\n",
+                strerror(errno));
+        return SERV_INIT_FAILURE;
+    }
 
-    char* p_buffer = calloc(MAX_BUFFER_SIZE + 1, sizeof(char));
-    if (NULL == p_buffer)
+    int       optval = 1;
+    socklen_t optlen = sizeof(optval);
+
+    int err = setsockopt(p_serv->serv_listener_fd,
+                         SOL_SOCKET,
+                         SO_REUSEADDR,
+                         &optval,
+                         optlen);
+    if (0 <= err && p_serv->b_reuseport)
+    {
+        // Every shard binds its own listener to the same port and the
+        // kernel spreads incoming connections across them.
+        //
+        err = setsockopt(p_serv->serv_listener_fd,
+                         SOL_SOCKET,
+                         SO_REUSEPORT,
+                         &optval,
+                         optlen);
+    }
+    if (0 > err)
     {
         fprintf(stderr,
-                "Error allocating memory for socket buffer. [%s]\n",
+                "Error setting socket options. [%s]\n",
                 strerror(errno));
-        char* p_error_message = "Server error. Disconnecting client.\n";
-        err = send(client_fd,
-                   p_error_message,
-                   strnlen(p_error_message, MAX_BUFFER_SIZE),
-                   0);
-        if (strnlen(p_error_message, MAX_BUFFER_SIZE) > err)
-        {
-            fprintf(stderr,
-                    "Error sending message to client. [%s]\n",
-                    strerror(errno));
-        }
+        close(p_serv->serv_listener_fd);
+        return SERV_INIT_FAILURE;
+    }
 
-        return false;
+    struct sockaddr_in serv_addr = { 0 };
+    serv_addr.sin_family      = AF_INET;
+    serv_addr.sin_addr.s_addr = INADDR_ANY;
+    serv_addr.sin_port        = htons(port_number);
+
+    err = bind(p_serv->serv_listener_fd,
+               (struct sockaddr*)&serv_addr,
+               sizeof(serv_addr));
+    if (0 > err)
+    {
+        fprintf(stderr,
+                "Failed to bind on given port. [%s]\n",
+                strerror(errno));
+        close(p_serv->serv_listener_fd);
+        return SERV_INIT_FAILURE;
+    }
+    else
+    {
+        printf("Listener bound on port [%d]\n", port_number);
     }
 
-    err = read_from_client(client_fd, p_buffer);
+    err = listen(p_serv->serv_listener_fd, p_serv->listen_backlog);
     if (0 > err)
     {
-        char* p_error_message = "Server error. Disconnecting client.\n";
-        err = send(client_fd,
-                   p_error_message,
-                   strnlen(p_error_message, MAX_BUFFER_SIZE),
-                   0);
-        free(p_buffer);
+        fprintf(stderr,
+                "Error setting listening state. [%s]\n",
+                strerror(errno));
+        close(p_serv->serv_listener_fd);
+        return SERV_INIT_FAILURE;
+    }
+    else
+    {
+        printf("Listener established.\n");
+    }
+
+    p_serv->unix_listener_fd = -1;
+    if (NULL != p_serv->p_unix_path &&
+        SERV_INIT_SUCCESS != open_unix_listener(p_serv))
+    {
+        close(p_serv->serv_listener_fd);
+        return SERV_INIT_FAILURE;
+    }
+    return SERV_INIT_SUCCESS;
+} /* open_listener */
+
+/**
+ * @brief Closes the server's listeners and removes its unix domain socket.
+ * @param[in] p_serv A pointer to a serv_t struct with open listeners.
+ */
+void close_listeners(serv_t* p_serv)
+{
+    close(p_serv->serv_listener_fd);
+    if (0 <= p_serv->unix_listener_fd)
+    {
+        close(p_serv->unix_listener_fd);
+        unlink(p_serv->p_unix_path);
+        p_serv->unix_listener_fd = -1;
+    }
+} /* close_listeners */
+
+/**
+ * @brief Turns away a client that cannot be served.
+ * @param[in] client_fd The client's socket File Descriptor
+ * @param[in] metric The SERV_METRIC_REJECTED counter to count it in.
+ */
+static void reject_connection(int client_fd, int metric)
+{
+    serv_metrics_add(metric, 1);
+    notify_client_max_connections(client_fd);
+    close(client_fd);
+} /* reject_connection */
+
+/**
+ * @brief Starts serving a client that holds a connection slot: hands it to
+ *        the workers, or turns it away if their queue is full.
+ * @param[in] p_serv A pointer to a running serv_t struct.
+ * @param[in] client_fd The client's socket File Descriptor
+ * @return True if a worker will serve the client.
+ *         False if the client was turned away; its slot is still held, and
+ *         the caller must free it.
+ */
+static bool start_connection(serv_t* p_serv, int client_fd)
+{
+    serv_metrics_add(SERV_METRIC_CONNECTIONS_ACCEPTED, 1);
+    SERV_LOG(SERV_LOG_LEVEL_INFO, "A client has connected.\n");
+
+    // Queue the client FD for a worker. The acceptor never waits for a
+    // worker to pick it up. The worker sends the handshake byte, so a
+    // client that cannot be queued is rejected before it has seen one.
+    //
+    if (false == dispatch_connection(p_serv, client_fd))
+    {
+        notify_client_max_connections(client_fd);
+        close(client_fd);
         return false;
     }
+    return true;
+} /* start_connection */
 
-    errno = 0;
-    float answer = 1.0; // Placeholder for simplification
-    if (EINVAL == errno)
-    {
-        fprintf(stderr, "Invalid equation given or an error has ");
-        fprintf(stderr, "occurred.\nNotifying client.\n");
-        char* p_err_message = 
-                "An error occurred processing the given equation.";
-        err = send(client_fd,
-                   p_err_message,
-                   strnlen(p_err_message, MAX_BUFFER_SIZE),
-                   0);
-        if (strnlen(p_err_message, MAX_BUFFER_SIZE) > err)
+/**
+ * @brief Takes a free connection slot, if there is one, for the client that
+ *        has waited longest, turning away any waiters the admission queue
+ *        sheds on the way.
+ * @param[in] p_serv A pointer to a running serv_t struct.
+ * @return The client's socket File Descriptor, which now holds a slot, or
+ *         ADMIT_EMPTY if there was no free slot or no client waiting.
+ */
+static int claim_waiting_connection(serv_t* p_serv)
+{
+    admit_queue_t* p_queue   = &(p_serv->admission);
+    int            client_fd = ADMIT_EMPTY;
+
+    pthread_mutex_lock(&(p_queue->lock));
+    if (0 == sem_trywait(&(p_serv->client_count_sem)))
+    {
+        uint64_t now_ns = monotonic_ns();
+        bool     b_shed = true;
+        while (b_shed &&
+               ADMIT_EMPTY != (client_fd = admit_queue_pop(p_queue,
+                                                           now_ns,
+                                                           &b_shed)))
         {
-            fprintf(stderr,
-                    "Error sending message to client. [%s]\n",
-                    strerror(errno));
-            is_connected = false;
+            if (b_shed)
+            {
+                SERV_LOG(SERV_LOG_LEVEL_WARN,
+                         "Shedding a client that waited too long.\n");
+                reject_connection(client_fd, SERV_METRIC_REJECTED_OVERLOAD);
+            }
         }
-    }
-    else
-    {
-        char response[MAX_BUFFER_SIZE] = { 0 };
-        printf("The answer to the equation sent by the client is [%f]\n",
-                answer);
-        char* p_format_string =
-                "The answer to the given equation is [%f]";
-        sprintf(response, p_format_string, answer);
-        err = send(client_fd,
-                   response,
-                   strnlen(response, MAX_BUFFER_SIZE),
-                   0);
-        if (strnlen(response, MAX_BUFFER_SIZE) > err)
+        if (ADMIT_EMPTY == client_fd)
         {
-            fprintf(stderr,
-                    "Error sending message to client. [%s]\n",
-                    strerror(errno));
-            is_connected = false;
+            sem_post(&(p_serv->client_count_sem));
         }
     }
-    free(p_buffer);
-    return is_connected;
-} /* handle_client */
+    pthread_mutex_unlock(&(p_queue->lock));
+    return client_fd;
+} /* claim_waiting_connection */
 
 /**
- * @brief Notifies a given client that it is unable to accept the connection
- *        and disconnects them.
- * @param[in] client_fd The client's socket File Descriptor
+ * @brief Hands free connection slots to waiting clients until one is
+ *        started, no slot is free or nobody is waiting.
+ * @param[in] p_serv A pointer to a running serv_t struct.
  */
-void notify_client_max_connections(int client_fd)
+static void admit_waiting_connection(serv_t* p_serv)
 {
-    char* message = "Unable to accept connection. Try again later.\n";
-    send(client_fd,
-         message,
-         strnlen(message, MAX_BUFFER_SIZE),
-         0);
-} /* notify_and_disconnect_client */
+    int client_fd = claim_waiting_connection(p_serv);
+
+    // A client turned away by the workers frees its slot for the next
+    // waiter. Loop rather than going back through release_connection_slot,
+    // so a run of failed starts cannot grow the stack.
+    //
+    while (ADMIT_EMPTY != client_fd &&
+           false == start_connection(p_serv, client_fd))
+    {
+        sem_post(&(p_serv->client_count_sem));
+        client_fd = p_serv->b_running ? claim_waiting_connection(p_serv) :
+                                        ADMIT_EMPTY;
+    }
+} /* admit_waiting_connection */
 
 /**
- * @brief Notifies a given client that it is unable to accept the connection
- *        and disconnects them.
+ * @brief Frees the connection slot of a client that has been closed, and
+ *        admits the next waiting client into it.
+ * @param[in] p_serv A pointer to the serv_t struct that served the client.
+ */
+void release_connection_slot(serv_t* p_serv)
+{
+    sem_post(&(p_serv->client_count_sem));
+
+    // Pairs with the fence in admit_connection: either this thread sees the
+    // waiter, or the acceptor sees the free slot.
+    //
+    atomic_thread_fence(memory_order_seq_cst);
+    if (p_serv->b_running && 0 < atomic_load(&(p_serv->admission.count)))
+    {
+        admit_waiting_connection(p_serv);
+    }
+} /* release_connection_slot */
+
+/**
+ * @brief Turns away the clients the admission queue sheds for waiting too
+ *        long. The acceptor also calls this while no client arrives, so
+ *        waiters are shed even when every open connection is long-lived.
+ * @param[in] p_serv A pointer to a running serv_t struct.
+ */
+void shed_waiting_connections(serv_t* p_serv)
+{
+    admit_queue_t* p_queue = &(p_serv->admission);
+    uint64_t       now_ns  = monotonic_ns();
+    int            shed_fd = ADMIT_EMPTY;
+
+    pthread_mutex_lock(&(p_queue->lock));
+    while (ADMIT_EMPTY != (shed_fd = admit_queue_shed(p_queue, now_ns)))
+    {
+        SERV_LOG(SERV_LOG_LEVEL_WARN,
+                 "Shedding a client that waited too long.\n");
+        reject_connection(shed_fd, SERV_METRIC_REJECTED_OVERLOAD);
+    }
+    pthread_mutex_unlock(&(p_queue->lock));
+} /* shed_waiting_connections */
+
+/**
+ * @brief Admits one accepted client. Clients arriving while the server is
+ *        at its connection limit wait in the admission queue for a slot,
+ *        and are only turned away if the queue is full or sheds them for
+ *        waiting too long.
+ * @param[in] p_serv A pointer to a running serv_t struct.
  * @param[in] client_fd The client's socket File Descriptor
- * @return NULL on thread exit
  */
-void* thread_handler(void* args)
+void admit_connection(serv_t* p_serv, int client_fd)
 {
-    serv_t* p_serv = (serv_t*)args;
-    bool    thread_client_connected;
-    int     thread_client_fd;
-    while(p_serv->b_running)
+    admit_queue_t* p_queue = &(p_serv->admission);
+
+    // Clients only skip the queue when nobody is waiting in it.
+    //
+    if (0 == atomic_load(&(p_queue->count)) &&
+        0 == sem_trywait(&(p_serv->client_count_sem)))
     {
-        pthread_mutex_lock(&(p_serv->new_connection_fd_lock));
-        while (0 == p_serv->new_connection_fd && p_serv->b_running)
+        if (false == start_connection(p_serv, client_fd))
         {
-            pthread_cond_wait(&(p_serv->new_connection),
-                              &(p_serv->new_connection_fd_lock));
+            release_connection_slot(p_serv);
         }
-        thread_client_fd = p_serv->new_connection_fd;
-        p_serv->new_connection_fd = 0;
-        pthread_cond_signal(&(p_serv->connection_accepted));
-        pthread_mutex_unlock(&(p_serv->new_connection_fd_lock));
+        return;
+    }
+
+    shed_waiting_connections(p_serv);
+    pthread_mutex_lock(&(p_queue->lock));
+    bool b_queued = admit_queue_push(p_queue, client_fd, monotonic_ns());
+    pthread_mutex_unlock(&(p_queue->lock));
+
+    if (false == b_queued)
+    {
+        SERV_LOG(SERV_LOG_LEVEL_WARN,
+                 "Max connections reached and admission queue is full.\n");
+        reject_connection(client_fd, SERV_METRIC_REJECTED_MAX_CONNECTIONS);
+        return;
+    }
+    serv_metrics_add(SERV_METRIC_CONNECTIONS_QUEUED, 1);
+
+    // A slot may have been freed before the client was queued.
+    //
+    atomic_thread_fence(memory_order_seq_cst);
+    admit_waiting_connection(p_serv);
+} /* admit_connection */
+
+/**
+ * @brief Works out how long the acceptor may sleep while clients wait for a
+ *        connection slot.
+ * @param[in] p_serv A pointer to a running serv_t struct.
+ * @return The admission target delay in milliseconds, at least 1.
+ */
+int admission_poll_ms(const serv_t* p_serv)
+{
+    uint64_t poll_ms = p_serv->admit_target_ns / 1000000;
+    return (0 < poll_ms) ? (int)poll_ms : 1;
+} /* admission_poll_ms */
+
+/**
+ * @brief Accepts clients on the server's listener and hands them to the
+ *        workers until the server stops or the listener is shut down.
+ * @param[in] p_serv A pointer to a running serv_t struct.
+ */
+void accept_connections(serv_t* p_serv)
+{
+    struct sockaddr_storage cli_addr;
 
-        // In the case of a pthread cond broadcast for exiting the server.
+    if (SERV_MODE_URING == p_serv->mode && uring_accept_connections(p_serv))
+    {
+        return;
+    }
+
+    while (p_serv->b_running)
+    {
+        // With a unix domain listener as well, wait for whichever is ready.
+        // While clients wait for a slot, wake up at least once per target
+        // delay to shed them even if nobody else arrives.
         //
-        if (0 == thread_client_fd)
+        int  listener_fd = p_serv->serv_listener_fd;
+        bool b_waiters   = (0 < atomic_load(&(p_serv->admission.count)));
+        if (b_waiters || 0 <= p_serv->unix_listener_fd)
         {
-            continue;
+            struct pollfd listeners[2] = {
+                { .fd = p_serv->serv_listener_fd, .events = POLLIN },
+                { .fd = p_serv->unix_listener_fd, .events = POLLIN }
+            };
+            int ready = poll(listeners,
+                             2,
+                             b_waiters ? admission_poll_ms(p_serv) : -1);
+            if (0 == ready)
+            {
+                shed_waiting_connections(p_serv);
+                continue;
+            }
+            if (0 > ready)
+            {
+                continue;
+            }
+            if (0 == listeners[0].revents)
+            {
+                listener_fd = p_serv->unix_listener_fd;
+            }
         }
-        
-        thread_client_connected = true;
-        while (thread_client_connected)
+
+        socklen_t clilen    = sizeof(cli_addr);
+        int       client_fd = accept(listener_fd,
+                               (struct sockaddr*)&cli_addr,
+                               &clilen);
+        if (0 > client_fd)
         {
-            thread_client_connected = handle_client(thread_client_fd);
+            if (EINVAL == errno || EBADF == errno)
+            {
+                break;
+            }
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            SERV_LOG(SERV_LOG_LEVEL_ERROR,
+                     "Error accepting connection. [%s]\n",
+                     strerror(errno));
+            continue;
         }
-        close(thread_client_fd);
-        thread_client_fd = 0;
-        sem_post(&(p_serv->client_count_sem));
+        admit_connection(p_serv, client_fd);
     }
-    return NULL;
-} /* thread_handler */
+} /* accept_connections */
+
+/**
+ * @brief Restricts a thread to one CPU.
+ * @param[in] thread The thread to pin.
+ * @param[in] cpu The CPU to run it on, or SERV_NO_CPU to leave it alone.
+ */
+void pin_thread(pthread_t thread, int cpu)
+{
+    if (SERV_NO_CPU == cpu)
+    {
+        return;
+    }
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    int err = pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+    if (0 != err)
+    {
+        fprintf(stderr,
+                "Unable to pin thread to CPU [%d]. [%s]\n",
+                cpu,
+                strerror(err));
+    }
+} /* pin_thread */
 
 /**
- * @brief Shuts down a given server within a serv_t object.
+ * @brief Prints the connection queue counters used to size the queue.
+ * @param[in] p_serv A pointer to an initialized serv_t struct.
+ */
+void print_queue_stats(serv_t* p_serv)
+{
+    fd_queue_stats_t stats;
+    fd_queue_get_stats(&(p_serv->connection_queue), &stats);
+    uint64_t dequeued = (0 == stats.dequeued) ? 1 : stats.dequeued;
+    printf("Connection queue: depth [%llu/%llu] max depth [%llu] "
+           "enqueued [%llu] dequeued [%llu] rejected full [%llu]\n",
+           (unsigned long long)stats.depth,
+           (unsigned long long)stats.capacity,
+           (unsigned long long)stats.max_depth,
+           (unsigned long long)stats.enqueued,
+           (unsigned long long)stats.dequeued,
+           (unsigned long long)stats.full_rejections);
+    printf("Connection queue wait (ns): enqueue total [%llu] max [%llu] "
+           "dequeue total [%llu] max [%llu] residence avg [%llu] max [%llu]\n",
+           (unsigned long long)stats.enqueue_wait_total,
+           (unsigned long long)stats.enqueue_wait_max,
+           (unsigned long long)stats.dequeue_wait_total,
+           (unsigned long long)stats.dequeue_wait_max,
+           (unsigned long long)(stats.residence_total / dequeued),
+           (unsigned long long)stats.residence_max);
+} /* print_queue_stats */
+
+/**
+ * @brief Shuts down a given server within a serv_t object. Call once its
+ *        acceptor has stopped, never from a signal handler.
  * @param[in] p_serv A pointer to an initialized serv_t struct.
  */
 void shutdown_server(serv_t* p_serv)
@@ -389,14 +988,35 @@ void shutdown_server(serv_t* p_serv)
     }
 
     p_serv->b_running = false;
-    pthread_cond_broadcast(&(p_serv->new_connection));
+    shutdown_admin(p_serv);
 
-    for(int i = 0; i < p_serv->max_connections; i++)
+    // Shuts down every open connection, so workers blocked on a client
+    // return and can be joined.
+    //
+    timeout_reaper_stop(&(p_serv->reaper));
+    if (SERV_MODE_EPOLL == p_serv->mode)
     {
-        err = pthread_join(p_serv->p_thread_ids[i], NULL);
-        if (0 > err)
+        shutdown_epoll_loops(p_serv);
+    }
+    else if (SERV_MODE_POOL == p_serv->mode)
+    {
+        shutdown_work_pool(p_serv);
+    }
+    else if (SERV_MODE_URING == p_serv->mode)
+    {
+        shutdown_uring_loops(p_serv);
+    }
+    else
+    {
+        fd_queue_wake_all(&(p_serv->connection_queue), p_serv->thread_count);
+
+        for(int i = 0; i < p_serv->thread_count; i++)
         {
-            fprintf(stderr, "Error joining thread. [%s]\n", strerror(err));
+            err = pthread_join(p_serv->p_thread_ids[i], NULL);
+            if (0 > err)
+            {
+                fprintf(stderr, "Error joining thread. [%s]\n", strerror(err));
+            }
         }
     }
 
@@ -411,21 +1031,32 @@ void shutdown_server(serv_t* p_serv)
                 strerror(errno));
     }
 
-    err = pthread_mutex_destroy(&(p_serv->new_connection_fd_lock));
-    if (0 > err)
+    // Connections still waiting for a worker are dropped.
+    //
+    int client_fd;
+    while (1 == fd_queue_dequeue_batch(&(p_serv->connection_queue),
+                                       &client_fd,
+                                       1))
     {
-        fprintf(stderr,
-                "Error destroying new connection mutex. [%s]\n",
-                strerror(errno));
+        close(client_fd);
     }
+    print_queue_stats(p_serv);
+    fd_queue_destroy(&(p_serv->connection_queue));
 
-    err = pthread_cond_destroy(&(p_serv->new_connection));
-    if (0 > err)
+    // So are clients waiting for a slot.
+    //
+    admit_queue_t* p_queue = &(p_serv->admission);
+    bool           b_shed  = false;
+    pthread_mutex_lock(&(p_queue->lock));
+    while (ADMIT_EMPTY != (client_fd = admit_queue_pop(p_queue,
+                                                       monotonic_ns(),
+                                                       &b_shed)))
     {
-        fprintf(stderr,
-                "Error destroying new connection condition var. [%s]\n",
-                strerror(err));
+        close(client_fd);
     }
+    pthread_mutex_unlock(&(p_queue->lock));
+    admit_queue_destroy(p_queue);
+    timeout_reaper_destroy(&(p_serv->reaper));
     free(p_serv->p_thread_ids);
 } /* shutdown_server */
 
@@ -440,43 +1071,78 @@ int init_server(serv_t* p_serv)
 {
     int err;
     p_serv->b_running = true;
-    p_serv->p_thread_ids = calloc(p_serv->max_connections, sizeof(pthread_t));
+    p_serv->start_ns  = monotonic_ns();
+    p_serv->p_thread_ids = calloc(p_serv->thread_count, sizeof(pthread_t));
 
-    err = pthread_mutex_init(&(p_serv->new_connection_fd_lock), NULL);
-    if (0 > err)
+    err = fd_queue_init(&(p_serv->connection_queue), p_serv->queue_depth);
+    if (FD_QUEUE_INIT_SUCCESS != err)
     {
-        fprintf(stderr,
-                "Unable to initiate new connection mutex. [%s]\n",
-                strerror(errno));
         shutdown_server(p_serv);
         return SERV_INIT_FAILURE;
     }
 
-    err = pthread_cond_init(&(p_serv->new_connection), NULL);
-    if (0 > err)
+    err = admit_queue_init(&(p_serv->admission),
+                           p_serv->admit_depth,
+                           p_serv->admit_target_ns);
+    if (ADMIT_INIT_SUCCESS != err)
     {
-        fprintf(stderr,
-                "Unable to initiate thread condition. [%s]\n",
-                strerror(errno));
         shutdown_server(p_serv);
         return SERV_INIT_FAILURE;
     }
 
-    for(int i = 0; i < p_serv->max_connections; i++)
+    err = timeout_reaper_start(&(p_serv->reaper));
+    if (TIMER_INIT_SUCCESS != err)
     {
-        err = pthread_create(&(p_serv->p_thread_ids[i]),
-                             NULL,
-                             &thread_handler,
-                             p_serv);
-        if (0 > err)
+        shutdown_server(p_serv);
+        return SERV_INIT_FAILURE;
+    }
+
+    if (SERV_MODE_EPOLL == p_serv->mode)
+    {
+        err = init_epoll_loops(p_serv);
+        if (SERV_INIT_SUCCESS != err)
         {
-            fprintf(stderr,
-                    "Thread unable to be created. [%s]\n",
-                    strerror(err));
             shutdown_server(p_serv);
             return SERV_INIT_FAILURE;
         }
     }
+    else if (SERV_MODE_POOL == p_serv->mode)
+    {
+        err = init_work_pool(p_serv);
+        if (SERV_INIT_SUCCESS != err)
+        {
+            shutdown_server(p_serv);
+            return SERV_INIT_FAILURE;
+        }
+    }
+    else if (SERV_MODE_URING == p_serv->mode)
+    {
+        err = init_uring_loops(p_serv);
+        if (SERV_INIT_SUCCESS != err)
+        {
+            shutdown_server(p_serv);
+            return SERV_INIT_FAILURE;
+        }
+    }
+    else
+    {
+        for(int i = 0; i < p_serv->thread_count; i++)
+        {
+            err = pthread_create(&(p_serv->p_thread_ids[i]),
+                                 NULL,
+                                 &thread_handler,
+                                 p_serv);
+            if (0 > err)
+            {
+                fprintf(stderr,
+                        "Thread unable to be created. [%s]\n",
+                        strerror(err));
+                shutdown_server(p_serv);
+                return SERV_INIT_FAILURE;
+            }
+            pin_thread(p_serv->p_thread_ids[i], p_serv->cpu);
+        }
+    }
 
     err = sem_init(&(p_serv->client_count_sem), 0, p_serv->max_connections);
     if (0 > err)
@@ -488,5 +1154,17 @@ int init_server(serv_t* p_serv)
         return SERV_INIT_FAILURE;
     }
 
+    // The admin port reports on the semaphore and queue, so it starts last.
+    //
+    if (0 < p_serv->admin_port)
+    {
+        err = init_admin(p_serv);
+        if (SERV_INIT_SUCCESS != err)
+        {
+            shutdown_server(p_serv);
+            return SERV_INIT_FAILURE;
+        }
+    }
+
     return SERV_INIT_SUCCESS;
 } /* init_server */
\ No newline at end of file
@@ -1,30 +1,100 @@
 #include <semaphore.h> // sem_t
+#include <stdatomic.h> // atomic_uint
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+
+#include "serv_admit.h"
+#include "serv_queue.h"
+#include "serv_timer.h"
 
 #define INVALID_PORT -1
 #define MAX_BUFFER_SIZE 100
-#define SOCK_READ_SUCCESS 0
-#define SOCK_READ_ERROR -1
 #define SERV_INIT_SUCCESS 0
 #define SERV_INIT_FAILURE -1
-#define SOCK_CLIENT_DISCONNECT -2
-#define SOCK_SEND_ERROR -3
 #define MIN_THREADS 2
+#define SERV_MODE_THREAD 0
+#define SERV_MODE_EPOLL 1
+#define SERV_MODE_POOL 2
+#define SERV_MODE_URING 3
+#define DEFAULT_EPOLL_MAX_CONNECTIONS 10000
+#define DEFAULT_LISTEN_BACKLOG 128
+#define SERV_NO_CPU -1
+#define SERV_RESPONSE_VERBOSE 0
+#define SERV_RESPONSE_NUMBER 1
+#define SERV_RESPONSE_BINARY 2
+#define SERV_DEFAULT_STREAM_MEMORY (1024 * 1024)
+
+struct epoll_loop_t;
+struct uring_loop_t;
+struct work_pool_t;
+struct worker_arena_t;
 
 typedef struct serv_t {
-    bool            b_running;
-    int             max_connections;
-    int             serv_listener_fd;
-    sem_t           client_count_sem;
-    pthread_mutex_t new_connection_fd_lock;
-    pthread_cond_t  new_connection;
-    int             new_connection_fd;
-    pthread_cond_t  connection_accepted;
-    pthread_t*      p_thread_ids;
+    bool                 b_running;
+    int                  mode;
+    int                  thread_count;
+    int                  max_connections;
+    int                  serv_listener_fd;
+    const char*          p_unix_path;
+    int                  unix_listener_fd;
+    int                  listen_backlog;
+    bool                 b_reuseport;
+    int                  cpu;
+    pthread_t            acceptor_thread_id;
+    struct serv_t*       p_next_shard;
+    sem_t                client_count_sem;
+    admit_queue_t        admission;
+    int                  admit_depth;
+    uint64_t             admit_target_ns;
+    timeout_reaper_t     reaper;
+    fd_queue_t           connection_queue;
+    int                  queue_depth;
+    pthread_t*           p_thread_ids;
+    struct epoll_loop_t* p_loops;
+    struct uring_loop_t* p_rings;
+    atomic_uint          next_loop;
+    int                  max_workers;
+    struct work_pool_t*  p_pool;
+    int                  admin_port;
+    int                  admin_fd;
+    pthread_t            admin_thread_id;
+    bool                 b_admin_running;
+    uint64_t             start_ns;
 } serv_t;
 
+extern int      g_serv_response_format;
+extern size_t   g_serv_stream_memory;
+extern uint64_t g_serv_timeout_ns[TIMEOUT_KIND_COUNT];
+
+uint64_t monotonic_ns(void);
+bool is_operator(char c);
 int  convert_port_number(char* p_string);
 int  convert_thread_count(char* p_string);
-bool handle_client(int client_fd);
+void sanitize_input_string(char* p_string);
+int  evaluate_equation(char* p_equation, double* p_answer);
+void record_evaluation(int eval_err, double answer, uint64_t eval_ns);
+int  format_response(int    eval_err,
+                     double answer,
+                     char*  p_response,
+                     int    response_size);
+int  build_response(char* p_equation,
+                    char* p_response,
+                    int   response_size,
+                    int*  p_eval_err);
+void handle_client(serv_t*                p_serv,
+                   int                    client_fd,
+                   struct worker_arena_t* p_arena);
 void notify_client_max_connections(int client_fd);
+void send_handshake(serv_t* p_serv, int client_fd);
+int  open_listener(serv_t* p_serv, int port_number);
+void close_listeners(serv_t* p_serv);
+void admit_connection(serv_t* p_serv, int client_fd);
+void release_connection_slot(serv_t* p_serv);
+void shed_waiting_connections(serv_t* p_serv);
+int  admission_poll_ms(const serv_t* p_serv);
+void accept_connections(serv_t* p_serv);
+void pin_thread(pthread_t thread, int cpu);
 void shutdown_server(serv_t* p_serv);
+bool dispatch_connection(serv_t* p_serv, int client_fd);
+void print_queue_stats(serv_t* p_serv);
 int  init_server(serv_t* p_serv);
\ No newline at end of file
@@ -0,0 +1,434 @@
+/** @file serv_log.c
+ *
+ * @brief Asynchronous leveled logger for the request path. Each thread that
+ *        logs gets its own single producer, single consumer ring of fixed
+ *        size records, so logging is a format into thread local memory and a
+ *        release store. A background flusher thread drains every ring and
+ *        writes the lines in batches. When a ring is full the line is dropped
+ *        and counted rather than blocking the caller; the flusher reports the
+ *        drop counts. A thread's ring is handed to the next thread that logs
+ *        once it exits, so threads that come and go do not use up the
+ *        slots.
+ * @par
+ * COPYRIGHT NOTICE: (c) 2018 Barr Group. All rights reserved.
+ */
+
+#define _XOPEN_SOURCE 700
+#include <pthread.h>
+#include <stdalign.h> // alignas
+#include <stdarg.h> // va_list
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h> // uint8_t, uint16_t, uint64_t
+#include <stdio.h> // stderr, vsnprintf, fwrite
+#include <stdlib.h> // aligned_alloc, free
+#include <string.h> // memcpy, strcmp, strerror
+#include <time.h> // nanosleep
+
+#include "serv_log.h"
+#include "serv_queue.h"
+
+#define LOG_RING_MASK (SERV_LOG_RING_RECORDS - 1)
+#define LOG_OUTPUT_SIZE 65536
+
+typedef struct log_record_t {
+    uint8_t  level;
+    uint16_t length;
+    char     text[SERV_LOG_LINE_SIZE];
+} log_record_t;
+
+/**
+ * @brief One thread's ring. Only the owning thread advances head and only
+ *        the flusher advances tail, so each position sits on its own cache
+ *        line.
+ */
+typedef struct log_ring_t {
+    alignas(CACHE_LINE_SIZE) atomic_size_t head;
+    atomic_uint_fast64_t                   dropped;
+    alignas(CACHE_LINE_SIZE) atomic_size_t tail;
+    alignas(CACHE_LINE_SIZE) log_record_t  records[SERV_LOG_RING_RECORDS];
+} log_ring_t;
+
+/**
+ * @brief Lines gathered by the flusher for one stream, written with a
+ *        single call once a pass over the rings is done.
+ */
+typedef struct log_output_t {
+    FILE*  p_stream;
+    size_t length;
+    char   buffer[LOG_OUTPUT_SIZE];
+} log_output_t;
+
+atomic_int g_serv_log_level = SERV_LOG_DEFAULT_LEVEL;
+
+static _Atomic(log_ring_t*) gp_rings[SERV_LOG_MAX_THREADS];
+static atomic_int           g_ring_count         = 0;
+static int                  g_free_slots[SERV_LOG_MAX_THREADS];
+static int                  g_free_count         = 0;
+static pthread_mutex_t      g_slots_lock         = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t        g_exit_key;
+static pthread_once_t       g_exit_key_once      = PTHREAD_ONCE_INIT;
+static atomic_uint_fast64_t g_unregistered_drops = 0;
+static atomic_uint          g_generation         = 0;
+static atomic_bool          g_b_running          = false;
+static pthread_t            g_flusher;
+static log_output_t         g_stdout_output;
+static log_output_t         g_stderr_output;
+
+static _Thread_local log_ring_t* gp_ring           = NULL;
+static _Thread_local unsigned    g_ring_generation = 0;
+static _Thread_local int         g_ring_slot       = 0;
+
+/**
+ * @brief Converts a level name to its SERV_LOG_LEVEL value.
+ * @param[in] p_string One of off, error, warn, info or request.
+ * @return The level, or -1 if the name is not recognized.
+ */
+int serv_log_parse_level(const char* p_string)
+{
+    static const char* const p_names[] =
+    {
+        "off", "error", "warn", "info", "request"
+    };
+
+    if (NULL == p_string)
+    {
+        return -1;
+    }
+    for (int level = SERV_LOG_LEVEL_OFF; level <= SERV_LOG_LEVEL_REQUEST;
+         level++)
+    {
+        if (0 == strcmp(p_string, p_names[level]))
+        {
+            return level;
+        }
+    }
+    return -1;
+} /* serv_log_parse_level */
+
+/**
+ * @brief Thread exit destructor. Hands the exiting thread's ring to the next
+ *        thread that logs. The flusher keeps draining it meanwhile, and the
+ *        next owner carries on from its head. A ring freed by
+ *        serv_log_shutdown since the thread registered is not handed on.
+ */
+static void release_ring(void* p_value)
+{
+    pthread_mutex_lock(&g_slots_lock);
+    unsigned generation = atomic_load_explicit(&g_generation,
+                                               memory_order_relaxed);
+    if (g_ring_generation == generation + 1 &&
+        p_value == atomic_load_explicit(&(gp_rings[g_ring_slot]),
+                                        memory_order_relaxed))
+    {
+        g_free_slots[g_free_count++] = g_ring_slot;
+    }
+    pthread_mutex_unlock(&g_slots_lock);
+    gp_ring           = NULL;
+    g_ring_generation = 0;
+} /* release_ring */
+
+/**
+ * @brief Creates the key whose destructor releases a thread's ring.
+ */
+static void create_exit_key(void)
+{
+    pthread_key_create(&g_exit_key, &release_ring);
+} /* create_exit_key */
+
+/**
+ * @brief Finds the calling thread's ring, registering one on the thread's
+ *        first line after the logger starts. A ring released by an exited
+ *        thread is reused before a new one is allocated.
+ * @return A pointer to the ring, or NULL if every slot is taken or the ring
+ *         could not be allocated.
+ */
+static log_ring_t* get_ring(void)
+{
+    unsigned generation = atomic_load_explicit(&g_generation,
+                                               memory_order_acquire);
+    if (g_ring_generation == generation + 1)
+    {
+        return gp_ring;
+    }
+
+    // Remember the outcome either way so a thread that could not register
+    // does not retry on every line.
+    //
+    g_ring_generation = generation + 1;
+    gp_ring           = NULL;
+    pthread_once(&g_exit_key_once, &create_exit_key);
+
+    // The lock also orders the exited owner's last head store before ours.
+    //
+    log_ring_t* p_ring = NULL;
+    pthread_mutex_lock(&g_slots_lock);
+    if (0 < g_free_count)
+    {
+        g_ring_slot = g_free_slots[--g_free_count];
+        p_ring      = atomic_load_explicit(&(gp_rings[g_ring_slot]),
+                                           memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&g_slots_lock);
+
+    if (NULL == p_ring)
+    {
+        int slot = atomic_fetch_add(&g_ring_count, 1);
+        if (SERV_LOG_MAX_THREADS <= slot)
+        {
+            return NULL;
+        }
+
+        p_ring = aligned_alloc(CACHE_LINE_SIZE, sizeof(log_ring_t));
+        if (NULL == p_ring)
+        {
+            return NULL;
+        }
+        atomic_init(&(p_ring->head), 0);
+        atomic_init(&(p_ring->tail), 0);
+        atomic_init(&(p_ring->dropped), 0);
+        atomic_store_explicit(&(gp_rings[slot]), p_ring, memory_order_release);
+        g_ring_slot = slot;
+    }
+
+    pthread_setspecific(g_exit_key, p_ring);
+    gp_ring = p_ring;
+    return p_ring;
+} /* get_ring */
+
+/**
+ * @brief Logs one line. Once the logger is running the line is formatted
+ *        into the calling thread's ring and written later by the flusher;
+ *        otherwise it is written straight to stdio. Lines longer than
+ *        SERV_LOG_LINE_SIZE are truncated.
+ * @param[in] level One of the SERV_LOG_LEVEL values. ERROR and WARN lines go
+ *                  to stderr, the rest to stdout.
+ * @param[in] p_format A printf format string for the line, including its
+ *                     newline.
+ */
+void serv_log(int level, const char* p_format, ...)
+{
+    va_list args;
+
+    if (false == atomic_load_explicit(&g_b_running, memory_order_acquire))
+    {
+        va_start(args, p_format);
+        vfprintf((SERV_LOG_LEVEL_WARN >= level) ? stderr : stdout,
+                 p_format,
+                 args);
+        va_end(args);
+        return;
+    }
+
+    log_ring_t* p_ring = get_ring();
+    if (NULL == p_ring)
+    {
+        atomic_fetch_add_explicit(&g_unregistered_drops,
+                                  1,
+                                  memory_order_relaxed);
+        return;
+    }
+
+    size_t head = atomic_load_explicit(&(p_ring->head), memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&(p_ring->tail), memory_order_acquire);
+    if (SERV_LOG_RING_RECORDS <= head - tail)
+    {
+        atomic_fetch_add_explicit(&(p_ring->dropped), 1, memory_order_relaxed);
+        return;
+    }
+
+    log_record_t* p_record = &(p_ring->records[head & LOG_RING_MASK]);
+    va_start(args, p_format);
+    int length = vsnprintf(p_record->text, SERV_LOG_LINE_SIZE, p_format, args);
+    va_end(args);
+    if (0 > length)
+    {
+        return;
+    }
+    if (SERV_LOG_LINE_SIZE <= length)
+    {
+        length = SERV_LOG_LINE_SIZE - 1;
+        p_record->text[length - 1] = '\n';
+    }
+    p_record->level  = (uint8_t)level;
+    p_record->length = (uint16_t)length;
+
+    atomic_store_explicit(&(p_ring->head), head + 1, memory_order_release);
+} /* serv_log */
+
+/**
+ * @brief Writes out everything gathered for a stream.
+ */
+static void flush_output(log_output_t* p_output)
+{
+    if (0 < p_output->length)
+    {
+        fwrite(p_output->buffer, 1, p_output->length, p_output->p_stream);
+        fflush(p_output->p_stream);
+        p_output->length = 0;
+    }
+} /* flush_output */
+
+/**
+ * @brief Adds a line to a stream's output, writing the output first if the
+ *        line does not fit.
+ */
+static void append_output(log_output_t* p_output,
+                          const char*   p_text,
+                          size_t        length)
+{
+    if (LOG_OUTPUT_SIZE - p_output->length < length)
+    {
+        flush_output(p_output);
+    }
+    memcpy(p_output->buffer + p_output->length, p_text, length);
+    p_output->length += length;
+} /* append_output */
+
+/**
+ * @brief Makes one pass over every registered ring, writing out the lines
+ *        found and reporting any that were dropped since the last pass.
+ * @return The number of lines written.
+ */
+static size_t drain_rings(void)
+{
+    size_t   drained = 0;
+    uint64_t dropped = atomic_exchange_explicit(&g_unregistered_drops,
+                                                0,
+                                                memory_order_relaxed);
+    int      count   = atomic_load_explicit(&g_ring_count,
+                                            memory_order_acquire);
+    if (SERV_LOG_MAX_THREADS < count)
+    {
+        count = SERV_LOG_MAX_THREADS;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        log_ring_t* p_ring = atomic_load_explicit(&(gp_rings[i]),
+                                                  memory_order_acquire);
+        if (NULL == p_ring)
+        {
+            continue;
+        }
+
+        size_t head = atomic_load_explicit(&(p_ring->head),
+                                           memory_order_acquire);
+        size_t tail = atomic_load_explicit(&(p_ring->tail),
+                                           memory_order_relaxed);
+        for (; tail != head; tail++)
+        {
+            const log_record_t* p_record =
+                &(p_ring->records[tail & LOG_RING_MASK]);
+            append_output((SERV_LOG_LEVEL_WARN >= p_record->level) ?
+                              &g_stderr_output : &g_stdout_output,
+                          p_record->text,
+                          p_record->length);
+            drained++;
+        }
+        atomic_store_explicit(&(p_ring->tail), tail, memory_order_release);
+
+        dropped += atomic_exchange_explicit(&(p_ring->dropped),
+                                            0,
+                                            memory_order_relaxed);
+    }
+
+    if (0 < dropped)
+    {
+        char report[64];
+        int  length = snprintf(report,
+                               sizeof(report),
+                               "Logger dropped [%llu] lines.\n",
+                               (unsigned long long)dropped);
+        append_output(&g_stderr_output, report, length);
+    }
+    flush_output(&g_stdout_output);
+    flush_output(&g_stderr_output);
+    return drained;
+} /* drain_rings */
+
+/**
+ * @brief Flusher thread. Drains the rings until the logger shuts down,
+ *        sleeping between passes that find nothing.
+ */
+static void* flusher_thread(void* p_arg)
+{
+    const struct timespec interval = { 0, SERV_LOG_FLUSH_INTERVAL_NS };
+
+    while (atomic_load_explicit(&g_b_running, memory_order_acquire))
+    {
+        if (0 == drain_rings())
+        {
+            nanosleep(&interval, NULL);
+        }
+    }
+    drain_rings();
+    return NULL;
+} /* flusher_thread */
+
+/**
+ * @brief Sets the log level and starts the flusher thread.
+ * @param[in] level One of the SERV_LOG_LEVEL values. Lines above it are
+ *                  neither formatted nor written.
+ * @return SERV_LOG_INIT_SUCCESS if lines are now written asynchronously.
+ *         SERV_LOG_INIT_FAILURE if the flusher could not start, in which
+ *         case lines are still written synchronously.
+ */
+int serv_log_init(int level)
+{
+    atomic_store(&g_serv_log_level, level);
+    if (atomic_load(&g_b_running))
+    {
+        return SERV_LOG_INIT_SUCCESS;
+    }
+
+    g_stdout_output.p_stream = stdout;
+    g_stdout_output.length   = 0;
+    g_stderr_output.p_stream = stderr;
+    g_stderr_output.length   = 0;
+
+    atomic_store(&g_b_running, true);
+    int err = pthread_create(&g_flusher, NULL, &flusher_thread, NULL);
+    if (0 != err)
+    {
+        atomic_store(&g_b_running, false);
+        fprintf(stderr, "Error starting log flusher. [%s]\n", strerror(err));
+        return SERV_LOG_INIT_FAILURE;
+    }
+    return SERV_LOG_INIT_SUCCESS;
+} /* serv_log_init */
+
+/**
+ * @brief Stops the flusher after it writes every line already logged, then
+ *        frees the rings. Call once every thread that logs has stopped;
+ *        later lines are written synchronously.
+ */
+void serv_log_shutdown(void)
+{
+    if (false == atomic_exchange(&g_b_running, false))
+    {
+        return;
+    }
+
+    int err = pthread_join(g_flusher, NULL);
+    if (0 != err)
+    {
+        fprintf(stderr, "Error joining log flusher. [%s]\n", strerror(err));
+        return;
+    }
+
+    int count = atomic_load(&g_ring_count);
+    if (SERV_LOG_MAX_THREADS < count)
+    {
+        count = SERV_LOG_MAX_THREADS;
+    }
+    pthread_mutex_lock(&g_slots_lock);
+    for (int i = 0; i < count; i++)
+    {
+        free(atomic_exchange(&(gp_rings[i]), NULL));
+    }
+    g_free_count = 0;
+    atomic_store(&g_ring_count, 0);
+    atomic_fetch_add_explicit(&g_generation, 1, memory_order_release);
+    pthread_mutex_unlock(&g_slots_lock);
+} /* serv_log_shutdown */
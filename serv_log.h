@@ -0,0 +1,56 @@
+#ifndef SERV_LOG_H
+#define SERV_LOG_H
+
+#include <stdatomic.h> // atomic_int
+#include <stdbool.h>
+
+#define SERV_LOG_LEVEL_OFF 0
+#define SERV_LOG_LEVEL_ERROR 1
+#define SERV_LOG_LEVEL_WARN 2
+#define SERV_LOG_LEVEL_INFO 3
+#define SERV_LOG_LEVEL_REQUEST 4
+#define SERV_LOG_DEFAULT_LEVEL SERV_LOG_LEVEL_INFO
+
+#define SERV_LOG_INIT_SUCCESS 0
+#define SERV_LOG_INIT_FAILURE -1
+
+#define SERV_LOG_LINE_SIZE 252
+#define SERV_LOG_RING_RECORDS 256
+#define SERV_LOG_MAX_THREADS 256
+#define SERV_LOG_FLUSH_INTERVAL_NS 2000000
+
+extern atomic_int g_serv_log_level;
+
+/**
+ * @brief Checks whether lines of a level are currently kept. Cheap enough to
+ *        guard every call site so disabled lines are never formatted.
+ * @param[in] level One of the SERV_LOG_LEVEL values.
+ * @return true if lines of the level are written, false if they are not.
+ */
+static inline bool serv_log_enabled(int level)
+{
+    return level <= atomic_load_explicit(&g_serv_log_level,
+                                         memory_order_relaxed);
+}
+
+/**
+ * @brief Logs one line if its level is enabled. Prefer this to calling
+ *        serv_log directly, since the arguments are not evaluated when the
+ *        level is disabled.
+ */
+#define SERV_LOG(level, ...)                 \
+    do                                       \
+    {                                        \
+        if (serv_log_enabled(level))         \
+        {                                    \
+            serv_log((level), __VA_ARGS__);  \
+        }                                    \
+    } while (0)
+
+int  serv_log_parse_level(const char* p_string);
+int  serv_log_init(int level);
+void serv_log_shutdown(void);
+void serv_log(int level, const char* p_format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+#endif /* SERV_LOG_H */
@@ -0,0 +1,280 @@
+/** @file serv_metrics.c
+ *
+ * @brief Per-thread server counters and latency histograms. Every thread
+ *        that records gets its own cache line aligned block, which only that
+ *        thread writes, so recording is a plain load and store with no
+ *        locked instructions. Readers sum every block on demand. A thread's
+ *        block is handed to the next thread that registers once it exits,
+ *        so threads that come and go do not use up the slots.
+ * @par
+ * COPYRIGHT NOTICE: (c) 2018 Barr Group. All rights reserved.
+ */
+
+#define _XOPEN_SOURCE 700
+#include <pthread.h> // pthread_key_create, pthread_once, pthread_setspecific
+#include <stdalign.h> // alignas
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h> // uint64_t, UINT64_MAX
+#include <stdlib.h> // aligned_alloc
+#include <string.h> // memset
+
+#include "serv_metrics.h"
+#include "serv_queue.h"
+
+typedef struct metrics_timer_t {
+    atomic_uint_fast64_t min;
+    atomic_uint_fast64_t max;
+    atomic_uint_fast64_t buckets[HISTOGRAM_BUCKET_COUNT];
+} metrics_timer_t;
+
+typedef struct thread_metrics_t {
+    alignas(CACHE_LINE_SIZE) atomic_uint_fast64_t counters[SERV_METRIC_COUNT];
+    alignas(CACHE_LINE_SIZE) metrics_timer_t      timers[SERV_TIMER_COUNT];
+} thread_metrics_t;
+
+static const char* const gp_metric_names[SERV_METRIC_COUNT] =
+{
+    "connections_accepted",
+    "connections_rejected_max_connections",
+    "connections_rejected_queue_full",
+    "requests",
+    "bytes_received",
+    "bytes_sent",
+    "errors",
+    "tasks_stolen",
+    "connections_queued",
+    "connections_rejected_overload",
+    "timeouts_idle",
+    "timeouts_read",
+    "timeouts_write",
+    "connections_shm"
+};
+
+static const char* const gp_timer_names[SERV_TIMER_COUNT] =
+{
+    "eval_ns",
+    "send_ns"
+};
+
+static _Atomic(thread_metrics_t*) gp_threads[SERV_METRICS_MAX_THREADS];
+static atomic_int                 g_thread_count = 0;
+static int                        g_free_slots[SERV_METRICS_MAX_THREADS];
+static int                        g_free_count   = 0;
+static pthread_mutex_t            g_slots_lock   = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t              g_exit_key;
+static pthread_once_t             g_exit_key_once = PTHREAD_ONCE_INIT;
+
+static _Thread_local thread_metrics_t* gp_local       = NULL;
+static _Thread_local bool              g_b_registered = false;
+static _Thread_local int               g_slot         = 0;
+
+const char* serv_metric_name(int metric)
+{
+    return gp_metric_names[metric];
+} /* serv_metric_name */
+
+const char* serv_timer_name(int timer)
+{
+    return gp_timer_names[timer];
+} /* serv_timer_name */
+
+/**
+ * @brief Thread exit destructor. Hands the exiting thread's block to the
+ *        next thread that registers, which carries on adding to its totals.
+ */
+static void release_local(void* p_value)
+{
+    (void)p_value;
+    pthread_mutex_lock(&g_slots_lock);
+    g_free_slots[g_free_count++] = g_slot;
+    pthread_mutex_unlock(&g_slots_lock);
+    gp_local       = NULL;
+    g_b_registered = false;
+} /* release_local */
+
+/**
+ * @brief Creates the key whose destructor releases a thread's block.
+ */
+static void create_exit_key(void)
+{
+    pthread_key_create(&g_exit_key, &release_local);
+} /* create_exit_key */
+
+/**
+ * @brief Finds the calling thread's block, registering one the first time
+ *        the thread records anything. Blocks live as long as the process so
+ *        totals survive the threads that produced them; a block released by
+ *        an exited thread is reused before a new one is allocated.
+ * @return A pointer to the block, or NULL if every slot is taken or the
+ *         block could not be allocated.
+ */
+static thread_metrics_t* get_local(void)
+{
+    if (g_b_registered)
+    {
+        return gp_local;
+    }
+    g_b_registered = true;
+    pthread_once(&g_exit_key_once, &create_exit_key);
+
+    // The lock also orders the exited owner's last writes before ours.
+    //
+    thread_metrics_t* p_metrics = NULL;
+    pthread_mutex_lock(&g_slots_lock);
+    if (0 < g_free_count)
+    {
+        g_slot    = g_free_slots[--g_free_count];
+        p_metrics = atomic_load_explicit(&(gp_threads[g_slot]),
+                                         memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&g_slots_lock);
+
+    if (NULL == p_metrics)
+    {
+        int slot = atomic_fetch_add(&g_thread_count, 1);
+        if (SERV_METRICS_MAX_THREADS <= slot)
+        {
+            return NULL;
+        }
+
+        p_metrics = aligned_alloc(CACHE_LINE_SIZE, sizeof(thread_metrics_t));
+        if (NULL == p_metrics)
+        {
+            return NULL;
+        }
+        memset(p_metrics, 0, sizeof(thread_metrics_t));
+        for (int i = 0; i < SERV_TIMER_COUNT; i++)
+        {
+            atomic_init(&(p_metrics->timers[i].min), UINT64_MAX);
+        }
+        atomic_store_explicit(&(gp_threads[slot]), p_metrics,
+                              memory_order_release);
+        g_slot = slot;
+    }
+
+    pthread_setspecific(g_exit_key, p_metrics);
+    gp_local = p_metrics;
+    return p_metrics;
+} /* get_local */
+
+/**
+ * @brief Adds to a value only the calling thread writes. Readers may see
+ *        the old or the new value but never a torn one.
+ */
+static void add_owned(atomic_uint_fast64_t* p_value, uint64_t amount)
+{
+    atomic_store_explicit(p_value,
+                          atomic_load_explicit(p_value, memory_order_relaxed) +
+                              amount,
+                          memory_order_relaxed);
+} /* add_owned */
+
+/**
+ * @brief Adds to one of the calling thread's counters.
+ * @param[in] metric One of the SERV_METRIC values.
+ * @param[in] value The amount to add.
+ */
+void serv_metrics_add(int metric, uint64_t value)
+{
+    thread_metrics_t* p_metrics = get_local();
+    if (NULL != p_metrics)
+    {
+        add_owned(&(p_metrics->counters[metric]), value);
+    }
+} /* serv_metrics_add */
+
+/**
+ * @brief Records one sample in the calling thread's histogram for a timer.
+ * @param[in] timer One of the SERV_TIMER values.
+ * @param[in] value The sample, in nanoseconds.
+ */
+void serv_metrics_record(int timer, uint64_t value)
+{
+    thread_metrics_t* p_metrics = get_local();
+    if (NULL == p_metrics)
+    {
+        return;
+    }
+
+    metrics_timer_t* p_timer = &(p_metrics->timers[timer]);
+    add_owned(&(p_timer->buckets[histogram_bucket_index(value)]), 1);
+    if (value < atomic_load_explicit(&(p_timer->min), memory_order_relaxed))
+    {
+        atomic_store_explicit(&(p_timer->min), value, memory_order_relaxed);
+    }
+    if (value > atomic_load_explicit(&(p_timer->max), memory_order_relaxed))
+    {
+        atomic_store_explicit(&(p_timer->max), value, memory_order_relaxed);
+    }
+} /* serv_metrics_record */
+
+/**
+ * @brief Sums every thread's counters and histograms. Threads keep
+ *        recording while this runs, so the sums are only consistent to
+ *        within the samples recorded during the call.
+ * @param[out] p_snapshot A pointer to the snapshot to fill.
+ */
+void serv_metrics_snapshot(serv_metrics_snapshot_t* p_snapshot)
+{
+    memset(p_snapshot->totals, 0, sizeof(p_snapshot->totals));
+    for (int t = 0; t < SERV_TIMER_COUNT; t++)
+    {
+        histogram_init(&(p_snapshot->timers[t]));
+    }
+
+    int count = atomic_load_explicit(&g_thread_count, memory_order_acquire);
+    if (SERV_METRICS_MAX_THREADS < count)
+    {
+        count = SERV_METRICS_MAX_THREADS;
+    }
+    p_snapshot->thread_count = count;
+
+    for (int i = 0; i < count; i++)
+    {
+        p_snapshot->thread_requests[i] = 0;
+        thread_metrics_t* p_metrics =
+            atomic_load_explicit(&(gp_threads[i]), memory_order_acquire);
+        if (NULL == p_metrics)
+        {
+            continue;
+        }
+
+        for (int m = 0; m < SERV_METRIC_COUNT; m++)
+        {
+            p_snapshot->totals[m] +=
+                atomic_load_explicit(&(p_metrics->counters[m]),
+                                     memory_order_relaxed);
+        }
+        p_snapshot->thread_requests[i] =
+            atomic_load_explicit(&(p_metrics->counters[SERV_METRIC_REQUESTS]),
+                                 memory_order_relaxed);
+
+        for (int t = 0; t < SERV_TIMER_COUNT; t++)
+        {
+            metrics_timer_t* p_timer = &(p_metrics->timers[t]);
+            histogram_t*     p_into  = &(p_snapshot->timers[t]);
+            for (int b = 0; b < HISTOGRAM_BUCKET_COUNT; b++)
+            {
+                uint64_t samples =
+                    atomic_load_explicit(&(p_timer->buckets[b]),
+                                         memory_order_relaxed);
+                p_into->buckets[b] += samples;
+                p_into->count      += samples;
+            }
+
+            uint64_t min = atomic_load_explicit(&(p_timer->min),
+                                                memory_order_relaxed);
+            uint64_t max = atomic_load_explicit(&(p_timer->max),
+                                                memory_order_relaxed);
+            if (min < p_into->min)
+            {
+                p_into->min = min;
+            }
+            if (max > p_into->max)
+            {
+                p_into->max = max;
+            }
+        }
+    }
+} /* serv_metrics_snapshot */
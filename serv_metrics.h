@@ -0,0 +1,47 @@
+#ifndef SERV_METRICS_H
+#define SERV_METRICS_H
+
+#include <stdint.h> // uint64_t
+
+#include "histogram.h"
+
+#define SERV_METRIC_CONNECTIONS_ACCEPTED 0
+#define SERV_METRIC_REJECTED_MAX_CONNECTIONS 1
+#define SERV_METRIC_REJECTED_QUEUE_FULL 2
+#define SERV_METRIC_REQUESTS 3
+#define SERV_METRIC_BYTES_RECEIVED 4
+#define SERV_METRIC_BYTES_SENT 5
+#define SERV_METRIC_ERRORS 6
+#define SERV_METRIC_TASKS_STOLEN 7
+#define SERV_METRIC_CONNECTIONS_QUEUED 8
+#define SERV_METRIC_REJECTED_OVERLOAD 9
+#define SERV_METRIC_TIMEOUTS_IDLE 10
+#define SERV_METRIC_TIMEOUTS_READ 11
+#define SERV_METRIC_TIMEOUTS_WRITE 12
+#define SERV_METRIC_SHM_CONNECTIONS 13
+#define SERV_METRIC_COUNT 14
+
+#define SERV_TIMER_EVAL 0
+#define SERV_TIMER_SEND 1
+#define SERV_TIMER_COUNT 2
+
+#define SERV_METRICS_MAX_THREADS 256
+
+/**
+ * @brief Every thread's counters summed at one point in time. Timers are in
+ *        nanoseconds.
+ */
+typedef struct serv_metrics_snapshot_t {
+    int         thread_count;
+    uint64_t    totals[SERV_METRIC_COUNT];
+    uint64_t    thread_requests[SERV_METRICS_MAX_THREADS];
+    histogram_t timers[SERV_TIMER_COUNT];
+} serv_metrics_snapshot_t;
+
+const char* serv_metric_name(int metric);
+const char* serv_timer_name(int timer);
+void        serv_metrics_add(int metric, uint64_t value);
+void        serv_metrics_record(int timer, uint64_t value);
+void        serv_metrics_snapshot(serv_metrics_snapshot_t* p_snapshot);
+
+#endif /* SERV_METRICS_H */
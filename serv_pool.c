@@ -0,0 +1,771 @@
+/** @file serv_pool.c
+ *
+ * @brief Elastic work-stealing worker pool for the postfix server. Client
+ *        sockets share one epoll set and are armed one shot, so a ready
+ *        connection is handed to exactly one worker at a time. Whichever
+ *        worker collects ready connections from the epoll set pushes them
+ *        onto its own deque and services them newest first; idle workers
+ *        steal the oldest from the others. A monitor thread adds workers,
+ *        up to max_workers, while the deques back up, and workers that
+ *        stay idle retire down to thread_count.
+ * @par
+ * COPYRIGHT NOTICE: (c) 2018 Barr Group. All rights reserved.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h> // errno, EAGAIN
+#include <fcntl.h> // F_SETFL, O_NONBLOCK
+#include <pthread.h>
+#include <stdalign.h> // alignas
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h> // int64_t, uint32_t, uint64_t
+#include <stdio.h> // stderr
+#include <stdlib.h> // aligned_alloc, calloc, free, malloc
+#include <string.h> // memset, strerror
+#include <sys/epoll.h> // epoll_create1, epoll_ctl, epoll_wait
+#include <sys/eventfd.h> // eventfd
+#include <time.h> // nanosleep
+#include <unistd.h> // close, read, write
+
+#include "serv_lib.h"
+#include "serv_conn.h"
+#include "serv_epoll.h"
+#include "serv_log.h"
+#include "serv_metrics.h"
+#include "serv_pool.h"
+
+#define POOL_DEQUE_MASK (POOL_DEQUE_SIZE - 1)
+#define POOL_SLOT_FREE 0
+#define POOL_SLOT_RUNNING 1
+#define POOL_SLOT_EXITED 2
+
+/**
+ * @brief A connection registered with the pool. The conn_t comes first so
+ *        the pool's connection list can hold conn_t pointers.
+ */
+typedef struct pool_conn_t {
+    conn_t   conn;
+    uint32_t events;
+} pool_conn_t;
+
+/**
+ * @brief Chase-Lev work-stealing deque of ready connections. Only the
+ *        owning worker pushes and pops at the bottom; any worker may steal
+ *        from the top.
+ */
+typedef struct pool_deque_t {
+    alignas(CACHE_LINE_SIZE) atomic_int_fast64_t top;
+    alignas(CACHE_LINE_SIZE) atomic_int_fast64_t bottom;
+    alignas(CACHE_LINE_SIZE) _Atomic(pool_conn_t*) tasks[POOL_DEQUE_SIZE];
+} pool_deque_t;
+
+typedef struct pool_worker_t {
+    pool_deque_t        deque;
+    pthread_t           thread_id;
+    atomic_int          state;
+    int                 index;
+    struct work_pool_t* p_pool;
+} pool_worker_t;
+
+typedef struct work_pool_t {
+    serv_t*         p_serv;
+    int             epoll_fd;
+    int             wake_fd;
+    int             stop_fd;
+    atomic_int      worker_count;
+    atomic_int      idle_workers;
+    atomic_bool     b_stopping;
+    pool_worker_t*  p_workers;
+    pthread_t       monitor_id;
+    bool            b_monitor_started;
+    pthread_mutex_t connections_lock;
+    conn_t*         p_connections;
+} work_pool_t;
+
+/**
+ * @brief Pushes a ready connection onto the bottom of the owner's deque.
+ * @return True if the connection was pushed, false if the deque is full.
+ */
+static bool deque_push(pool_deque_t* p_deque, pool_conn_t* p_task)
+{
+    int64_t bottom = atomic_load_explicit(&(p_deque->bottom),
+                                          memory_order_relaxed);
+    int64_t top    = atomic_load_explicit(&(p_deque->top),
+                                          memory_order_acquire);
+    if (POOL_DEQUE_SIZE <= bottom - top)
+    {
+        return false;
+    }
+    atomic_store_explicit(&(p_deque->tasks[bottom & POOL_DEQUE_MASK]),
+                          p_task,
+                          memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&(p_deque->bottom), bottom + 1,
+                          memory_order_relaxed);
+    return true;
+} /* deque_push */
+
+/**
+ * @brief Pops the most recently pushed connection off the owner's deque.
+ * @return The connection, or NULL if the deque is empty or a thief took the
+ *         last one.
+ */
+static pool_conn_t* deque_pop(pool_deque_t* p_deque)
+{
+    int64_t bottom = atomic_load_explicit(&(p_deque->bottom),
+                                          memory_order_relaxed) - 1;
+    atomic_store_explicit(&(p_deque->bottom), bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t top = atomic_load_explicit(&(p_deque->top), memory_order_relaxed);
+
+    if (top > bottom)
+    {
+        atomic_store_explicit(&(p_deque->bottom), bottom + 1,
+                              memory_order_relaxed);
+        return NULL;
+    }
+
+    pool_conn_t* p_task =
+        atomic_load_explicit(&(p_deque->tasks[bottom & POOL_DEQUE_MASK]),
+                             memory_order_relaxed);
+    if (top == bottom)
+    {
+        // Last item: race any thief for it.
+        //
+        if (!atomic_compare_exchange_strong_explicit(&(p_deque->top),
+                                                     &top,
+                                                     top + 1,
+                                                     memory_order_seq_cst,
+                                                     memory_order_relaxed))
+        {
+            p_task = NULL;
+        }
+        atomic_store_explicit(&(p_deque->bottom), bottom + 1,
+                              memory_order_relaxed);
+    }
+    return p_task;
+} /* deque_pop */
+
+/**
+ * @brief Steals the oldest connection from another worker's deque.
+ * @return The connection, or NULL if the deque is empty or another thread
+ *         won the race for it.
+ */
+static pool_conn_t* deque_steal(pool_deque_t* p_deque)
+{
+    int64_t top = atomic_load_explicit(&(p_deque->top), memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t bottom = atomic_load_explicit(&(p_deque->bottom),
+                                          memory_order_acquire);
+    if (top >= bottom)
+    {
+        return NULL;
+    }
+
+    pool_conn_t* p_task =
+        atomic_load_explicit(&(p_deque->tasks[top & POOL_DEQUE_MASK]),
+                             memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&(p_deque->top),
+                                                 &top,
+                                                 top + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed))
+    {
+        return NULL;
+    }
+    return p_task;
+} /* deque_steal */
+
+/**
+ * @brief Counts the connections waiting in a deque. Only a hint while the
+ *        deque is in use.
+ */
+static int64_t deque_depth(pool_deque_t* p_deque)
+{
+    int64_t depth = atomic_load_explicit(&(p_deque->bottom),
+                                         memory_order_relaxed) -
+                    atomic_load_explicit(&(p_deque->top),
+                                         memory_order_relaxed);
+    return (0 < depth) ? depth : 0;
+} /* deque_depth */
+
+/**
+ * @brief Closes a client connection, releases its state and frees up a
+ *        connection slot.
+ * @param[in] p_pool A pointer to the pool the connection is registered with.
+ * @param[in] p_conn A pointer to the connection to close.
+ */
+static void close_connection(work_pool_t* p_pool, conn_t* p_conn)
+{
+    epoll_ctl(p_pool->epoll_fd, EPOLL_CTL_DEL, p_conn->fd, NULL);
+
+    pthread_mutex_lock(&(p_pool->connections_lock));
+    if (NULL != p_conn->p_prev)
+    {
+        p_conn->p_prev->p_next = p_conn->p_next;
+    }
+    else
+    {
+        p_pool->p_connections = p_conn->p_next;
+    }
+    if (NULL != p_conn->p_next)
+    {
+        p_conn->p_next->p_prev = p_conn->p_prev;
+    }
+    pthread_mutex_unlock(&(p_pool->connections_lock));
+
+    timeout_unwatch(&(p_pool->p_serv->reaper), &(p_conn->timer));
+    conn_release(p_conn);
+    close(p_conn->fd);
+    free(p_conn);
+    release_connection_slot(p_pool->p_serv);
+} /* close_connection */
+
+/**
+ * @brief Registers a batch of queued connections with the pool's epoll set.
+ * @param[in] p_pool A pointer to the pool receiving the connections.
+ * @param[in] p_client_fds A pointer to the dequeued client fds.
+ * @param[in] count The number of client fds.
+ */
+static void register_connections(work_pool_t* p_pool,
+                                 int*         p_client_fds,
+                                 size_t       count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        int client_fd = p_client_fds[i];
+
+        pool_conn_t* p_task = malloc(sizeof(pool_conn_t));
+        if (NULL == p_task)
+        {
+            SERV_LOG(SERV_LOG_LEVEL_ERROR,
+                     "Error allocating connection state. [%s]\n",
+                     strerror(errno));
+            close(client_fd);
+            release_connection_slot(p_pool->p_serv);
+            continue;
+        }
+        conn_t* p_conn = &(p_task->conn);
+        send_handshake(p_pool->p_serv, client_fd);
+        conn_init(p_conn, client_fd);
+
+        int flags = fcntl(client_fd, F_GETFL, 0);
+        fcntl(client_fd, F_SETFL, (flags | O_NONBLOCK));
+
+        // Linked in before it is armed, since a worker may close it as soon
+        // as it is.
+        //
+        pthread_mutex_lock(&(p_pool->connections_lock));
+        p_conn->p_next = p_pool->p_connections;
+        if (NULL != p_pool->p_connections)
+        {
+            p_pool->p_connections->p_prev = p_conn;
+        }
+        p_pool->p_connections = p_conn;
+        pthread_mutex_unlock(&(p_pool->connections_lock));
+
+        if (false == timeout_watch(&(p_pool->p_serv->reaper),
+                                   &(p_conn->timer)))
+        {
+            close_connection(p_pool, p_conn);
+            continue;
+        }
+
+        struct epoll_event event = { 0 };
+        event.events   = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        event.data.ptr = p_task;
+        if (0 > epoll_ctl(p_pool->epoll_fd, EPOLL_CTL_ADD, client_fd, &event))
+        {
+            SERV_LOG(SERV_LOG_LEVEL_ERROR,
+                     "Error registering client socket. [%s]\n",
+                     strerror(errno));
+            close_connection(p_pool, p_conn);
+        }
+    }
+} /* register_connections */
+
+/**
+ * @brief Clears the pool's wake up event, takes every queued connection in
+ *        batches and rearms the wake up event.
+ * @param[in] p_pool A pointer to the woken pool.
+ */
+static void drain_connection_queue(work_pool_t* p_pool)
+{
+    uint64_t wake_count;
+    if (0 > read(p_pool->wake_fd, &wake_count, sizeof(wake_count)) &&
+        EAGAIN != errno)
+    {
+        SERV_LOG(SERV_LOG_LEVEL_ERROR,
+                 "Error reading wake event. [%s]\n",
+                 strerror(errno));
+    }
+
+    int    client_fds[HANDOFF_BATCH_SIZE];
+    size_t count;
+    do
+    {
+        count = fd_queue_dequeue_batch(&(p_pool->p_serv->connection_queue),
+                                       client_fds,
+                                       HANDOFF_BATCH_SIZE);
+        register_connections(p_pool, client_fds, count);
+    } while (HANDOFF_BATCH_SIZE == count);
+
+    struct epoll_event event = { 0 };
+    event.events   = EPOLLIN | EPOLLONESHOT;
+    event.data.ptr = NULL;
+    epoll_ctl(p_pool->epoll_fd, EPOLL_CTL_MOD, p_pool->wake_fd, &event);
+} /* drain_connection_queue */
+
+/**
+ * @brief Services one ready connection, then rearms it for whatever it is
+ *        waiting on next. Once rearmed the connection may be picked up by
+ *        another worker, so it is not touched again.
+ * @param[in] p_pool A pointer to the pool the connection is registered with.
+ * @param[in] p_task A pointer to the ready connection.
+ */
+static void run_task(work_pool_t* p_pool, pool_conn_t* p_task)
+{
+    conn_t*  p_conn       = &(p_task->conn);
+    uint32_t flags        = p_task->events;
+    bool     is_connected = true;
+
+    if (flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+    {
+        is_connected = conn_on_readable(p_conn);
+    }
+    else if (flags & EPOLLOUT)
+    {
+        is_connected = conn_flush(p_conn);
+        if (is_connected && p_conn->b_input_pending)
+        {
+            is_connected = conn_on_readable(p_conn);
+        }
+    }
+    if (false == is_connected)
+    {
+        close_connection(p_pool, p_conn);
+        return;
+    }
+
+    conn_arm_deadline(p_conn);
+
+    // Stop reading while responses are backed up; the sockets are level
+    // triggered, so unread input is reported again once they drain.
+    //
+    struct epoll_event event = { 0 };
+    event.events   = ((0 < p_conn->out_length) ? EPOLLOUT : EPOLLIN) |
+                     EPOLLRDHUP | EPOLLONESHOT;
+    event.data.ptr = p_task;
+    if (0 > epoll_ctl(p_pool->epoll_fd, EPOLL_CTL_MOD, p_conn->fd, &event))
+    {
+        SERV_LOG(SERV_LOG_LEVEL_ERROR,
+                 "Error rearming client socket. [%s]\n",
+                 strerror(errno));
+        close_connection(p_pool, p_conn);
+    }
+} /* run_task */
+
+/**
+ * @brief Looks for a ready connection on every other running worker.
+ * @param[in] p_worker A pointer to the idle worker.
+ * @return A stolen connection, or NULL if none could be taken.
+ */
+static pool_conn_t* steal_task(pool_worker_t* p_worker)
+{
+    work_pool_t* p_pool      = p_worker->p_pool;
+    int          max_workers = p_pool->p_serv->max_workers;
+    for (int offset = 1; offset < max_workers; offset++)
+    {
+        pool_worker_t* p_victim =
+            &(p_pool->p_workers[(p_worker->index + offset) % max_workers]);
+        if (POOL_SLOT_RUNNING != atomic_load_explicit(&(p_victim->state),
+                                                      memory_order_relaxed))
+        {
+            continue;
+        }
+        pool_conn_t* p_task = deque_steal(&(p_victim->deque));
+        if (NULL != p_task)
+        {
+            serv_metrics_add(SERV_METRIC_TASKS_STOLEN, 1);
+            return p_task;
+        }
+    }
+    return NULL;
+} /* steal_task */
+
+/**
+ * @brief Gives up a worker's place in the pool if it is above its minimum
+ *        size.
+ * @return True if the calling worker should exit.
+ */
+static bool try_retire(work_pool_t* p_pool)
+{
+    int count = atomic_load(&(p_pool->worker_count));
+    while (p_pool->p_serv->thread_count < count)
+    {
+        if (atomic_compare_exchange_weak(&(p_pool->worker_count),
+                                         &count,
+                                         count - 1))
+        {
+            return true;
+        }
+    }
+    return false;
+} /* try_retire */
+
+/**
+ * @brief Worker thread body. Services its own deque, then steals, then
+ *        collects more ready connections from the epoll set, until the pool
+ *        stops or the worker has been idle long enough to retire.
+ * @param[in] args A pointer to the pool_worker_t to run.
+ * @return NULL on thread exit
+ */
+static void* pool_worker_handler(void* args)
+{
+    pool_worker_t*     p_worker   = (pool_worker_t*)args;
+    work_pool_t*       p_pool     = p_worker->p_pool;
+    int                idle_polls = 0;
+    struct epoll_event events[POOL_MAX_EVENTS];
+
+    while (false == atomic_load_explicit(&(p_pool->b_stopping),
+                                         memory_order_relaxed))
+    {
+        pool_conn_t* p_task = deque_pop(&(p_worker->deque));
+        if (NULL == p_task)
+        {
+            p_task = steal_task(p_worker);
+        }
+        if (NULL != p_task)
+        {
+            run_task(p_pool, p_task);
+            idle_polls = 0;
+            continue;
+        }
+
+        atomic_fetch_add_explicit(&(p_pool->idle_workers), 1,
+                                  memory_order_relaxed);
+        int count = epoll_wait(p_pool->epoll_fd,
+                               events,
+                               POOL_MAX_EVENTS,
+                               POOL_POLL_TIMEOUT_MS);
+        atomic_fetch_sub_explicit(&(p_pool->idle_workers), 1,
+                                  memory_order_relaxed);
+        if (0 > count)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            SERV_LOG(SERV_LOG_LEVEL_ERROR,
+                     "Error waiting on events. [%s]\n",
+                     strerror(errno));
+            break;
+        }
+        if (0 == count)
+        {
+            idle_polls++;
+            if (POOL_IDLE_POLLS <= idle_polls && try_retire(p_pool))
+            {
+                break;
+            }
+            continue;
+        }
+
+        idle_polls = 0;
+        for (int i = 0; i < count; i++)
+        {
+            pool_conn_t* p_ready = events[i].data.ptr;
+            if (NULL == p_ready)
+            {
+                drain_connection_queue(p_pool);
+                continue;
+            }
+            if ((void*)p_pool == (void*)p_ready)
+            {
+                continue;
+            }
+
+            p_ready->events = events[i].events;
+            if (false == deque_push(&(p_worker->deque), p_ready))
+            {
+                run_task(p_pool, p_ready);
+            }
+        }
+    }
+
+    atomic_store(&(p_worker->state), POOL_SLOT_EXITED);
+    return NULL;
+} /* pool_worker_handler */
+
+/**
+ * @brief Starts a worker in a free slot. Only called by init_work_pool and
+ *        the monitor, so slots are never claimed concurrently.
+ * @return True if a worker was started.
+ */
+static bool start_worker(work_pool_t* p_pool)
+{
+    serv_t* p_serv = p_pool->p_serv;
+    for (int i = 0; i < p_serv->max_workers; i++)
+    {
+        pool_worker_t* p_worker = &(p_pool->p_workers[i]);
+        int            state    = atomic_load(&(p_worker->state));
+        if (POOL_SLOT_RUNNING == state)
+        {
+            continue;
+        }
+        if (POOL_SLOT_EXITED == state)
+        {
+            pthread_join(p_worker->thread_id, NULL);
+        }
+
+        atomic_store(&(p_worker->state), POOL_SLOT_RUNNING);
+        atomic_fetch_add(&(p_pool->worker_count), 1);
+        int err = pthread_create(&(p_worker->thread_id),
+                                 NULL,
+                                 &pool_worker_handler,
+                                 p_worker);
+        if (0 != err)
+        {
+            fprintf(stderr,
+                    "Thread unable to be created. [%s]\n",
+                    strerror(err));
+            atomic_fetch_sub(&(p_pool->worker_count), 1);
+            atomic_store(&(p_worker->state), POOL_SLOT_FREE);
+            return false;
+        }
+        pin_thread(p_worker->thread_id, p_serv->cpu);
+        return true;
+    }
+    return false;
+} /* start_worker */
+
+/**
+ * @brief Monitor thread body. Adds a worker whenever the deques hold more
+ *        than POOL_GROW_DEPTH connections per worker, or no worker has been
+ *        idle for POOL_GROW_BUSY_SAMPLES samples in a row.
+ * @param[in] args A pointer to the work_pool_t to watch.
+ * @return NULL on thread exit
+ */
+static void* pool_monitor_handler(void* args)
+{
+    work_pool_t*          p_pool       = (work_pool_t*)args;
+    serv_t*               p_serv       = p_pool->p_serv;
+    int                   busy_samples = 0;
+    const struct timespec interval     = { 0, POOL_MONITOR_INTERVAL_NS };
+
+    while (false == atomic_load(&(p_pool->b_stopping)))
+    {
+        nanosleep(&interval, NULL);
+
+        int count = atomic_load(&(p_pool->worker_count));
+        if (count >= p_serv->max_workers)
+        {
+            busy_samples = 0;
+            continue;
+        }
+
+        int64_t depth = 0;
+        for (int i = 0; i < p_serv->max_workers; i++)
+        {
+            depth += deque_depth(&(p_pool->p_workers[i].deque));
+        }
+        busy_samples = (0 == atomic_load(&(p_pool->idle_workers))) ?
+                           busy_samples + 1 : 0;
+
+        if ((depth > (int64_t)count * POOL_GROW_DEPTH ||
+             POOL_GROW_BUSY_SAMPLES <= busy_samples) &&
+            start_worker(p_pool))
+        {
+            busy_samples = 0;
+        }
+    }
+    return NULL;
+} /* pool_monitor_handler */
+
+/**
+ * @brief Creates the pool's epoll set and events and starts thread_count
+ *        workers and the monitor.
+ * @param[in] p_serv A pointer to a serv_t struct with thread_count and
+ *                   max_workers set.
+ * @return SERV_INIT_SUCCESS if the pool started.
+ *         SERV_INIT_FAILURE if it could not be started.
+ */
+int init_work_pool(serv_t* p_serv)
+{
+    work_pool_t* p_pool = calloc(1, sizeof(work_pool_t));
+    if (NULL == p_pool)
+    {
+        fprintf(stderr,
+                "Unable to allocate worker pool. [%s]\n",
+                strerror(errno));
+        return SERV_INIT_FAILURE;
+    }
+    p_serv->p_pool   = p_pool;
+    p_pool->p_serv   = p_serv;
+    p_pool->epoll_fd = -1;
+    p_pool->wake_fd  = -1;
+    p_pool->stop_fd  = -1;
+    pthread_mutex_init(&(p_pool->connections_lock), NULL);
+
+    size_t workers_size = p_serv->max_workers * sizeof(pool_worker_t);
+    p_pool->p_workers   = aligned_alloc(CACHE_LINE_SIZE, workers_size);
+    if (NULL == p_pool->p_workers)
+    {
+        fprintf(stderr,
+                "Unable to allocate pool workers. [%s]\n",
+                strerror(errno));
+        return SERV_INIT_FAILURE;
+    }
+    memset(p_pool->p_workers, 0, workers_size);
+    for (int i = 0; i < p_serv->max_workers; i++)
+    {
+        p_pool->p_workers[i].index  = i;
+        p_pool->p_workers[i].p_pool = p_pool;
+    }
+
+    p_pool->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    p_pool->wake_fd  = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    p_pool->stop_fd  = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (0 > p_pool->epoll_fd || 0 > p_pool->wake_fd || 0 > p_pool->stop_fd)
+    {
+        fprintf(stderr,
+                "Unable to create pool events. [%s]\n",
+                strerror(errno));
+        return SERV_INIT_FAILURE;
+    }
+
+    // The wake up event goes to one worker at a time; the stop event stays
+    // level triggered so it reaches every worker.
+    //
+    struct epoll_event wake_event = { 0 };
+    wake_event.events   = EPOLLIN | EPOLLONESHOT;
+    wake_event.data.ptr = NULL;
+    struct epoll_event stop_event = { 0 };
+    stop_event.events   = EPOLLIN;
+    stop_event.data.ptr = p_pool;
+    if (0 > epoll_ctl(p_pool->epoll_fd,
+                      EPOLL_CTL_ADD,
+                      p_pool->wake_fd,
+                      &wake_event) ||
+        0 > epoll_ctl(p_pool->epoll_fd,
+                      EPOLL_CTL_ADD,
+                      p_pool->stop_fd,
+                      &stop_event))
+    {
+        fprintf(stderr,
+                "Unable to register pool events. [%s]\n",
+                strerror(errno));
+        return SERV_INIT_FAILURE;
+    }
+
+    for (int i = 0; i < p_serv->thread_count; i++)
+    {
+        if (false == start_worker(p_pool))
+        {
+            return SERV_INIT_FAILURE;
+        }
+    }
+
+    int err = pthread_create(&(p_pool->monitor_id),
+                             NULL,
+                             &pool_monitor_handler,
+                             p_pool);
+    if (0 != err)
+    {
+        fprintf(stderr,
+                "Thread unable to be created. [%s]\n",
+                strerror(err));
+        return SERV_INIT_FAILURE;
+    }
+    p_pool->b_monitor_started = true;
+    return SERV_INIT_SUCCESS;
+} /* init_work_pool */
+
+/**
+ * @brief Wakes one worker to take newly queued connections.
+ * @param[in] p_serv A pointer to a running serv_t struct.
+ */
+void work_pool_wake(serv_t* p_serv)
+{
+    uint64_t wake = 1;
+    if (sizeof(wake) != write(p_serv->p_pool->wake_fd, &wake, sizeof(wake)))
+    {
+        fprintf(stderr, "Error waking worker pool. [%s]\n", strerror(errno));
+    }
+} /* work_pool_wake */
+
+/**
+ * @brief Reports the number of workers currently in the pool.
+ * @param[in] p_serv A pointer to a serv_t struct.
+ * @return The worker count, or 0 if the server has no pool.
+ */
+int work_pool_worker_count(serv_t* p_serv)
+{
+    if (NULL == p_serv->p_pool)
+    {
+        return 0;
+    }
+    return atomic_load(&(p_serv->p_pool->worker_count));
+} /* work_pool_worker_count */
+
+/**
+ * @brief Stops and joins every worker and the monitor, closing all
+ *        connections.
+ * @param[in] p_serv A pointer to a serv_t struct.
+ */
+void shutdown_work_pool(serv_t* p_serv)
+{
+    work_pool_t* p_pool = p_serv->p_pool;
+    if (NULL == p_pool)
+    {
+        return;
+    }
+
+    atomic_store(&(p_pool->b_stopping), true);
+    uint64_t stop = 1;
+    if (0 <= p_pool->stop_fd &&
+        sizeof(stop) != write(p_pool->stop_fd, &stop, sizeof(stop)))
+    {
+        fprintf(stderr, "Error stopping worker pool. [%s]\n", strerror(errno));
+    }
+
+    if (p_pool->b_monitor_started)
+    {
+        pthread_join(p_pool->monitor_id, NULL);
+    }
+    for (int i = 0; NULL != p_pool->p_workers && i < p_serv->max_workers; i++)
+    {
+        pool_worker_t* p_worker = &(p_pool->p_workers[i]);
+        if (POOL_SLOT_FREE != atomic_load(&(p_worker->state)))
+        {
+            int err = pthread_join(p_worker->thread_id, NULL);
+            if (0 != err)
+            {
+                fprintf(stderr, "Error joining thread. [%s]\n", strerror(err));
+            }
+        }
+    }
+
+    while (NULL != p_pool->p_connections)
+    {
+        close_connection(p_pool, p_pool->p_connections);
+    }
+
+    if (0 <= p_pool->epoll_fd)
+    {
+        close(p_pool->epoll_fd);
+    }
+    if (0 <= p_pool->wake_fd)
+    {
+        close(p_pool->wake_fd);
+    }
+    if (0 <= p_pool->stop_fd)
+    {
+        close(p_pool->stop_fd);
+    }
+    pthread_mutex_destroy(&(p_pool->connections_lock));
+    free(p_pool->p_workers);
+    free(p_pool);
+    p_serv->p_pool = NULL;
+} /* shutdown_work_pool */
@@ -0,0 +1,15 @@
+#include <stdbool.h>
+
+#define POOL_DEQUE_SIZE 256
+#define POOL_MAX_EVENTS 64
+#define POOL_POLL_TIMEOUT_MS 100
+#define POOL_IDLE_POLLS 20
+#define POOL_MONITOR_INTERVAL_NS 5000000
+#define POOL_GROW_DEPTH 4
+#define POOL_GROW_BUSY_SAMPLES 2
+#define DEFAULT_POOL_MAX_FACTOR 4
+
+int  init_work_pool(serv_t* p_serv);
+void work_pool_wake(serv_t* p_serv);
+int  work_pool_worker_count(serv_t* p_serv);
+void shutdown_work_pool(serv_t* p_serv);
@@ -0,0 +1,370 @@
+/** @file serv_queue.c
+ *
+ * @brief Bounded lock-free MPMC ring used to hand accepted connections from
+ *        the acceptor to the workers. Each cell carries a sequence number so
+ *        producers and consumers only contend on their own position counter.
+ * @par
+ * COPYRIGHT NOTICE: (c) 2018 Barr Group. All rights reserved.
+ */
+
+#define _XOPEN_SOURCE 700
+#include <errno.h> // errno, EINTR
+#include <pthread.h>
+#include <sched.h> // sched_yield
+#include <semaphore.h> // sem_init, sem_post, sem_wait, sem_trywait
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h> // stderr
+#include <stdlib.h> // calloc, free
+#include <string.h> // strerror
+
+#include "serv_lib.h"
+
+/**
+ * @brief Raises a running maximum to the given value if it is larger.
+ */
+static void update_max(atomic_uint_fast64_t* p_max, uint64_t value)
+{
+    uint64_t current = atomic_load_explicit(p_max, memory_order_relaxed);
+    while (value > current &&
+           !atomic_compare_exchange_weak_explicit(p_max,
+                                                  &current,
+                                                  value,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed))
+    {
+        /* continue */
+    }
+} /* update_max */
+
+/**
+ * @brief Adds a sample to a total and maximum pair.
+ */
+static void record_time(atomic_uint_fast64_t* p_total,
+                        atomic_uint_fast64_t* p_max,
+                        uint64_t              value)
+{
+    atomic_fetch_add_explicit(p_total, value, memory_order_relaxed);
+    update_max(p_max, value);
+} /* record_time */
+
+/**
+ * @brief Initializes an empty queue.
+ * @param[in] p_queue A pointer to the queue to initialize.
+ * @param[in] depth The minimum number of fds the queue must hold. Rounded up
+ *                  to a power of two.
+ * @return FD_QUEUE_INIT_SUCCESS if the queue is ready for use.
+ *         FD_QUEUE_INIT_FAILURE if memory could not be allocated.
+ */
+int fd_queue_init(fd_queue_t* p_queue, size_t depth)
+{
+    size_t capacity = 2;
+    while (capacity < depth)
+    {
+        capacity <<= 1;
+    }
+
+    p_queue->p_cells = calloc(capacity, sizeof(fd_queue_cell_t));
+    if (NULL == p_queue->p_cells)
+    {
+        fprintf(stderr,
+                "Unable to allocate connection queue. [%s]\n",
+                strerror(errno));
+        return FD_QUEUE_INIT_FAILURE;
+    }
+    p_queue->mask = capacity - 1;
+    for (size_t i = 0; i < capacity; i++)
+    {
+        atomic_init(&(p_queue->p_cells[i].sequence), i);
+    }
+
+    if (0 > sem_init(&(p_queue->items), 0, 0))
+    {
+        fprintf(stderr,
+                "Unable to initiate connection queue semaphore. [%s]\n",
+                strerror(errno));
+        free(p_queue->p_cells);
+        p_queue->p_cells = NULL;
+        return FD_QUEUE_INIT_FAILURE;
+    }
+
+    atomic_init(&(p_queue->enqueue_pos), 0);
+    atomic_init(&(p_queue->dequeue_pos), 0);
+    atomic_init(&(p_queue->enqueued), 0);
+    atomic_init(&(p_queue->full_rejections), 0);
+    atomic_init(&(p_queue->enqueue_wait_total), 0);
+    atomic_init(&(p_queue->enqueue_wait_max), 0);
+    atomic_init(&(p_queue->max_depth), 0);
+    atomic_init(&(p_queue->dequeued), 0);
+    atomic_init(&(p_queue->dequeue_wait_total), 0);
+    atomic_init(&(p_queue->dequeue_wait_max), 0);
+    atomic_init(&(p_queue->residence_total), 0);
+    atomic_init(&(p_queue->wakes), 0);
+    atomic_init(&(p_queue->residence_max), 0);
+    return FD_QUEUE_INIT_SUCCESS;
+} /* fd_queue_init */
+
+/**
+ * @brief Releases the queue's memory. Any fds still queued are closed by the
+ *        caller beforehand.
+ * @param[in] p_queue A pointer to an initialized queue.
+ */
+void fd_queue_destroy(fd_queue_t* p_queue)
+{
+    if (NULL == p_queue->p_cells)
+    {
+        return;
+    }
+    sem_destroy(&(p_queue->items));
+    free(p_queue->p_cells);
+    p_queue->p_cells = NULL;
+} /* fd_queue_destroy */
+
+/**
+ * @brief Adds an fd to the queue without ever blocking.
+ * @param[in] p_queue A pointer to an initialized queue.
+ * @param[in] fd The accepted client's socket File Descriptor
+ * @return True if the fd was queued.
+ *         False if the queue is full.
+ */
+bool fd_queue_enqueue(fd_queue_t* p_queue, int fd)
+{
+    uint64_t         start   = monotonic_ns();
+    bool             b_retry = false;
+    fd_queue_cell_t* p_cell;
+    size_t           pos = atomic_load_explicit(&(p_queue->enqueue_pos),
+                                                memory_order_relaxed);
+    while (true)
+    {
+        p_cell = &(p_queue->p_cells[pos & p_queue->mask]);
+        size_t   sequence = atomic_load_explicit(&(p_cell->sequence),
+                                                 memory_order_acquire);
+        intptr_t diff     = (intptr_t)sequence - (intptr_t)pos;
+        if (0 == diff)
+        {
+            if (atomic_compare_exchange_weak_explicit(&(p_queue->enqueue_pos),
+                                                      &pos,
+                                                      pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (0 > diff)
+        {
+            atomic_fetch_add_explicit(&(p_queue->full_rejections),
+                                      1,
+                                      memory_order_relaxed);
+            return false;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&(p_queue->enqueue_pos),
+                                       memory_order_relaxed);
+        }
+        b_retry = true;
+    }
+
+    p_cell->fd         = fd;
+    p_cell->enqueue_ns = start;
+    atomic_store_explicit(&(p_cell->sequence), pos + 1, memory_order_release);
+    sem_post(&(p_queue->items));
+
+    atomic_fetch_add_explicit(&(p_queue->enqueued), 1, memory_order_relaxed);
+    size_t depth = pos + 1 - atomic_load_explicit(&(p_queue->dequeue_pos),
+                                                  memory_order_relaxed);
+    update_max(&(p_queue->max_depth), depth);
+    if (b_retry)
+    {
+        record_time(&(p_queue->enqueue_wait_total),
+                    &(p_queue->enqueue_wait_max),
+                    monotonic_ns() - start);
+    }
+    return true;
+} /* fd_queue_enqueue */
+
+/**
+ * @brief Removes one fd from the queue if one is published.
+ * @param[in] p_queue A pointer to an initialized queue.
+ * @param[out] p_fd A pointer to store the dequeued fd in.
+ * @return True if an fd was dequeued.
+ *         False if the queue is empty.
+ */
+static bool dequeue_one(fd_queue_t* p_queue, int* p_fd)
+{
+    fd_queue_cell_t* p_cell;
+    size_t           pos = atomic_load_explicit(&(p_queue->dequeue_pos),
+                                                memory_order_relaxed);
+    while (true)
+    {
+        p_cell = &(p_queue->p_cells[pos & p_queue->mask]);
+        size_t   sequence = atomic_load_explicit(&(p_cell->sequence),
+                                                 memory_order_acquire);
+        intptr_t diff     = (intptr_t)sequence - (intptr_t)(pos + 1);
+        if (0 == diff)
+        {
+            if (atomic_compare_exchange_weak_explicit(&(p_queue->dequeue_pos),
+                                                      &pos,
+                                                      pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (0 > diff)
+        {
+            return false;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&(p_queue->dequeue_pos),
+                                       memory_order_relaxed);
+        }
+    }
+
+    *p_fd = p_cell->fd;
+    uint64_t enqueue_ns = p_cell->enqueue_ns;
+    atomic_store_explicit(&(p_cell->sequence),
+                          pos + p_queue->mask + 1,
+                          memory_order_release);
+
+    atomic_fetch_add_explicit(&(p_queue->dequeued), 1, memory_order_relaxed);
+    record_time(&(p_queue->residence_total),
+                &(p_queue->residence_max),
+                monotonic_ns() - enqueue_ns);
+    return true;
+} /* dequeue_one */
+
+/**
+ * @brief Removes up to max fds from the queue without blocking.
+ * @param[in] p_queue A pointer to an initialized queue.
+ * @param[out] p_fds A pointer to an array of at least max fds.
+ * @param[in] max The most fds to dequeue.
+ * @return The number of fds dequeued.
+ */
+size_t fd_queue_dequeue_batch(fd_queue_t* p_queue, int* p_fds, size_t max)
+{
+    size_t count = 0;
+    while (count < max && dequeue_one(p_queue, &(p_fds[count])))
+    {
+        // Keep the item count in step for any blocking consumers.
+        //
+        sem_trywait(&(p_queue->items));
+        count++;
+    }
+    return count;
+} /* fd_queue_dequeue_batch */
+
+/**
+ * @brief Claims one of the items posts made by fd_queue_wake_all, if any is
+ *        left.
+ * @return True if a wake was claimed.
+ */
+static bool claim_wake(fd_queue_t* p_queue)
+{
+    int wakes = atomic_load(&(p_queue->wakes));
+    while (0 < wakes &&
+           !atomic_compare_exchange_weak(&(p_queue->wakes), &wakes, wakes - 1))
+    {
+        /* continue */
+    }
+    return (0 < wakes);
+} /* claim_wake */
+
+/**
+ * @brief Removes one fd from the queue, sleeping until one is available or
+ *        the waiter is woken by fd_queue_wake_all.
+ * @param[in] p_queue A pointer to an initialized queue.
+ * @return The dequeued fd.
+ *         FD_QUEUE_EMPTY if woken by fd_queue_wake_all without an fd to
+ *         serve.
+ */
+int fd_queue_dequeue_wait(fd_queue_t* p_queue)
+{
+    uint64_t start = monotonic_ns();
+    while (0 > sem_wait(&(p_queue->items)))
+    {
+        if (EINTR != errno)
+        {
+            return FD_QUEUE_EMPTY;
+        }
+    }
+    record_time(&(p_queue->dequeue_wait_total),
+                &(p_queue->dequeue_wait_max),
+                monotonic_ns() - start);
+
+    // Every post but a wake is made for an fd, yet the cell at the head may
+    // be claimed by a producer that has not published it. Retry until it is
+    // rather than strand the fd with its post spent.
+    //
+    int fd = FD_QUEUE_EMPTY;
+    while (false == dequeue_one(p_queue, &fd))
+    {
+        if (claim_wake(p_queue))
+        {
+            return FD_QUEUE_EMPTY;
+        }
+        sched_yield();
+    }
+    return fd;
+} /* fd_queue_dequeue_wait */
+
+/**
+ * @brief Wakes sleeping consumers so they can observe a shutdown.
+ * @param[in] p_queue A pointer to an initialized queue.
+ * @param[in] waiter_count The number of consumers that may be sleeping.
+ */
+void fd_queue_wake_all(fd_queue_t* p_queue, int waiter_count)
+{
+    atomic_fetch_add(&(p_queue->wakes), waiter_count);
+    for (int i = 0; i < waiter_count; i++)
+    {
+        sem_post(&(p_queue->items));
+    }
+} /* fd_queue_wake_all */
+
+/**
+ * @brief Takes a snapshot of the queue's counters.
+ * @param[in] p_queue A pointer to an initialized queue.
+ * @param[out] p_stats A pointer to store the snapshot in.
+ */
+void fd_queue_get_stats(fd_queue_t* p_queue, fd_queue_stats_t* p_stats)
+{
+    size_t enqueue_pos = atomic_load_explicit(&(p_queue->enqueue_pos),
+                                              memory_order_relaxed);
+    size_t dequeue_pos = atomic_load_explicit(&(p_queue->dequeue_pos),
+                                              memory_order_relaxed);
+
+    p_stats->capacity  = p_queue->mask + 1;
+    p_stats->depth     = (enqueue_pos > dequeue_pos) ?
+                         (enqueue_pos - dequeue_pos) : 0;
+    p_stats->max_depth = atomic_load_explicit(&(p_queue->max_depth),
+                                              memory_order_relaxed);
+    p_stats->enqueued  = atomic_load_explicit(&(p_queue->enqueued),
+                                              memory_order_relaxed);
+    p_stats->dequeued  = atomic_load_explicit(&(p_queue->dequeued),
+                                              memory_order_relaxed);
+    p_stats->full_rejections =
+        atomic_load_explicit(&(p_queue->full_rejections),
+                             memory_order_relaxed);
+    p_stats->enqueue_wait_total =
+        atomic_load_explicit(&(p_queue->enqueue_wait_total),
+                             memory_order_relaxed);
+    p_stats->enqueue_wait_max =
+        atomic_load_explicit(&(p_queue->enqueue_wait_max),
+                             memory_order_relaxed);
+    p_stats->dequeue_wait_total =
+        atomic_load_explicit(&(p_queue->dequeue_wait_total),
+                             memory_order_relaxed);
+    p_stats->dequeue_wait_max =
+        atomic_load_explicit(&(p_queue->dequeue_wait_max),
+                             memory_order_relaxed);
+    p_stats->residence_total =
+        atomic_load_explicit(&(p_queue->residence_total),
+                             memory_order_relaxed);
+    p_stats->residence_max =
+        atomic_load_explicit(&(p_queue->residence_max),
+                             memory_order_relaxed);
+} /* fd_queue_get_stats */
@@ -0,0 +1,76 @@
+#ifndef SERV_QUEUE_H
+#define SERV_QUEUE_H
+
+#include <semaphore.h> // sem_t
+#include <stdalign.h> // alignas
+#include <stdatomic.h> // atomic_size_t, atomic_uint_fast64_t
+#include <stdbool.h>
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+
+#define CACHE_LINE_SIZE 64
+#define FD_QUEUE_INIT_SUCCESS 0
+#define FD_QUEUE_INIT_FAILURE -1
+#define FD_QUEUE_EMPTY -1
+#define DEFAULT_FD_QUEUE_DEPTH 1024
+
+typedef struct fd_queue_cell_t {
+    atomic_size_t sequence;
+    int           fd;
+    uint64_t      enqueue_ns;
+} fd_queue_cell_t;
+
+/**
+ * @brief Snapshot of the counters kept by an fd_queue_t. Times are in
+ *        nanoseconds.
+ */
+typedef struct fd_queue_stats_t {
+    uint64_t capacity;
+    uint64_t depth;
+    uint64_t max_depth;
+    uint64_t enqueued;
+    uint64_t dequeued;
+    uint64_t full_rejections;
+    uint64_t enqueue_wait_total;
+    uint64_t enqueue_wait_max;
+    uint64_t dequeue_wait_total;
+    uint64_t dequeue_wait_max;
+    uint64_t residence_total;
+    uint64_t residence_max;
+} fd_queue_stats_t;
+
+/**
+ * @brief Bounded multi producer, multi consumer ring of accepted client file
+ *        descriptors. Producers and consumers never take a lock; consumers
+ *        that want to sleep while the ring is empty wait on items. wakes
+ *        counts the items posts made by fd_queue_wake_all rather than for an
+ *        fd.
+ */
+typedef struct fd_queue_t {
+    fd_queue_cell_t*              p_cells;
+    size_t                        mask;
+    sem_t                         items;
+    alignas(CACHE_LINE_SIZE) atomic_size_t enqueue_pos;
+    atomic_uint_fast64_t          enqueued;
+    atomic_uint_fast64_t          full_rejections;
+    atomic_uint_fast64_t          enqueue_wait_total;
+    atomic_uint_fast64_t          enqueue_wait_max;
+    atomic_uint_fast64_t          max_depth;
+    alignas(CACHE_LINE_SIZE) atomic_size_t dequeue_pos;
+    atomic_uint_fast64_t          dequeued;
+    atomic_uint_fast64_t          dequeue_wait_total;
+    atomic_uint_fast64_t          dequeue_wait_max;
+    atomic_uint_fast64_t          residence_total;
+    atomic_uint_fast64_t          residence_max;
+    atomic_int                    wakes;
+} fd_queue_t;
+
+int    fd_queue_init(fd_queue_t* p_queue, size_t depth);
+void   fd_queue_destroy(fd_queue_t* p_queue);
+bool   fd_queue_enqueue(fd_queue_t* p_queue, int fd);
+size_t fd_queue_dequeue_batch(fd_queue_t* p_queue, int* p_fds, size_t max);
+int    fd_queue_dequeue_wait(fd_queue_t* p_queue);
+void   fd_queue_wake_all(fd_queue_t* p_queue, int waiter_count);
+void   fd_queue_get_stats(fd_queue_t* p_queue, fd_queue_stats_t* p_stats);
+
+#endif /* SERV_QUEUE_H */
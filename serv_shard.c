@@ -0,0 +1,169 @@
+/** @file serv_shard.c
+ *
+ * @brief Shared-nothing server shards. Each shard is a complete server with
+ *        its own SO_REUSEPORT listener on the common port, its own acceptor
+ *        thread, connection queue, connection limit and workers, all pinned
+ *        to one CPU. The kernel spreads incoming connections across the
+ *        listeners, so shards never contend with each other to accept or
+ *        hand off a client.
+ * @par
+ * COPYRIGHT NOTICE: (c) 2018 Barr Group. All rights reserved.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h> // errno
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h> // stderr
+#include <stdlib.h> // calloc, free
+#include <string.h> // strerror
+#include <sys/socket.h> // shutdown
+#include <unistd.h> // close, sysconf
+
+#include "serv_lib.h"
+#include "serv_admin.h"
+#include "serv_shard.h"
+
+/**
+ * @brief Acceptor thread body for one shard.
+ * @param[in] args A pointer to the shard's serv_t struct.
+ * @return NULL on thread exit
+ */
+static void* shard_acceptor(void* args)
+{
+    accept_connections((serv_t*)args);
+    return NULL;
+} /* shard_acceptor */
+
+/**
+ * @brief Stops one shard's acceptor, then the rest of the shard.
+ */
+static void shutdown_shard(serv_t* p_shard, bool b_acceptor_started)
+{
+    // Shutting the listeners down fails the blocked accept, which ends the
+    // acceptor.
+    //
+    shutdown(p_shard->serv_listener_fd, SHUT_RDWR);
+    if (0 <= p_shard->unix_listener_fd)
+    {
+        shutdown(p_shard->unix_listener_fd, SHUT_RDWR);
+    }
+    if (b_acceptor_started)
+    {
+        int err = pthread_join(p_shard->acceptor_thread_id, NULL);
+        if (0 != err)
+        {
+            fprintf(stderr, "Error joining thread. [%s]\n", strerror(err));
+        }
+    }
+    shutdown_server(p_shard);
+    close_listeners(p_shard);
+} /* shutdown_shard */
+
+/**
+ * @brief Starts a number of shards, each a copy of a template server
+ *        pinned round robin to the online CPUs.
+ * @param[in] p_template A pointer to a serv_t struct with the settings
+ *                       every shard uses. thread_count, max_connections and
+ *                       queue_depth apply to each shard. The first
+ *                       shard serves the admin port and the unix domain
+ *                       socket for all of them.
+ * @param[in] shard_count The number of shards to start.
+ * @param[in] port_number The port every shard listens on.
+ * @return A pointer to an array of shard_count running shards, linked in
+ *         order through p_next_shard.
+ *         NULL if any shard could not be started. No shard is left running.
+ */
+serv_t* init_shards(const serv_t* p_template, int shard_count, int port_number)
+{
+    serv_t* p_shards = calloc(shard_count, sizeof(serv_t));
+    if (NULL == p_shards)
+    {
+        fprintf(stderr,
+                "Unable to allocate server shards. [%s]\n",
+                strerror(errno));
+        return NULL;
+    }
+
+    long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (1 > cpu_count)
+    {
+        cpu_count = 1;
+    }
+
+    for (int i = 0; i < shard_count; i++)
+    {
+        serv_t* p_shard = &(p_shards[i]);
+        *p_shard              = *p_template;
+        p_shard->b_reuseport  = true;
+        p_shard->cpu          = (int)(i % cpu_count);
+        p_shard->p_next_shard = (i + 1 < shard_count) ? &(p_shards[i + 1]) :
+                                                        NULL;
+        p_shard->admin_port   = 0;
+        p_shard->p_unix_path  = (0 == i) ? p_template->p_unix_path : NULL;
+
+        bool b_started = false;
+        if (SERV_INIT_SUCCESS == open_listener(p_shard, port_number))
+        {
+            if (SERV_INIT_SUCCESS == init_server(p_shard))
+            {
+                int err = pthread_create(&(p_shard->acceptor_thread_id),
+                                         NULL,
+                                         &shard_acceptor,
+                                         p_shard);
+                if (0 == err)
+                {
+                    pin_thread(p_shard->acceptor_thread_id, p_shard->cpu);
+                    b_started = true;
+                }
+                else
+                {
+                    fprintf(stderr,
+                            "Thread unable to be created. [%s]\n",
+                            strerror(err));
+                    shutdown_shard(p_shard, false);
+                }
+            }
+            else
+            {
+                close_listeners(p_shard);
+            }
+        }
+
+        if (false == b_started)
+        {
+            shutdown_shards(p_shards, i);
+            return NULL;
+        }
+    }
+
+    // The admin port reports on every shard, so it starts once they all
+    // have.
+    //
+    if (0 < p_template->admin_port)
+    {
+        p_shards[0].admin_port = p_template->admin_port;
+        if (SERV_INIT_SUCCESS != init_admin(&(p_shards[0])))
+        {
+            shutdown_shards(p_shards, shard_count);
+            return NULL;
+        }
+    }
+
+    printf("Started [%d] shards on [%ld] CPUs.\n", shard_count, cpu_count);
+    return p_shards;
+} /* init_shards */
+
+/**
+ * @brief Stops every shard and frees the shard array.
+ * @param[in] p_shards A pointer to shards returned by init_shards.
+ * @param[in] shard_count The number of running shards in the array.
+ */
+void shutdown_shards(serv_t* p_shards, int shard_count)
+{
+    for (int i = 0; i < shard_count; i++)
+    {
+        shutdown_shard(&(p_shards[i]), true);
+    }
+    free(p_shards);
+} /* shutdown_shards */
@@ -0,0 +1,4 @@
+#include <stdbool.h>
+
+serv_t* init_shards(const serv_t* p_template, int shard_count, int port_number);
+void    shutdown_shards(serv_t* p_shards, int shard_count);
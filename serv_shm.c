@@ -0,0 +1,130 @@
+/** @file serv_shm.c
+ *
+ * @brief Serves a thread mode client over shared memory once it asks for
+ *        it. The connection's buffers and parser are the same as over the
+ *        socket; only the bytes come from and go to the region's rings, so
+ *        a request costs no system calls while the client keeps the rings
+ *        busy. The socket is kept only to notice the client leaving, or the
+ *        timeout reaper shutting it down.
+ * @par
+ * COPYRIGHT NOTICE: (c) 2018 Barr Group. All rights reserved.
+ */
+
+#include <stdbool.h>
+#include <stddef.h> // size_t
+#include <unistd.h> // close
+
+#include "serv_lib.h"
+#include "serv_conn.h"
+#include "serv_log.h"
+#include "serv_metrics.h"
+#include "serv_shm.h"
+#include "shm_ring.h"
+
+/**
+ * @brief Writes all pending output into the response ring, waiting for the
+ *        client to make room when it is full.
+ * @return True if the client is still connected.
+ */
+static bool flush_to_ring(conn_t* p_conn, shm_region_t* p_region)
+{
+    while (p_conn->out_offset < p_conn->out_length)
+    {
+        size_t written = shm_ring_write(&(p_region->responses),
+                                        p_conn->out_buffer + p_conn->out_offset,
+                                        p_conn->out_length -
+                                            p_conn->out_offset);
+        if (0 == written)
+        {
+            conn_arm_deadline(p_conn);
+            if (false == shm_ring_wait_writable(&(p_region->responses),
+                                                p_conn->fd))
+            {
+                return false;
+            }
+            continue;
+        }
+        serv_metrics_add(SERV_METRIC_BYTES_SENT, written);
+        p_conn->out_offset += written;
+    }
+    p_conn->out_offset = 0;
+    p_conn->out_length = 0;
+    return true;
+} /* flush_to_ring */
+
+/**
+ * @brief Serves requests from the ring until the client disconnects.
+ */
+static void serve_ring(conn_t* p_conn, shm_region_t* p_region)
+{
+    while (true)
+    {
+        size_t bytes_read = shm_ring_read(&(p_region->requests),
+                                          p_conn->in_buffer +
+                                              p_conn->in_length,
+                                          CONN_IN_BUFFER_SIZE -
+                                              p_conn->in_length);
+        if (0 == bytes_read)
+        {
+            conn_arm_deadline(p_conn);
+            if (false == shm_ring_wait_readable(&(p_region->requests),
+                                                p_conn->fd))
+            {
+                SERV_LOG(SERV_LOG_LEVEL_INFO, "Client has disconnected.\n");
+                return;
+            }
+            continue;
+        }
+        serv_metrics_add(SERV_METRIC_BYTES_RECEIVED, bytes_read);
+        p_conn->in_length += bytes_read;
+
+        do
+        {
+            conn_process_input(p_conn);
+            if (false == flush_to_ring(p_conn, p_region))
+            {
+                return;
+            }
+        } while (p_conn->b_input_pending);
+    }
+} /* serve_ring */
+
+/**
+ * @brief Answers a client's request for shared memory and, if the region
+ *        could be set up, serves the client through it.
+ * @param[in] p_conn A pointer to a connection with b_shm_requested set.
+ * @return True if the client was served over shared memory until it
+ *         disconnected.
+ *         False if the client was declined and stays on the socket.
+ */
+bool serve_shm_connection(conn_t* p_conn)
+{
+    int           memfd    = SHM_NO_FD;
+    shm_region_t* p_region = NULL;
+    p_conn->b_shm_requested = false;
+
+    // A client waits for the answer before sending its first frame, so
+    // anything already buffered means it does not follow the handshake.
+    //
+    if (0 == p_conn->in_length)
+    {
+        p_region = shm_region_create(&memfd);
+    }
+    if (NULL == p_region)
+    {
+        shm_send_reply(p_conn->fd, PROTO_SHM_DECLINED, SHM_NO_FD);
+        return false;
+    }
+
+    bool b_sent = shm_send_reply(p_conn->fd, PROTO_SHM_ACCEPTED, memfd);
+    close(memfd);
+    if (b_sent)
+    {
+        serv_metrics_add(SERV_METRIC_SHM_CONNECTIONS, 1);
+        serve_ring(p_conn, p_region);
+        shm_ring_close(&(p_region->requests));
+        shm_ring_close(&(p_region->responses));
+    }
+    shm_region_unmap(p_region);
+    return true;
+} /* serve_shm_connection */
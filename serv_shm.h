@@ -0,0 +1,10 @@
+#ifndef SERV_SHM_H
+#define SERV_SHM_H
+
+#include <stdbool.h>
+
+#include "serv_conn.h"
+
+bool serve_shm_connection(conn_t* p_conn);
+
+#endif /* SERV_SHM_H */
@@ -0,0 +1,543 @@
+/** @file serv_timer.c
+ *
+ * @brief Idle, read and write timeouts for client connections. Every
+ *        connection has one entry in a hierarchical timing wheel, driven by
+ *        a single reaper thread per server. Connections never touch the
+ *        wheel while they are served: they only store their next deadline,
+ *        and the reaper moves the entry lazily when it comes due, so a
+ *        timeout costs no system calls and no timer per connection until a
+ *        client actually stalls.
+ * @par
+ * COPYRIGHT NOTICE: (c) 2018 Barr Group. All rights reserved.
+ */
+
+#define _XOPEN_SOURCE 700
+#include <errno.h> // errno
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h> // stderr
+#include <string.h> // strerror
+#include <sys/socket.h> // shutdown, SHUT_RDWR
+#include <time.h> // CLOCK_MONOTONIC, timespec
+
+#include "serv_lib.h"
+#include "serv_log.h"
+#include "serv_metrics.h"
+#include "serv_timer.h"
+
+static const int g_timeout_metrics[TIMEOUT_KIND_COUNT] =
+{
+    SERV_METRIC_TIMEOUTS_IDLE,
+    SERV_METRIC_TIMEOUTS_READ,
+    SERV_METRIC_TIMEOUTS_WRITE
+};
+
+static const char* const gp_timeout_names[TIMEOUT_KIND_COUNT] =
+{
+    "idle",
+    "read",
+    "write"
+};
+
+/**
+ * @brief Empties a slot, leaving it as a circular list of just its head.
+ */
+static void slot_init(timer_entry_t* p_slot)
+{
+    p_slot->p_prev = p_slot;
+    p_slot->p_next = p_slot;
+} /* slot_init */
+
+/**
+ * @brief Links an entry in at the back of a slot.
+ */
+static void slot_append(timer_entry_t* p_slot, timer_entry_t* p_entry)
+{
+    p_entry->p_prev         = p_slot->p_prev;
+    p_entry->p_next         = p_slot;
+    p_slot->p_prev->p_next  = p_entry;
+    p_slot->p_prev          = p_entry;
+} /* slot_append */
+
+/**
+ * @brief Unlinks an entry from whatever slot holds it.
+ */
+static void slot_remove(timer_entry_t* p_entry)
+{
+    p_entry->p_prev->p_next = p_entry->p_next;
+    p_entry->p_next->p_prev = p_entry->p_prev;
+    p_entry->p_prev         = NULL;
+    p_entry->p_next         = NULL;
+} /* slot_remove */
+
+/**
+ * @brief Moves every entry of a slot onto a list of its own, so the slot can
+ *        be refilled while the list is walked.
+ */
+static void slot_take(timer_entry_t* p_slot, timer_entry_t* p_list)
+{
+    slot_init(p_list);
+    if (p_slot->p_next == p_slot)
+    {
+        return;
+    }
+    p_list->p_next         = p_slot->p_next;
+    p_list->p_prev         = p_slot->p_prev;
+    p_list->p_next->p_prev = p_list;
+    p_list->p_prev->p_next = p_list;
+    slot_init(p_slot);
+} /* slot_take */
+
+/**
+ * @brief Puts an entry in the slot of the lowest level whose span reaches
+ *        its tick. Ticks beyond the top level wait in its furthest slot and
+ *        are placed again when they cascade.
+ */
+static void place_entry(timer_wheel_t* p_wheel, timer_entry_t* p_entry)
+{
+    uint64_t expires = p_entry->expires_tick;
+    if (expires < p_wheel->next_tick)
+    {
+        expires = p_wheel->next_tick;
+    }
+
+    uint64_t delta = expires - p_wheel->next_tick;
+    int      level = 0;
+    while (TIMER_WHEEL_LEVELS - 1 > level &&
+           delta >= (1ull << ((level + 1) * TIMER_WHEEL_BITS)))
+    {
+        level++;
+    }
+    if (delta >= (1ull << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS)))
+    {
+        expires = p_wheel->next_tick +
+                  (1ull << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS)) - 1;
+    }
+
+    size_t slot = (expires >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK;
+    slot_append(&(p_wheel->slots[level][slot]), p_entry);
+} /* place_entry */
+
+/**
+ * @brief Empties a wheel whose first tick is the one now_ns falls in.
+ * @param[in] p_wheel A pointer to the wheel to initialize.
+ * @param[in] tick_ns The wheel's resolution.
+ * @param[in] now_ns The current time.
+ */
+void timer_wheel_init(timer_wheel_t* p_wheel, uint64_t tick_ns, uint64_t now_ns)
+{
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+        {
+            slot_init(&(p_wheel->slots[level][slot]));
+        }
+    }
+    p_wheel->tick_ns   = tick_ns;
+    p_wheel->next_tick = now_ns / tick_ns;
+    p_wheel->count     = 0;
+} /* timer_wheel_init */
+
+/**
+ * @brief Marks an entry as not scheduled.
+ * @param[in] p_entry A pointer to the entry to initialize.
+ */
+void timer_entry_init(timer_entry_t* p_entry)
+{
+    p_entry->p_prev       = NULL;
+    p_entry->p_next       = NULL;
+    p_entry->expires_tick = 0;
+} /* timer_entry_init */
+
+/**
+ * @brief Tells whether an entry is scheduled on a wheel.
+ * @param[in] p_entry A pointer to an initialized entry.
+ * @return True if the entry is scheduled.
+ */
+bool timer_entry_pending(const timer_entry_t* p_entry)
+{
+    return NULL != p_entry->p_next;
+} /* timer_entry_pending */
+
+/**
+ * @brief Schedules an entry, or moves it if it is already scheduled. It
+ *        expires on the first tick at or after its deadline.
+ * @param[in] p_wheel A pointer to an initialized wheel.
+ * @param[in] p_entry A pointer to an initialized entry.
+ * @param[in] deadline_ns The time the entry expires.
+ */
+void timer_wheel_schedule(timer_wheel_t* p_wheel,
+                          timer_entry_t* p_entry,
+                          uint64_t       deadline_ns)
+{
+    if (timer_entry_pending(p_entry))
+    {
+        slot_remove(p_entry);
+        p_wheel->count--;
+    }
+    p_entry->expires_tick = deadline_ns / p_wheel->tick_ns +
+                            ((0 < deadline_ns % p_wheel->tick_ns) ? 1 : 0);
+    place_entry(p_wheel, p_entry);
+    p_wheel->count++;
+} /* timer_wheel_schedule */
+
+/**
+ * @brief Removes an entry from the wheel if it is scheduled.
+ * @param[in] p_wheel A pointer to the wheel the entry may be scheduled on.
+ * @param[in] p_entry A pointer to an initialized entry.
+ */
+void timer_wheel_cancel(timer_wheel_t* p_wheel, timer_entry_t* p_entry)
+{
+    if (timer_entry_pending(p_entry))
+    {
+        slot_remove(p_entry);
+        p_wheel->count--;
+    }
+} /* timer_wheel_cancel */
+
+/**
+ * @brief Turns the wheel to the current time, expiring every entry whose
+ *        tick has come. Entries are unscheduled before the callback sees
+ *        them, so it may schedule them again.
+ * @param[in] p_wheel A pointer to an initialized wheel.
+ * @param[in] now_ns The current time.
+ * @param[in] p_expired The function called for each expired entry.
+ * @param[in] p_context Passed to p_expired.
+ * @return The number of entries that expired.
+ */
+size_t timer_wheel_advance(timer_wheel_t*   p_wheel,
+                           uint64_t         now_ns,
+                           timer_expired_fn p_expired,
+                           void*            p_context)
+{
+    uint64_t now_tick = now_ns / p_wheel->tick_ns;
+    size_t   expired  = 0;
+    while (p_wheel->next_tick <= now_tick)
+    {
+        // Nothing can come due on an empty wheel, so skip straight to now.
+        //
+        if (0 == p_wheel->count)
+        {
+            p_wheel->next_tick = now_tick + 1;
+            break;
+        }
+
+        // Each time a level wraps, the next slot of the level above is
+        // spread out over the levels below.
+        //
+        uint64_t      tick  = p_wheel->next_tick;
+        size_t        slot  = tick & TIMER_WHEEL_MASK;
+        timer_entry_t list;
+        for (int level = 1; 0 == slot && level < TIMER_WHEEL_LEVELS; level++)
+        {
+            slot = (tick >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK;
+            slot_take(&(p_wheel->slots[level][slot]), &list);
+            while (list.p_next != &list)
+            {
+                timer_entry_t* p_entry = list.p_next;
+                slot_remove(p_entry);
+                place_entry(p_wheel, p_entry);
+            }
+        }
+
+        slot_take(&(p_wheel->slots[0][tick & TIMER_WHEEL_MASK]), &list);
+        p_wheel->next_tick++;
+        while (list.p_next != &list)
+        {
+            timer_entry_t* p_entry = list.p_next;
+            slot_remove(p_entry);
+            p_wheel->count--;
+            expired++;
+            p_expired(p_entry, p_context);
+        }
+    }
+    return expired;
+} /* timer_wheel_advance */
+
+/**
+ * @brief Calls a function for every scheduled entry, leaving them all
+ *        scheduled. The function must not schedule or cancel entries.
+ * @param[in] p_wheel A pointer to an initialized wheel.
+ * @param[in] p_visit The function called for each entry.
+ * @param[in] p_context Passed to p_visit.
+ */
+void timer_wheel_for_each(timer_wheel_t*   p_wheel,
+                          timer_expired_fn p_visit,
+                          void*            p_context)
+{
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+        {
+            timer_entry_t* p_slot = &(p_wheel->slots[level][slot]);
+            for (timer_entry_t* p_entry = p_slot->p_next;
+                 p_entry != p_slot;
+                 p_entry = p_entry->p_next)
+            {
+                p_visit(p_entry, p_context);
+            }
+        }
+    }
+} /* timer_wheel_for_each */
+
+/**
+ * @brief Prepares a connection's timer, starting on its idle deadline.
+ * @param[in] p_timer A pointer to the timer to initialize.
+ * @param[in] fd The connection's socket File Descriptor
+ */
+void conn_timer_init(conn_timer_t* p_timer, int fd)
+{
+    timer_entry_init(&(p_timer->entry));
+    p_timer->fd = fd;
+    atomic_init(&(p_timer->deadline), 0);
+    conn_timer_set(p_timer, TIMEOUT_IDLE, monotonic_ns());
+} /* conn_timer_init */
+
+/**
+ * @brief Starts one of a connection's timeouts from now, replacing whichever
+ *        was running. Safe to call while the reaper is checking it.
+ * @param[in] p_timer A pointer to an initialized timer.
+ * @param[in] kind TIMEOUT_IDLE, TIMEOUT_READ or TIMEOUT_WRITE.
+ * @param[in] now_ns The current time.
+ */
+void conn_timer_set(conn_timer_t* p_timer, int kind, uint64_t now_ns)
+{
+    uint64_t timeout_ns  = g_serv_timeout_ns[kind];
+    uint64_t deadline_ns = (0 == timeout_ns) ? TIMER_NEVER :
+                                               now_ns + timeout_ns;
+    atomic_store_explicit(&(p_timer->deadline),
+                          (deadline_ns & ~(uint64_t)TIMEOUT_KIND_MASK) |
+                              (uint64_t)kind,
+                          memory_order_relaxed);
+} /* conn_timer_set */
+
+/**
+ * @brief Schedules a connection's next check: its deadline, or sooner if
+ *        the deadline could move before it.
+ */
+static void schedule_check(timeout_reaper_t* p_reaper,
+                           conn_timer_t*     p_timer,
+                           uint64_t          deadline,
+                           uint64_t          now_ns)
+{
+    uint64_t due_ns = deadline & ~(uint64_t)TIMEOUT_KIND_MASK;
+    if (TIMER_NEVER != p_reaper->check_ns &&
+        due_ns > now_ns + p_reaper->check_ns)
+    {
+        due_ns = now_ns + p_reaper->check_ns;
+    }
+    timer_wheel_schedule(&(p_reaper->wheel), &(p_timer->entry), due_ns);
+} /* schedule_check */
+
+/**
+ * @brief Wheel callback for a connection whose last known deadline came due.
+ *        Connections that have moved their deadline since are scheduled
+ *        again; the rest are shut down.
+ */
+static void on_deadline(timer_entry_t* p_entry, void* p_context)
+{
+    timeout_reaper_t* p_reaper = p_context;
+    conn_timer_t*     p_timer  = (conn_timer_t*)p_entry;
+    uint64_t          deadline = atomic_load_explicit(&(p_timer->deadline),
+                                                      memory_order_relaxed);
+    uint64_t          now_ns   = monotonic_ns();
+    int               kind     = (int)(deadline & TIMEOUT_KIND_MASK);
+    if ((deadline & ~(uint64_t)TIMEOUT_KIND_MASK) > now_ns)
+    {
+        schedule_check(p_reaper, p_timer, deadline, now_ns);
+        return;
+    }
+
+    serv_metrics_add(g_timeout_metrics[kind], 1);
+    SERV_LOG(SERV_LOG_LEVEL_WARN,
+             "Disconnecting client after %s timeout.\n",
+             gp_timeout_names[kind]);
+    shutdown(p_timer->fd, SHUT_RDWR);
+} /* on_deadline */
+
+/**
+ * @brief Wheel callback that shuts down a connection still open at exit.
+ */
+static void on_stop(timer_entry_t* p_entry, void* p_context)
+{
+    (void)p_context;
+    shutdown(((conn_timer_t*)p_entry)->fd, SHUT_RDWR);
+} /* on_stop */
+
+/**
+ * @brief Reaper thread body. Sleeps until a connection is watched, then
+ *        turns the wheel once a tick until the reaper is stopped.
+ * @param[in] args A pointer to the timeout_reaper_t to run.
+ * @return NULL on thread exit
+ */
+static void* reaper_handler(void* args)
+{
+    timeout_reaper_t* p_reaper = args;
+
+    pthread_mutex_lock(&(p_reaper->lock));
+    while (false == p_reaper->b_stopping)
+    {
+        if (0 == p_reaper->wheel.count)
+        {
+            pthread_cond_wait(&(p_reaper->wake), &(p_reaper->lock));
+            continue;
+        }
+
+        uint64_t        wake_ns = monotonic_ns() + p_reaper->wheel.tick_ns;
+        struct timespec until;
+        until.tv_sec  = (time_t)(wake_ns / 1000000000ull);
+        until.tv_nsec = (long)(wake_ns % 1000000000ull);
+        pthread_cond_timedwait(&(p_reaper->wake), &(p_reaper->lock), &until);
+        timer_wheel_advance(&(p_reaper->wheel),
+                            monotonic_ns(),
+                            &on_deadline,
+                            p_reaper);
+    }
+    pthread_mutex_unlock(&(p_reaper->lock));
+    return NULL;
+} /* reaper_handler */
+
+/**
+ * @brief Creates the reaper's wheel and starts its thread.
+ * @param[in] p_reaper A pointer to a zeroed reaper.
+ * @return TIMER_INIT_SUCCESS if the reaper is running.
+ *         TIMER_INIT_FAILURE if it could not be started.
+ */
+int timeout_reaper_start(timeout_reaper_t* p_reaper)
+{
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    int err = pthread_cond_init(&(p_reaper->wake), &attributes);
+    pthread_condattr_destroy(&attributes);
+    if (0 != err)
+    {
+        fprintf(stderr,
+                "Unable to initiate timeout condition. [%s]\n",
+                strerror(err));
+        return TIMER_INIT_FAILURE;
+    }
+
+    err = pthread_mutex_init(&(p_reaper->lock), NULL);
+    if (0 != err)
+    {
+        fprintf(stderr,
+                "Unable to initiate timeout lock. [%s]\n",
+                strerror(err));
+        pthread_cond_destroy(&(p_reaper->wake));
+        return TIMER_INIT_FAILURE;
+    }
+    timer_wheel_init(&(p_reaper->wheel), TIMER_TICK_NS, monotonic_ns());
+    p_reaper->check_ns      = TIMER_NEVER;
+    for (int kind = 0; kind < TIMEOUT_KIND_COUNT; kind++)
+    {
+        if (0 < g_serv_timeout_ns[kind] &&
+            g_serv_timeout_ns[kind] < p_reaper->check_ns)
+        {
+            p_reaper->check_ns = g_serv_timeout_ns[kind];
+        }
+    }
+    p_reaper->b_stopping    = false;
+    p_reaper->b_initialized = true;
+
+    err = pthread_create(&(p_reaper->thread_id),
+                         NULL,
+                         &reaper_handler,
+                         p_reaper);
+    if (0 != err)
+    {
+        fprintf(stderr,
+                "Timeout thread unable to be created. [%s]\n",
+                strerror(err));
+        return TIMER_INIT_FAILURE;
+    }
+    p_reaper->b_started = true;
+    return TIMER_INIT_SUCCESS;
+} /* timeout_reaper_start */
+
+/**
+ * @brief Stops the reaper and shuts down every connection it still watches,
+ *        so threads blocked serving them return. Connections are still
+ *        unwatched and closed by their owners afterwards.
+ * @param[in] p_reaper A pointer to a started reaper.
+ */
+void timeout_reaper_stop(timeout_reaper_t* p_reaper)
+{
+    if (false == p_reaper->b_initialized)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&(p_reaper->lock));
+    p_reaper->b_stopping = true;
+    timer_wheel_for_each(&(p_reaper->wheel), &on_stop, NULL);
+    pthread_cond_signal(&(p_reaper->wake));
+    pthread_mutex_unlock(&(p_reaper->lock));
+
+    if (p_reaper->b_started)
+    {
+        int err = pthread_join(p_reaper->thread_id, NULL);
+        if (0 != err)
+        {
+            fprintf(stderr, "Error joining thread. [%s]\n", strerror(err));
+        }
+        p_reaper->b_started = false;
+    }
+} /* timeout_reaper_stop */
+
+/**
+ * @brief Releases a stopped reaper once no connection is watched any more.
+ * @param[in] p_reaper A pointer to a stopped reaper.
+ */
+void timeout_reaper_destroy(timeout_reaper_t* p_reaper)
+{
+    if (false == p_reaper->b_initialized)
+    {
+        return;
+    }
+    pthread_mutex_destroy(&(p_reaper->lock));
+    pthread_cond_destroy(&(p_reaper->wake));
+    p_reaper->b_initialized = false;
+} /* timeout_reaper_destroy */
+
+/**
+ * @brief Starts enforcing a connection's deadlines. Called once, before the
+ *        connection is first served.
+ * @param[in] p_reaper A pointer to a started reaper.
+ * @param[in] p_timer A pointer to the connection's initialized timer.
+ * @return True if the connection is watched.
+ *         False if the server is stopping; the connection should be closed
+ *         without being served.
+ */
+bool timeout_watch(timeout_reaper_t* p_reaper, conn_timer_t* p_timer)
+{
+    uint64_t deadline = atomic_load_explicit(&(p_timer->deadline),
+                                             memory_order_relaxed);
+
+    pthread_mutex_lock(&(p_reaper->lock));
+    bool b_watched = (false == p_reaper->b_stopping);
+    if (b_watched)
+    {
+        if (0 == p_reaper->wheel.count)
+        {
+            pthread_cond_signal(&(p_reaper->wake));
+        }
+        schedule_check(p_reaper, p_timer, deadline, monotonic_ns());
+    }
+    pthread_mutex_unlock(&(p_reaper->lock));
+    return b_watched;
+} /* timeout_watch */
+
+/**
+ * @brief Stops enforcing a connection's deadlines. Must be called before
+ *        its socket is closed, so the reaper never shuts down a reused fd.
+ * @param[in] p_reaper A pointer to the reaper watching the connection.
+ * @param[in] p_timer A pointer to the connection's timer.
+ */
+void timeout_unwatch(timeout_reaper_t* p_reaper, conn_timer_t* p_timer)
+{
+    pthread_mutex_lock(&(p_reaper->lock));
+    timer_wheel_cancel(&(p_reaper->wheel), &(p_timer->entry));
+    pthread_mutex_unlock(&(p_reaper->lock));
+} /* timeout_unwatch */
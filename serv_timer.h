@@ -0,0 +1,108 @@
+#ifndef SERV_TIMER_H
+#define SERV_TIMER_H
+
+#include <pthread.h> // pthread_mutex_t, pthread_cond_t
+#include <stdatomic.h> // atomic_uint_fast64_t
+#include <stdbool.h>
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+
+#define TIMER_INIT_SUCCESS 0
+#define TIMER_INIT_FAILURE -1
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_TICK_NS 100000000ull
+#define TIMER_NEVER UINT64_MAX
+#define TIMEOUT_IDLE 0
+#define TIMEOUT_READ 1
+#define TIMEOUT_WRITE 2
+#define TIMEOUT_KIND_COUNT 3
+#define TIMEOUT_KIND_MASK 3
+#define DEFAULT_IDLE_TIMEOUT_S 300
+#define DEFAULT_READ_TIMEOUT_S 30
+#define DEFAULT_WRITE_TIMEOUT_S 30
+
+typedef struct timer_entry_t {
+    struct timer_entry_t* p_prev;
+    struct timer_entry_t* p_next;
+    uint64_t              expires_tick;
+} timer_entry_t;
+
+/**
+ * @brief Hierarchical timing wheel. Level 0 has one slot per tick for the
+ *        next TIMER_WHEEL_SLOTS ticks; every level above covers
+ *        TIMER_WHEEL_SLOTS times the span of the one below, and its timers
+ *        cascade down a level as the wheel turns past them. Scheduling and
+ *        cancelling are O(1), and a tick costs only the timers it expires
+ *        or cascades. Not thread safe.
+ */
+typedef struct timer_wheel_t {
+    uint64_t      tick_ns;
+    uint64_t      next_tick;
+    size_t        count;
+    timer_entry_t slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} timer_wheel_t;
+
+typedef void (*timer_expired_fn)(timer_entry_t* p_entry, void* p_context);
+
+/**
+ * @brief A connection's deadline as the reaper sees it. The connection's
+ *        owner only stores a new deadline, with the kind of timeout in its
+ *        low bits; the reaper checks it when the wheel fires and reschedules
+ *        the connection if it moved, so serving a connection never takes the
+ *        reaper's lock.
+ */
+typedef struct conn_timer_t {
+    timer_entry_t        entry;
+    int                  fd;
+    atomic_uint_fast64_t deadline;
+} conn_timer_t;
+
+/**
+ * @brief Thread that disconnects clients whose deadline has passed, by
+ *        shutting their socket down so whoever serves them sees it close.
+ *        A deadline may move earlier than the one scheduled, so each
+ *        connection is checked at least every check_ns, the shortest
+ *        timeout; a deadline set since the last check is then never due
+ *        before the next one. Every watched connection is in the wheel, so
+ *        stopping the reaper also shuts down every connection still open.
+ */
+typedef struct timeout_reaper_t {
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+    pthread_t       thread_id;
+    uint64_t        check_ns;
+    bool            b_initialized;
+    bool            b_started;
+    bool            b_stopping;
+    timer_wheel_t   wheel;
+} timeout_reaper_t;
+
+void   timer_wheel_init(timer_wheel_t* p_wheel,
+                        uint64_t       tick_ns,
+                        uint64_t       now_ns);
+void   timer_entry_init(timer_entry_t* p_entry);
+bool   timer_entry_pending(const timer_entry_t* p_entry);
+void   timer_wheel_schedule(timer_wheel_t* p_wheel,
+                            timer_entry_t* p_entry,
+                            uint64_t       deadline_ns);
+void   timer_wheel_cancel(timer_wheel_t* p_wheel, timer_entry_t* p_entry);
+size_t timer_wheel_advance(timer_wheel_t*   p_wheel,
+                           uint64_t         now_ns,
+                           timer_expired_fn p_expired,
+                           void*            p_context);
+void   timer_wheel_for_each(timer_wheel_t*   p_wheel,
+                            timer_expired_fn p_visit,
+                            void*            p_context);
+
+void conn_timer_init(conn_timer_t* p_timer, int fd);
+void conn_timer_set(conn_timer_t* p_timer, int kind, uint64_t now_ns);
+int  timeout_reaper_start(timeout_reaper_t* p_reaper);
+void timeout_reaper_stop(timeout_reaper_t* p_reaper);
+void timeout_reaper_destroy(timeout_reaper_t* p_reaper);
+bool timeout_watch(timeout_reaper_t* p_reaper, conn_timer_t* p_timer);
+void timeout_unwatch(timeout_reaper_t* p_reaper, conn_timer_t* p_timer);
+
+#endif /* SERV_TIMER_H */
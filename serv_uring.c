@@ -0,0 +1,951 @@
+/** @file serv_uring.c
+ *
+ * @brief io_uring event loops for the postfix server. Each loop thread owns
+ *        a ring and a ring of provided receive buffers. Receives, sends and
+ *        the loop's wake up read are all submitted as ring entries, and every
+ *        entry queued while handling one batch of completions is submitted by
+ *        the same io_uring_enter that waits for the next batch, so one system
+ *        call services many requests. The acceptor takes connections with a
+ *        single multishot accept. The ring is driven through the raw system
+ *        calls, so no library is needed.
+ * @par
+ * COPYRIGHT NOTICE: (c) 2018 Barr Group. All rights reserved.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h> // errno, EINTR
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h> // uint16_t, uint64_t, uintptr_t
+#include <stdio.h> // stderr
+#include <stdlib.h> // aligned_alloc, calloc, free, malloc
+#include <string.h> // memcpy, memset, strerror
+#include <sys/eventfd.h> // eventfd
+#include <sys/mman.h> // mmap, munmap
+#include <sys/socket.h> // shutdown, MSG_NOSIGNAL
+#include <sys/syscall.h> // __NR_io_uring_setup
+#include <unistd.h> // close, syscall, write
+
+#include "serv_lib.h"
+#include "serv_conn.h"
+#include "serv_epoll.h"
+#include "serv_log.h"
+#include "serv_metrics.h"
+#include "serv_uring.h"
+
+#define URING_BUFFER_MASK (URING_BUFFER_COUNT - 1)
+
+// Completions carry the connection they belong to, with the kind of entry in
+// the low bits. malloc aligns well beyond the bits used.
+//
+#define URING_OP_MASK 3
+#define URING_OP_WAKE 1
+#define URING_OP_RECV 2
+#define URING_OP_SEND 3
+
+// The acceptor marks each accept with the index of its listener, TCP then
+// unix domain, and tells them from its timeouts.
+//
+#define URING_LISTENER_COUNT 2
+#define URING_ACCEPT_TIMEOUT URING_LISTENER_COUNT
+
+/**
+ * @brief The user space view of one ring's shared queues.
+ */
+typedef struct uring_t {
+    int                  ring_fd;
+    unsigned             sq_mask;
+    unsigned             sq_entries;
+    unsigned             sq_tail;
+    atomic_uint*         p_sq_head;
+    atomic_uint*         p_sq_tail;
+    unsigned*            p_sq_array;
+    struct io_uring_sqe* p_sqes;
+    unsigned             cq_mask;
+    atomic_uint*         p_cq_head;
+    atomic_uint*         p_cq_tail;
+    struct io_uring_cqe* p_cqes;
+    void*                p_sq_map;
+    size_t               sq_map_size;
+    void*                p_cq_map;
+    size_t               cq_map_size;
+    size_t               sqes_size;
+} uring_t;
+
+/**
+ * @brief A connection served by a ring. Its state may only be freed once no
+ *        entry that refers to it is still in flight.
+ */
+typedef struct uring_conn_t {
+    conn_t   conn;
+    int      in_flight;
+    bool     b_recv_armed;
+    bool     b_send_armed;
+    bool     b_socket_drained;
+    bool     b_closing;
+    uint64_t send_start_ns;
+} uring_conn_t;
+
+typedef struct uring_loop_t {
+    pthread_t                 thread_id;
+    int                       wake_fd;
+    uint64_t                  wake_value;
+    uring_t                   ring;
+    struct io_uring_buf_ring* p_buf_ring;
+    char*                     p_buffers;
+    uint16_t                  buf_tail;
+    conn_t*                   p_connections;
+    serv_t*                   p_serv;
+} uring_loop_t;
+
+/**
+ * @brief Creates a ring and maps its queues.
+ * @param[out] p_ring A pointer to the ring to set up.
+ * @param[in] entries The number of submission queue entries.
+ * @return True if the ring is ready. False if io_uring is unavailable.
+ */
+static bool uring_setup(uring_t* p_ring, unsigned entries)
+{
+    memset(p_ring, 0, sizeof(uring_t));
+    p_ring->p_sq_map = MAP_FAILED;
+    p_ring->p_cq_map = MAP_FAILED;
+    p_ring->p_sqes   = MAP_FAILED;
+
+    // Completions are only ever reaped by the thread that submits, so the
+    // kernel need not interrupt it to run completion work.
+    //
+    struct io_uring_params params = { 0 };
+    params.flags    = IORING_SETUP_COOP_TASKRUN;
+    p_ring->ring_fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (0 > p_ring->ring_fd && EINVAL == errno)
+    {
+        memset(&params, 0, sizeof(params));
+        p_ring->ring_fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    }
+    if (0 > p_ring->ring_fd)
+    {
+        return false;
+    }
+
+    p_ring->sq_map_size = params.sq_off.array +
+                          (params.sq_entries * sizeof(unsigned));
+    p_ring->cq_map_size = params.cq_off.cqes +
+                          (params.cq_entries * sizeof(struct io_uring_cqe));
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (p_ring->cq_map_size > p_ring->sq_map_size)
+        {
+            p_ring->sq_map_size = p_ring->cq_map_size;
+        }
+        p_ring->cq_map_size = 0;
+    }
+
+    p_ring->p_sq_map = mmap(NULL, p_ring->sq_map_size,
+                            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            p_ring->ring_fd, IORING_OFF_SQ_RING);
+    if (MAP_FAILED == p_ring->p_sq_map)
+    {
+        return false;
+    }
+    p_ring->p_cq_map = p_ring->p_sq_map;
+    if (0 < p_ring->cq_map_size)
+    {
+        p_ring->p_cq_map = mmap(NULL, p_ring->cq_map_size,
+                                PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE,
+                                p_ring->ring_fd, IORING_OFF_CQ_RING);
+        if (MAP_FAILED == p_ring->p_cq_map)
+        {
+            return false;
+        }
+    }
+    p_ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    p_ring->p_sqes    = mmap(NULL, p_ring->sqes_size,
+                             PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             p_ring->ring_fd, IORING_OFF_SQES);
+    if (MAP_FAILED == p_ring->p_sqes)
+    {
+        return false;
+    }
+
+    char* p_sq = p_ring->p_sq_map;
+    char* p_cq = p_ring->p_cq_map;
+    p_ring->sq_entries = params.sq_entries;
+    p_ring->sq_mask    = *(unsigned*)(p_sq + params.sq_off.ring_mask);
+    p_ring->p_sq_head  = (atomic_uint*)(p_sq + params.sq_off.head);
+    p_ring->p_sq_tail  = (atomic_uint*)(p_sq + params.sq_off.tail);
+    p_ring->p_sq_array = (unsigned*)(p_sq + params.sq_off.array);
+    p_ring->sq_tail    = atomic_load_explicit(p_ring->p_sq_tail,
+                                              memory_order_relaxed);
+    p_ring->cq_mask    = *(unsigned*)(p_cq + params.cq_off.ring_mask);
+    p_ring->p_cq_head  = (atomic_uint*)(p_cq + params.cq_off.head);
+    p_ring->p_cq_tail  = (atomic_uint*)(p_cq + params.cq_off.tail);
+    p_ring->p_cqes     = (struct io_uring_cqe*)(p_cq + params.cq_off.cqes);
+    return true;
+} /* uring_setup */
+
+/**
+ * @brief Unmaps and closes a ring. Safe to call on a partly set up ring.
+ */
+static void uring_teardown(uring_t* p_ring)
+{
+    if (MAP_FAILED != p_ring->p_sqes)
+    {
+        munmap(p_ring->p_sqes, p_ring->sqes_size);
+    }
+    if (0 < p_ring->cq_map_size && MAP_FAILED != p_ring->p_cq_map)
+    {
+        munmap(p_ring->p_cq_map, p_ring->cq_map_size);
+    }
+    if (MAP_FAILED != p_ring->p_sq_map)
+    {
+        munmap(p_ring->p_sq_map, p_ring->sq_map_size);
+    }
+    if (0 <= p_ring->ring_fd)
+    {
+        close(p_ring->ring_fd);
+    }
+    p_ring->ring_fd = -1;
+} /* uring_teardown */
+
+/**
+ * @brief Hands every queued entry to the kernel and optionally waits for
+ *        completions.
+ * @param[in] p_ring A pointer to the ring.
+ * @param[in] wait_count The number of completions to wait for.
+ * @return The result of io_uring_enter; negative with errno set on failure.
+ */
+static int uring_enter(uring_t* p_ring, unsigned wait_count)
+{
+    atomic_store_explicit(p_ring->p_sq_tail,
+                          p_ring->sq_tail,
+                          memory_order_release);
+    unsigned pending = p_ring->sq_tail -
+                       atomic_load_explicit(p_ring->p_sq_head,
+                                            memory_order_acquire);
+    return (int)syscall(__NR_io_uring_enter,
+                        p_ring->ring_fd,
+                        pending,
+                        wait_count,
+                        (0 < wait_count) ? IORING_ENTER_GETEVENTS : 0,
+                        NULL,
+                        0);
+} /* uring_enter */
+
+/**
+ * @brief Claims the next free submission queue entry, submitting what is
+ *        queued first if the queue is full.
+ * @return A pointer to a cleared entry.
+ */
+static struct io_uring_sqe* uring_get_sqe(uring_t* p_ring)
+{
+    while (p_ring->sq_tail -
+           atomic_load_explicit(p_ring->p_sq_head, memory_order_acquire) >=
+           p_ring->sq_entries)
+    {
+        if (0 > uring_enter(p_ring, 0) && EINTR != errno && EBUSY != errno)
+        {
+            SERV_LOG(SERV_LOG_LEVEL_ERROR,
+                     "Error submitting to ring. [%s]\n",
+                     strerror(errno));
+        }
+    }
+
+    unsigned             index  = p_ring->sq_tail & p_ring->sq_mask;
+    struct io_uring_sqe* p_sqe  = &(p_ring->p_sqes[index]);
+    p_ring->p_sq_array[index]   = index;
+    p_ring->sq_tail++;
+    memset(p_sqe, 0, sizeof(struct io_uring_sqe));
+    return p_sqe;
+} /* uring_get_sqe */
+
+/**
+ * @brief Queues a provided buffer back onto a loop's buffer ring. The
+ *        kernel sees it once the tail is published.
+ */
+static void recycle_buffer(uring_loop_t* p_loop, uint16_t buffer_id)
+{
+    struct io_uring_buf* p_buf =
+        &(p_loop->p_buf_ring->bufs[p_loop->buf_tail & URING_BUFFER_MASK]);
+    p_buf->addr = (uintptr_t)(p_loop->p_buffers +
+                              ((size_t)buffer_id * URING_BUFFER_SIZE));
+    p_buf->len  = URING_BUFFER_SIZE;
+    p_buf->bid  = buffer_id;
+    p_loop->buf_tail++;
+} /* recycle_buffer */
+
+/**
+ * @brief Makes recycled buffers visible to the kernel.
+ */
+static void publish_buffers(uring_loop_t* p_loop)
+{
+    atomic_store_explicit((_Atomic uint16_t*)&(p_loop->p_buf_ring->tail),
+                          p_loop->buf_tail,
+                          memory_order_release);
+} /* publish_buffers */
+
+/**
+ * @brief Queues a read of the loop's wake up event.
+ */
+static void arm_wake(uring_loop_t* p_loop)
+{
+    struct io_uring_sqe* p_sqe = uring_get_sqe(&(p_loop->ring));
+    p_sqe->opcode    = IORING_OP_READ;
+    p_sqe->fd        = p_loop->wake_fd;
+    p_sqe->addr      = (uintptr_t)&(p_loop->wake_value);
+    p_sqe->len       = sizeof(p_loop->wake_value);
+    p_sqe->user_data = URING_OP_WAKE;
+} /* arm_wake */
+
+/**
+ * @brief Closes a client connection, releases its state and frees up a
+ *        connection slot. Only called once nothing is in flight for it.
+ * @param[in] p_loop A pointer to the loop that owns the connection.
+ * @param[in] p_task A pointer to the connection to close.
+ */
+static void close_connection(uring_loop_t* p_loop, uring_conn_t* p_task)
+{
+    conn_t* p_conn = &(p_task->conn);
+    if (NULL != p_conn->p_prev)
+    {
+        p_conn->p_prev->p_next = p_conn->p_next;
+    }
+    else
+    {
+        p_loop->p_connections = p_conn->p_next;
+    }
+    if (NULL != p_conn->p_next)
+    {
+        p_conn->p_next->p_prev = p_conn->p_prev;
+    }
+
+    timeout_unwatch(&(p_loop->p_serv->reaper), &(p_conn->timer));
+    conn_release(p_conn);
+    close(p_conn->fd);
+    free(p_task);
+    release_connection_slot(p_loop->p_serv);
+} /* close_connection */
+
+/**
+ * @brief Starts closing a connection. Shutting the socket down completes
+ *        whatever is still in flight for it, and the last completion closes
+ *        it.
+ */
+static void begin_close(uring_conn_t* p_task)
+{
+    if (false == p_task->b_closing)
+    {
+        p_task->b_closing = true;
+        shutdown(p_task->conn.fd, SHUT_RDWR);
+    }
+} /* begin_close */
+
+/**
+ * @brief Queues whatever a connection is waiting on next: a send of its
+ *        pending responses and, while it has room for them, a receive of
+ *        more requests.
+ * @param[in] p_loop A pointer to the loop that owns the connection.
+ * @param[in] p_task A pointer to the connection.
+ */
+static void update_connection(uring_loop_t* p_loop, uring_conn_t* p_task)
+{
+    conn_t* p_conn = &(p_task->conn);
+    if (p_task->b_closing)
+    {
+        if (0 == p_task->in_flight)
+        {
+            close_connection(p_loop, p_task);
+        }
+        return;
+    }
+
+    // Requests left over when the output buffer filled up are resumed once
+    // every response before them has been sent.
+    //
+    if (p_conn->b_input_pending && 0 == p_conn->out_length)
+    {
+        conn_process_input(p_conn);
+        if (false == p_conn->b_input_pending && p_task->b_socket_drained)
+        {
+            conn_end_of_burst(p_conn);
+        }
+    }
+
+    if (p_conn->out_offset < p_conn->out_length && !p_task->b_send_armed)
+    {
+        struct io_uring_sqe* p_sqe = uring_get_sqe(&(p_loop->ring));
+        p_sqe->opcode    = IORING_OP_SEND;
+        p_sqe->fd        = p_conn->fd;
+        p_sqe->addr      = (uintptr_t)(p_conn->out_buffer + p_conn->out_offset);
+        p_sqe->len       = p_conn->out_length - p_conn->out_offset;
+        p_sqe->msg_flags = MSG_NOSIGNAL;
+        p_sqe->user_data = (uintptr_t)p_task | URING_OP_SEND;
+        p_task->b_send_armed  = true;
+        p_task->send_start_ns = monotonic_ns();
+        p_task->in_flight++;
+    }
+
+    size_t room = CONN_IN_BUFFER_SIZE - p_conn->in_length;
+    if (!p_task->b_recv_armed && !p_conn->b_input_pending && 0 < room)
+    {
+        struct io_uring_sqe* p_sqe = uring_get_sqe(&(p_loop->ring));
+        p_sqe->opcode    = IORING_OP_RECV;
+        p_sqe->flags     = IOSQE_BUFFER_SELECT;
+        p_sqe->fd        = p_conn->fd;
+        p_sqe->len       = (URING_BUFFER_SIZE < room) ? URING_BUFFER_SIZE :
+                                                         room;
+        p_sqe->buf_group = URING_BUFFER_GROUP;
+        p_sqe->user_data = (uintptr_t)p_task | URING_OP_RECV;
+        p_task->b_recv_armed = true;
+        p_task->in_flight++;
+    }
+    conn_arm_deadline(p_conn);
+} /* update_connection */
+
+/**
+ * @brief Takes in one completed receive and dispatches the requests it
+ *        completes.
+ */
+static void on_recv(uring_loop_t*         p_loop,
+                    uring_conn_t*         p_task,
+                    struct io_uring_cqe*  p_cqe)
+{
+    conn_t* p_conn = &(p_task->conn);
+    p_task->b_recv_armed = false;
+    p_task->in_flight--;
+
+    if (p_cqe->flags & IORING_CQE_F_BUFFER)
+    {
+        uint16_t    buffer_id = p_cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        const char* p_data    = p_loop->p_buffers +
+                                ((size_t)buffer_id * URING_BUFFER_SIZE);
+        if (0 < p_cqe->res && false == p_task->b_closing)
+        {
+            memcpy(p_conn->in_buffer + p_conn->in_length,
+                   p_data,
+                   p_cqe->res);
+        }
+        recycle_buffer(p_loop, buffer_id);
+    }
+    if (p_task->b_closing)
+    {
+        return;
+    }
+
+    if (0 == p_cqe->res)
+    {
+        SERV_LOG(SERV_LOG_LEVEL_INFO, "Client has disconnected.\n");
+        begin_close(p_task);
+        return;
+    }
+    if (0 > p_cqe->res)
+    {
+        // Out of provided buffers; the receive is simply queued again.
+        //
+        if (-ENOBUFS == p_cqe->res || -EINTR == p_cqe->res ||
+            -EAGAIN == p_cqe->res)
+        {
+            return;
+        }
+        serv_metrics_add(SERV_METRIC_ERRORS, 1);
+        SERV_LOG(SERV_LOG_LEVEL_ERROR,
+                 "Error reading from socket. [%s]\n",
+                 strerror(-(p_cqe->res)));
+        begin_close(p_task);
+        return;
+    }
+
+    serv_metrics_add(SERV_METRIC_BYTES_RECEIVED, p_cqe->res);
+    p_conn->in_length        += p_cqe->res;
+    p_task->b_socket_drained  = !(p_cqe->flags & IORING_CQE_F_SOCK_NONEMPTY);
+    conn_process_input(p_conn);
+    if (p_task->b_socket_drained)
+    {
+        conn_end_of_burst(p_conn);
+    }
+} /* on_recv */
+
+/**
+ * @brief Accounts for one completed send.
+ */
+static void on_send(uring_conn_t* p_task, struct io_uring_cqe* p_cqe)
+{
+    conn_t* p_conn = &(p_task->conn);
+    p_task->b_send_armed = false;
+    p_task->in_flight--;
+    if (p_task->b_closing)
+    {
+        return;
+    }
+
+    serv_metrics_record(SERV_TIMER_SEND,
+                        monotonic_ns() - p_task->send_start_ns);
+    if (0 > p_cqe->res)
+    {
+        if (-EINTR == p_cqe->res || -EAGAIN == p_cqe->res)
+        {
+            return;
+        }
+        serv_metrics_add(SERV_METRIC_ERRORS, 1);
+        SERV_LOG(SERV_LOG_LEVEL_ERROR,
+                 "Error sending message to client. [%s]\n",
+                 strerror(-(p_cqe->res)));
+        begin_close(p_task);
+        return;
+    }
+
+    serv_metrics_add(SERV_METRIC_BYTES_SENT, p_cqe->res);
+    p_conn->out_offset += p_cqe->res;
+    if (p_conn->out_offset == p_conn->out_length)
+    {
+        p_conn->out_offset = 0;
+        p_conn->out_length = 0;
+    }
+} /* on_send */
+
+/**
+ * @brief Takes ownership of a batch of queued connections and queues their
+ *        first receive.
+ * @param[in] p_loop A pointer to the loop receiving the connections.
+ * @param[in] p_client_fds A pointer to the dequeued client fds.
+ * @param[in] count The number of client fds.
+ */
+static void register_connections(uring_loop_t* p_loop,
+                                 int*          p_client_fds,
+                                 size_t        count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        uring_conn_t* p_task = malloc(sizeof(uring_conn_t));
+        if (NULL == p_task)
+        {
+            SERV_LOG(SERV_LOG_LEVEL_ERROR,
+                     "Error allocating connection state. [%s]\n",
+                     strerror(errno));
+            close(p_client_fds[i]);
+            release_connection_slot(p_loop->p_serv);
+            continue;
+        }
+        conn_t* p_conn = &(p_task->conn);
+        send_handshake(p_loop->p_serv, p_client_fds[i]);
+        conn_init(p_conn, p_client_fds[i]);
+        p_task->in_flight        = 0;
+        p_task->b_recv_armed     = false;
+        p_task->b_send_armed     = false;
+        p_task->b_socket_drained = false;
+        p_task->b_closing        = false;
+
+        p_conn->p_next = p_loop->p_connections;
+        if (NULL != p_loop->p_connections)
+        {
+            p_loop->p_connections->p_prev = p_conn;
+        }
+        p_loop->p_connections = p_conn;
+        if (false == timeout_watch(&(p_loop->p_serv->reaper),
+                                   &(p_conn->timer)))
+        {
+            close_connection(p_loop, p_task);
+            continue;
+        }
+        update_connection(p_loop, p_task);
+    }
+} /* register_connections */
+
+/**
+ * @brief Takes every queued connection in batches.
+ */
+static void drain_connection_queue(uring_loop_t* p_loop)
+{
+    int    client_fds[HANDOFF_BATCH_SIZE];
+    size_t count;
+    do
+    {
+        count = fd_queue_dequeue_batch(&(p_loop->p_serv->connection_queue),
+                                       client_fds,
+                                       HANDOFF_BATCH_SIZE);
+        register_connections(p_loop, client_fds, count);
+    } while (HANDOFF_BATCH_SIZE == count);
+} /* drain_connection_queue */
+
+/**
+ * @brief Handles every completion the kernel has posted.
+ * @return False once the loop has been woken to stop.
+ */
+static bool reap_completions(uring_loop_t* p_loop)
+{
+    uring_t* p_ring    = &(p_loop->ring);
+    bool     b_running = true;
+    unsigned head      = atomic_load_explicit(p_ring->p_cq_head,
+                                              memory_order_relaxed);
+    unsigned tail      = atomic_load_explicit(p_ring->p_cq_tail,
+                                              memory_order_acquire);
+    for (; head != tail; head++)
+    {
+        struct io_uring_cqe* p_cqe = &(p_ring->p_cqes[head & p_ring->cq_mask]);
+        uintptr_t            op    = p_cqe->user_data & URING_OP_MASK;
+        uring_conn_t*        p_task =
+            (uring_conn_t*)(uintptr_t)(p_cqe->user_data &
+                                       ~(uint64_t)URING_OP_MASK);
+
+        if (URING_OP_WAKE == op)
+        {
+            if (p_loop->p_serv->b_running)
+            {
+                drain_connection_queue(p_loop);
+                arm_wake(p_loop);
+            }
+            else
+            {
+                b_running = false;
+            }
+            continue;
+        }
+
+        if (URING_OP_RECV == op)
+        {
+            on_recv(p_loop, p_task, p_cqe);
+        }
+        else
+        {
+            on_send(p_task, p_cqe);
+        }
+        update_connection(p_loop, p_task);
+    }
+    atomic_store_explicit(p_ring->p_cq_head, head, memory_order_release);
+    publish_buffers(p_loop);
+    return b_running;
+} /* reap_completions */
+
+/**
+ * @brief Loop thread body. Submits queued entries and waits for their
+ *        completions in one system call until the server stops running,
+ *        then drains every connection.
+ * @param[in] args A pointer to the uring_loop_t to run.
+ * @return NULL on thread exit
+ */
+static void* uring_loop_handler(void* args)
+{
+    uring_loop_t* p_loop    = (uring_loop_t*)args;
+    bool          b_running = true;
+
+    while (b_running)
+    {
+        if (0 > uring_enter(&(p_loop->ring), 1) &&
+            EINTR != errno && EBUSY != errno)
+        {
+            fprintf(stderr, "Error waiting on ring. [%s]\n", strerror(errno));
+            break;
+        }
+        b_running = reap_completions(p_loop);
+    }
+
+    // Connections are freed by their last completion.
+    //
+    for (conn_t* p_conn = p_loop->p_connections; NULL != p_conn;)
+    {
+        uring_conn_t* p_task = (uring_conn_t*)p_conn;
+        p_conn = p_conn->p_next;
+        begin_close(p_task);
+        update_connection(p_loop, p_task);
+    }
+    while (NULL != p_loop->p_connections)
+    {
+        if (0 > uring_enter(&(p_loop->ring), 1) &&
+            EINTR != errno && EBUSY != errno)
+        {
+            fprintf(stderr, "Error waiting on ring. [%s]\n", strerror(errno));
+            break;
+        }
+        reap_completions(p_loop);
+    }
+    return NULL;
+} /* uring_loop_handler */
+
+/**
+ * @brief Creates a loop's ring, wake up event and provided buffers.
+ * @return SERV_INIT_SUCCESS if the loop is ready to start.
+ *         SERV_INIT_FAILURE if any part could not be created.
+ */
+static int init_uring_loop(uring_loop_t* p_loop)
+{
+    if (false == uring_setup(&(p_loop->ring), URING_ENTRIES))
+    {
+        fprintf(stderr, "Unable to create io_uring. [%s]\n", strerror(errno));
+        return SERV_INIT_FAILURE;
+    }
+
+    p_loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (0 > p_loop->wake_fd)
+    {
+        fprintf(stderr,
+                "Unable to create wake up event. [%s]\n",
+                strerror(errno));
+        return SERV_INIT_FAILURE;
+    }
+
+    long   page_size = sysconf(_SC_PAGESIZE);
+    size_t ring_size = URING_BUFFER_COUNT * sizeof(struct io_uring_buf);
+    ring_size = (ring_size + page_size - 1) & ~(size_t)(page_size - 1);
+    p_loop->p_buf_ring = aligned_alloc(page_size, ring_size);
+    p_loop->p_buffers  = malloc((size_t)URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+    if (NULL == p_loop->p_buf_ring || NULL == p_loop->p_buffers)
+    {
+        fprintf(stderr,
+                "Unable to allocate receive buffers. [%s]\n",
+                strerror(errno));
+        return SERV_INIT_FAILURE;
+    }
+    memset(p_loop->p_buf_ring, 0, ring_size);
+
+    struct io_uring_buf_reg registration = { 0 };
+    registration.ring_addr    = (uintptr_t)p_loop->p_buf_ring;
+    registration.ring_entries = URING_BUFFER_COUNT;
+    registration.bgid         = URING_BUFFER_GROUP;
+    if (0 > syscall(__NR_io_uring_register,
+                    p_loop->ring.ring_fd,
+                    IORING_REGISTER_PBUF_RING,
+                    &registration,
+                    1))
+    {
+        fprintf(stderr,
+                "Unable to register receive buffers. [%s]\n",
+                strerror(errno));
+        return SERV_INIT_FAILURE;
+    }
+    for (int i = 0; i < URING_BUFFER_COUNT; i++)
+    {
+        recycle_buffer(p_loop, (uint16_t)i);
+    }
+    publish_buffers(p_loop);
+    arm_wake(p_loop);
+    return SERV_INIT_SUCCESS;
+} /* init_uring_loop */
+
+/**
+ * @brief Wakes one of the loops, picked round robin, to take newly queued
+ *        connections.
+ * @param[in] p_serv A pointer to a running serv_t struct.
+ */
+void uring_wake_loop(serv_t* p_serv)
+{
+    // Connections are released, and waiting ones admitted, on every loop
+    // thread, so the cursor is shared between them.
+    //
+    unsigned      next   = atomic_fetch_add(&(p_serv->next_loop), 1);
+    uring_loop_t* p_loop = &(p_serv->p_rings[next %
+                                             (unsigned)p_serv->thread_count]);
+
+    uint64_t wake = 1;
+    if (sizeof(wake) != write(p_loop->wake_fd, &wake, sizeof(wake)))
+    {
+        fprintf(stderr, "Error waking loop thread. [%s]\n", strerror(errno));
+    }
+} /* uring_wake_loop */
+
+/**
+ * @brief Stops and joins every loop thread, closing their connections.
+ * @param[in] p_serv A pointer to a serv_t struct with b_running cleared.
+ */
+void shutdown_uring_loops(serv_t* p_serv)
+{
+    if (NULL == p_serv->p_rings)
+    {
+        return;
+    }
+
+    uint64_t wake = 1;
+    for (int i = 0; i < p_serv->thread_count; i++)
+    {
+        uring_loop_t* p_loop = &(p_serv->p_rings[i]);
+        if (0 != p_loop->thread_id)
+        {
+            if (sizeof(wake) != write(p_loop->wake_fd, &wake, sizeof(wake)))
+            {
+                fprintf(stderr,
+                        "Error waking loop thread. [%s]\n",
+                        strerror(errno));
+            }
+            int err = pthread_join(p_loop->thread_id, NULL);
+            if (0 != err)
+            {
+                fprintf(stderr, "Error joining thread. [%s]\n", strerror(err));
+            }
+        }
+
+        // The ring goes first, so the kernel is done with the buffers
+        // before they are freed.
+        //
+        uring_teardown(&(p_loop->ring));
+        if (0 <= p_loop->wake_fd)
+        {
+            close(p_loop->wake_fd);
+        }
+        free(p_loop->p_buf_ring);
+        free(p_loop->p_buffers);
+    }
+    free(p_serv->p_rings);
+    p_serv->p_rings = NULL;
+} /* shutdown_uring_loops */
+
+/**
+ * @brief Creates the rings, wake up events and threads for every loop.
+ * @param[in] p_serv A pointer to a serv_t struct with thread_count set.
+ * @return SERV_INIT_SUCCESS if every loop started.
+ *         SERV_INIT_FAILURE if a loop could not be started.
+ */
+int init_uring_loops(serv_t* p_serv)
+{
+    atomic_init(&(p_serv->next_loop), 0);
+    p_serv->p_rings   = calloc(p_serv->thread_count, sizeof(uring_loop_t));
+    if (NULL == p_serv->p_rings)
+    {
+        fprintf(stderr,
+                "Unable to allocate event loops. [%s]\n",
+                strerror(errno));
+        return SERV_INIT_FAILURE;
+    }
+    for (int i = 0; i < p_serv->thread_count; i++)
+    {
+        p_serv->p_rings[i].ring.ring_fd  = -1;
+        p_serv->p_rings[i].ring.p_sq_map = MAP_FAILED;
+        p_serv->p_rings[i].ring.p_cq_map = MAP_FAILED;
+        p_serv->p_rings[i].ring.p_sqes   = MAP_FAILED;
+        p_serv->p_rings[i].wake_fd       = -1;
+    }
+
+    for (int i = 0; i < p_serv->thread_count; i++)
+    {
+        uring_loop_t* p_loop = &(p_serv->p_rings[i]);
+        p_loop->p_serv       = p_serv;
+        if (SERV_INIT_SUCCESS != init_uring_loop(p_loop))
+        {
+            return SERV_INIT_FAILURE;
+        }
+
+        int err = pthread_create(&(p_loop->thread_id),
+                                 NULL,
+                                 &uring_loop_handler,
+                                 p_loop);
+        if (0 != err)
+        {
+            fprintf(stderr,
+                    "Thread unable to be created. [%s]\n",
+                    strerror(err));
+            p_loop->thread_id = 0;
+            return SERV_INIT_FAILURE;
+        }
+        pin_thread(p_loop->thread_id, p_serv->cpu);
+    }
+    return SERV_INIT_SUCCESS;
+} /* init_uring_loops */
+
+/**
+ * @brief Accepts clients with one multishot accept per listener until a
+ *        listener is shut down or the server stops running, admitting each
+ *        and shedding waiting clients as accept_connections does.
+ * @param[in] p_serv A pointer to a running serv_t struct.
+ * @return True once accepting has finished.
+ *         False if no ring could be created; nothing was accepted.
+ */
+bool uring_accept_connections(serv_t* p_serv)
+{
+    uring_t ring;
+    if (false == uring_setup(&ring, URING_ACCEPT_ENTRIES))
+    {
+        fprintf(stderr,
+                "Unable to create accept ring, falling back to accept. [%s]\n",
+                strerror(errno));
+        uring_teardown(&ring);
+        return false;
+    }
+
+    struct __kernel_timespec timeout;
+    int  listener_fds[URING_LISTENER_COUNT] = { p_serv->serv_listener_fd,
+                                                p_serv->unix_listener_fd };
+    bool b_armed[URING_LISTENER_COUNT]      = { false, false };
+    bool b_timing                           = false;
+    bool b_listening                        = true;
+    while (p_serv->b_running && b_listening)
+    {
+        for (int i = 0; i < URING_LISTENER_COUNT; i++)
+        {
+            if (0 > listener_fds[i] || b_armed[i])
+            {
+                continue;
+            }
+            struct io_uring_sqe* p_sqe = uring_get_sqe(&ring);
+            p_sqe->opcode       = IORING_OP_ACCEPT;
+            p_sqe->ioprio       = IORING_ACCEPT_MULTISHOT;
+            p_sqe->fd           = listener_fds[i];
+            p_sqe->accept_flags = SOCK_CLOEXEC;
+            p_sqe->user_data    = i;
+            b_armed[i]          = true;
+        }
+
+        // While clients wait for a slot, wake up at least once per target
+        // delay to shed them even if nobody else arrives.
+        //
+        bool b_waiters = (0 < atomic_load(&(p_serv->admission.count)));
+        if (b_waiters && false == b_timing)
+        {
+            int poll_ms = admission_poll_ms(p_serv);
+            timeout.tv_sec  = poll_ms / 1000;
+            timeout.tv_nsec = (long long)(poll_ms % 1000) * 1000000;
+            struct io_uring_sqe* p_sqe = uring_get_sqe(&ring);
+            p_sqe->opcode    = IORING_OP_TIMEOUT;
+            p_sqe->addr      = (uintptr_t)&timeout;
+            p_sqe->len       = 1;
+            p_sqe->user_data = URING_ACCEPT_TIMEOUT;
+            b_timing         = true;
+        }
+        if (0 > uring_enter(&ring, 1) && EINTR != errno && EBUSY != errno)
+        {
+            SERV_LOG(SERV_LOG_LEVEL_ERROR,
+                     "Error waiting on accept ring. [%s]\n",
+                     strerror(errno));
+            break;
+        }
+
+        unsigned head = atomic_load_explicit(ring.p_cq_head,
+                                             memory_order_relaxed);
+        unsigned tail = atomic_load_explicit(ring.p_cq_tail,
+                                             memory_order_acquire);
+        for (; head != tail; head++)
+        {
+            struct io_uring_cqe* p_cqe = &(ring.p_cqes[head & ring.cq_mask]);
+            if (URING_ACCEPT_TIMEOUT == p_cqe->user_data)
+            {
+                b_timing = false;
+                continue;
+            }
+            if (!(p_cqe->flags & IORING_CQE_F_MORE))
+            {
+                b_armed[p_cqe->user_data] = false;
+            }
+            if (0 <= p_cqe->res)
+            {
+                admit_connection(p_serv, p_cqe->res);
+            }
+            else if (-EINVAL == p_cqe->res || -EBADF == p_cqe->res)
+            {
+                b_listening = false;
+            }
+            else if (-ECANCELED != p_cqe->res)
+            {
+                SERV_LOG(SERV_LOG_LEVEL_ERROR,
+                         "Error accepting connection. [%s]\n",
+                         strerror(-(p_cqe->res)));
+            }
+        }
+        atomic_store_explicit(ring.p_cq_head, head, memory_order_release);
+        if (b_waiters)
+        {
+            shed_waiting_connections(p_serv);
+        }
+    }
+
+    uring_teardown(&ring);
+    return true;
+} /* uring_accept_connections */
@@ -0,0 +1,12 @@
+#include <stdbool.h>
+
+#define URING_ENTRIES 256
+#define URING_ACCEPT_ENTRIES 64
+#define URING_BUFFER_COUNT 256
+#define URING_BUFFER_SIZE 4096
+#define URING_BUFFER_GROUP 0
+
+int  init_uring_loops(serv_t* p_serv);
+void uring_wake_loop(serv_t* p_serv);
+void shutdown_uring_loops(serv_t* p_serv);
+bool uring_accept_connections(serv_t* p_serv);
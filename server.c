@@ -3,6 +3,49 @@
  * @brief This program is a postfix notation solving server. It binds on the
  *        given port.
  *        The first argument provided should be the port number.
+ *        -p [PORT]
+ *        -n [THREADS] (optional, default 2)
+ *        -m [thread|epoll|pool|uring] (optional, default thread)
+ *          thread serves one client per thread, so -n caps the clients.
+ *          epoll multiplexes clients over -n event loop threads.
+ *          pool shares every client between a work-stealing pool of at
+ *          least -n workers that grows under load.
+ *          uring multiplexes clients over -n io_uring loop threads.
+ *        -c [MAX CONNECTIONS] (optional, epoll, pool and uring modes only)
+ *        -w [MAX WORKERS] (optional, pool mode only, default 4 x -n)
+ *        -q [DEPTH] (optional) Accepted connection queue depth.
+ *        -l [off|error|warn|info|request] (optional, default info)
+ *          request also logs every equation and answer.
+ *        -a [PORT] (optional) Serve counters as plain text on this port on
+ *          the loopback interface.
+ *        -s [SHARDS] (optional) Run this many shared-nothing shards, each
+ *          with its own SO_REUSEPORT listener, acceptor and -n workers
+ *          pinned to one CPU. 0 starts one shard per online CPU. -c and -q
+ *          apply to each shard.
+ *        -b [BACKLOG] (optional, default 128) Listen backlog.
+ *        -r [verbose|number|binary] (optional, default verbose) How
+ *          equations are answered. verbose is a sentence, number is just the
+ *          answer (newline terminated for text clients), and binary is the
+ *          status and IEEE double bytecode answers use. Answers are printed
+ *          with the fewest digits that parse back to the exact value.
+ *        -o [DEPTH] (optional, default 128) Clients arriving at the
+ *          connection limit wait in a queue this deep for a slot instead of
+ *          being turned away. 0 turns them away at once.
+ *        -t [MS] (optional, default 5) Waiting clients are shed, CoDel
+ *          style, once the time they wait stays above this target for 20
+ *          targets in a row.
+ *        -x [BYTES] (optional, default 1 MiB) Memory each connection may use
+ *          for the pending operands of an equation longer than 100
+ *          characters. Such equations are evaluated as they arrive, so
+ *          their length is otherwise unbounded. Text clients must end them
+ *          with a newline.
+ *        -k [IDLE,READ,WRITE] (optional, default 300,30,30) Seconds a
+ *          client may wait between requests, take to send the rest of a
+ *          request, and leave its responses unread before it is
+ *          disconnected. 0 disables a timeout.
+ *        -u [PATH] (optional) Also listen on a unix domain socket at this
+ *          path. In thread mode, clients connected there may move their
+ *          framed traffic onto shared memory rings.
  * @par
  * COPYRIGHT NOTICE: (c) 2018 Barr Group. All rights reserved.
  */
@@ -17,25 +60,60 @@
 #include <stdio.h> // stderr
 #include <stdlib.h> // EXIT_FAILURE
 #include <string.h> // strerror
+#include <sys/socket.h> // shutdown, SHUT_RDWR
 #include <unistd.h> // close
 
+#include "postfix_proto.h"
+#include "serv_eval.h"
 #include "serv_lib.h"
+#include "serv_log.h"
+#include "serv_metrics.h"
+#include "serv_pool.h"
+#include "serv_shard.h"
+
+#define USAGE_STRING "Usage: %s -p [0-65535](Port number) -n [2+](Thread count)" \
+                     " -m [thread|epoll|pool|uring](Mode) -c [1+](Max connections)" \
+                     " -w [1+](Max pool workers)" \
+                     " -q [2+](Connection queue depth)" \
+                     " -l [off|error|warn|info|request](Log level)" \
+                     " -a [0-65535](Admin port)" \
+                     " -s [0+](Shards) -b [1+](Listen backlog)" \
+                     " -r [verbose|number|binary](Response format)" \
+                     " -o [0+](Admission queue depth)" \
+                     " -t [1+](Admission target ms)" \
+                     " -x [512+](Streamed equation memory)" \
+                     " -k [IDLE,READ,WRITE](Timeout seconds)" \
+                     " -u [PATH](Unix socket path)\n"
 
 serv_t g_serv = { 0 };
 
+static volatile sig_atomic_t g_b_interrupted = false;
+static volatile sig_atomic_t g_b_accepting   = false;
+
 /**
- * @brief Signal interrupt handler function. Sets running to false and closes
- *        the server listener to unblock.
+ * @brief Signal interrupt handler function. Records the interrupt for main
+ *        and, once main is accepting, shuts the server listeners down to
+ *        unblock the acceptor. main shuts the server down itself, so nothing
+ *        here takes a lock.
  */
 void sig_interrupt_handler(int dummy)
 {
-    int count = 0;
-    sem_getvalue(&(g_serv.client_count_sem), &count);
-    //if (g_serv.max_connections == count)
-    //{
-        shutdown_server(&g_serv);
-    //}
-}
+    g_b_interrupted = true;
+
+    // Shutting the listeners down fails the blocked accept, which ends
+    // accept_connections. An interrupt that comes before main is accepting
+    // is seen by main instead.
+    //
+    if (g_b_accepting)
+    {
+        g_b_accepting = false;
+        shutdown(g_serv.serv_listener_fd, SHUT_RDWR);
+        if (0 <= g_serv.unix_listener_fd)
+        {
+            shutdown(g_serv.unix_listener_fd, SHUT_RDWR);
+        }
+    }
+} /* sig_interrupt_handler */
 
 int main(int argc, char** argv)
 {
@@ -43,9 +121,7 @@ int main(int argc, char** argv)
     //
     if (2 > argc)
     {
-        fprintf(stderr,
-                "Usage: %s -p [0-65535](Port number) -n [2+](Thread count)\n",
-                argv[0]);
+        fprintf(stderr, USAGE_STRING, argv[0]);
         return EXIT_FAILURE;
     }
 
@@ -55,16 +131,72 @@ int main(int argc, char** argv)
     //
     char* p_thread_count = "2";
     char* p_port_number  = NULL;
+    char* p_mode         = "thread";
+    char* p_max_clients  = NULL;
+    char* p_queue_depth  = NULL;
+    char* p_log_level    = "info";
+    char* p_admin_port   = NULL;
+    char* p_shard_count  = NULL;
+    char* p_backlog      = NULL;
+    char* p_max_workers  = NULL;
+    char* p_response     = "verbose";
+    char* p_stream_limit = NULL;
+    char* p_admit_depth  = NULL;
+    char* p_admit_target = NULL;
+    char* p_timeouts     = NULL;
+    char* p_unix_path    = NULL;
 
     int   opt;
     do
     {
-        opt = getopt(argc, argv, "n:p:");
+        opt = getopt(argc, argv, "n:p:m:c:q:l:a:s:b:w:r:x:o:t:k:u:");
         switch (opt)
         {
             case 'n':
                 p_thread_count = optarg;
             break;
+            case 'm':
+                p_mode = optarg;
+            break;
+            case 'c':
+                p_max_clients = optarg;
+            break;
+            case 'q':
+                p_queue_depth = optarg;
+            break;
+            case 'l':
+                p_log_level = optarg;
+            break;
+            case 'a':
+                p_admin_port = optarg;
+            break;
+            case 's':
+                p_shard_count = optarg;
+            break;
+            case 'b':
+                p_backlog = optarg;
+            break;
+            case 'w':
+                p_max_workers = optarg;
+            break;
+            case 'r':
+                p_response = optarg;
+            break;
+            case 'x':
+                p_stream_limit = optarg;
+            break;
+            case 'o':
+                p_admit_depth = optarg;
+            break;
+            case 't':
+                p_admit_target = optarg;
+            break;
+            case 'k':
+                p_timeouts = optarg;
+            break;
+            case 'u':
+                p_unix_path = optarg;
+            break;
             case 'p':
                 p_port_number = optarg;
             default:
@@ -75,143 +207,253 @@ int main(int argc, char** argv)
     int port_number = convert_port_number(p_port_number);
     if (0 > port_number)
     {
-        fprintf(stderr,
-                "Usage: %s -p [0-65535](Port number) -n [2+](Thread count)\n",
-                argv[0]);
+        fprintf(stderr, USAGE_STRING, argv[0]);
         return EXIT_FAILURE;
     }
 
     int thread_count       = convert_thread_count(p_thread_count);
+    g_serv.thread_count    = thread_count;
     g_serv.max_connections = thread_count;
-
-    // Create sig interrupt handler
-    //
-    struct sigaction handler = { 0 };
-    handler.sa_handler       = &sig_interrupt_handler;
-
-    int err = sigaction(SIGINT, &handler, NULL);
-    if (0 > err)
+    if (0 == strcmp(p_mode, "epoll") || 0 == strcmp(p_mode, "pool") ||
+        0 == strcmp(p_mode, "uring"))
     {
-        printf("Error assigning sig handler [%s]\n", strerror(errno));
+        g_serv.mode            = (0 == strcmp(p_mode, "epoll")) ?
+                                     SERV_MODE_EPOLL :
+                                 (0 == strcmp(p_mode, "pool")) ?
+                                     SERV_MODE_POOL : SERV_MODE_URING;
+        g_serv.max_connections = DEFAULT_EPOLL_MAX_CONNECTIONS;
+        if (NULL != p_max_clients)
+        {
+            g_serv.max_connections = atoi(p_max_clients);
+        }
+    }
+    else if (0 != strcmp(p_mode, "thread"))
+    {
+        fprintf(stderr, "Unknown server mode [%s].\n", p_mode);
+        fprintf(stderr, USAGE_STRING, argv[0]);
         return EXIT_FAILURE;
     }
-    struct sockaddr_in serv_addr = { 0 };
 
-    // Initialize socket
-    //
-    g_serv.serv_listener_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (0 > g_serv.serv_listener_fd)
+    if (0 == strcmp(p_response, "number"))
     {
-        fprintf(stderr,
-                "Failed to create listener socket. [%s]\n",
-                strerror(errno));
+        g_serv_response_format = SERV_RESPONSE_NUMBER;
+    }
+    else if (0 == strcmp(p_response, "binary"))
+    {
+        g_serv_response_format = SERV_RESPONSE_BINARY;
+    }
+    else if (0 != strcmp(p_response, "verbose"))
+    {
+        fprintf(stderr, "Unknown response format [%s].\n", p_response);
+        fprintf(stderr, USAGE_STRING, argv[0]);
         return EXIT_FAILURE;
     }
 
-    int       optval = 1;
-    socklen_t optlen = sizeof(optval);
+    if (NULL != p_stream_limit)
+    {
+        long long stream_limit = atoll(p_stream_limit);
+        if ((long long)EVAL_STREAM_MIN_MEMORY > stream_limit)
+        {
+            fprintf(stderr,
+                    "Streamed equation memory must be at least [%zu].\n",
+                    EVAL_STREAM_MIN_MEMORY);
+            return EXIT_FAILURE;
+        }
+        g_serv_stream_memory = (size_t)stream_limit;
+    }
 
-    err = setsockopt(g_serv.serv_listener_fd, SOL_SOCKET, SO_REUSEADDR, &optval, optlen);
-    if(0 > err) {
-        fprintf(stderr,
-                "Error setting socket options. [%s]\n",
-                strerror(errno));
-        close(g_serv.serv_listener_fd);
+    g_serv.admit_depth = DEFAULT_ADMIT_DEPTH;
+    if (NULL != p_admit_depth)
+    {
+        g_serv.admit_depth = atoi(p_admit_depth);
+    }
+    if (0 > g_serv.admit_depth)
+    {
+        fprintf(stderr, "Admission queue depth cannot be negative.\n");
         return EXIT_FAILURE;
     }
 
-    serv_addr.sin_family      = AF_INET;
-    serv_addr.sin_addr.s_addr = INADDR_ANY;
-    serv_addr.sin_port        = htons(port_number);
-
-    err = bind(g_serv.serv_listener_fd,
-               (struct sockaddr*)&serv_addr,
-               sizeof(serv_addr));
-    if (0 > err)
+    int admit_target_ms = DEFAULT_ADMIT_TARGET_MS;
+    if (NULL != p_admit_target)
+    {
+        admit_target_ms = atoi(p_admit_target);
+    }
+    if (1 > admit_target_ms)
     {
-        fprintf(stderr,
-                "Failed to bind on given port. [%s]\n",
-                strerror(errno));
+        fprintf(stderr, "Admission target must be at least 1 ms.\n");
         return EXIT_FAILURE;
     }
-    else
+    g_serv.admit_target_ns = (uint64_t)admit_target_ms * 1000000;
+
+    if (NULL != p_timeouts)
     {
-        printf("Listener bound on port [%d]\n", port_number);
+        int timeouts[TIMEOUT_KIND_COUNT] = { DEFAULT_IDLE_TIMEOUT_S,
+                                             DEFAULT_READ_TIMEOUT_S,
+                                             DEFAULT_WRITE_TIMEOUT_S };
+        int count = sscanf(p_timeouts,
+                           "%d,%d,%d",
+                           &timeouts[TIMEOUT_IDLE],
+                           &timeouts[TIMEOUT_READ],
+                           &timeouts[TIMEOUT_WRITE]);
+        for (int kind = 0; kind < TIMEOUT_KIND_COUNT; kind++)
+        {
+            if (1 > count || 0 > timeouts[kind])
+            {
+                fprintf(stderr, "Invalid timeouts [%s].\n", p_timeouts);
+                fprintf(stderr, USAGE_STRING, argv[0]);
+                return EXIT_FAILURE;
+            }
+            g_serv_timeout_ns[kind] = (uint64_t)timeouts[kind] * 1000000000;
+        }
     }
 
-    err = listen(g_serv.serv_listener_fd, 5);
-    if (0 > err)
+    g_serv.max_workers = thread_count * DEFAULT_POOL_MAX_FACTOR;
+    if (NULL != p_max_workers)
     {
-        fprintf(stderr,
-                "Error setting listening state. [%s]\n",
-                strerror(errno));
-        shutdown_server(&g_serv);
-        return EXIT_FAILURE;
+        g_serv.max_workers = atoi(p_max_workers);
     }
-    else
+    if (thread_count > g_serv.max_workers)
     {
-        printf("Listener established.\n");
+        fprintf(stderr, "Max workers must be at least the thread count.\n");
+        return EXIT_FAILURE;
     }
 
-    struct sockaddr_in cli_addr;
-    int                client_fd = 0;
+    g_serv.queue_depth = DEFAULT_FD_QUEUE_DEPTH;
+    if (NULL != p_queue_depth)
+    {
+        g_serv.queue_depth = atoi(p_queue_depth);
+    }
 
-    socklen_t clilen = sizeof(cli_addr);
+    if (1 > g_serv.max_connections)
+    {
+        fprintf(stderr, "Max connections must be at least 1.\n");
+        return EXIT_FAILURE;
+    }
 
-    // Set up server
-    //
-    init_server(&g_serv);
+    if (2 > g_serv.queue_depth)
+    {
+        fprintf(stderr, "Connection queue depth must be at least 2.\n");
+        return EXIT_FAILURE;
+    }
 
-    while(g_serv.b_running)
+    if (NULL != p_admin_port)
     {
-        //printf("Awaiting connection.\n");
-        client_fd = accept(g_serv.serv_listener_fd,
-                           (struct sockaddr*)&cli_addr,
-                           &clilen);
-        if (0 > client_fd)
+        g_serv.admin_port = convert_port_number(p_admin_port);
+        if (0 >= g_serv.admin_port || port_number == g_serv.admin_port)
         {
-            fprintf(stderr,
-                    "Error accepting connection. [%s]\n",
-                    strerror(errno));
-            continue;
+            fprintf(stderr, "Invalid admin port [%s].\n", p_admin_port);
+            fprintf(stderr, USAGE_STRING, argv[0]);
+            return EXIT_FAILURE;
         }
+    }
 
+    g_serv.cpu            = SERV_NO_CPU;
+    g_serv.p_unix_path    = p_unix_path;
+    g_serv.listen_backlog = DEFAULT_LISTEN_BACKLOG;
+    if (NULL != p_backlog)
+    {
+        g_serv.listen_backlog = atoi(p_backlog);
+    }
+    if (1 > g_serv.listen_backlog)
+    {
+        fprintf(stderr, "Listen backlog must be at least 1.\n");
+        return EXIT_FAILURE;
+    }
 
-        err = sem_trywait(&(g_serv.client_count_sem));
-        if (0 > err)
+    int shard_count = -1;
+    if (NULL != p_shard_count)
+    {
+        shard_count = atoi(p_shard_count);
+        if (0 > shard_count)
         {
-            fprintf(stderr,
-                    "Max connections reached. [%s]\n",
-                    strerror(errno));
-            notify_client_max_connections(client_fd);
-            close(client_fd);
-            client_fd = 0;
-            continue;
+            fprintf(stderr, "Shard count cannot be negative.\n");
+            return EXIT_FAILURE;
         }
+        if (0 == shard_count)
+        {
+            shard_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        }
+    }
 
-        printf("A client has connected.\n");
+    int log_level = serv_log_parse_level(p_log_level);
+    if (0 > log_level)
+    {
+        fprintf(stderr, "Unknown log level [%s].\n", p_log_level);
+        fprintf(stderr, USAGE_STRING, argv[0]);
+        return EXIT_FAILURE;
+    }
 
-        char byte[2] = "0";
-        err = send(client_fd, byte, 1, 0);
+    // Create sig interrupt handler
+    //
+    struct sigaction handler = { 0 };
+    handler.sa_handler       = &sig_interrupt_handler;
 
-        // Set up client FD in global position and wake up a thread to grab it
+    int err = sigaction(SIGINT, &handler, NULL);
+    if (0 > err)
+    {
+        printf("Error assigning sig handler [%s]\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    // Workers log through the asynchronous logger, so start its flusher
+    // first.
+    //
+    serv_log_init(log_level);
+
+    if (0 < shard_count)
+    {
+        // Only this thread takes SIGINT, so block it before the shard
+        // threads start and inherit the mask.
         //
-        pthread_mutex_lock(&(g_serv.new_connection_fd_lock));
-        g_serv.new_connection_fd = client_fd;
-        if (0 != g_serv.new_connection_fd)
+        sigset_t interrupt_mask;
+        sigset_t wait_mask;
+        sigemptyset(&interrupt_mask);
+        sigaddset(&interrupt_mask, SIGINT);
+        pthread_sigmask(SIG_BLOCK, &interrupt_mask, &wait_mask);
+        sigdelset(&wait_mask, SIGINT);
+
+        serv_t* p_shards = init_shards(&g_serv, shard_count, port_number);
+        if (NULL == p_shards)
         {
-            pthread_cond_signal(&(g_serv.new_connection));
+            serv_log_shutdown();
+            return EXIT_FAILURE;
         }
-        // Wait for notification that a thread successfully pulled the FD
-        // before continuing.
-        //
-        while (0 != g_serv.new_connection_fd)
+
+        while (false == g_b_interrupted)
         {
-            pthread_cond_wait(&(g_serv.connection_accepted),
-                              &(g_serv.new_connection_fd_lock));
+            sigsuspend(&wait_mask);
         }
-        pthread_mutex_unlock(&(g_serv.new_connection_fd_lock));
+        shutdown_shards(p_shards, shard_count);
+        serv_log_shutdown();
+        return EXIT_SUCCESS;
     }
-    
+
+    // Set up server
+    //
+    if (SERV_INIT_SUCCESS != open_listener(&g_serv, port_number))
+    {
+        serv_log_shutdown();
+        return EXIT_FAILURE;
+    }
+
+    err = init_server(&g_serv);
+    if (SERV_INIT_SUCCESS != err)
+    {
+        close_listeners(&g_serv);
+        serv_log_shutdown();
+        return EXIT_FAILURE;
+    }
+
+    // Check for an interrupt only once the handler can see that main is
+    // accepting, so one arriving during startup is not lost.
+    //
+    g_b_accepting = true;
+    if (false == g_b_interrupted)
+    {
+        accept_connections(&g_serv);
+    }
+    g_b_accepting = false;
+
     shutdown_server(&g_serv);
-} /* main */
\ No newline at end of file
+    close_listeners(&g_serv);
+    serv_log_shutdown();
+} /* main */
@@ -0,0 +1,486 @@
+/** @file shm_ring.c
+ *
+ * @brief Shared memory transport for clients on the same host as the
+ *        server. The server creates the region as an anonymous memory file
+ *        and hands its descriptor to the client over their unix domain
+ *        socket; from then on frames travel through a pair of rings without
+ *        a system call while both sides are busy. The socket stays open so
+ *        either side can tell when the other has gone.
+ * @par
+ * COPYRIGHT NOTICE: (c) 2018 Barr Group. All rights reserved.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h> // errno, EINTR, EAGAIN
+#include <linux/futex.h> // FUTEX_WAIT, FUTEX_WAKE
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h> // uint8_t, uint32_t, uint64_t
+#include <stdio.h> // stderr
+#include <string.h> // memcpy, memset, strerror
+#include <sys/mman.h> // memfd_create, mmap, munmap
+#include <sys/socket.h> // getsockname, recvmsg, sendmsg, SCM_RIGHTS
+#include <sys/stat.h> // fstat
+#include <sys/syscall.h> // SYS_futex
+#include <time.h> // clock_gettime
+#include <unistd.h> // close, ftruncate, syscall, sysconf
+
+#include "shm_ring.h"
+
+/**
+ * @brief Tells the core it is in a spin loop, which saves power and lets a
+ *        sibling hyperthread run.
+ */
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+} /* cpu_relax */
+
+/**
+ * @brief Reports whether waiting should spin before sleeping. Spinning only
+ *        pays off when the other side runs on another CPU at the same time;
+ *        with a single CPU it just delays the other side.
+ */
+static bool should_spin(void)
+{
+    static atomic_int spin = -1;
+    int               b_spin = atomic_load_explicit(&spin,
+                                                    memory_order_relaxed);
+    if (0 > b_spin)
+    {
+        b_spin = (1 < sysconf(_SC_NPROCESSORS_ONLN)) ? 1 : 0;
+        atomic_store_explicit(&spin, b_spin, memory_order_relaxed);
+    }
+    return (1 == b_spin);
+} /* should_spin */
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000ull) + (uint64_t)now.tv_nsec;
+} /* now_ns */
+
+/**
+ * @brief Copies bytes into the ring starting at a position, wrapping at its
+ *        end.
+ */
+static void copy_in(shm_ring_t* p_ring,
+                    uint32_t    position,
+                    const void* p_data,
+                    size_t      length)
+{
+    size_t offset = position & SHM_RING_MASK;
+    size_t first  = SHM_RING_SIZE - offset;
+    if (first > length)
+    {
+        first = length;
+    }
+    memcpy(p_ring->data + offset, p_data, first);
+    memcpy(p_ring->data, (const uint8_t*)p_data + first, length - first);
+} /* copy_in */
+
+/**
+ * @brief Copies bytes out of the ring starting at a position, wrapping at
+ *        its end.
+ */
+static void copy_out(shm_ring_t* p_ring,
+                     uint32_t    position,
+                     void*       p_buffer,
+                     size_t      length)
+{
+    size_t offset = position & SHM_RING_MASK;
+    size_t first  = SHM_RING_SIZE - offset;
+    if (first > length)
+    {
+        first = length;
+    }
+    memcpy(p_buffer, p_ring->data + offset, first);
+    memcpy((uint8_t*)p_buffer + first, p_ring->data, length - first);
+} /* copy_out */
+
+/**
+ * @brief Wakes the other side if it went to sleep on a position that was
+ *        just advanced. The fence orders the new position before the check
+ *        of the waiting flag, pairing with the waiter setting its flag
+ *        before checking the position, so one of the two always sees the
+ *        other.
+ */
+static void wake_waiter(atomic_uint* p_position, atomic_uint* p_waiting)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (0 != atomic_load_explicit(p_waiting, memory_order_relaxed))
+    {
+        syscall(SYS_futex, (uint32_t*)p_position, FUTEX_WAKE, 1,
+                NULL, NULL, 0);
+    }
+} /* wake_waiter */
+
+/**
+ * @brief Copies as much of the data into the ring as fits.
+ * @param[in] p_ring A pointer to a ring this side produces into.
+ * @param[in] p_data The bytes to write.
+ * @param[in] length The number of bytes to write.
+ * @return The number of bytes written; 0 if the ring is full.
+ */
+size_t shm_ring_write(shm_ring_t* p_ring, const void* p_data, size_t length)
+{
+    uint32_t tail = atomic_load_explicit(&(p_ring->tail),
+                                         memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&(p_ring->head),
+                                         memory_order_acquire);
+    size_t   room = SHM_RING_SIZE - (uint32_t)(tail - head);
+    if (length > room)
+    {
+        length = room;
+    }
+    if (0 == length)
+    {
+        return 0;
+    }
+    copy_in(p_ring, tail, p_data, length);
+    atomic_store_explicit(&(p_ring->tail),
+                          tail + (uint32_t)length,
+                          memory_order_release);
+    wake_waiter(&(p_ring->tail), &(p_ring->reader_waiting));
+    return length;
+} /* shm_ring_write */
+
+/**
+ * @brief Copies as many bytes out of the ring as are available and fit.
+ * @param[in] p_ring A pointer to a ring this side consumes from.
+ * @param[out] p_buffer Where to copy the bytes.
+ * @param[in] size The size of p_buffer.
+ * @return The number of bytes read; 0 if the ring is empty.
+ */
+size_t shm_ring_read(shm_ring_t* p_ring, void* p_buffer, size_t size)
+{
+    uint32_t head      = atomic_load_explicit(&(p_ring->head),
+                                              memory_order_relaxed);
+    uint32_t tail      = atomic_load_explicit(&(p_ring->tail),
+                                              memory_order_acquire);
+    size_t   available = (uint32_t)(tail - head);
+    if (size > available)
+    {
+        size = available;
+    }
+    if (0 == size)
+    {
+        return 0;
+    }
+    copy_out(p_ring, head, p_buffer, size);
+    atomic_store_explicit(&(p_ring->head),
+                          head + (uint32_t)size,
+                          memory_order_release);
+    wake_waiter(&(p_ring->head), &(p_ring->writer_waiting));
+    return size;
+} /* shm_ring_read */
+
+/**
+ * @brief Checks that the other side still holds its end of the socket.
+ */
+static bool is_peer_connected(int peer_fd)
+{
+    uint8_t byte;
+    ssize_t result = recv(peer_fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (0 < result)
+    {
+        return true;
+    }
+    return (0 > result) &&
+           (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno);
+} /* is_peer_connected */
+
+/**
+ * @brief Waits until a position no longer holds a value. On a machine with
+ *        more than one CPU it spins for SHM_SPIN_NS first, since the other
+ *        side usually answers within a few microseconds, then sleeps in
+ *        slices of SHM_WAIT_SLICE_MS. Between slices it checks that the
+ *        other side is still connected, in case it went away without
+ *        closing the ring.
+ */
+static bool wait_for_change(shm_ring_t*  p_ring,
+                            atomic_uint* p_position,
+                            uint32_t     value,
+                            atomic_uint* p_waiting,
+                            int          peer_fd)
+{
+    uint64_t spin_end_ns = now_ns() + SHM_SPIN_NS;
+    for (uint32_t spins = 1; should_spin(); spins++)
+    {
+        if (value != atomic_load_explicit(p_position, memory_order_acquire))
+        {
+            return true;
+        }
+        cpu_relax();
+        if (0 == (spins % 64) && now_ns() >= spin_end_ns)
+        {
+            break;
+        }
+    }
+
+    struct timespec slice = { .tv_sec  = 0,
+                              .tv_nsec = SHM_WAIT_SLICE_MS * 1000000l };
+    while (true)
+    {
+        atomic_store(p_waiting, 1);
+        if (value == atomic_load(p_position) &&
+            0 == atomic_load(&(p_ring->closed)))
+        {
+            syscall(SYS_futex, (uint32_t*)p_position, FUTEX_WAIT, value,
+                    &slice, NULL, 0);
+        }
+        atomic_store(p_waiting, 0);
+        if (value != atomic_load_explicit(p_position, memory_order_acquire))
+        {
+            return true;
+        }
+        if (0 != atomic_load(&(p_ring->closed)) ||
+            false == is_peer_connected(peer_fd))
+        {
+            return false;
+        }
+    }
+} /* wait_for_change */
+
+/**
+ * @brief Waits until the ring has bytes to read.
+ * @param[in] p_ring A pointer to a ring this side consumes from.
+ * @param[in] peer_fd The socket shared with the producer.
+ * @return True once the ring is not empty.
+ *         False if the producer disconnected.
+ */
+bool shm_ring_wait_readable(shm_ring_t* p_ring, int peer_fd)
+{
+    uint32_t head = atomic_load_explicit(&(p_ring->head),
+                                         memory_order_relaxed);
+    return wait_for_change(p_ring,
+                           &(p_ring->tail),
+                           head,
+                           &(p_ring->reader_waiting),
+                           peer_fd);
+} /* shm_ring_wait_readable */
+
+/**
+ * @brief Waits until the ring has room to write.
+ * @param[in] p_ring A pointer to a ring this side produces into.
+ * @param[in] peer_fd The socket shared with the consumer.
+ * @return True once the ring is not full.
+ *         False if the consumer disconnected.
+ */
+bool shm_ring_wait_writable(shm_ring_t* p_ring, int peer_fd)
+{
+    uint32_t tail = atomic_load_explicit(&(p_ring->tail),
+                                         memory_order_relaxed);
+    return wait_for_change(p_ring,
+                           &(p_ring->head),
+                           tail - SHM_RING_SIZE,
+                           &(p_ring->writer_waiting),
+                           peer_fd);
+} /* shm_ring_wait_writable */
+
+/**
+ * @brief Marks the ring closed and wakes the other side if it is waiting on
+ *        it, so it stops waiting for bytes or room that will never come.
+ * @param[in] p_ring A pointer to a ring this side is done with.
+ */
+void shm_ring_close(shm_ring_t* p_ring)
+{
+    atomic_store(&(p_ring->closed), 1);
+    syscall(SYS_futex, (uint32_t*)&(p_ring->tail), FUTEX_WAKE, 1,
+            NULL, NULL, 0);
+    syscall(SYS_futex, (uint32_t*)&(p_ring->head), FUTEX_WAKE, 1,
+            NULL, NULL, 0);
+} /* shm_ring_close */
+
+/**
+ * @brief Creates a zeroed region backed by an anonymous memory file.
+ * @param[out] p_memfd Set to the memory file's descriptor, to be passed to
+ *                     the client and then closed.
+ * @return A pointer to the mapped region.
+ *         NULL if the region could not be created.
+ */
+shm_region_t* shm_region_create(int* p_memfd)
+{
+    int memfd = memfd_create("postfix_shm", MFD_CLOEXEC);
+    if (0 > memfd)
+    {
+        fprintf(stderr,
+                "Unable to create shared memory. [%s]\n",
+                strerror(errno));
+        return NULL;
+    }
+    if (0 > ftruncate(memfd, sizeof(shm_region_t)))
+    {
+        fprintf(stderr,
+                "Unable to size shared memory. [%s]\n",
+                strerror(errno));
+        close(memfd);
+        return NULL;
+    }
+
+    shm_region_t* p_region = mmap(NULL,
+                                  sizeof(shm_region_t),
+                                  PROT_READ | PROT_WRITE,
+                                  MAP_SHARED,
+                                  memfd,
+                                  0);
+    if (MAP_FAILED == p_region)
+    {
+        fprintf(stderr,
+                "Unable to map shared memory. [%s]\n",
+                strerror(errno));
+        close(memfd);
+        return NULL;
+    }
+    p_region->magic     = SHM_REGION_MAGIC;
+    p_region->ring_size = SHM_RING_SIZE;
+    *p_memfd            = memfd;
+    return p_region;
+} /* shm_region_create */
+
+/**
+ * @brief Maps a region received from the server.
+ * @param[in] memfd The memory file's descriptor. The caller closes it
+ *                  afterwards; the mapping stays valid.
+ * @return A pointer to the mapped region.
+ *         NULL if the region could not be mapped or was not built with the
+ *         same layout.
+ */
+shm_region_t* shm_region_map(int memfd)
+{
+    struct stat info;
+    if (0 > fstat(memfd, &info) ||
+        (size_t)info.st_size < sizeof(shm_region_t))
+    {
+        fprintf(stderr, "Shared memory region has the wrong size.\n");
+        return NULL;
+    }
+
+    shm_region_t* p_region = mmap(NULL,
+                                  sizeof(shm_region_t),
+                                  PROT_READ | PROT_WRITE,
+                                  MAP_SHARED,
+                                  memfd,
+                                  0);
+    if (MAP_FAILED == p_region)
+    {
+        fprintf(stderr,
+                "Unable to map shared memory. [%s]\n",
+                strerror(errno));
+        return NULL;
+    }
+    if (SHM_REGION_MAGIC != p_region->magic ||
+        SHM_RING_SIZE != p_region->ring_size)
+    {
+        fprintf(stderr, "Shared memory region has the wrong layout.\n");
+        shm_region_unmap(p_region);
+        return NULL;
+    }
+    return p_region;
+} /* shm_region_map */
+
+void shm_region_unmap(shm_region_t* p_region)
+{
+    munmap(p_region, sizeof(shm_region_t));
+} /* shm_region_unmap */
+
+/**
+ * @brief Reports whether a connected socket is a unix domain socket, and so
+ *        has its peer on this host.
+ */
+bool shm_socket_is_local(int fd)
+{
+    struct sockaddr_storage addr;
+    socklen_t               length = sizeof(addr);
+    if (0 > getsockname(fd, (struct sockaddr*)&addr, &length))
+    {
+        return false;
+    }
+    return (AF_UNIX == addr.ss_family);
+} /* shm_socket_is_local */
+
+/**
+ * @brief Answers a request for shared memory.
+ * @param[in] fd The client's unix domain socket.
+ * @param[in] reply PROTO_SHM_ACCEPTED or PROTO_SHM_DECLINED.
+ * @param[in] memfd The region's memory file to pass along, or SHM_NO_FD.
+ * @return True if the reply was sent.
+ */
+bool shm_send_reply(int fd, uint8_t reply, int memfd)
+{
+    union {
+        struct cmsghdr header;
+        char           space[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct iovec  iov     = { .iov_base = &reply, .iov_len = 1 };
+    struct msghdr message = { .msg_iov = &iov, .msg_iovlen = 1 };
+    memset(&control, 0, sizeof(control));
+    if (SHM_NO_FD != memfd)
+    {
+        message.msg_control    = control.space;
+        message.msg_controllen = sizeof(control.space);
+        struct cmsghdr* p_cmsg = CMSG_FIRSTHDR(&message);
+        p_cmsg->cmsg_level     = SOL_SOCKET;
+        p_cmsg->cmsg_type      = SCM_RIGHTS;
+        p_cmsg->cmsg_len       = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(p_cmsg), &memfd, sizeof(int));
+    }
+
+    while (0 > sendmsg(fd, &message, MSG_NOSIGNAL))
+    {
+        if (EINTR != errno)
+        {
+            return false;
+        }
+    }
+    return true;
+} /* shm_send_reply */
+
+/**
+ * @brief Waits for the server's answer to a request for shared memory.
+ * @param[in] fd The unix domain socket connected to the server.
+ * @param[out] p_reply Set to the reply byte.
+ * @param[out] p_memfd Set to the region's memory file if one came with the
+ *                     reply, otherwise SHM_NO_FD.
+ * @return True if a reply arrived.
+ *         False if the connection closed or failed first.
+ */
+bool shm_receive_reply(int fd, uint8_t* p_reply, int* p_memfd)
+{
+    union {
+        struct cmsghdr header;
+        char           space[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct iovec  iov     = { .iov_base = p_reply, .iov_len = 1 };
+    struct msghdr message = { .msg_iov        = &iov,
+                              .msg_iovlen     = 1,
+                              .msg_control    = control.space,
+                              .msg_controllen = sizeof(control.space) };
+    ssize_t       result;
+    *p_memfd = SHM_NO_FD;
+    do
+    {
+        result = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+    } while (0 > result && EINTR == errno);
+    if (1 != result)
+    {
+        return false;
+    }
+
+    for (struct cmsghdr* p_cmsg = CMSG_FIRSTHDR(&message);
+         NULL != p_cmsg;
+         p_cmsg = CMSG_NXTHDR(&message, p_cmsg))
+    {
+        if (SOL_SOCKET == p_cmsg->cmsg_level &&
+            SCM_RIGHTS == p_cmsg->cmsg_type)
+        {
+            memcpy(p_memfd, CMSG_DATA(p_cmsg), sizeof(int));
+        }
+    }
+    return true;
+} /* shm_receive_reply */
@@ -0,0 +1,62 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdalign.h> // alignas
+#include <stdatomic.h> // atomic_uint
+#include <stdbool.h>
+#include <stddef.h> // size_t
+#include <stdint.h> // uint8_t, uint32_t
+
+#define SHM_RING_SIZE 65536
+#define SHM_RING_MASK (SHM_RING_SIZE - 1)
+#define SHM_CACHE_LINE_SIZE 64
+#define SHM_REGION_MAGIC 0x50465852u
+#define SHM_SPIN_NS 50000
+#define SHM_WAIT_SLICE_MS 100
+#define SHM_NO_FD -1
+
+/**
+ * @brief Single producer, single consumer byte ring in shared memory. Only
+ *        the producer advances tail and only the consumer advances head;
+ *        both count bytes and wrap naturally. A side that finds the ring
+ *        empty or full spins briefly, then sets its waiting flag and sleeps
+ *        on the other side's position with a futex, so the other side only
+ *        makes a system call when someone is actually asleep. Either side
+ *        may close the ring, which wakes the other at once.
+ */
+typedef struct shm_ring_t {
+    alignas(SHM_CACHE_LINE_SIZE) atomic_uint tail;
+    atomic_uint                              reader_waiting;
+    alignas(SHM_CACHE_LINE_SIZE) atomic_uint head;
+    atomic_uint                              writer_waiting;
+    atomic_uint                              closed;
+    alignas(SHM_CACHE_LINE_SIZE) uint8_t     data[SHM_RING_SIZE];
+} shm_ring_t;
+
+/**
+ * @brief Memory shared by one client and the server thread serving it.
+ *        Requests flow through one ring and responses through the other,
+ *        carrying the same frames the socket would.
+ */
+typedef struct shm_region_t {
+    uint32_t   magic;
+    uint32_t   ring_size;
+    shm_ring_t requests;
+    shm_ring_t responses;
+} shm_region_t;
+
+size_t        shm_ring_write(shm_ring_t* p_ring,
+                             const void* p_data,
+                             size_t      length);
+size_t        shm_ring_read(shm_ring_t* p_ring, void* p_buffer, size_t size);
+bool          shm_ring_wait_readable(shm_ring_t* p_ring, int peer_fd);
+bool          shm_ring_wait_writable(shm_ring_t* p_ring, int peer_fd);
+void          shm_ring_close(shm_ring_t* p_ring);
+shm_region_t* shm_region_create(int* p_memfd);
+shm_region_t* shm_region_map(int memfd);
+void          shm_region_unmap(shm_region_t* p_region);
+bool          shm_socket_is_local(int fd);
+bool          shm_send_reply(int fd, uint8_t reply, int memfd);
+bool          shm_receive_reply(int fd, uint8_t* p_reply, int* p_memfd);
+
+#endif /* SHM_RING_H */